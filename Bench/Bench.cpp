@@ -0,0 +1,2071 @@
+/*
+ OFX Bench host.
+ A minimal, headless OFX host that instanciates every plugin of one or more
+ plugin binaries, renders synthetic images with them and reports timings.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+
+ */
+
+/*
+ Usage: Bench [options] plugin.ofx.bundle|plugin.ofx ...
+
+ Every image effect plugin found in the given binaries is described in the
+ first supported context (filter, general or generator), instanciated with
+ its default parameters, and rendered on synthetic input images for each
+ combination of the requested image sizes, bit depths and components.
+ Results (render wall-time and Mpix/s per configuration, and the peak resident
+ memory of the whole run) are written as JSON.
+
+ Options:
+  -s, --sizes LIST       comma-separated sizes: 720p,1080p,2k,uhd,4k,8k or WxH (default: 1080p)
+  -d, --depths LIST      comma-separated depths: byte,short,float (default: float)
+  -c, --components LIST  comma-separated components: rgba,rgb,alpha (default: rgba)
+  -n, --iterations N     number of timed renders per configuration (default: 3)
+  -w, --warmup N         number of untimed renders per configuration (default: 1)
+  -t, --threads N        number of threads reported by the multithread suite (default: number of CPUs)
+  -p, --plugin STRING    only benchmark plugins whose identifier contains STRING (may be repeated)
+  -o, --output FILE      write the JSON report to FILE instead of stdout
+ */
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdarg>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "ofxImageEffect.h"
+#include "ofxMemory.h"
+#include "ofxMessage.h"
+#include "ofxMultiThread.h"
+#include "ofxParametricParam.h"
+#include "ofxhBinary.h"
+#include "ofxhUtilities.h"
+
+#define kBenchHostName "net.sf.openfx.Bench"
+#define kBenchHostLabel "OFX Bench"
+#define kBenchFrameFirst 1
+#define kBenchFrameCount 100
+
+////////////////////////////////////////////////////////////////////////////////
+// properties
+
+namespace {
+
+struct Property {
+    enum TypeEnum {
+        ePointer,
+        eString,
+        eDouble,
+        eInt
+    };
+
+    TypeEnum type;
+    std::vector<void*> p;
+    std::vector<std::string> s;
+    std::vector<double> d;
+    std::vector<int> i;
+
+    Property(TypeEnum t = eInt) : type(t) {}
+
+    int dimension() const
+    {
+        switch (type) {
+            case ePointer: return (int)p.size();
+            case eString:  return (int)s.size();
+            case eDouble:  return (int)d.size();
+            case eInt:     return (int)i.size();
+        }
+        return 0;
+    }
+};
+
+// A lenient property set: setting an unknown property creates it,
+// getting an unknown property returns kOfxStatErrUnknown.
+struct PropertySet {
+    std::map<std::string, Property> props;
+
+    Property* find(const char* name)
+    {
+        std::map<std::string, Property>::iterator it = props.find(name);
+        return (it == props.end()) ? 0 : &it->second;
+    }
+
+    Property& fetch(const char* name, Property::TypeEnum type)
+    {
+        Property& p = props[name];
+        if (p.type != type && p.dimension() > 0) {
+            // a property may be redefined with another type (e.g. int/double confusion)
+            p = Property(type);
+        }
+        p.type = type;
+        return p;
+    }
+
+    void setPointer(const char* name, void* v, int idx = 0)
+    {
+        Property& p = fetch(name, Property::ePointer);
+        if ((int)p.p.size() <= idx) {
+            p.p.resize(idx + 1, 0);
+        }
+        p.p[idx] = v;
+    }
+
+    void setString(const char* name, const std::string& v, int idx = 0)
+    {
+        Property& p = fetch(name, Property::eString);
+        if ((int)p.s.size() <= idx) {
+            p.s.resize(idx + 1);
+        }
+        p.s[idx] = v;
+    }
+
+    void setDouble(const char* name, double v, int idx = 0)
+    {
+        Property& p = fetch(name, Property::eDouble);
+        if ((int)p.d.size() <= idx) {
+            p.d.resize(idx + 1, 0.);
+        }
+        p.d[idx] = v;
+    }
+
+    void setInt(const char* name, int v, int idx = 0)
+    {
+        Property& p = fetch(name, Property::eInt);
+        if ((int)p.i.size() <= idx) {
+            p.i.resize(idx + 1, 0);
+        }
+        p.i[idx] = v;
+    }
+
+    std::string getString(const char* name, int idx = 0, const std::string& def = std::string())
+    {
+        Property* p = find(name);
+        if (!p || p->type != Property::eString || (int)p->s.size() <= idx) {
+            return def;
+        }
+        return p->s[idx];
+    }
+
+    int getInt(const char* name, int idx = 0, int def = 0)
+    {
+        Property* p = find(name);
+        if (!p || (int)p->dimension() <= idx) {
+            return def;
+        }
+        if (p->type == Property::eInt) {
+            return p->i[idx];
+        }
+        if (p->type == Property::eDouble) {
+            return (int)p->d[idx];
+        }
+        return def;
+    }
+
+    double getDouble(const char* name, int idx = 0, double def = 0.)
+    {
+        Property* p = find(name);
+        if (!p || (int)p->dimension() <= idx) {
+            return def;
+        }
+        if (p->type == Property::eDouble) {
+            return p->d[idx];
+        }
+        if (p->type == Property::eInt) {
+            return p->i[idx];
+        }
+        return def;
+    }
+
+    // true if the string property exists and contains the given value, or if it does not exist
+    bool containsOrMissing(const char* name, const std::string& v)
+    {
+        Property* p = find(name);
+        if (!p || p->type != Property::eString || p->s.empty()) {
+            return true;
+        }
+        return std::find(p->s.begin(), p->s.end(), v) != p->s.end();
+    }
+};
+
+inline PropertySet* toProps(OfxPropertySetHandle h) { return reinterpret_cast<PropertySet*>(h); }
+inline OfxPropertySetHandle toHandle(PropertySet* p) { return reinterpret_cast<OfxPropertySetHandle>(p); }
+
+static OfxStatus
+propSetPointer(OfxPropertySetHandle properties, const char *property, int index, void *value)
+{
+    if (!properties || index < 0) return kOfxStatErrBadHandle;
+    toProps(properties)->setPointer(property, value, index);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetString(OfxPropertySetHandle properties, const char *property, int index, const char *value)
+{
+    if (!properties || index < 0) return kOfxStatErrBadHandle;
+    toProps(properties)->setString(property, value ? value : "", index);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetDouble(OfxPropertySetHandle properties, const char *property, int index, double value)
+{
+    if (!properties || index < 0) return kOfxStatErrBadHandle;
+    toProps(properties)->setDouble(property, value, index);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetInt(OfxPropertySetHandle properties, const char *property, int index, int value)
+{
+    if (!properties || index < 0) return kOfxStatErrBadHandle;
+    toProps(properties)->setInt(property, value, index);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetPointerN(OfxPropertySetHandle properties, const char *property, int count, void *const*value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property& p = toProps(properties)->fetch(property, Property::ePointer);
+    p.p.assign(value, value + count);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetStringN(OfxPropertySetHandle properties, const char *property, int count, const char *const*value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property& p = toProps(properties)->fetch(property, Property::eString);
+    p.s.resize(count);
+    for (int i = 0; i < count; ++i) {
+        p.s[i] = value[i] ? value[i] : "";
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetDoubleN(OfxPropertySetHandle properties, const char *property, int count, const double *value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property& p = toProps(properties)->fetch(property, Property::eDouble);
+    p.d.assign(value, value + count);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propSetIntN(OfxPropertySetHandle properties, const char *property, int count, const int *value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property& p = toProps(properties)->fetch(property, Property::eInt);
+    p.i.assign(value, value + count);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetPointer(OfxPropertySetHandle properties, const char *property, int index, void **value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property* p = toProps(properties)->find(property);
+    if (!p) return kOfxStatErrUnknown;
+    if (p->type != Property::ePointer) return kOfxStatErrValue;
+    if (index < 0 || index >= (int)p->p.size()) return kOfxStatErrBadIndex;
+    *value = p->p[index];
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetString(OfxPropertySetHandle properties, const char *property, int index, char **value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property* p = toProps(properties)->find(property);
+    if (!p) return kOfxStatErrUnknown;
+    if (p->type != Property::eString) return kOfxStatErrValue;
+    if (index < 0 || index >= (int)p->s.size()) return kOfxStatErrBadIndex;
+    *value = const_cast<char*>(p->s[index].c_str());
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetDouble(OfxPropertySetHandle properties, const char *property, int index, double *value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property* p = toProps(properties)->find(property);
+    if (!p) return kOfxStatErrUnknown;
+    if (index < 0 || index >= p->dimension()) return kOfxStatErrBadIndex;
+    if (p->type == Property::eDouble) {
+        *value = p->d[index];
+    } else if (p->type == Property::eInt) {
+        *value = p->i[index];
+    } else {
+        return kOfxStatErrValue;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetInt(OfxPropertySetHandle properties, const char *property, int index, int *value)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property* p = toProps(properties)->find(property);
+    if (!p) return kOfxStatErrUnknown;
+    if (index < 0 || index >= p->dimension()) return kOfxStatErrBadIndex;
+    if (p->type == Property::eInt) {
+        *value = p->i[index];
+    } else if (p->type == Property::eDouble) {
+        *value = (int)p->d[index];
+    } else {
+        return kOfxStatErrValue;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetPointerN(OfxPropertySetHandle properties, const char *property, int count, void **value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus st = propGetPointer(properties, property, i, &value[i]);
+        if (st != kOfxStatOK) return st;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetStringN(OfxPropertySetHandle properties, const char *property, int count, char **value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus st = propGetString(properties, property, i, &value[i]);
+        if (st != kOfxStatOK) return st;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetDoubleN(OfxPropertySetHandle properties, const char *property, int count, double *value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus st = propGetDouble(properties, property, i, &value[i]);
+        if (st != kOfxStatOK) return st;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetIntN(OfxPropertySetHandle properties, const char *property, int count, int *value)
+{
+    for (int i = 0; i < count; ++i) {
+        OfxStatus st = propGetInt(properties, property, i, &value[i]);
+        if (st != kOfxStatOK) return st;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propReset(OfxPropertySetHandle properties, const char *property)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    if (!toProps(properties)->find(property)) return kOfxStatErrUnknown;
+    // we do not know the default values: keep the current value
+    return kOfxStatOK;
+}
+
+static OfxStatus
+propGetDimension(OfxPropertySetHandle properties, const char *property, int *count)
+{
+    if (!properties) return kOfxStatErrBadHandle;
+    Property* p = toProps(properties)->find(property);
+    if (!p) return kOfxStatErrUnknown;
+    *count = p->dimension();
+    return kOfxStatOK;
+}
+
+static OfxPropertySuiteV1 gPropertySuite;
+
+////////////////////////////////////////////////////////////////////////////////
+// parameters
+
+struct ParamSet;
+
+struct Param {
+    std::string name;
+    std::string type;
+    PropertySet props;
+    std::vector<double> d;
+    std::vector<int> i;
+    std::string s;
+};
+
+struct ParamSet {
+    PropertySet props;
+    std::vector<Param*> params;
+    std::map<std::string, Param*> byName;
+
+    ~ParamSet()
+    {
+        for (std::vector<Param*>::iterator it = params.begin(); it != params.end(); ++it) {
+            delete *it;
+        }
+    }
+
+    Param* define(const std::string& type, const std::string& name)
+    {
+        if (byName.find(name) != byName.end()) {
+            return 0;
+        }
+        Param* p = new Param;
+        p->name = name;
+        p->type = type;
+        p->props.setString(kOfxPropType, kOfxTypeParameter);
+        p->props.setString(kOfxPropName, name);
+        p->props.setString(kOfxParamPropType, type);
+        params.push_back(p);
+        byName[name] = p;
+        return p;
+    }
+};
+
+inline bool
+isIntParam(const std::string& type)
+{
+    return (type == kOfxParamTypeInteger || type == kOfxParamTypeBoolean || type == kOfxParamTypeChoice ||
+            type == kOfxParamTypeInteger2D || type == kOfxParamTypeInteger3D);
+}
+
+inline bool
+isDoubleParam(const std::string& type)
+{
+    return (type == kOfxParamTypeDouble || type == kOfxParamTypeDouble2D || type == kOfxParamTypeDouble3D ||
+            type == kOfxParamTypeRGB || type == kOfxParamTypeRGBA);
+}
+
+inline bool
+isStringParam(const std::string& type)
+{
+    return (type == kOfxParamTypeString || type == kOfxParamTypeCustom);
+}
+
+inline int
+paramDimension(const std::string& type)
+{
+    if (type == kOfxParamTypeInteger2D || type == kOfxParamTypeDouble2D) {
+        return 2;
+    }
+    if (type == kOfxParamTypeInteger3D || type == kOfxParamTypeDouble3D || type == kOfxParamTypeRGB) {
+        return 3;
+    }
+    if (type == kOfxParamTypeRGBA) {
+        return 4;
+    }
+    return 1;
+}
+
+// Initialize an instance parameter from its descriptor, denormalising spatial defaults
+static void
+paramInitInstance(Param* p, const Param& desc, double width, double height)
+{
+    p->props = desc.props;
+    const int dim = paramDimension(p->type);
+    if (isIntParam(p->type)) {
+        p->i.resize(dim);
+        for (int k = 0; k < dim; ++k) {
+            p->i[k] = p->props.getInt(kOfxParamPropDefault, k, 0);
+        }
+    } else if (isDoubleParam(p->type)) {
+        p->d.resize(dim);
+        const std::string doubleType = p->props.getString(kOfxParamPropDoubleType);
+        const bool spatial = (doubleType.find_first_of("XY") != std::string::npos);
+        const bool normalised = spatial && (p->props.getString(kOfxParamPropDefaultCoordinateSystem) == kOfxParamCoordinatesNormalised ||
+                                            doubleType.find("Normalised") != std::string::npos);
+        for (int k = 0; k < dim; ++k) {
+            double v = p->props.getDouble(kOfxParamPropDefault, k, 0.);
+            if (normalised) {
+                bool isY = (dim == 2) ? (k == 1) : (doubleType.find('Y') != std::string::npos &&
+                                                    doubleType.find('X') == std::string::npos);
+                v *= isY ? height : width;
+            }
+            p->d[k] = v;
+        }
+    } else if (isStringParam(p->type)) {
+        p->s = p->props.getString(kOfxParamPropDefault);
+    }
+}
+
+inline Param* toParam(OfxParamHandle h) { return reinterpret_cast<Param*>(h); }
+inline ParamSet* toParamSet(OfxParamSetHandle h) { return reinterpret_cast<ParamSet*>(h); }
+
+static OfxStatus
+paramDefine(OfxParamSetHandle paramSet, const char *paramType, const char *name, OfxPropertySetHandle *propertySet)
+{
+    if (!paramSet) return kOfxStatErrBadHandle;
+    Param* p = toParamSet(paramSet)->define(paramType, name);
+    if (!p) return kOfxStatErrExists;
+    if (propertySet) {
+        *propertySet = toHandle(&p->props);
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramGetHandle(OfxParamSetHandle paramSet, const char *name, OfxParamHandle *param, OfxPropertySetHandle *propertySet)
+{
+    if (!paramSet) return kOfxStatErrBadHandle;
+    ParamSet* ps = toParamSet(paramSet);
+    std::map<std::string, Param*>::iterator it = ps->byName.find(name);
+    if (it == ps->byName.end()) return kOfxStatErrUnknown;
+    *param = reinterpret_cast<OfxParamHandle>(it->second);
+    if (propertySet) {
+        *propertySet = toHandle(&it->second->props);
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramSetGetPropertySet(OfxParamSetHandle paramSet, OfxPropertySetHandle *propHandle)
+{
+    if (!paramSet) return kOfxStatErrBadHandle;
+    *propHandle = toHandle(&toParamSet(paramSet)->props);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramGetPropertySet(OfxParamHandle param, OfxPropertySetHandle *propHandle)
+{
+    if (!param) return kOfxStatErrBadHandle;
+    *propHandle = toHandle(&toParam(param)->props);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramGetValueV(Param* p, va_list ap)
+{
+    if (isIntParam(p->type)) {
+        for (size_t k = 0; k < p->i.size(); ++k) {
+            int* v = va_arg(ap, int*);
+            *v = p->i[k];
+        }
+    } else if (isDoubleParam(p->type)) {
+        for (size_t k = 0; k < p->d.size(); ++k) {
+            double* v = va_arg(ap, double*);
+            *v = p->d[k];
+        }
+    } else if (isStringParam(p->type)) {
+        const char** v = va_arg(ap, const char**);
+        *v = p->s.c_str();
+    } else {
+        return kOfxStatErrBadHandle;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramSetValueV(Param* p, va_list ap)
+{
+    if (isIntParam(p->type)) {
+        for (size_t k = 0; k < p->i.size(); ++k) {
+            p->i[k] = va_arg(ap, int);
+        }
+    } else if (isDoubleParam(p->type)) {
+        for (size_t k = 0; k < p->d.size(); ++k) {
+            p->d[k] = va_arg(ap, double);
+        }
+    } else if (isStringParam(p->type)) {
+        const char* v = va_arg(ap, const char*);
+        p->s = v ? v : "";
+    } else {
+        return kOfxStatErrBadHandle;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramGetValue(OfxParamHandle paramHandle, ...)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    va_list ap;
+    va_start(ap, paramHandle);
+    OfxStatus st = paramGetValueV(toParam(paramHandle), ap);
+    va_end(ap);
+    return st;
+}
+
+// parameters are never animated by this host
+static OfxStatus
+paramGetValueAtTime(OfxParamHandle paramHandle, OfxTime time, ...)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    va_list ap;
+    va_start(ap, time);
+    OfxStatus st = paramGetValueV(toParam(paramHandle), ap);
+    va_end(ap);
+    return st;
+}
+
+static OfxStatus
+paramGetDerivative(OfxParamHandle paramHandle, OfxTime time, ...)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    Param* p = toParam(paramHandle);
+    if (!isDoubleParam(p->type)) return kOfxStatErrBadHandle;
+    va_list ap;
+    va_start(ap, time);
+    for (size_t k = 0; k < p->d.size(); ++k) {
+        double* v = va_arg(ap, double*);
+        *v = 0.;
+    }
+    va_end(ap);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramGetIntegral(OfxParamHandle paramHandle, OfxTime time1, OfxTime time2, ...)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    Param* p = toParam(paramHandle);
+    if (!isDoubleParam(p->type)) return kOfxStatErrBadHandle;
+    va_list ap;
+    va_start(ap, time2);
+    for (size_t k = 0; k < p->d.size(); ++k) {
+        double* v = va_arg(ap, double*);
+        *v = p->d[k] * (time2 - time1);
+    }
+    va_end(ap);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramSetValue(OfxParamHandle paramHandle, ...)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    va_list ap;
+    va_start(ap, paramHandle);
+    OfxStatus st = paramSetValueV(toParam(paramHandle), ap);
+    va_end(ap);
+    return st;
+}
+
+static OfxStatus
+paramSetValueAtTime(OfxParamHandle paramHandle, OfxTime time, ...)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    va_list ap;
+    va_start(ap, time);
+    OfxStatus st = paramSetValueV(toParam(paramHandle), ap);
+    va_end(ap);
+    return st;
+}
+
+static OfxStatus
+paramGetNumKeys(OfxParamHandle paramHandle, unsigned int *numberOfKeys)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    *numberOfKeys = 0;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramGetKeyTime(OfxParamHandle paramHandle, unsigned int /*nthKey*/, OfxTime */*time*/)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    return kOfxStatErrBadIndex;
+}
+
+static OfxStatus
+paramGetKeyIndex(OfxParamHandle paramHandle, OfxTime /*time*/, int /*direction*/, int */*index*/)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    return kOfxStatFailed;
+}
+
+static OfxStatus
+paramDeleteKey(OfxParamHandle paramHandle, OfxTime /*time*/)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    return kOfxStatErrBadIndex;
+}
+
+static OfxStatus
+paramDeleteAllKeys(OfxParamHandle paramHandle)
+{
+    if (!paramHandle) return kOfxStatErrBadHandle;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramCopy(OfxParamHandle paramTo, OfxParamHandle paramFrom, OfxTime /*dstOffset*/, const OfxRangeD */*frameRange*/)
+{
+    if (!paramTo || !paramFrom) return kOfxStatErrBadHandle;
+    Param* to = toParam(paramTo);
+    Param* from = toParam(paramFrom);
+    if (to->type != from->type) return kOfxStatErrValue;
+    to->d = from->d;
+    to->i = from->i;
+    to->s = from->s;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+paramEditBegin(OfxParamSetHandle paramSet, const char */*name*/)
+{
+    return paramSet ? kOfxStatOK : kOfxStatErrBadHandle;
+}
+
+static OfxStatus
+paramEditEnd(OfxParamSetHandle paramSet)
+{
+    return paramSet ? kOfxStatOK : kOfxStatErrBadHandle;
+}
+
+static OfxParameterSuiteV1 gParameterSuite;
+
+////////////////////////////////////////////////////////////////////////////////
+// images, clips and effects
+
+struct Effect;
+
+// a pixel buffer, shared by all the images fetched from the same clip
+struct Buffer {
+    std::vector<unsigned char> data;
+    int width;
+    int height;
+    int rowBytes;
+};
+
+struct Clip {
+    std::string name;
+    PropertySet props;
+    Effect* effect;
+    bool connected;
+    Buffer* buffer;
+
+    Clip() : effect(0), connected(false), buffer(0) {}
+};
+
+struct Effect {
+    PropertySet props;
+    ParamSet params;
+    std::vector<Clip*> clips;
+    std::map<std::string, Clip*> clipsByName;
+    int width;
+    int height;
+
+    Effect() : width(0), height(0) {}
+
+    ~Effect()
+    {
+        for (std::vector<Clip*>::iterator it = clips.begin(); it != clips.end(); ++it) {
+            delete *it;
+        }
+    }
+
+    Clip* defineClip(const std::string& name)
+    {
+        if (clipsByName.find(name) != clipsByName.end()) {
+            return clipsByName[name];
+        }
+        Clip* c = new Clip;
+        c->name = name;
+        c->effect = this;
+        c->props.setString(kOfxPropType, kOfxTypeClip);
+        c->props.setString(kOfxPropName, name);
+        clips.push_back(c);
+        clipsByName[name] = c;
+        return c;
+    }
+};
+
+inline Effect* toEffect(OfxImageEffectHandle h) { return reinterpret_cast<Effect*>(h); }
+inline Clip* toClip(OfxImageClipHandle h) { return reinterpret_cast<Clip*>(h); }
+
+static OfxStatus
+getPropertySet(OfxImageEffectHandle imageEffect, OfxPropertySetHandle *propHandle)
+{
+    if (!imageEffect) return kOfxStatErrBadHandle;
+    *propHandle = toHandle(&toEffect(imageEffect)->props);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+getParamSet(OfxImageEffectHandle imageEffect, OfxParamSetHandle *paramSet)
+{
+    if (!imageEffect) return kOfxStatErrBadHandle;
+    *paramSet = reinterpret_cast<OfxParamSetHandle>(&toEffect(imageEffect)->params);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clipDefine(OfxImageEffectHandle imageEffect, const char *name, OfxPropertySetHandle *propertySet)
+{
+    if (!imageEffect) return kOfxStatErrBadHandle;
+    Clip* c = toEffect(imageEffect)->defineClip(name);
+    if (propertySet) {
+        *propertySet = toHandle(&c->props);
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clipGetHandle(OfxImageEffectHandle imageEffect, const char *name, OfxImageClipHandle *clip, OfxPropertySetHandle *propertySet)
+{
+    if (!imageEffect) return kOfxStatErrBadHandle;
+    Effect* e = toEffect(imageEffect);
+    std::map<std::string, Clip*>::iterator it = e->clipsByName.find(name);
+    if (it == e->clipsByName.end()) return kOfxStatErrBadHandle;
+    *clip = reinterpret_cast<OfxImageClipHandle>(it->second);
+    if (propertySet) {
+        *propertySet = toHandle(&it->second->props);
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clipGetPropertySet(OfxImageClipHandle clip, OfxPropertySetHandle *propHandle)
+{
+    if (!clip) return kOfxStatErrBadHandle;
+    *propHandle = toHandle(&toClip(clip)->props);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clipGetImage(OfxImageClipHandle clip, OfxTime time, const OfxRectD */*region*/, OfxPropertySetHandle *imageHandle)
+{
+    if (!clip) return kOfxStatErrBadHandle;
+    Clip* c = toClip(clip);
+    if (!c->connected || !c->buffer) {
+        return kOfxStatFailed;
+    }
+    // the whole clip is returned, whatever the region asked for
+    PropertySet* img = new PropertySet;
+    PropertySet& p = *img;
+    p.setString(kOfxPropType, kOfxTypeImage);
+    p.setString(kOfxImageEffectPropPixelDepth, c->props.getString(kOfxImageEffectPropPixelDepth));
+    p.setString(kOfxImageEffectPropComponents, c->props.getString(kOfxImageEffectPropComponents));
+    p.setString(kOfxImageEffectPropPreMultiplication, c->props.getString(kOfxImageEffectPropPreMultiplication));
+    p.setDouble(kOfxImageEffectPropRenderScale, 1., 0);
+    p.setDouble(kOfxImageEffectPropRenderScale, 1., 1);
+    p.setDouble(kOfxImagePropPixelAspectRatio, 1.);
+    p.setPointer(kOfxImagePropData, c->buffer->data.empty() ? 0 : &c->buffer->data[0]);
+    const int bounds[4] = { 0, 0, c->buffer->width, c->buffer->height };
+    for (int k = 0; k < 4; ++k) {
+        p.setInt(kOfxImagePropBounds, bounds[k], k);
+        p.setInt(kOfxImagePropRegionOfDefinition, bounds[k], k);
+    }
+    p.setInt(kOfxImagePropRowBytes, c->buffer->rowBytes);
+    p.setString(kOfxImagePropField, kOfxImageFieldNone);
+    std::ostringstream id;
+    id << c->name << '@' << time;
+    p.setString(kOfxImagePropUniqueIdentifier, id.str());
+    *imageHandle = toHandle(img);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clipReleaseImage(OfxPropertySetHandle imageHandle)
+{
+    if (!imageHandle) return kOfxStatErrBadHandle;
+    delete toProps(imageHandle);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clipGetRegionOfDefinition(OfxImageClipHandle clip, OfxTime /*time*/, OfxRectD *bounds)
+{
+    if (!clip) return kOfxStatErrBadHandle;
+    Clip* c = toClip(clip);
+    bounds->x1 = bounds->y1 = 0.;
+    if (c->connected && c->effect) {
+        bounds->x2 = c->effect->width;
+        bounds->y2 = c->effect->height;
+    } else {
+        bounds->x2 = bounds->y2 = 0.;
+    }
+    return kOfxStatOK;
+}
+
+static int
+abortFunc(OfxImageEffectHandle /*imageEffect*/)
+{
+    return 0;
+}
+
+struct ImageMemory {
+    void* data;
+    size_t size;
+};
+
+static OfxStatus
+imageMemoryAlloc(OfxImageEffectHandle /*instanceHandle*/, size_t nBytes, OfxImageMemoryHandle *memoryHandle)
+{
+    ImageMemory* m = new ImageMemory;
+    m->data = std::malloc(nBytes);
+    m->size = nBytes;
+    if (!m->data) {
+        delete m;
+        *memoryHandle = 0;
+        return kOfxStatErrMemory;
+    }
+    *memoryHandle = reinterpret_cast<OfxImageMemoryHandle>(m);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+imageMemoryFree(OfxImageMemoryHandle memoryHandle)
+{
+    if (!memoryHandle) return kOfxStatErrBadHandle;
+    ImageMemory* m = reinterpret_cast<ImageMemory*>(memoryHandle);
+    std::free(m->data);
+    delete m;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+imageMemoryLock(OfxImageMemoryHandle memoryHandle, void **returnedPtr)
+{
+    if (!memoryHandle) return kOfxStatErrBadHandle;
+    *returnedPtr = reinterpret_cast<ImageMemory*>(memoryHandle)->data;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+imageMemoryUnlock(OfxImageMemoryHandle memoryHandle)
+{
+    return memoryHandle ? kOfxStatOK : kOfxStatErrBadHandle;
+}
+
+static OfxImageEffectSuiteV1 gImageEffectSuite;
+
+////////////////////////////////////////////////////////////////////////////////
+// memory, threads and messages
+
+static OfxStatus
+memoryAlloc(void */*handle*/, size_t nBytes, void **allocatedData)
+{
+    *allocatedData = std::malloc(nBytes);
+    return *allocatedData ? kOfxStatOK : kOfxStatErrMemory;
+}
+
+static OfxStatus
+memoryFree(void *allocatedData)
+{
+    std::free(allocatedData);
+    return kOfxStatOK;
+}
+
+static OfxMemorySuiteV1 gMemorySuite;
+
+static unsigned int gNThreads = 1;
+static pthread_key_t gThreadIndexKey;
+
+struct ThreadArgs {
+    OfxThreadFunctionV1* func;
+    unsigned int threadIndex;
+    unsigned int threadMax;
+    void* customArg;
+};
+
+static void*
+threadStart(void* arg)
+{
+    ThreadArgs* a = (ThreadArgs*)arg;
+    // store index+1, so that 0 means "not a spawned thread"
+    pthread_setspecific(gThreadIndexKey, (void*)(size_t)(a->threadIndex + 1));
+    a->func(a->threadIndex, a->threadMax, a->customArg);
+    return 0;
+}
+
+static OfxStatus
+multiThread(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg)
+{
+    if (nThreads == 0) {
+        return kOfxStatErrValue;
+    }
+    if (nThreads == 1) {
+        func(0, 1, customArg);
+        return kOfxStatOK;
+    }
+    std::vector<pthread_t> threads(nThreads);
+    std::vector<ThreadArgs> args(nThreads);
+    std::vector<bool> started(nThreads, false);
+    for (unsigned int t = 0; t < nThreads; ++t) {
+        args[t].func = func;
+        args[t].threadIndex = t;
+        args[t].threadMax = nThreads;
+        args[t].customArg = customArg;
+        started[t] = (pthread_create(&threads[t], NULL, threadStart, &args[t]) == 0);
+    }
+    for (unsigned int t = 0; t < nThreads; ++t) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            // could not spawn: run it in this thread
+            func(t, nThreads, customArg);
+        }
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+multiThreadNumCPUs(unsigned int *nCPUs)
+{
+    *nCPUs = gNThreads;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+multiThreadIndex(unsigned int *threadIndex)
+{
+    size_t idx = (size_t)pthread_getspecific(gThreadIndexKey);
+    *threadIndex = idx ? (unsigned int)(idx - 1) : 0;
+    return kOfxStatOK;
+}
+
+static int
+multiThreadIsSpawnedThread(void)
+{
+    return pthread_getspecific(gThreadIndexKey) != 0;
+}
+
+static OfxStatus
+mutexCreate(OfxMutexHandle *mutex, int lockCount)
+{
+    pthread_mutex_t* m = new pthread_mutex_t;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+    for (int i = 0; i < lockCount; ++i) {
+        pthread_mutex_lock(m);
+    }
+    *mutex = reinterpret_cast<OfxMutexHandle>(m);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+mutexDestroy(const OfxMutexHandle mutex)
+{
+    if (!mutex) return kOfxStatErrBadHandle;
+    pthread_mutex_t* m = reinterpret_cast<pthread_mutex_t*>(mutex);
+    pthread_mutex_destroy(m);
+    delete m;
+    return kOfxStatOK;
+}
+
+static OfxStatus
+mutexLock(const OfxMutexHandle mutex)
+{
+    if (!mutex) return kOfxStatErrBadHandle;
+    pthread_mutex_lock(reinterpret_cast<pthread_mutex_t*>(mutex));
+    return kOfxStatOK;
+}
+
+static OfxStatus
+mutexUnLock(const OfxMutexHandle mutex)
+{
+    if (!mutex) return kOfxStatErrBadHandle;
+    pthread_mutex_unlock(reinterpret_cast<pthread_mutex_t*>(mutex));
+    return kOfxStatOK;
+}
+
+static OfxStatus
+mutexTryLock(const OfxMutexHandle mutex)
+{
+    if (!mutex) return kOfxStatErrBadHandle;
+    return pthread_mutex_trylock(reinterpret_cast<pthread_mutex_t*>(mutex)) == 0 ? kOfxStatOK : kOfxStatFailed;
+}
+
+static OfxMultiThreadSuiteV1 gMultiThreadSuite;
+
+static void
+vmessage(const char* messageType, const char* messageId, const char* format, va_list ap)
+{
+    char buf[1024];
+    vsnprintf(buf, sizeof(buf), format, ap);
+    std::cerr << "OFX Bench: " << (messageType ? messageType : "message");
+    if (messageId) {
+        std::cerr << " (" << messageId << ")";
+    }
+    std::cerr << ": " << buf << std::endl;
+}
+
+static OfxStatus
+message(void */*handle*/, const char *messageType, const char *messageId, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vmessage(messageType, messageId, format, ap);
+    va_end(ap);
+    // this host is not interactive: answer yes to all questions
+    if (messageType && std::strcmp(messageType, kOfxMessageQuestion) == 0) {
+        return kOfxStatReplyYes;
+    }
+    return kOfxStatOK;
+}
+
+static OfxStatus
+setPersistentMessage(void */*handle*/, const char *messageType, const char *messageId, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vmessage(messageType, messageId, format, ap);
+    va_end(ap);
+    return kOfxStatOK;
+}
+
+static OfxStatus
+clearPersistentMessage(void */*handle*/)
+{
+    return kOfxStatOK;
+}
+
+static OfxMessageSuiteV1 gMessageSuite;
+static OfxMessageSuiteV2 gMessageSuiteV2;
+
+////////////////////////////////////////////////////////////////////////////////
+// the host
+
+static PropertySet gHostProps;
+static OfxHost gHost;
+
+static const void*
+fetchSuite(OfxPropertySetHandle /*host*/, const char *suiteName, int suiteVersion)
+{
+    if (std::strcmp(suiteName, kOfxPropertySuite) == 0 && suiteVersion == 1) {
+        return &gPropertySuite;
+    }
+    if (std::strcmp(suiteName, kOfxParameterSuite) == 0 && suiteVersion == 1) {
+        return &gParameterSuite;
+    }
+    if (std::strcmp(suiteName, kOfxImageEffectSuite) == 0 && suiteVersion == 1) {
+        return &gImageEffectSuite;
+    }
+    if (std::strcmp(suiteName, kOfxMemorySuite) == 0 && suiteVersion == 1) {
+        return &gMemorySuite;
+    }
+    if (std::strcmp(suiteName, kOfxMultiThreadSuite) == 0 && suiteVersion == 1) {
+        return &gMultiThreadSuite;
+    }
+    if (std::strcmp(suiteName, kOfxMessageSuite) == 0 && suiteVersion == 1) {
+        return &gMessageSuite;
+    }
+    if (std::strcmp(suiteName, kOfxMessageSuite) == 0 && suiteVersion == 2) {
+        return &gMessageSuiteV2;
+    }
+    // interact, progress, timeline, parametric parameters and the extension suites are not supported
+    return 0;
+}
+
+static void
+initHost()
+{
+    gPropertySuite.propSetPointer = propSetPointer;
+    gPropertySuite.propSetString = propSetString;
+    gPropertySuite.propSetDouble = propSetDouble;
+    gPropertySuite.propSetInt = propSetInt;
+    gPropertySuite.propSetPointerN = propSetPointerN;
+    gPropertySuite.propSetStringN = propSetStringN;
+    gPropertySuite.propSetDoubleN = propSetDoubleN;
+    gPropertySuite.propSetIntN = propSetIntN;
+    gPropertySuite.propGetPointer = propGetPointer;
+    gPropertySuite.propGetString = propGetString;
+    gPropertySuite.propGetDouble = propGetDouble;
+    gPropertySuite.propGetInt = propGetInt;
+    gPropertySuite.propGetPointerN = propGetPointerN;
+    gPropertySuite.propGetStringN = propGetStringN;
+    gPropertySuite.propGetDoubleN = propGetDoubleN;
+    gPropertySuite.propGetIntN = propGetIntN;
+    gPropertySuite.propReset = propReset;
+    gPropertySuite.propGetDimension = propGetDimension;
+
+    gParameterSuite.paramDefine = paramDefine;
+    gParameterSuite.paramGetHandle = paramGetHandle;
+    gParameterSuite.paramSetGetPropertySet = paramSetGetPropertySet;
+    gParameterSuite.paramGetPropertySet = paramGetPropertySet;
+    gParameterSuite.paramGetValue = paramGetValue;
+    gParameterSuite.paramGetValueAtTime = paramGetValueAtTime;
+    gParameterSuite.paramGetDerivative = paramGetDerivative;
+    gParameterSuite.paramGetIntegral = paramGetIntegral;
+    gParameterSuite.paramSetValue = paramSetValue;
+    gParameterSuite.paramSetValueAtTime = paramSetValueAtTime;
+    gParameterSuite.paramGetNumKeys = paramGetNumKeys;
+    gParameterSuite.paramGetKeyTime = paramGetKeyTime;
+    gParameterSuite.paramGetKeyIndex = paramGetKeyIndex;
+    gParameterSuite.paramDeleteKey = paramDeleteKey;
+    gParameterSuite.paramDeleteAllKeys = paramDeleteAllKeys;
+    gParameterSuite.paramCopy = paramCopy;
+    gParameterSuite.paramEditBegin = paramEditBegin;
+    gParameterSuite.paramEditEnd = paramEditEnd;
+
+    gImageEffectSuite.getPropertySet = getPropertySet;
+    gImageEffectSuite.getParamSet = getParamSet;
+    gImageEffectSuite.clipDefine = clipDefine;
+    gImageEffectSuite.clipGetHandle = clipGetHandle;
+    gImageEffectSuite.clipGetPropertySet = clipGetPropertySet;
+    gImageEffectSuite.clipGetImage = clipGetImage;
+    gImageEffectSuite.clipReleaseImage = clipReleaseImage;
+    gImageEffectSuite.clipGetRegionOfDefinition = clipGetRegionOfDefinition;
+    gImageEffectSuite.abort = abortFunc;
+    gImageEffectSuite.imageMemoryAlloc = imageMemoryAlloc;
+    gImageEffectSuite.imageMemoryFree = imageMemoryFree;
+    gImageEffectSuite.imageMemoryLock = imageMemoryLock;
+    gImageEffectSuite.imageMemoryUnlock = imageMemoryUnlock;
+
+    gMemorySuite.memoryAlloc = memoryAlloc;
+    gMemorySuite.memoryFree = memoryFree;
+
+    gMultiThreadSuite.multiThread = multiThread;
+    gMultiThreadSuite.multiThreadNumCPUs = multiThreadNumCPUs;
+    gMultiThreadSuite.multiThreadIndex = multiThreadIndex;
+    gMultiThreadSuite.multiThreadIsSpawnedThread = multiThreadIsSpawnedThread;
+    gMultiThreadSuite.mutexCreate = mutexCreate;
+    gMultiThreadSuite.mutexDestroy = mutexDestroy;
+    gMultiThreadSuite.mutexLock = mutexLock;
+    gMultiThreadSuite.mutexUnLock = mutexUnLock;
+    gMultiThreadSuite.mutexTryLock = mutexTryLock;
+    pthread_key_create(&gThreadIndexKey, NULL);
+
+    gMessageSuite.message = message;
+    gMessageSuiteV2.message = message;
+    gMessageSuiteV2.setPersistentMessage = setPersistentMessage;
+    gMessageSuiteV2.clearPersistentMessage = clearPersistentMessage;
+
+    PropertySet& h = gHostProps;
+    h.setString(kOfxPropType, kOfxTypeImageEffectHost);
+    h.setString(kOfxPropName, kBenchHostName);
+    h.setString(kOfxPropLabel, kBenchHostLabel);
+    h.setInt(kOfxPropAPIVersion, 1, 0);
+    h.setInt(kOfxPropAPIVersion, 3, 1);
+    h.setInt(kOfxPropVersion, 1, 0);
+    h.setInt(kOfxPropVersion, 0, 1);
+    h.setInt(kOfxPropVersion, 0, 2);
+    h.setString(kOfxPropVersionLabel, "1.0");
+    h.setInt(kOfxImageEffectHostPropIsBackground, 1);
+    h.setInt(kOfxImageEffectPropSupportsOverlays, 0);
+    h.setInt(kOfxImageEffectPropSupportsMultiResolution, 1);
+    h.setInt(kOfxImageEffectPropSupportsTiles, 1);
+    h.setInt(kOfxImageEffectPropTemporalClipAccess, 1);
+    h.setString(kOfxImageEffectPropSupportedComponents, kOfxImageComponentRGBA, 0);
+    h.setString(kOfxImageEffectPropSupportedComponents, kOfxImageComponentRGB, 1);
+    h.setString(kOfxImageEffectPropSupportedComponents, kOfxImageComponentAlpha, 2);
+    h.setString(kOfxImageEffectPropSupportedContexts, kOfxImageEffectContextFilter, 0);
+    h.setString(kOfxImageEffectPropSupportedContexts, kOfxImageEffectContextGeneral, 1);
+    h.setString(kOfxImageEffectPropSupportedContexts, kOfxImageEffectContextGenerator, 2);
+    h.setString(kOfxImageEffectPropSupportedPixelDepths, kOfxBitDepthByte, 0);
+    h.setString(kOfxImageEffectPropSupportedPixelDepths, kOfxBitDepthShort, 1);
+    h.setString(kOfxImageEffectPropSupportedPixelDepths, kOfxBitDepthFloat, 2);
+    h.setInt(kOfxImageEffectPropSupportsMultipleClipDepths, 0);
+    h.setInt(kOfxImageEffectPropSupportsMultipleClipPARs, 0);
+    h.setInt(kOfxImageEffectPropSetableFrameRate, 0);
+    h.setInt(kOfxImageEffectPropSetableFielding, 0);
+    h.setInt(kOfxImageEffectInstancePropSequentialRender, 0);
+    h.setInt(kOfxParamHostPropSupportsCustomInteract, 0);
+    h.setInt(kOfxParamHostPropSupportsStringAnimation, 0);
+    h.setInt(kOfxParamHostPropSupportsChoiceAnimation, 0);
+    h.setInt(kOfxParamHostPropSupportsBooleanAnimation, 0);
+    h.setInt(kOfxParamHostPropSupportsCustomAnimation, 0);
+    h.setInt(kOfxParamHostPropSupportsParametricAnimation, 0);
+    h.setInt(kOfxParamHostPropMaxParameters, -1);
+    h.setInt(kOfxParamHostPropMaxPages, 0);
+    h.setInt(kOfxParamHostPropPageRowColumnCount, 0, 0);
+    h.setInt(kOfxParamHostPropPageRowColumnCount, 0, 1);
+
+    gHost.host = toHandle(&gHostProps);
+    gHost.fetchSuite = fetchSuite;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// benchmark configurations and results
+
+struct BenchSize {
+    std::string name;
+    int width;
+    int height;
+};
+
+struct BenchConfig {
+    BenchSize size;
+    std::string depth;      // kOfxBitDepth*
+    std::string components; // kOfxImageComponent*
+};
+
+struct BenchResult {
+    std::string pluginId;
+    int versionMajor;
+    int versionMinor;
+    std::string context;
+    BenchConfig config;
+    std::string status;
+    bool identity;
+    int iterations;
+    double timeMin;
+    double timeMean;
+    double timeMax;
+
+    BenchResult() : versionMajor(0), versionMinor(0), identity(false), iterations(0), timeMin(0.), timeMean(0.), timeMax(0.) {}
+};
+
+struct BenchOptions {
+    std::vector<BenchSize> sizes;
+    std::vector<std::string> depths;
+    std::vector<std::string> components;
+    std::vector<std::string> filters;
+    int iterations;
+    int warmup;
+    std::string output;
+
+    BenchOptions() : iterations(3), warmup(1) {}
+};
+
+static double
+now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// peak resident set size of the process since it started, in kilobytes.
+// This is a high-water mark which never decreases, so it can only be reported for the whole run.
+static long
+peakRSS()
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return ru.ru_maxrss / 1024; // bytes on OS X
+#else
+    return ru.ru_maxrss; // kilobytes on Linux and FreeBSD
+#endif
+}
+
+static int
+bytesPerComponent(const std::string& depth)
+{
+    if (depth == kOfxBitDepthByte) {
+        return 1;
+    }
+    if (depth == kOfxBitDepthShort) {
+        return 2;
+    }
+    return 4;
+}
+
+static int
+componentCount(const std::string& components)
+{
+    if (components == kOfxImageComponentAlpha) {
+        return 1;
+    }
+    if (components == kOfxImageComponentRGB) {
+        return 3;
+    }
+    return 4;
+}
+
+// fill a buffer with a deterministic pattern: smooth gradients plus some noise,
+// so that keyers, trackers and statistics do not hit trivial code paths
+static void
+fillSynthetic(Buffer* b, const std::string& depth, int nComps)
+{
+    unsigned int seed = 12345;
+    for (int y = 0; y < b->height; ++y) {
+        unsigned char* row = &b->data[(size_t)y * b->rowBytes];
+        for (int x = 0; x < b->width; ++x) {
+            for (int c = 0; c < nComps; ++c) {
+                seed = seed * 1664525u + 1013904223u;
+                double noise = ((seed >> 8) & 0xffff) / 65535. - 0.5;
+                double v;
+                if (nComps == 1 || c == 3) {
+                    v = 0.5 + 0.5 * std::sin(x * 0.01 + y * 0.013); // alpha
+                } else {
+                    v = (c == 0 ? (double)x / b->width : c == 1 ? (double)y / b->height : 0.5) + 0.1 * noise;
+                }
+                v = std::max(0., std::min(1., v));
+                size_t idx = (size_t)x * nComps + c;
+                if (depth == kOfxBitDepthByte) {
+                    row[idx] = (unsigned char)(v * 255 + 0.5);
+                } else if (depth == kOfxBitDepthShort) {
+                    ((unsigned short*)row)[idx] = (unsigned short)(v * 65535 + 0.5);
+                } else {
+                    ((float*)row)[idx] = (float)v;
+                }
+            }
+        }
+    }
+}
+
+static Buffer*
+createBuffer(int width, int height, const std::string& depth, const std::string& components, bool synthetic)
+{
+    Buffer* b = new Buffer;
+    const int nComps = componentCount(components);
+    b->width = width;
+    b->height = height;
+    b->rowBytes = width * nComps * bytesPerComponent(depth);
+    b->data.resize((size_t)b->rowBytes * height);
+    if (synthetic) {
+        fillSynthetic(b, depth, nComps);
+    }
+    return b;
+}
+
+static void
+copyProps(PropertySet* dst, const PropertySet& src)
+{
+    for (std::map<std::string, Property>::const_iterator it = src.props.begin(); it != src.props.end(); ++it) {
+        dst->props[it->first] = it->second;
+    }
+}
+
+static std::string
+jsonEscape(const std::string& s)
+{
+    std::string r;
+    for (std::string::const_iterator it = s.begin(); it != s.end(); ++it) {
+        switch (*it) {
+            case '"':  r += "\\\""; break;
+            case '\\': r += "\\\\"; break;
+            case '\n': r += "\\n"; break;
+            case '\t': r += "\\t"; break;
+            default:
+                if ((unsigned char)*it < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", *it);
+                    r += buf;
+                } else {
+                    r += *it;
+                }
+        }
+    }
+    return r;
+}
+
+static std::string
+depthName(const std::string& depth)
+{
+    if (depth == kOfxBitDepthByte) return "byte";
+    if (depth == kOfxBitDepthShort) return "short";
+    if (depth == kOfxBitDepthFloat) return "float";
+    return depth;
+}
+
+static std::string
+componentsName(const std::string& components)
+{
+    if (components == kOfxImageComponentRGBA) return "rgba";
+    if (components == kOfxImageComponentRGB) return "rgb";
+    if (components == kOfxImageComponentAlpha) return "alpha";
+    return components;
+}
+
+static void
+writeReport(std::ostream& os, const std::vector<BenchResult>& results)
+{
+    os << "{\n";
+    os << "  \"host\": \"" << kBenchHostName << "\",\n";
+    os << "  \"threads\": " << gNThreads << ",\n";
+    os << "  \"peak_rss_kb\": " << peakRSS() << ",\n";
+    os << "  \"results\": [";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const BenchResult& res = results[r];
+        const double mpix = (double)res.config.size.width * res.config.size.height / 1e6;
+        os << (r ? ",\n" : "\n");
+        os << "    {";
+        os << "\"plugin\": \"" << jsonEscape(res.pluginId) << "\", ";
+        os << "\"version\": \"" << res.versionMajor << '.' << res.versionMinor << "\", ";
+        os << "\"context\": \"" << jsonEscape(res.context) << "\", ";
+        os << "\"size\": \"" << jsonEscape(res.config.size.name) << "\", ";
+        os << "\"width\": " << res.config.size.width << ", ";
+        os << "\"height\": " << res.config.size.height << ", ";
+        os << "\"depth\": \"" << depthName(res.config.depth) << "\", ";
+        os << "\"components\": \"" << componentsName(res.config.components) << "\", ";
+        os << "\"status\": \"" << jsonEscape(res.status) << "\"";
+        if (res.iterations > 0) {
+            os << ", \"identity\": " << (res.identity ? "true" : "false");
+            os << ", \"iterations\": " << res.iterations;
+            os << ", \"time_min\": " << res.timeMin;
+            os << ", \"time_mean\": " << res.timeMean;
+            os << ", \"time_max\": " << res.timeMax;
+            os << ", \"mpix_per_s\": " << (res.timeMean > 0. ? mpix / res.timeMean : 0.);
+        }
+        os << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// driving the plugins
+
+static std::string
+statusString(const char* action, OfxStatus st)
+{
+    return std::string("error: ") + action + " returned " + OFX::StatStr(st);
+}
+
+inline bool
+failed(OfxStatus st)
+{
+    return st != kOfxStatOK && st != kOfxStatReplyDefault;
+}
+
+// initialize inst as an instance of the context descriptor, with all input clips connected
+static void
+initInstance(const Effect& ctxDesc, const std::string& context, const BenchConfig& cfg, Effect* inst)
+{
+    inst->width = cfg.size.width;
+    inst->height = cfg.size.height;
+    copyProps(&inst->props, ctxDesc.props);
+    PropertySet& p = inst->props;
+    p.setString(kOfxPropType, kOfxTypeImageEffectInstance);
+    p.setString(kOfxImageEffectPropContext, context);
+    p.setInt(kOfxPropIsInteractive, 0);
+    p.setDouble(kOfxImageEffectPropProjectSize, cfg.size.width, 0);
+    p.setDouble(kOfxImageEffectPropProjectSize, cfg.size.height, 1);
+    p.setDouble(kOfxImageEffectPropProjectOffset, 0., 0);
+    p.setDouble(kOfxImageEffectPropProjectOffset, 0., 1);
+    p.setDouble(kOfxImageEffectPropProjectExtent, cfg.size.width, 0);
+    p.setDouble(kOfxImageEffectPropProjectExtent, cfg.size.height, 1);
+    p.setDouble(kOfxImageEffectPropProjectPixelAspectRatio, 1.);
+    p.setDouble(kOfxImageEffectInstancePropEffectDuration, kBenchFrameCount);
+    p.setInt(kOfxImageEffectInstancePropSequentialRender, 0);
+    p.setDouble(kOfxImageEffectPropFrameRate, 24.);
+
+    for (std::vector<Param*>::const_iterator it = ctxDesc.params.params.begin(); it != ctxDesc.params.params.end(); ++it) {
+        Param* param = inst->params.define((*it)->type, (*it)->name);
+        paramInitInstance(param, **it, cfg.size.width, cfg.size.height);
+    }
+
+    for (std::vector<Clip*>::const_iterator it = ctxDesc.clips.begin(); it != ctxDesc.clips.end(); ++it) {
+        Clip* c = inst->defineClip((*it)->name);
+        copyProps(&c->props, (*it)->props);
+        const bool isOutput = (c->name == kOfxImageEffectOutputClipName);
+        const bool optional = c->props.getInt(kOfxImageClipPropOptional, 0, 0) != 0;
+        const bool isMask = c->props.getInt(kOfxImageClipPropIsMask, 0, 0) != 0;
+        // connect the output and all mandatory inputs
+        c->connected = isOutput || (!optional && !isMask);
+        PropertySet& cp = c->props;
+        cp.setInt(kOfxImageClipPropConnected, c->connected);
+        cp.setString(kOfxImageEffectPropPixelDepth, cfg.depth);
+        cp.setString(kOfxImageEffectPropComponents, cfg.components);
+        cp.setString(kOfxImageClipPropUnmappedPixelDepth, cfg.depth);
+        cp.setString(kOfxImageClipPropUnmappedComponents, cfg.components);
+        cp.setString(kOfxImageEffectPropPreMultiplication,
+                     cfg.components == kOfxImageComponentRGB ? kOfxImageOpaque : kOfxImagePreMultiplied);
+        cp.setDouble(kOfxImagePropPixelAspectRatio, 1.);
+        cp.setDouble(kOfxImageEffectPropFrameRate, 24.);
+        cp.setDouble(kOfxImageEffectPropUnmappedFrameRate, 24.);
+        cp.setDouble(kOfxImageEffectPropFrameRange, kBenchFrameFirst, 0);
+        cp.setDouble(kOfxImageEffectPropFrameRange, kBenchFrameFirst + kBenchFrameCount - 1, 1);
+        cp.setDouble(kOfxImageEffectPropUnmappedFrameRange, kBenchFrameFirst, 0);
+        cp.setDouble(kOfxImageEffectPropUnmappedFrameRange, kBenchFrameFirst + kBenchFrameCount - 1, 1);
+        cp.setString(kOfxImageClipPropFieldOrder, kOfxImageFieldNone);
+        cp.setInt(kOfxImageClipPropContinuousSamples, 0);
+    }
+}
+
+// ask the plugin for its clip preferences, and apply them to the clips
+static OfxStatus
+applyClipPreferences(OfxPlugin* plugin, Effect* inst)
+{
+    PropertySet outArgs;
+    for (std::vector<Clip*>::iterator it = inst->clips.begin(); it != inst->clips.end(); ++it) {
+        const std::string& name = (*it)->name;
+        outArgs.setString(("OfxImageClipPropComponents_" + name).c_str(), (*it)->props.getString(kOfxImageEffectPropComponents));
+        outArgs.setString(("OfxImageClipPropDepth_" + name).c_str(), (*it)->props.getString(kOfxImageEffectPropPixelDepth));
+        outArgs.setDouble(("OfxImageClipPropPAR_" + name).c_str(), 1.);
+    }
+    outArgs.setDouble(kOfxImageEffectPropFrameRate, 24.);
+    outArgs.setString(kOfxImageClipPropFieldOrder, kOfxImageFieldNone);
+    outArgs.setString(kOfxImageEffectPropPreMultiplication, inst->clipsByName[kOfxImageEffectOutputClipName]->props.getString(kOfxImageEffectPropPreMultiplication));
+    outArgs.setInt(kOfxImageClipPropContinuousSamples, 0);
+    outArgs.setInt(kOfxImageEffectFrameVarying, 0);
+
+    OfxStatus st = plugin->mainEntry(kOfxImageEffectActionGetClipPreferences, inst, NULL, toHandle(&outArgs));
+    if (failed(st)) {
+        return st;
+    }
+    for (std::vector<Clip*>::iterator it = inst->clips.begin(); it != inst->clips.end(); ++it) {
+        const std::string& name = (*it)->name;
+        PropertySet& cp = (*it)->props;
+        cp.setString(kOfxImageEffectPropComponents, outArgs.getString(("OfxImageClipPropComponents_" + name).c_str(), 0, cp.getString(kOfxImageEffectPropComponents)));
+        cp.setString(kOfxImageEffectPropPixelDepth, outArgs.getString(("OfxImageClipPropDepth_" + name).c_str(), 0, cp.getString(kOfxImageEffectPropPixelDepth)));
+    }
+    Clip* output = inst->clipsByName[kOfxImageEffectOutputClipName];
+    output->props.setString(kOfxImageEffectPropPreMultiplication, outArgs.getString(kOfxImageEffectPropPreMultiplication, 0, output->props.getString(kOfxImageEffectPropPreMultiplication)));
+    return kOfxStatOK;
+}
+
+static OfxStatus
+renderOnce(OfxPlugin* plugin, Effect* inst, double time, bool* identity)
+{
+    const int window[4] = { 0, 0, inst->width, inst->height };
+    PropertySet inArgs;
+    inArgs.setDouble(kOfxPropTime, time);
+    inArgs.setString(kOfxImageEffectPropFieldToRender, kOfxImageFieldNone);
+    inArgs.setDouble(kOfxImageEffectPropRenderScale, 1., 0);
+    inArgs.setDouble(kOfxImageEffectPropRenderScale, 1., 1);
+    for (int k = 0; k < 4; ++k) {
+        inArgs.setInt(kOfxImageEffectPropRenderWindow, window[k], k);
+    }
+    inArgs.setInt(kOfxImageEffectPropSequentialRenderStatus, 1);
+    inArgs.setInt(kOfxImageEffectPropInteractiveRenderStatus, 0);
+
+    if (identity) {
+        PropertySet outArgs;
+        outArgs.setString(kOfxPropName, "");
+        outArgs.setDouble(kOfxPropTime, time);
+        OfxStatus st = plugin->mainEntry(kOfxImageEffectActionIsIdentity, inst, toHandle(&inArgs), toHandle(&outArgs));
+        *identity = (st == kOfxStatOK) && !outArgs.getString(kOfxPropName).empty();
+    }
+    return plugin->mainEntry(kOfxImageEffectActionRender, inst, toHandle(&inArgs), NULL);
+}
+
+static void
+benchConfig(OfxPlugin* plugin, const Effect& ctxDesc, const std::string& context, const BenchOptions& opts, BenchResult* res)
+{
+    const BenchConfig& cfg = res->config;
+    Effect instance;
+    initInstance(ctxDesc, context, cfg, &instance);
+    Effect* inst = &instance;
+    OfxStatus st = plugin->mainEntry(kOfxActionCreateInstance, inst, NULL, NULL);
+    if (failed(st)) {
+        res->status = statusString(kOfxActionCreateInstance, st);
+        return;
+    }
+    std::vector<Buffer*> buffers;
+    st = applyClipPreferences(plugin, inst);
+    if (failed(st)) {
+        res->status = statusString(kOfxImageEffectActionGetClipPreferences, st);
+    } else {
+        // allocate the images: synthetic content for inputs, uninitialized output
+        for (std::vector<Clip*>::iterator it = inst->clips.begin(); it != inst->clips.end(); ++it) {
+            Clip* c = *it;
+            if (!c->connected) {
+                continue;
+            }
+            const bool isOutput = (c->name == kOfxImageEffectOutputClipName);
+            c->buffer = createBuffer(cfg.size.width, cfg.size.height,
+                                     c->props.getString(kOfxImageEffectPropPixelDepth),
+                                     c->props.getString(kOfxImageEffectPropComponents),
+                                     !isOutput);
+            buffers.push_back(c->buffer);
+        }
+
+        PropertySet seqArgs;
+        seqArgs.setDouble(kOfxImageEffectPropFrameRange, kBenchFrameFirst, 0);
+        seqArgs.setDouble(kOfxImageEffectPropFrameRange, kBenchFrameFirst + opts.warmup + opts.iterations, 1);
+        seqArgs.setDouble(kOfxImageEffectPropFrameStep, 1.);
+        seqArgs.setInt(kOfxPropIsInteractive, 0);
+        seqArgs.setDouble(kOfxImageEffectPropRenderScale, 1., 0);
+        seqArgs.setDouble(kOfxImageEffectPropRenderScale, 1., 1);
+        plugin->mainEntry(kOfxImageEffectActionBeginSequenceRender, inst, toHandle(&seqArgs), NULL);
+
+        double time = kBenchFrameFirst;
+        for (int i = 0; i < opts.warmup && !failed(st); ++i, time += 1.) {
+            st = renderOnce(plugin, inst, time, i == 0 ? &res->identity : 0);
+        }
+        double total = 0.;
+        res->timeMin = 0.;
+        res->timeMax = 0.;
+        for (int i = 0; i < opts.iterations && !failed(st); ++i, time += 1.) {
+            const double t0 = now();
+            st = renderOnce(plugin, inst, time, (opts.warmup == 0 && i == 0) ? &res->identity : 0);
+            const double t = now() - t0;
+            if (!failed(st)) {
+                total += t;
+                res->timeMin = (i == 0) ? t : std::min(res->timeMin, t);
+                res->timeMax = std::max(res->timeMax, t);
+                ++res->iterations;
+            }
+        }
+        plugin->mainEntry(kOfxImageEffectActionEndSequenceRender, inst, toHandle(&seqArgs), NULL);
+        if (failed(st)) {
+            res->status = statusString(kOfxImageEffectActionRender, st);
+            res->iterations = 0;
+        } else {
+            res->status = "ok";
+            res->timeMean = res->iterations ? total / res->iterations : 0.;
+        }
+    }
+    plugin->mainEntry(kOfxActionDestroyInstance, inst, NULL, NULL);
+    for (std::vector<Buffer*>::iterator it = buffers.begin(); it != buffers.end(); ++it) {
+        delete *it;
+    }
+}
+
+static bool
+pluginSelected(const std::string& id, const BenchOptions& opts)
+{
+    if (opts.filters.empty()) {
+        return true;
+    }
+    for (std::vector<std::string>::const_iterator it = opts.filters.begin(); it != opts.filters.end(); ++it) {
+        if (id.find(*it) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+benchPlugin(OfxPlugin* plugin, const BenchOptions& opts, std::vector<BenchResult>* results)
+{
+    BenchResult proto;
+    proto.pluginId = plugin->pluginIdentifier;
+    proto.versionMajor = plugin->pluginVersionMajor;
+    proto.versionMinor = plugin->pluginVersionMinor;
+    std::cerr << "OFX Bench: " << proto.pluginId << std::endl;
+
+    plugin->setHost(&gHost);
+    OfxStatus st = plugin->mainEntry(kOfxActionLoad, NULL, NULL, NULL);
+    if (failed(st)) {
+        proto.status = statusString(kOfxActionLoad, st);
+        results->push_back(proto);
+        return;
+    }
+    Effect desc;
+    desc.props.setString(kOfxPropType, kOfxTypeImageEffect);
+    st = plugin->mainEntry(kOfxActionDescribe, &desc, NULL, NULL);
+    if (failed(st)) {
+        proto.status = statusString(kOfxActionDescribe, st);
+        results->push_back(proto);
+        plugin->mainEntry(kOfxActionUnload, NULL, NULL, NULL);
+        return;
+    }
+
+    // pick the first context supported by both the plugin and this host
+    const char* contexts[] = { kOfxImageEffectContextFilter, kOfxImageEffectContextGeneral, kOfxImageEffectContextGenerator, 0 };
+    Property* supported = desc.props.find(kOfxImageEffectPropSupportedContexts);
+    for (int i = 0; contexts[i] && proto.context.empty(); ++i) {
+        if (supported && std::find(supported->s.begin(), supported->s.end(), contexts[i]) != supported->s.end()) {
+            proto.context = contexts[i];
+        }
+    }
+    if (proto.context.empty()) {
+        proto.status = "unsupported: no supported context";
+        results->push_back(proto);
+        plugin->mainEntry(kOfxActionUnload, NULL, NULL, NULL);
+        return;
+    }
+
+    Effect ctxDesc;
+    copyProps(&ctxDesc.props, desc.props);
+    PropertySet inArgs;
+    inArgs.setString(kOfxImageEffectPropContext, proto.context);
+    st = plugin->mainEntry(kOfxImageEffectActionDescribeInContext, &ctxDesc, toHandle(&inArgs), NULL);
+    if (failed(st)) {
+        proto.status = statusString(kOfxImageEffectActionDescribeInContext, st);
+        results->push_back(proto);
+        plugin->mainEntry(kOfxActionUnload, NULL, NULL, NULL);
+        return;
+    }
+
+    for (std::vector<BenchSize>::const_iterator s = opts.sizes.begin(); s != opts.sizes.end(); ++s) {
+        for (std::vector<std::string>::const_iterator d = opts.depths.begin(); d != opts.depths.end(); ++d) {
+            for (std::vector<std::string>::const_iterator c = opts.components.begin(); c != opts.components.end(); ++c) {
+                BenchResult res = proto;
+                res.config.size = *s;
+                res.config.depth = *d;
+                res.config.components = *c;
+                std::map<std::string, Clip*>::const_iterator output = ctxDesc.clipsByName.find(kOfxImageEffectOutputClipName);
+                if (!ctxDesc.props.containsOrMissing(kOfxImageEffectPropSupportedPixelDepths, *d)) {
+                    res.status = "unsupported: pixel depth";
+                } else if (output == ctxDesc.clipsByName.end()) {
+                    res.status = "error: no output clip";
+                } else if (!output->second->props.containsOrMissing(kOfxImageEffectPropSupportedComponents, *c)) {
+                    res.status = "unsupported: components";
+                } else {
+                    benchConfig(plugin, ctxDesc, proto.context, opts, &res);
+                }
+                results->push_back(res);
+            }
+        }
+    }
+    plugin->mainEntry(kOfxActionUnload, NULL, NULL, NULL);
+}
+
+// locate the binary inside a bundle, or return the path unchanged
+static std::string
+binaryPath(const std::string& path)
+{
+    const std::string suffix = ".bundle";
+    std::string p = path;
+    while (!p.empty() && p[p.size() - 1] == '/') {
+        p.erase(p.size() - 1);
+    }
+    if (p.size() <= suffix.size() || p.compare(p.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return path;
+    }
+    std::string name = p.substr(0, p.size() - suffix.size());
+    std::string::size_type slash = name.rfind('/');
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+#if defined(__APPLE__)
+    const char* arch = "MacOS";
+#elif defined(__linux__)
+#  if defined(__x86_64__) || defined(__LP64__)
+    const char* arch = "Linux-x86-64";
+#  else
+    const char* arch = "Linux-x86";
+#  endif
+#elif defined(__FreeBSD__)
+#  if defined(__x86_64__) || defined(__LP64__)
+    const char* arch = "FreeBSD-x86-64";
+#  else
+    const char* arch = "FreeBSD-x86";
+#  endif
+#else
+#  error Not building on your operating system quite yet
+#endif
+    return p + "/Contents/" + arch + "/" + name;
+}
+
+static void
+benchBinary(const std::string& path, const BenchOptions& opts, std::vector<BenchResult>* results)
+{
+    const std::string binPath = binaryPath(path);
+    OFX::Binary binary(binPath);
+    binary.load();
+    if (binary.isInvalid()) {
+        std::cerr << "OFX Bench: Error: cannot load " << binPath << std::endl;
+        return;
+    }
+    int (*getNumberOfPlugins)(void) = (int(*)()) binary.findSymbol("OfxGetNumberOfPlugins");
+    OfxPlugin* (*getPlugin)(int) = (OfxPlugin*(*)(int)) binary.findSymbol("OfxGetPlugin");
+    if (!getNumberOfPlugins || !getPlugin) {
+        std::cerr << "OFX Bench: Error: " << binPath << " is not an OFX plugin" << std::endl;
+        binary.unload();
+        return;
+    }
+    const int n = getNumberOfPlugins();
+    for (int i = 0; i < n; ++i) {
+        OfxPlugin* plugin = getPlugin(i);
+        if (!plugin || std::strcmp(plugin->pluginApi, kOfxImageEffectPluginApi) != 0) {
+            continue;
+        }
+        if (!pluginSelected(plugin->pluginIdentifier, opts)) {
+            continue;
+        }
+        benchPlugin(plugin, opts, results);
+    }
+    binary.unload();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// command-line
+
+static std::vector<std::string>
+split(const std::string& s)
+{
+    std::vector<std::string> r;
+    std::string::size_type start = 0;
+    while (start <= s.size()) {
+        std::string::size_type end = s.find(',', start);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            r.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return r;
+}
+
+static bool
+parseSize(const std::string& s, BenchSize* size)
+{
+    static const struct { const char* name; int w; int h; } presets[] = {
+        { "720p", 1280, 720 },
+        { "1080p", 1920, 1080 },
+        { "hd", 1920, 1080 },
+        { "2k", 2048, 1080 },
+        { "uhd", 3840, 2160 },
+        { "4k", 4096, 2160 },
+        { "8k", 8192, 4320 },
+        { 0, 0, 0 }
+    };
+    for (int i = 0; presets[i].name; ++i) {
+        if (s == presets[i].name) {
+            size->name = s;
+            size->width = presets[i].w;
+            size->height = presets[i].h;
+            return true;
+        }
+    }
+    int w = 0, h = 0;
+    if (std::sscanf(s.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+        size->name = s;
+        size->width = w;
+        size->height = h;
+        return true;
+    }
+    return false;
+}
+
+static void
+usage(const char* argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [options] plugin.ofx.bundle|plugin.ofx ...\n"
+    "Options:\n"
+    "  -s, --sizes LIST       comma-separated sizes: 720p,1080p,2k,uhd,4k,8k or WxH (default: 1080p)\n"
+    "  -d, --depths LIST      comma-separated depths: byte,short,float (default: float)\n"
+    "  -c, --components LIST  comma-separated components: rgba,rgb,alpha (default: rgba)\n"
+    "  -n, --iterations N     number of timed renders per configuration (default: 3)\n"
+    "  -w, --warmup N         number of untimed renders per configuration (default: 1)\n"
+    "  -t, --threads N        number of threads (default: number of CPUs)\n"
+    "  -p, --plugin STRING    only benchmark plugins whose identifier contains STRING\n"
+    "  -o, --output FILE      write the JSON report to FILE instead of stdout\n";
+}
+
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+    BenchOptions opts;
+    std::vector<std::string> binaries;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    gNThreads = ncpus > 0 ? (unsigned int)ncpus : 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = (i + 1 < argc);
+        if ((arg == "-s" || arg == "--sizes") && hasValue) {
+            std::vector<std::string> l = split(argv[++i]);
+            for (size_t k = 0; k < l.size(); ++k) {
+                BenchSize size;
+                if (!parseSize(l[k], &size)) {
+                    std::cerr << "OFX Bench: Error: invalid size " << l[k] << std::endl;
+                    return 1;
+                }
+                opts.sizes.push_back(size);
+            }
+        } else if ((arg == "-d" || arg == "--depths") && hasValue) {
+            std::vector<std::string> l = split(argv[++i]);
+            for (size_t k = 0; k < l.size(); ++k) {
+                if (l[k] == "byte") {
+                    opts.depths.push_back(kOfxBitDepthByte);
+                } else if (l[k] == "short") {
+                    opts.depths.push_back(kOfxBitDepthShort);
+                } else if (l[k] == "float") {
+                    opts.depths.push_back(kOfxBitDepthFloat);
+                } else {
+                    std::cerr << "OFX Bench: Error: invalid depth " << l[k] << std::endl;
+                    return 1;
+                }
+            }
+        } else if ((arg == "-c" || arg == "--components") && hasValue) {
+            std::vector<std::string> l = split(argv[++i]);
+            for (size_t k = 0; k < l.size(); ++k) {
+                if (l[k] == "rgba") {
+                    opts.components.push_back(kOfxImageComponentRGBA);
+                } else if (l[k] == "rgb") {
+                    opts.components.push_back(kOfxImageComponentRGB);
+                } else if (l[k] == "alpha") {
+                    opts.components.push_back(kOfxImageComponentAlpha);
+                } else {
+                    std::cerr << "OFX Bench: Error: invalid components " << l[k] << std::endl;
+                    return 1;
+                }
+            }
+        } else if ((arg == "-n" || arg == "--iterations") && hasValue) {
+            opts.iterations = std::max(1, std::atoi(argv[++i]));
+        } else if ((arg == "-w" || arg == "--warmup") && hasValue) {
+            opts.warmup = std::max(0, std::atoi(argv[++i]));
+        } else if ((arg == "-t" || arg == "--threads") && hasValue) {
+            gNThreads = (unsigned int)std::max(1, std::atoi(argv[++i]));
+        } else if ((arg == "-p" || arg == "--plugin") && hasValue) {
+            opts.filters.push_back(argv[++i]);
+        } else if ((arg == "-o" || arg == "--output") && hasValue) {
+            opts.output = argv[++i];
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            binaries.push_back(arg);
+        }
+    }
+    if (binaries.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.sizes.empty()) {
+        BenchSize size;
+        parseSize("1080p", &size);
+        opts.sizes.push_back(size);
+    }
+    if (opts.depths.empty()) {
+        opts.depths.push_back(kOfxBitDepthFloat);
+    }
+    if (opts.components.empty()) {
+        opts.components.push_back(kOfxImageComponentRGBA);
+    }
+
+    initHost();
+
+    std::vector<BenchResult> results;
+    for (std::vector<std::string>::const_iterator it = binaries.begin(); it != binaries.end(); ++it) {
+        benchBinary(*it, opts, &results);
+    }
+
+    if (opts.output.empty()) {
+        writeReport(std::cout, results);
+    } else {
+        std::ofstream ofs(opts.output.c_str());
+        if (!ofs) {
+            std::cerr << "OFX Bench: Error: cannot write " << opts.output << std::endl;
+            return 1;
+        }
+        writeReport(ofs, results);
+    }
+    return 0;
+}
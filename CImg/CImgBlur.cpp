@@ -76,6 +76,8 @@
 #include <cmath>
 #include <cstring>
 #include <climits>
+#include <vector>
+#include <algorithm>
 #ifdef _WINDOWS
 #include <windows.h>
 #endif
@@ -179,182 +181,277 @@ enum FilterEnum
 typedef float T;
 using namespace cimg_library;
 
-#if cimg_version < 160
-// [internal] Apply a recursive filter (used by CImg<T>::vanvliet()).
+// The recursive (IIR) filters below process kBlurLinesPerBlock adjacent lines at once: the innermost loops run
+// across lines, which are contiguous in memory for the 'y' axis, so that they can be vectorized.
+// The blocks of lines are distributed between threads.
+#define kBlurLinesPerBlock 8
+
+// coefficients of the Van Vliet or Deriche recursive filter along one axis
+struct RecursiveFilter
+{
+    bool vanvliet; //!< Van Vliet (Gaussian) or Deriche (quasi-Gaussian) filter
+    int order; //!< the order of the filter 0 (smoothing), 1st derivative, 2nd derivative
+    bool boundary_conditions; //!< Boundary conditions. Can be <tt>{ 0=dirichlet | 1=neumann }</tt>.
+    double filter[4]; //!< Van Vliet: the coefficients of the filter in the following order [n,n-1,n-2,n-3]
+    double M[9]; //!< Van Vliet: Triggs matrix
+    float a0, a1, a2, a3, b1, b2, coefp, coefn; //!< Deriche coefficients
+};
+
+// [internal] Apply the Van Vliet recursive filter to nLines lines (used by vanvliet()).
 /**
- \param ptr the pointer of the data
- \param filter the coefficient of the filter in the following order [n,n-1,n-2,n-3].
- \param N size of the data
- \param off the offset between two data point
- \param order the order of the filter 0 (smoothing), 1st derivtive, 2nd derivative, 3rd derivative
- \param boundary_conditions Boundary conditions. Can be <tt>{ 0=dirichlet | 1=neumann }</tt>.
+ \param data the pointer to the first value of the first line
+ \param N size of the lines
+ \param off the offset between two data points of a line
+ \param lineOff the offset between two lines
+ \param nLines the number of lines (at most kBlurLinesPerBlock)
  \note dirichlet boundary conditions have a strange behavior. And
  boundary condition should be corrected using Bill Triggs method (IEEE trans on Sig Proc 2005).
  **/
-template <int K>
-static void _cimg_recursive_apply(T *data, const double filter[], const int N, const unsigned long off,
-                                  const int order, const bool boundary_conditions) {
-    double val[K];  // res[n,n-1,n-2,n-3,..] or res[n,n+1,n+2,n+3,..]
+static void
+_vanvliet_apply_lines(T *data, const RecursiveFilter& rf, const int N, const size_t off, const size_t lineOff, const int nLines)
+{
+    assert(nLines <= kBlurLinesPerBlock);
+    const bool boundary_conditions = rf.boundary_conditions;
+    const double *filter = rf.filter;
+    const double *M = rf.M;
     const double
     sumsq = filter[0],
     sum = sumsq * sumsq,
-    b1 = filter[1], b2 = filter[2], b3 = filter[3],
-    a3 = b3,
-    a2 = b2,
-    a1 = b1,
-    scaleM = 1.0 / ( (1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3) );
-    double M[9]; // Triggs matrix (for K == 4)
-    if (K == 4) {
-        M[0] = scaleM * (-a3 * a1 + 1.0 - a3 * a3 - a2);
-        M[1] = scaleM * (a3 + a1) * (a2 + a3 * a1);
-        M[2] = scaleM * a3 * (a1 + a3 * a2);
-        M[3] = scaleM * (a1 + a3 * a2);
-        M[4] = -scaleM * (a2 - 1.0) * (a2 + a3 * a1);
-        M[5] = -scaleM * a3 * (a3 * a1 + a3 * a3 + a2 - 1.0);
-        M[6] = scaleM * (a3 * a1 + a2 + a1 * a1 - a2 * a2);
-        M[7] = scaleM * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3);
-        M[8] = scaleM * a3 * (a1 + a3 * a2);
-    }
-    switch (order) {
-        case 0 : {
-            const double iplus = (boundary_conditions?data[(N-1)*off]:0);
-            for (int pass = 0; pass<2; ++pass) {
-                if (!pass || K != 4) {
-                    for (int k = 1; k<K; ++k) val[k] = (boundary_conditions?*data/sumsq:0);
-                } else {
-                    /* apply Triggs border condition */
-                    const double
-                    uplus = iplus / (1.0 - a1 - a2 - a3),
-                    vplus = uplus / (1.0 - b1 - b2 - b3),
-                    p1 = val[1],
-                    p2 = val[2],
-                    p3 = val[3],
-                    unp = p1 - uplus,
-                    unp1 = p2 - uplus,
-                    unp2 = p3 - uplus;
-                    val[0] = (M[0] * unp + M[1] * unp1 + M[2] * unp2 + vplus) * sum;
-                    val[1] = (M[3] * unp + M[4] * unp1 + M[5] * unp2 + vplus) * sum;
-                    val[2] = (M[6] * unp + M[7] * unp1 + M[8] * unp2 + vplus) * sum;
-                    *data = (T)val[0];
-                    data-=off;
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                for (int n = (pass && K == 4); n<N; ++n) {
-                    val[0] = (*data);
-                    if (pass) val[0] *= sum;
-                    for (int k = 1; k<K; ++k) val[0]+=val[k]*filter[k];
-                    *data = (T)val[0];
-                    if (!pass) data+=off; else data-=off;
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                if (!pass) data-=off;
+    f1 = filter[1], f2 = filter[2], f3 = filter[3],
+    a1 = f1, a2 = f2, a3 = f3,
+    b1 = f1, b2 = f2, b3 = f3;
+    double val1[kBlurLinesPerBlock], val2[kBlurLinesPerBlock], val3[kBlurLinesPerBlock]; // res[n-1,n-2,n-3] or res[n+1,n+2,n+3]
+    T *p;
+
+    if (rf.order == 0) {
+        double iplus[kBlurLinesPerBlock];
+        p = data;
+        for (int l = 0; l < nLines; ++l) {
+            iplus[l] = boundary_conditions ? data[l*lineOff + (N-1)*off] : 0;
+            val1[l] = val2[l] = val3[l] = boundary_conditions ? p[l*lineOff]/sumsq : 0;
+        }
+        // causal pass
+        for (int n = 0; n < N; ++n, p += off) {
+            for (int l = 0; l < nLines; ++l) {
+                const double v = p[l*lineOff] + val1[l]*f1 + val2[l]*f2 + val3[l]*f3;
+                p[l*lineOff] = (T)v;
+                val3[l] = val2[l];
+                val2[l] = val1[l];
+                val1[l] = v;
             }
-        } break;
-        case 1 : {
-            double x[3]; // [front,center,back]
-            for (int pass = 0; pass<2; ++pass) {
-                if (!pass || K != 4) {
-                    for (int k = 0; k<3; ++k) x[k] = (boundary_conditions?*data:0);
-                    for (int k = 0; k<K; ++k) val[k] = 0;
-                } else {
-                    /* apply Triggs border condition */
-                    const double
-                    unp = val[1],
-                    unp1 = val[2],
-                    unp2 = val[3];
-                    val[0] = (M[0] * unp + M[1] * unp1 + M[2] * unp2) * sum;
-                    val[1] = (M[3] * unp + M[4] * unp1 + M[5] * unp2) * sum;
-                    val[2] = (M[6] * unp + M[7] * unp1 + M[8] * unp2) * sum;
-                    *data = (T)val[0];
-                    data-=off;
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                for (int n = (pass && K == 4); n<N-1; ++n) {
-                    if (!pass) {
-                        x[0] = *(data+off);
-                        val[0] = 0.5f * (x[0] - x[2]);
-                    } else val[0] = (*data)*sum;
-                    for (int k = 1; k<K; ++k) val[0]+=val[k]*filter[k];
-                    *data = (T)val[0];
-                    if (!pass) {
-                        data+=off;
-                        for (int k = 2; k>0; --k) x[k] = x[k-1];
-                    } else data-=off;
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                *data = (T)0;
+        }
+        // anticausal pass, starting with Triggs border condition
+        p = data + (N-1)*off;
+        for (int l = 0; l < nLines; ++l) {
+            const double
+            uplus = iplus[l] / (1.0 - a1 - a2 - a3),
+            vplus = uplus / (1.0 - b1 - b2 - b3),
+            unp = val1[l] - uplus,
+            unp1 = val2[l] - uplus,
+            unp2 = val3[l] - uplus;
+            const double v0 = (M[0] * unp + M[1] * unp1 + M[2] * unp2 + vplus) * sum;
+            const double v1 = (M[3] * unp + M[4] * unp1 + M[5] * unp2 + vplus) * sum;
+            const double v2 = (M[6] * unp + M[7] * unp1 + M[8] * unp2 + vplus) * sum;
+            p[l*lineOff] = (T)v0;
+            val1[l] = v0;
+            val2[l] = v1;
+            val3[l] = v2;
+        }
+        p -= off;
+        for (int n = 1; n < N; ++n, p -= off) {
+            for (int l = 0; l < nLines; ++l) {
+                const double v = p[l*lineOff]*sum + val1[l]*f1 + val2[l]*f2 + val3[l]*f3;
+                p[l*lineOff] = (T)v;
+                val3[l] = val2[l];
+                val2[l] = val1[l];
+                val1[l] = v;
             }
-        } break;
-        case 2: {
-            double x[3]; // [front,center,back]
-            for (int pass = 0; pass<2; ++pass) {
-                if (!pass || K != 4) {
-                    for (int k = 0; k<3; ++k) x[k] = (boundary_conditions?*data:0);
-                    for (int k = 0; k<K; ++k) val[k] = 0;
-                } else {
-                    /* apply Triggs border condition */
-                    const double
-                    unp = val[1],
-                    unp1 = val[2],
-                    unp2 = val[3];
-                    val[0] = (M[0] * unp + M[1] * unp1 + M[2] * unp2) * sum;
-                    val[1] = (M[3] * unp + M[4] * unp1 + M[5] * unp2) * sum;
-                    val[2] = (M[6] * unp + M[7] * unp1 + M[8] * unp2) * sum;
-                    *data = (T)val[0];
-                    data-=off;
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                for (int n = (pass && K == 4); n<N-1; ++n) {
-                    if (!pass) { x[0] = *(data+off); val[0] = (x[1] - x[2]); }
-                    else { x[0] = *(data-off); val[0] = (x[2] - x[1])*sum; }
-                    for (int k = 1; k<K; ++k) val[0]+=val[k]*filter[k];
-                    *data = (T)val[0];
-                    if (!pass) data+=off; else data-=off;
-                    for (int k = 2; k>0; --k) x[k] = x[k-1];
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                *data = (T)0;
+        }
+    } else {
+        assert(rf.order == 1 || rf.order == 2);
+        const bool first = (rf.order == 1);
+        double x1[kBlurLinesPerBlock], x2[kBlurLinesPerBlock]; // [center,back]
+        p = data;
+        for (int l = 0; l < nLines; ++l) {
+            x1[l] = x2[l] = boundary_conditions ? p[l*lineOff] : 0;
+            val1[l] = val2[l] = val3[l] = 0;
+        }
+        // causal pass
+        for (int n = 0; n < N-1; ++n, p += off) {
+            for (int l = 0; l < nLines; ++l) {
+                const double x0 = p[off + l*lineOff];
+                double v = first ? 0.5f * (x0 - x2[l]) : (x1[l] - x2[l]);
+                v = v + val1[l]*f1 + val2[l]*f2 + val3[l]*f3; // same summation order as the scalar filter
+                p[l*lineOff] = (T)v;
+                x2[l] = x1[l];
+                x1[l] = x0;
+                val3[l] = val2[l];
+                val2[l] = val1[l];
+                val1[l] = v;
             }
-        } break;
-        case 3: {
-            double x[3]; // [front,center,back]
-            for (int pass = 0; pass<2; ++pass) {
-                if (!pass || K != 4) {
-                    for (int k = 0; k<3; ++k) x[k] = (boundary_conditions?*data:0);
-                    for (int k = 0; k<K; ++k) val[k] = 0;
+        }
+        for (int l = 0; l < nLines; ++l) {
+            p[l*lineOff] = (T)0;
+        }
+        // anticausal pass, starting with Triggs border condition
+        for (int l = 0; l < nLines; ++l) {
+            const double
+            unp = val1[l],
+            unp1 = val2[l],
+            unp2 = val3[l];
+            const double v0 = (M[0] * unp + M[1] * unp1 + M[2] * unp2) * sum;
+            const double v1 = (M[3] * unp + M[4] * unp1 + M[5] * unp2) * sum;
+            const double v2 = (M[6] * unp + M[7] * unp1 + M[8] * unp2) * sum;
+            p[l*lineOff] = (T)v0;
+            val1[l] = v0;
+            val2[l] = v1;
+            val3[l] = v2;
+        }
+        if (N < 2) {
+            return;
+        }
+        p -= off;
+        for (int n = 1; n < N-1; ++n, p -= off) {
+            for (int l = 0; l < nLines; ++l) {
+                double v;
+                if (first) {
+                    v = p[l*lineOff]*sum;
                 } else {
-                    /* apply Triggs border condition */
-                    const double
-                    unp = val[1],
-                    unp1 = val[2],
-                    unp2 = val[3];
-                    val[0] = (M[0] * unp + M[1] * unp1 + M[2] * unp2) * sum;
-                    val[1] = (M[3] * unp + M[4] * unp1 + M[5] * unp2) * sum;
-                    val[2] = (M[6] * unp + M[7] * unp1 + M[8] * unp2) * sum;
-                    *data = (T)val[0];
-                    data-=off;
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
+                    // the first values of x1 and x2 are those left by the causal pass
+                    const double x0 = p[l*lineOff - off];
+                    v = (x2[l] - x1[l])*sum;
+                    x2[l] = x1[l];
+                    x1[l] = x0;
                 }
-                for (int n = (pass && K == 4); n<N-1; ++n) {
-                    if (!pass) { x[0] = *(data+off); val[0] = (x[0] - 2*x[1] + x[2]); }
-                    else { x[0] = *(data-off); val[0] = 0.5f*(x[2] - x[0])*sum; }
-                    for (int k = 1; k<K; ++k) val[0]+=val[k]*filter[k];
-                    *data = (T)val[0];
-                    if (!pass) data+=off; else data-=off;
-                    for (int k = 2; k>0; --k) x[k] = x[k-1];
-                    for (int k = K-1; k>0; --k) val[k] = val[k-1];
-                }
-                *data = (T)0;
+                v = v + val1[l]*f1 + val2[l]*f2 + val3[l]*f3;
+                p[l*lineOff] = (T)v;
+                val3[l] = val2[l];
+                val2[l] = val1[l];
+                val1[l] = v;
             }
-        } break;
+        }
+        for (int l = 0; l < nLines; ++l) {
+            p[l*lineOff] = (T)0;
+        }
     }
 }
 
+// [internal] Apply the Deriche recursive filter to nLines lines (used by deriche()).
+/**
+ \param data the pointer to the first value of the first line
+ \param N size of the lines
+ \param off the offset between two data points of a line
+ \param lineOff the offset between two lines
+ \param nLines the number of lines (at most kBlurLinesPerBlock)
+ \param Y a buffer of N*kBlurLinesPerBlock values, which holds the result of the causal pass
+ **/
+static void
+_deriche_apply_lines(T *data, const RecursiveFilter& rf, const int N, const size_t off, const size_t lineOff, const int nLines, T *Y)
+{
+    assert(nLines <= kBlurLinesPerBlock);
+    const bool boundary_conditions = rf.boundary_conditions;
+    const float a0 = rf.a0, a1 = rf.a1, a2 = rf.a2, a3 = rf.a3, b1 = rf.b1, b2 = rf.b2;
+    T x1[kBlurLinesPerBlock], x2[kBlurLinesPerBlock]; // causal: [xp,unused], anticausal: [xn,xa]
+    T y1[kBlurLinesPerBlock], y2[kBlurLinesPerBlock]; // causal: [yp,yb], anticausal: [yn,ya]
+
+    // causal pass
+    T *p = data;
+    T *ptrY = Y;
+    for (int l = 0; l < nLines; ++l) {
+        x1[l] = boundary_conditions ? p[l*lineOff] : (T)0;
+        y1[l] = y2[l] = boundary_conditions ? (T)(rf.coefp*x1[l]) : (T)0;
+    }
+    for (int m = 0; m < N; ++m, p += off, ptrY += kBlurLinesPerBlock) {
+        for (int l = 0; l < nLines; ++l) {
+            const T xc = p[l*lineOff];
+            const T yc = ptrY[l] = (T)(a0*xc + a1*x1[l] - b1*y1[l] - b2*y2[l]);
+            x1[l] = xc;
+            y2[l] = y1[l];
+            y1[l] = yc;
+        }
+    }
+    // anticausal pass
+    p -= off;
+    ptrY -= kBlurLinesPerBlock;
+    for (int l = 0; l < nLines; ++l) {
+        x1[l] = x2[l] = boundary_conditions ? p[l*lineOff] : (T)0;
+        y1[l] = y2[l] = boundary_conditions ? (T)(rf.coefn*x1[l]) : (T)0;
+    }
+    for (int n = N - 1; n >= 0; --n, p -= off, ptrY -= kBlurLinesPerBlock) {
+        for (int l = 0; l < nLines; ++l) {
+            const T xc = p[l*lineOff];
+            const T yc = (T)(a2*x1[l] + a3*x2[l] - b1*y1[l] - b2*y2[l]);
+            x2[l] = x1[l];
+            x1[l] = xc;
+            y2[l] = y1[l];
+            y1[l] = yc;
+            p[l*lineOff] = (T)(ptrY[l] + yc);
+        }
+    }
+}
+
+// applies a recursive filter along the x or y axis, by blocks of adjacent lines distributed between threads
+class RecursiveFilterProcessor : public OFX::MultiThread::Processor
+{
+public:
+    RecursiveFilterProcessor(CImg<T>& img, const RecursiveFilter& rf, const char axis)
+    : _img(img)
+    , _rf(rf)
+    , _N(axis == 'x' ? img._width : img._height)
+    , _off(axis == 'x' ? 1 : img._width)
+    , _lineOff(axis == 'x' ? img._width : 1)
+    , _linesPerPlane(axis == 'x' ? img._height : img._width)
+    , _blocksPerPlane( (_linesPerPlane + kBlurLinesPerBlock - 1) / kBlurLinesPerBlock )
+    , _nBlocks(_blocksPerPlane * img._depth * img._spectrum)
+    {
+        assert(axis == 'x' || axis == 'y');
+    }
+
+    void process()
+    {
+        const unsigned int nThreads = std::max(1U, std::min(OFX::MultiThread::getNumCPUs(), _nBlocks));
+        if (!_rf.vanvliet) {
+            // the buffers for the causal pass are allocated here, since the threads must not throw
+            _Y.resize( (size_t)nThreads * _N * kBlurLinesPerBlock );
+        }
+        multiThread(nThreads);
+    }
+
+private:
+    virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads) OVERRIDE FINAL
+    {
+        const unsigned int bBegin = (unsigned int)( (size_t)_nBlocks * threadId / nThreads );
+        const unsigned int bEnd = (unsigned int)( (size_t)_nBlocks * (threadId + 1) / nThreads );
+        T *Y = _rf.vanvliet ? 0 : &_Y[(size_t)threadId * _N * kBlurLinesPerBlock];
+        for (unsigned int b = bBegin; b < bEnd; ++b) {
+            const unsigned int plane = b / _blocksPerPlane;
+            const unsigned int first = (b % _blocksPerPlane) * kBlurLinesPerBlock;
+            const int nLines = (int)std::min(_linesPerPlane - first, (unsigned int)kBlurLinesPerBlock);
+            T *data = _img._data + (size_t)plane * _img._width * _img._height + first * _lineOff;
+            if (_rf.vanvliet) {
+                _vanvliet_apply_lines(data, _rf, _N, _off, _lineOff, nLines);
+            } else {
+                _deriche_apply_lines(data, _rf, _N, _off, _lineOff, nLines, Y);
+            }
+        }
+    }
+
+    CImg<T>& _img;
+    const RecursiveFilter& _rf;
+    const int _N;
+    const size_t _off;
+    const size_t _lineOff;
+    const unsigned int _linesPerPlane;
+    const unsigned int _blocksPerPlane;
+    const unsigned int _nBlocks;
+    std::vector<T> _Y;
+};
+
 //! Van Vliet recursive Gaussian filter.
 /**
  \param sigma standard deviation of the Gaussian filter
- \param order the order of the filter 0,1,2,3
- \param axis  Axis along which the filter is computed. Can be <tt>{ 'x' | 'y' | 'z' | 'c' }</tt>.
+ \param order the order of the filter 0,1,2
+ \param axis  Axis along which the filter is computed. Can be <tt>{ 'x' | 'y' }</tt>.
  \param boundary_conditions Boundary conditions. Can be <tt>{ 0=dirichlet | 1=neumann }</tt>.
  \note dirichlet boundary condition has a strange behavior
 
@@ -367,17 +464,20 @@ static void _cimg_recursive_apply(T *data, const double filter[], const int N, c
  B. Triggs and M. Sdika. Boundary conditions for Young-van Vliet
  recursive filtering. IEEE Trans. Signal Processing,
  vol. 54, pp. 2365-2367, 2006.
+
+ The VanVliet filter was inexistent before CImg 1.53, and buggy before CImg.h from
+ 57ffb8393314e5102c00e5f9f8fa3dcace179608 Thu Dec 11 10:57:13 2014 +0100: this is the fixed version, multi-threaded.
  **/
-void
+static void
 vanvliet(CImg<T>& img, const float sigma, const int order, const char axis='x', const bool boundary_conditions=true)
 {
-    if (img.is_empty()) return/* *this*/;
-    const unsigned int _width = img._width, _height = img._height, _depth = img._depth, _spectrum = img._spectrum;
-    const char naxis = cimg::uncase(axis);
-    const float nsigma = sigma>=0?sigma:-sigma*(naxis=='x'?_width:naxis=='y'?_height:naxis=='z'?_depth:_spectrum)/100;
-    if (img.is_empty() || (nsigma<0.1f && !order)) return/* *this*/;
+    if (img.is_empty() || (sigma<0.1f && !order)) return/* *this*/;
+    RecursiveFilter rf;
+    rf.vanvliet = true;
+    rf.order = order;
+    rf.boundary_conditions = boundary_conditions;
     const double
-    nnsigma = nsigma<0.1f?0.1f:nsigma,
+    nnsigma = sigma<0.1f?0.1f:sigma,
     m0 = 1.16680, m1 = 1.10783, m2 = 1.40586,
     m1sq = m1 * m1, m2sq = m2 * m2,
     q = (nnsigma<3.556?-0.2568+0.5784*nnsigma+0.0561*nnsigma*nnsigma:2.5091+0.9804*(nnsigma-3.556)),
@@ -387,43 +487,78 @@ vanvliet(CImg<T>& img, const float sigma, const int order, const char axis='x',
     b2 = qsq * (m0 + 2 * m1 + 3 * q) / scale,
     b3 = -qsq * q / scale,
     B = ( m0 * (m1sq + m2sq) ) / scale;
-    double filter[4];
-    filter[0] = B; filter[1] = -b1; filter[2] = -b2; filter[3] = -b3;
-    switch (naxis) {
-        case 'x' : {
-#ifdef cimg_use_openmp
-#pragma omp parallel for collapse(3) if (_width>=256 && _height*_depth*_spectrum>=16)
-#endif
-            cimg_forYZC(img,y,z,c)
-            _cimg_recursive_apply<4>(img.data(0,y,z,c),filter,img._width,1U,order,boundary_conditions);
+    rf.filter[0] = B; rf.filter[1] = -b1; rf.filter[2] = -b2; rf.filter[3] = -b3;
+    const double
+    a1 = rf.filter[1], a2 = rf.filter[2], a3 = rf.filter[3],
+    scaleM = 1.0 / ( (1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3) );
+    rf.M[0] = scaleM * (-a3 * a1 + 1.0 - a3 * a3 - a2);
+    rf.M[1] = scaleM * (a3 + a1) * (a2 + a3 * a1);
+    rf.M[2] = scaleM * a3 * (a1 + a3 * a2);
+    rf.M[3] = scaleM * (a1 + a3 * a2);
+    rf.M[4] = -scaleM * (a2 - 1.0) * (a2 + a3 * a1);
+    rf.M[5] = -scaleM * a3 * (a3 * a1 + a3 * a3 + a2 - 1.0);
+    rf.M[6] = scaleM * (a3 * a1 + a2 + a1 * a1 - a2 * a2);
+    rf.M[7] = scaleM * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3);
+    rf.M[8] = scaleM * a3 * (a1 + a3 * a2);
+    RecursiveFilterProcessor processor(img, rf, cimg::uncase(axis));
+    processor.process();
+}
+
+//! Deriche recursive quasi-Gaussian filter (same as CImg<T>::deriche(), but multi-threaded).
+/**
+ \param sigma standard deviation of the filter
+ \param order the order of the filter 0,1,2
+ \param axis  Axis along which the filter is computed. Can be <tt>{ 'x' | 'y' }</tt>.
+ \param boundary_conditions Boundary conditions. Can be <tt>{ 0=dirichlet | 1=neumann }</tt>.
+ **/
+static void
+deriche(CImg<T>& img, const float sigma, const int order, const char axis='x', const bool boundary_conditions=true)
+{
+    if (img.is_empty() || (sigma<0.1f && !order)) return/* *this*/;
+    RecursiveFilter rf;
+    rf.vanvliet = false;
+    rf.order = order;
+    rf.boundary_conditions = boundary_conditions;
+    const float
+    nnsigma = sigma<0.1f?0.1f:sigma,
+    alpha = 1.695f/nnsigma,
+    ema = (float)std::exp(-alpha),
+    ema2 = (float)std::exp(-2*alpha);
+    rf.b1 = -2*ema;
+    rf.b2 = ema2;
+    switch (order) {
+        case 0 : {
+            const float k = (1-ema)*(1-ema)/(1 + 2*alpha*ema-ema2);
+            rf.a0 = k;
+            rf.a1 = k*(alpha - 1)*ema;
+            rf.a2 = k*(alpha + 1)*ema;
+            rf.a3 = -k*ema2;
         } break;
-        case 'y' : {
-#ifdef cimg_use_openmp
-#pragma omp parallel for collapse(3) if (_width>=256 && _height*_depth*_spectrum>=16)
-#endif
-            cimg_forXZC(img,x,z,c)
-            _cimg_recursive_apply<4>(img.data(x,0,z,c),filter,_height,(unsigned long)_width,order,boundary_conditions);
+        case 1 : {
+            const float k = -(1-ema)*(1-ema)*(1-ema)/(2*(ema + 1)*ema);
+            rf.a0 = rf.a3 = 0;
+            rf.a1 = k*ema;
+            rf.a2 = -rf.a1;
         } break;
-        case 'z' : {
-#ifdef cimg_use_openmp
-#pragma omp parallel for collapse(3) if (_width>=256 && _height*_depth*_spectrum>=16)
-#endif
-            cimg_forXYC(img,x,y,c)
-            _cimg_recursive_apply<4>(img.data(x,y,0,c),filter,_depth,(unsigned long)(_width*_height),
-                                     order,boundary_conditions);
+        case 2 : {
+            const float
+            ea = (float)std::exp(-alpha),
+            k = -(ema2 - 1)/(2*alpha*ema),
+            kn = (-2*(-1 + 3*ea - 3*ea*ea + ea*ea*ea)/(3*ea + 1 + 3*ea*ea + ea*ea*ea));
+            rf.a0 = kn;
+            rf.a1 = -kn*(1 + k*alpha)*ema;
+            rf.a2 = kn*(1 - k*alpha)*ema;
+            rf.a3 = -kn*ema2;
         } break;
-        default : {
-#ifdef cimg_use_openmp
-#pragma omp parallel for collapse(3) if (_width>=256 && _height*_depth*_spectrum>=16)
-#endif
-            cimg_forXYZ(img,x,y,z)
-            _cimg_recursive_apply<4>(img.data(x,y,z,0),filter,_spectrum,(unsigned long)(_width*_height*_depth),
-                                     order,boundary_conditions);
-        }
+        default :
+            assert(false);
+            return;
     }
-    return/* *this*/;
+    rf.coefp = (rf.a0 + rf.a1)/(1 + rf.b1 + rf.b2);
+    rf.coefn = (rf.a2 + rf.a3)/(1 + rf.b1 + rf.b2);
+    RecursiveFilterProcessor processor(img, rf, cimg::uncase(axis));
+    processor.process();
 }
-#endif // cimg_version < 160
 
 static inline
 T get_data(T *data, const int N, const unsigned long off, const bool boundary_conditions, const int x)
@@ -680,6 +815,12 @@ public:
         }
     }
 
+    // the box, triangle and quadratic filters have a bounded support, the Gaussian filters are recursive
+    virtual bool supportsStrips(const CImgBlurParams& params) OVERRIDE FINAL
+    {
+        return (params.filter == eFilterBox || params.filter == eFilterTriangle || params.filter == eFilterQuadratic);
+    }
+
     virtual void render(const OFX::RenderArguments &args, const CImgBlurParams& params, int /*x1*/, int /*y1*/, cimg_library::CImg<float>& cimg) OVERRIDE FINAL
     {
         // PROCESSING.
@@ -690,29 +831,14 @@ public:
             if (sigmax < 0.1 && sigmay < 0.1 && params.orderX == 0 && params.orderY == 0) {
                 return;
             }
-#if       cimg_version >= 160
-            //if (params.orderX == 0 && params.orderY == 0) {
-            //    cimg.blur(sigma, (bool)params.boundary_i, params.filter == eFilterGaussian);
-            //} else {
-            if (params.filter == eFilterGaussian) {
-                cimg.vanvliet(sigmax, params.orderX, 'x', (bool)params.boundary_i);
-                cimg.vanvliet(sigmay, params.orderY, 'y', (bool)params.boundary_i);
-            } else {
-                cimg.deriche(sigmax, params.orderX, 'x', (bool)params.boundary_i);
-                cimg.deriche(sigmay, params.orderY, 'y', (bool)params.boundary_i);
-            }
-            //}
-#         else
-            // VanVliet filter was inexistent before 1.53, and buggy before CImg.h from
-            // 57ffb8393314e5102c00e5f9f8fa3dcace179608 Thu Dec 11 10:57:13 2014 +0100
+            // multi-threaded versions of cimg.vanvliet() and cimg.deriche()
             if (params.filter == eFilterGaussian) {
-                vanvliet(cimg,/*cimg.vanvliet(*/sigmax, params.orderX, 'x', (bool)params.boundary_i);
-                vanvliet(cimg,/*cimg.vanvliet(*/sigmay, params.orderY, 'y', (bool)params.boundary_i);
+                vanvliet(cimg, sigmax, params.orderX, 'x', (bool)params.boundary_i);
+                vanvliet(cimg, sigmay, params.orderY, 'y', (bool)params.boundary_i);
             } else {
-                cimg.deriche(sigmax, params.orderX, 'x', (bool)params.boundary_i);
-                cimg.deriche(sigmay, params.orderY, 'y', (bool)params.boundary_i);
+                deriche(cimg, sigmax, params.orderX, 'x', (bool)params.boundary_i);
+                deriche(cimg, sigmay, params.orderY, 'y', (bool)params.boundary_i);
             }
-#         endif
         } else if (params.filter == eFilterBox || params.filter == eFilterTriangle || params.filter == eFilterQuadratic) {
             int iter = (params.filter == eFilterBox ? 1 :
                         (params.filter == eFilterTriangle ? 2 : 3));
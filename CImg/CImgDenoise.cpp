@@ -195,6 +195,8 @@ public:
         roi->y2 = rect.y2 + delta_pix;
     }
 
+    virtual bool supportsStrips(const CImgDenoiseParams& /*params*/) OVERRIDE FINAL { return true; }
+
     virtual void render(const OFX::RenderArguments &args, const CImgDenoiseParams& params, int /*x1*/, int /*y1*/, cimg_library::CImg<float>& cimg) OVERRIDE FINAL
     {
         // PROCESSING.
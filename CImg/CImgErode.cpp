@@ -156,6 +156,8 @@ public:
         roi->y2 = rect.y2 + delta_pix_y;
     }
 
+    virtual bool supportsStrips(const CImgErodeParams& /*params*/) OVERRIDE FINAL { return true; }
+
     virtual void render(const OFX::RenderArguments &args, const CImgErodeParams& params, int /*x1*/, int /*y1*/, cimg_library::CImg<float>& cimg) OVERRIDE FINAL
     {
         // PROCESSING.
@@ -242,7 +242,9 @@ public:
         // http://dx.doi.org/10.1109/ICPR.2004.1334273
         // compute blur(x^(P+1))/blur(x^P)
         {
-            cimg_library::CImg<float> denom(cimg, false);
+            CImgScratchBuffer denomData(_scratchPool, cimg.size() * sizeof(float));
+            cimg_library::CImg<float> denom(denomData.data(), cimg.width(), cimg.height(), cimg.depth(), cimg.spectrum(), true);
+            denom = cimg;
             const double vmin = std::pow((double)ERODESMOOTH_MIN, (double)1./params.exponent);
             //printf("%g\n",vmin);
 #ifdef cimg_use_openmp
@@ -15,9 +15,14 @@
 #include "ofxsPixelProcessor.h"
 #include "ofxsCopier.h"
 #include "ofxsMerging.h"
+#include "ofxsMaskMix.h"
+#include "ofxsMultiThread.h"
 
 #include <cassert>
 #include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 //#define CIMG_DEBUG
 
@@ -34,6 +39,8 @@ CLANG_DIAG_OFF(shorten-64-to-32)
 #include "CImg.h"
 CLANG_DIAG_ON(shorten-64-to-32)
 
+#include "CImgScratchPool.h"
+
 #define kParamProcessR      "r"
 #define kParamProcessRLabel "R"
 #define kParamProcessRHint  "Process red component"
@@ -47,6 +54,267 @@ CLANG_DIAG_ON(shorten-64-to-32)
 #define kParamProcessALabel "A"
 #define kParamProcessAHint  "Process alpha component"
 
+#define kCImgFilterStripMinHeight 32 // minimum number of rows of a strip processed by one thread, see supportsStrips()
+#define kCImgFilterStripsPerThread 4 // strips are processed by waves of one strip per thread, abort() is checked between waves
+
+/** @brief Base class for the processors that convert between OFX images (interleaved) and the CImg image (planar).
+ Rows of the render window are split between the threads, as in OFX::ImageProcessor. */
+class CImgPlanarProcessorBase : public OFX::MultiThread::Processor
+{
+public:
+    CImgPlanarProcessorBase(OFX::ImageEffect &effect,
+                            const OFX::Image *srcImg,
+                            int srcBoundary,
+                            bool premult,
+                            int premultChannel,
+                            cimg_library::CImg<float> &cimg,
+                            const OfxRectI &cimgBounds,
+                            const std::vector<int> &unpChannel)
+    : _effect(effect)
+    , _srcImg(srcImg)
+    , _srcBoundary(srcBoundary)
+    , _premult(premult)
+    , _premultChannel(premultChannel)
+    , _cimg(cimg)
+    , _cimgBounds(cimgBounds)
+    , _unpChannel(unpChannel)
+    {
+        _renderWindow.x1 = _renderWindow.y1 = _renderWindow.x2 = _renderWindow.y2 = 0;
+        if (_srcImg) {
+            _srcBounds = _srcImg->getBounds();
+        } else {
+            _srcBounds.x1 = _srcBounds.y1 = _srcBounds.x2 = _srcBounds.y2 = 0;
+        }
+        assert((int)_unpChannel.size() == _cimg.spectrum());
+    }
+
+    void setRenderWindow(const OfxRectI &rect) { _renderWindow = rect; }
+
+    /** @brief process the render window. If multiThreaded is false, it is processed in the calling thread
+     (the OFX multithread suite cannot be called recursively). */
+    void process(bool multiThreaded = true)
+    {
+        const int nRows = _renderWindow.y2 - _renderWindow.y1;
+        if (nRows <= 0 || _renderWindow.x2 <= _renderWindow.x1) {
+            return;
+        }
+        if (multiThreaded) {
+            multiThread( std::min(OFX::MultiThread::getNumCPUs(), (unsigned int)nRows) );
+        } else {
+            multiThreadProcessImages(_renderWindow);
+        }
+    }
+
+protected:
+    /** @brief map coordinate c to [b1,b2) using the boundary conditions (0: Black/Dirichlet, 1: Nearest/Neumann,
+     2: Repeat/Periodic). Returns false if the pixel is black. */
+    static bool boundaryCoord(int boundary, int b1, int b2, int *c)
+    {
+        if (b1 >= b2) {
+            return false;
+        }
+        if (b1 <= *c && *c < b2) {
+            return true;
+        }
+        switch (boundary) {
+            case 1:
+                *c = std::max(b1, std::min(*c, b2 - 1));
+                return true;
+            case 2: {
+                const int w = b2 - b1;
+                *c = b1 + ((*c - b1) % w + w) % w;
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    /** @brief the first source pixel of row y, after applying the boundary conditions, or NULL if the row is black */
+    const float *srcRowAddress(int y) const
+    {
+        if (!_srcImg || !boundaryCoord(_srcBoundary, _srcBounds.y1, _srcBounds.y2, &y)) {
+            return NULL;
+        }
+        return (const float *) _srcImg->getPixelAddress(_srcBounds.x1, y);
+    }
+
+    /** @brief pixel x of srcRow (see srcRowAddress()), after applying the boundary conditions, or NULL if it is black */
+    template <int nComponents>
+    const float *srcPixelAddress(const float *srcRow, int x) const
+    {
+        if (!srcRow || !boundaryCoord(_srcBoundary, _srcBounds.x1, _srcBounds.x2, &x)) {
+            return NULL;
+        }
+        return srcRow + (size_t)(x - _srcBounds.x1) * nComponents;
+    }
+
+    // the address of pixel (x,y) in each cimg channel
+    void cimgPixelAddresses(int x, int y, float *planes[4]) const
+    {
+        for (int c = 0; c < _cimg.spectrum(); ++c) {
+            planes[c] = _cimg.data(x - _cimgBounds.x1, y - _cimgBounds.y1, 0, c);
+        }
+    }
+
+    virtual void multiThreadProcessImages(const OfxRectI &procWindow) = 0;
+
+private:
+    virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads) OVERRIDE FINAL
+    {
+        // slice the y range into the number of threads it has
+        const int dy = _renderWindow.y2 - _renderWindow.y1;
+        OfxRectI procWindow = _renderWindow;
+        procWindow.y1 = _renderWindow.y1 + (int)( (size_t)dy * threadId / nThreads );
+        procWindow.y2 = _renderWindow.y1 + (int)( (size_t)dy * (threadId + 1) / nThreads );
+        if (procWindow.y1 < procWindow.y2) {
+            multiThreadProcessImages(procWindow);
+        }
+    }
+
+protected:
+    OFX::ImageEffect &_effect;
+    const OFX::Image *_srcImg;
+    OfxRectI _srcBounds;
+    int _srcBoundary;
+    bool _premult;
+    int _premultChannel;
+    cimg_library::CImg<float> &_cimg;
+    OfxRectI _cimgBounds; //!< the pixel coordinates of the cimg
+    std::vector<int> _unpChannel; //!< for each cimg channel, the corresponding index in the (un)premultiplied 4-component pixel
+    OfxRectI _renderWindow;
+};
+
+/** @brief Copy the source (with boundary conditions) into the cimg channels, unpremultiplying on the fly.
+ This replaces a copy to an interleaved temporary image followed by a deinterleaving pass. */
+template <int nComponents>
+class CImgPixelsToPlanar : public CImgPlanarProcessorBase
+{
+public:
+    CImgPixelsToPlanar(OFX::ImageEffect &effect,
+                       const OFX::Image *srcImg,
+                       int srcBoundary,
+                       bool premult,
+                       int premultChannel,
+                       cimg_library::CImg<float> &cimg,
+                       const OfxRectI &cimgBounds,
+                       const std::vector<int> &unpChannel)
+    : CImgPlanarProcessorBase(effect, srcImg, srcBoundary, premult && nComponents == 4, premultChannel, cimg, cimgBounds, unpChannel)
+    {
+    }
+
+private:
+    virtual void multiThreadProcessImages(const OfxRectI &procWindow) OVERRIDE FINAL
+    {
+        const int spectrum = _cimg.spectrum();
+        float *planes[4];
+        float unpPix[4];
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            cimgPixelAddresses(procWindow.x1, y, planes);
+            const float *srcRow = srcRowAddress(y);
+            // the part of the row that is within the source bounds
+            const int bx1 = std::max(procWindow.x1, std::min(_srcBounds.x1, procWindow.x2));
+            const int bx2 = std::max(bx1, std::min(_srcBounds.x2, procWindow.x2));
+            int x = procWindow.x1;
+            if (nComponents == 1 && spectrum == 1 && srcRow) {
+                // single channel: planar and interleaved are the same, copy the row directly
+                for (; x < bx1; ++x) {
+                    const float *srcPix = srcPixelAddress<nComponents>(srcRow, x);
+                    planes[0][x - procWindow.x1] = srcPix ? *srcPix : 0.f;
+                }
+                std::copy(srcRow + (bx1 - _srcBounds.x1), srcRow + (bx2 - _srcBounds.x1), planes[0] + (bx1 - procWindow.x1));
+                x = bx2;
+            }
+            for (; x < procWindow.x2; ++x) {
+                const float *srcPix = srcPixelAddress<nComponents>(srcRow, x);
+                ofxsUnPremult<float, nComponents, 1>(srcPix, unpPix, _premult, _premultChannel);
+                for (int c = 0; c < spectrum; ++c) {
+                    planes[c][x - procWindow.x1] = unpPix[_unpChannel[c]];
+                }
+            }
+        }
+    }
+};
+
+/** @brief Copy the cimg channels to the destination, taking the unprocessed channels from the source, and
+ premultiply, mask and mix on the fly.
+ This replaces a reinterleaving pass to a temporary image followed by a copy with premult/mask/mix. */
+template <int nComponents>
+class CImgPlanarToPixels : public CImgPlanarProcessorBase
+{
+public:
+    CImgPlanarToPixels(OFX::ImageEffect &effect,
+                       const OFX::Image *srcImg,
+                       int srcBoundary,
+                       bool premult,
+                       int premultChannel,
+                       cimg_library::CImg<float> &cimg,
+                       const OfxRectI &cimgBounds,
+                       const std::vector<int> &unpChannel,
+                       OFX::Image *dstImg,
+                       const OFX::Image *maskImg,
+                       bool maskInvert,
+                       double mix)
+    : CImgPlanarProcessorBase(effect, srcImg, srcBoundary, premult && nComponents == 4, premultChannel, cimg, cimgBounds, unpChannel)
+    , _dstImg(dstImg)
+    , _maskImg(maskImg)
+    , _doMasking(maskImg != NULL)
+    , _maskInvert(maskInvert)
+    , _mix(mix)
+    {
+    }
+
+private:
+    virtual void multiThreadProcessImages(const OfxRectI &procWindow) OVERRIDE FINAL
+    {
+        const int spectrum = _cimg.spectrum();
+        // if all channels were processed, the source is only needed for mixing
+        const bool allChannels = (spectrum == nComponents);
+        const bool copyRows = (nComponents == 1 && spectrum == 1 && !_doMasking && _mix == 1.);
+        float *planes[4];
+        float unpPix[4];
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            cimgPixelAddresses(procWindow.x1, y, planes);
+            float *dstPix = (float *) _dstImg->getPixelAddress(procWindow.x1, y);
+            assert(dstPix);
+            if (copyRows) {
+                // single channel, no mask and no mix: planar and interleaved are the same, copy the row directly
+                std::copy(planes[0], planes[0] + (procWindow.x2 - procWindow.x1), dstPix);
+                continue;
+            }
+            const float *srcRow = srcRowAddress(y);
+            const bool origRow = (_srcBounds.y1 <= y && y < _srcBounds.y2);
+            for (int x = procWindow.x1; x < procWindow.x2; ++x, dstPix += nComponents) {
+                const float *srcPix = srcPixelAddress<nComponents>(srcRow, x);
+                if (allChannels) {
+                    unpPix[0] = unpPix[1] = unpPix[2] = 0.f;
+                    unpPix[3] = (nComponents == 3) ? 1.f : 0.f;
+                } else {
+                    ofxsUnPremult<float, nComponents, 1>(srcPix, unpPix, _premult, _premultChannel);
+                }
+                for (int c = 0; c < spectrum; ++c) {
+                    unpPix[_unpChannel[c]] = planes[c][x - procWindow.x1];
+                }
+                // mix with the original source pixel, which is black outside of the source bounds
+                const float *origPix = (origRow && _srcBounds.x1 <= x && x < _srcBounds.x2) ? srcPix : NULL;
+                ofxsPremultMaskMixPix<float, nComponents, 1, true>(unpPix, _premult, _premultChannel, x, y, origPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
+            }
+        }
+    }
+
+    OFX::Image *_dstImg;
+    const OFX::Image *_maskImg;
+    bool _doMasking;
+    bool _maskInvert;
+    double _mix;
+};
+
 template <class Params, bool sourceIsOptional>
 class CImgFilterPluginHelper : public OFX::ImageEffect
 {
@@ -62,6 +330,7 @@ public:
     , _dstClip(0)
     , _srcClip(0)
     , _maskClip(0)
+    , _scratchPool(this)
     , _processR(0)
     , _processG(0)
     , _processB(0)
@@ -104,6 +373,9 @@ public:
     /* Override the render */
     virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
 
+    /* release the scratch buffers */
+    virtual void purgeCaches() OVERRIDE FINAL { _scratchPool.purge(); }
+
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip* &identityClip, double &identityTime) OVERRIDE FINAL;
 
     virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL
@@ -159,6 +431,56 @@ public:
     // 0: Black/Dirichlet, 1: Nearest/Neumann, 2: Repeat/Periodic
     virtual int getBoundary(const Params& /*params*/) { return 0; }
 
+    // return true if the filter has a bounded support, i.e. each output pixel only depends on the input pixels
+    // given by getRoI(). The processed window is then cut into horizontal strips, which are processed in
+    // parallel, each with its own RoI. Only used if the plugin supports tiles.
+    // The strips are processed by waves, and the render can be aborted between two waves.
+    virtual bool supportsStrips(const Params& /*params*/) { return false; }
+
+protected:
+    /** @brief starts reporting the progress of a long render, and ends it when going out of scope.
+     To be used by render(args,params,x1,y1,cimg) around the iterations of an iterative filter, see renderAborted().
+     The progress is only reported by filters that do not support tiles, since tiles may be rendered concurrently. */
+    class ProgressReport
+    {
+    public:
+        ProgressReport(CImgFilterPluginHelper &effect, const std::string &message)
+        : _effect(effect)
+        {
+            if (!_effect._supportsTiles) {
+                _effect.progressStart(message);
+            }
+        }
+
+        ~ProgressReport()
+        {
+            if (!_effect._supportsTiles) {
+                _effect.progressEnd();
+            }
+        }
+
+    private:
+        CImgFilterPluginHelper &_effect;
+    };
+
+    // to be called by render(args,params,x1,y1,cimg) between the iterations of a long computation, in the scope
+    // of a ProgressReport: reports the progress (between 0 and 1) and returns true if the render was aborted.
+    // If the user cancelled the render from the progress report, the render fails, so that the partial result
+    // is not used.
+    bool renderAborted(double progress)
+    {
+        if ( abort() ) {
+            return true;
+        }
+        if ( !_supportsTiles && !progressUpdate(progress) ) {
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+
+        return false;
+    }
+
+public:
+
     //static void describe(OFX::ImageEffectDescriptor &desc, bool supportsTiles);
 
     static OFX::PageParamDescriptor*
@@ -298,6 +620,66 @@ private:
                  OFX::BitDepthEnum dstPixelDepth,
                  int dstRowBytes);
 
+    // everything renderProcessWindow() needs, apart from the window
+    struct ProcessArgs
+    {
+        const OFX::RenderArguments *args;
+        const Params *params;
+        const OFX::Image *src;
+        const OFX::Image *mask; //!< NULL if there is no masking
+        OFX::Image *dst;
+        OfxRectI dstRoD;
+        int srcBoundary;
+        int srcNComponents;
+        std::vector<int> unpChannel; //!< for each cimg channel, the index of the channel in the 4-component pixels given by ofxsUnPremult()
+        bool premult;
+        int premultChannel;
+        double mix;
+        bool maskInvert;
+    };
+
+    /** @brief processes the strips of the process window, one strip per thread */
+    class StripProcessor : public OFX::MultiThread::Processor
+    {
+    public:
+        StripProcessor(CImgFilterPluginHelper &effect, const ProcessArgs &pargs, const std::vector<OfxRectI> &strips)
+        : _effect(effect)
+        , _pargs(pargs)
+        , _strips(strips)
+        , _done(strips.size(), 0)
+        {
+        }
+
+        void process() { multiThread( (unsigned int)_strips.size() ); }
+
+        bool done(int i) const { return _done[i] != 0; }
+
+    private:
+        virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads) OVERRIDE FINAL
+        {
+            for (unsigned int i = threadId; i < _strips.size(); i += nThreads) {
+                try {
+                    _effect.renderProcessWindow(_pargs, _strips[i], false);
+                    _done[i] = 1;
+                } catch (...) {
+                    // the main thread will try again
+                }
+            }
+        }
+
+        CImgFilterPluginHelper &_effect;
+        const ProcessArgs &_pargs;
+        const std::vector<OfxRectI> &_strips;
+        std::vector<char> _done; // not std::vector<bool>, which can't be written concurrently
+    };
+    friend class StripProcessor;
+
+    /** @brief compute the RoI of processWindow, convert it to a cimg, process it, and write processWindow to dst */
+    void
+    renderProcessWindow(const ProcessArgs &pargs,
+                        const OfxRectI &processWindow,
+                        bool multiThreaded);
+
     void
     setupAndCopy(OFX::PixelProcessorFilterBase & processor,
                  double time,
@@ -429,6 +811,9 @@ protected:
     OFX::Clip *_srcClip;
     OFX::Clip *_maskClip;
 
+    // scratch buffers for the cimg and the temporary images of the filters, recycled across renders
+    CImgScratchPool _scratchPool;
+
 private:
     // params
     OFX::BooleanParam* _processR;
@@ -823,163 +1208,184 @@ CImgFilterPluginHelper<Params,sourceIsOptional>::render(const OFX::RenderArgumen
                           ((srcPixelComponents == OFX::ePixelComponentRGB) ? 3 : 4));
 
     // from here on, we do the following steps:
-    // 1- copy & unpremult all channels from srcRoI, from src to a tmp image of size srcRoI
-    // 2- extract channels to be processed from tmp to a cimg of size srcRoI (and do the interleaved to coplanar conversion)
-    // 3- process the cimg
-    // 4- copy back the processed channels from the cImg to tmp. only processWindow has to be copied
-    // 5- copy+premult+max+mix tmp to dst (only processWindow)
-
-    //////////////////////////////////////////////////////////////////////////////////////////
-    // 1- copy & unpremult all channels from srcRoI, from src to a tmp image of size srcRoI
-
-    const OfxRectI tmpBounds = srcRoI;
-    const OFX::PixelComponentEnum tmpPixelComponents = srcPixelComponents;
-    const OFX::BitDepthEnum tmpBitDepth = OFX::eBitDepthFloat;
-    const int tmpWidth = tmpBounds.x2 - tmpBounds.x1;
-    const int tmpHeight = tmpBounds.y2 - tmpBounds.y1;
-    const int tmpRowBytes = getPixelBytes(tmpPixelComponents, tmpBitDepth) * tmpWidth;
-    size_t tmpSize = tmpRowBytes * tmpHeight;
-
-    assert(tmpSize > 0);
-    std::auto_ptr<OFX::ImageMemory> tmpData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpPixelData = (float*)tmpData->lock();
-
-    {
-        std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
-        if (!src.get()) {
-            // no src, fill with black & transparent
-            if (dstPixelComponents == OFX::ePixelComponentRGBA) {
-                fred.reset(new OFX::BlackFiller<float, 4>(*this));
-            } else if (dstPixelComponents == OFX::ePixelComponentRGB) {
-                fred.reset(new OFX::BlackFiller<float, 3>(*this));
-            }  else if (dstPixelComponents == OFX::ePixelComponentAlpha) {
-                fred.reset(new OFX::BlackFiller<float, 1>(*this));
-            }
-        } else {
-            if (dstPixelComponents == OFX::ePixelComponentRGBA) {
-                fred.reset(new OFX::PixelCopierUnPremult<float, 4, 1, float, 4, 1>(*this));
-            } else if (dstPixelComponents == OFX::ePixelComponentRGB) {
-                // just copy, no premult
-                fred.reset(new OFX::PixelCopier<float, 3>(*this));
-            }  else if (dstPixelComponents == OFX::ePixelComponentAlpha) {
-                // just copy, no premult
-                fred.reset(new OFX::PixelCopier<float, 1>(*this));
-            }
-        }
-        setupAndCopy(*fred, time, srcRoI, src.get(), mask.get(),
-                     srcPixelData, srcBounds, srcPixelComponents, srcBitDepth, srcRowBytes, srcBoundary,
-                     tmpPixelData, tmpBounds, tmpPixelComponents, tmpBitDepth, tmpRowBytes,
-                     premult, premultChannel, mix, maskInvert);
-    }
+    // 1- copy & unpremult the channels to be processed from srcRoI, from src to a cimg of size srcRoI
+    //    (and do the interleaved to coplanar conversion)
+    // 2- process the cimg
+    // 3- copy+premult+max+mix the processed channels from the cimg and the other channels from src to dst
+    //    (only processWindow)
+    // There is no interleaved temporary image: the conversions are fused with the (un)premult and mask/mix passes.
 
-    //////////////////////////////////////////////////////////////////////////////////////////
-    // 2- extract channels to be processed from tmp to a cimg of size srcRoI (and do the interleaved to coplanar conversion)
-
-    // allocate the cimg data to hold the src ROI
     const int cimgSpectrum = ((srcPixelComponents == OFX::ePixelComponentAlpha) ? (int)processA :
                               ((srcPixelComponents == OFX::ePixelComponentRGB) ? ((int)processR + (int)processG + (int) processB) :
                                ((int)processR + (int)processG + (int) processB + (int)processA)));
-    const int cimgWidth = srcRoI.x2 - srcRoI.x1;
-    const int cimgHeight = srcRoI.y2 - srcRoI.y1;
-    const size_t cimgSize = cimgWidth * cimgHeight * cimgSpectrum * sizeof(float);
-    std::vector<int> srcChannel(cimgSpectrum, -1);
-    std::vector<int> cimgChannel(srcNComponents, -1);
+    ProcessArgs pargs;
+    pargs.args = &args;
+    pargs.params = &params;
+    pargs.src = src.get();
+    pargs.mask = doMasking ? mask.get() : NULL;
+    pargs.dst = dst.get();
+    pargs.dstRoD = dstRoD;
+    pargs.srcBoundary = srcBoundary;
+    pargs.srcNComponents = srcNComponents;
+    pargs.premult = premult;
+    pargs.premultChannel = premultChannel;
+    pargs.mix = mix;
+    pargs.maskInvert = maskInvert;
+    std::vector<int> &unpChannel = pargs.unpChannel;
+    unpChannel.resize(cimgSpectrum, -1);
 
     if (srcNComponents == 1) {
         if (processA) {
             assert(cimgSpectrum == 1);
-            srcChannel[0] = 0;
-            cimgChannel[0] = 0;
+            unpChannel[0] = 3;
         } else {
             assert(cimgSpectrum == 0);
         }
     } else {
         int c = 0;
         if (processR) {
-            srcChannel[c] = 0;
+            unpChannel[c] = 0;
             ++c;
         }
         if (processG) {
-            srcChannel[c] = 1;
+            unpChannel[c] = 1;
             ++c;
         }
         if (processB) {
-            srcChannel[c] = 2;
+            unpChannel[c] = 2;
             ++c;
         }
         if (processA && srcNComponents >= 4) {
-            srcChannel[c] = 3;
+            unpChannel[c] = 3;
             ++c;
         }
         assert(c == cimgSpectrum);
     }
 
+    // cut the process window into strips if the filter allows it. The strips must be high enough so that their
+    // halo (the rows of their RoI above and below them) does not dominate the cost.
+    // There are a few strips per thread, so that abort() can be checked between two waves of strips, without
+    // waiting for the whole process window.
+    const int height = processWindow.y2 - processWindow.y1;
+    const int nThreads = (int)OFX::MultiThread::getNumCPUs();
+    int nStrips = 1;
+    if ( _supportsTiles && supportsStrips(params) ) {
+        const int halo = std::max(0, (srcRoI.y2 - srcRoI.y1) - height);
+        const int minHeight = std::max(kCImgFilterStripMinHeight, halo);
+        nStrips = std::min(nThreads * kCImgFilterStripsPerThread, height / minHeight);
+    }
+
+    if (nStrips <= 1) {
+        renderProcessWindow(pargs, processWindow, true);
+    } else {
+        std::vector<OfxRectI> strips(nStrips, processWindow);
+        for (int i = 0; i < nStrips; ++i) {
+            strips[i].y1 = processWindow.y1 + (int)( (size_t)height * i / nStrips );
+            strips[i].y2 = processWindow.y1 + (int)( (size_t)height * (i + 1) / nStrips );
+        }
+        for (int first = 0; first < nStrips; first += nThreads) {
+            const std::vector<OfxRectI> wave(strips.begin() + first, strips.begin() + std::min(first + nThreads, nStrips));
+            StripProcessor processor(*this, pargs, wave);
+            processor.process();
+            // strips that failed in their thread (e.g. out of memory) are processed again in the main thread,
+            // which reports the error if it fails again
+            for (int i = 0; i < (int)wave.size() && !abort(); ++i) {
+                if ( !processor.done(i) ) {
+                    renderProcessWindow(pargs, wave[i], true);
+                }
+            }
+            if ( abort() ) {
+                return;
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+    // done!
+}
+
+
+template <class Params, bool sourceIsOptional>
+void
+CImgFilterPluginHelper<Params,sourceIsOptional>::renderProcessWindow(const ProcessArgs &pargs,
+                                                                     const OfxRectI &processWindow,
+                                                                     bool multiThreaded)
+{
+    const OFX::RenderArguments &args = *pargs.args;
+    const Params &params = *pargs.params;
+    const std::vector<int> &unpChannel = pargs.unpChannel;
+
+    // compute the src ROI (should be consistent with getRegionsOfInterest())
+    OfxRectI srcRoI;
+    getRoI(processWindow, args.renderScale, params, &srcRoI);
+
+    // intersect against the destination RoD
+    OFX::MergeImages2D::rectIntersection(srcRoI, pargs.dstRoD, &srcRoI);
+
+    // allocate the cimg data to hold the src ROI
+    const int cimgSpectrum = (int)unpChannel.size();
+    const int cimgWidth = srcRoI.x2 - srcRoI.x1;
+    const int cimgHeight = srcRoI.y2 - srcRoI.y1;
+    const size_t cimgSize = (size_t)cimgWidth * cimgHeight * cimgSpectrum * sizeof(float);
+
+    std::auto_ptr<CImgScratchBuffer> cimgData;
+    cimg_library::CImg<float> cimg;
     if (cimgSize) { // may be zero if no channel is processed
-        std::auto_ptr<OFX::ImageMemory> cimgData(new OFX::ImageMemory(cimgSize, this));
-        float *cimgPixelData = (float*)cimgData->lock();
-        cimg_library::CImg<float> cimg(cimgPixelData, cimgWidth, cimgHeight, 1, cimgSpectrum, true);
+        cimgData.reset( new CImgScratchBuffer(_scratchPool, cimgSize) );
+        cimg.assign(cimgData->data(), cimgWidth, cimgHeight, 1, cimgSpectrum, true);
 
+        //////////////////////////////////////////////////////////////////////////////////////////
+        // 1- copy & unpremult the channels to be processed from srcRoI, from src to the cimg
 
-        for (int c=0; c < cimgSpectrum; ++c) {
-            float *dst = cimg.data(0,0,0,c);
-            const float *src = tmpPixelData + srcChannel[c];
-            for (unsigned int siz = cimgWidth * cimgHeight; siz; --siz, src += srcNComponents, ++dst) {
-                *dst = *src;
+        {
+            std::auto_ptr<CImgPlanarProcessorBase> fred;
+            if (pargs.srcNComponents == 4) {
+                fred.reset(new CImgPixelsToPlanar<4>(*this, pargs.src, pargs.srcBoundary, pargs.premult, pargs.premultChannel, cimg, srcRoI, unpChannel));
+            } else if (pargs.srcNComponents == 3) {
+                fred.reset(new CImgPixelsToPlanar<3>(*this, pargs.src, pargs.srcBoundary, pargs.premult, pargs.premultChannel, cimg, srcRoI, unpChannel));
+            } else {
+                fred.reset(new CImgPixelsToPlanar<1>(*this, pargs.src, pargs.srcBoundary, pargs.premult, pargs.premultChannel, cimg, srcRoI, unpChannel));
             }
+            fred->setRenderWindow(srcRoI);
+            fred->process(multiThreaded);
+        }
+        if ( abort() ) {
+            return;
         }
 
         //////////////////////////////////////////////////////////////////////////////////////////
-        // 3- process the cimg
+        // 2- process the cimg
         printRectI("render srcRoI", srcRoI);
         render(args, params, srcRoI.x1, srcRoI.y1, cimg);
         // check that the dimensions didn't change
         assert(cimg.width() == cimgWidth && cimg.height() == cimgHeight && cimg.depth() == 1 && cimg.spectrum() == cimgSpectrum);
-
-        //////////////////////////////////////////////////////////////////////////////////////////
-        // 4- copy back the processed channels from the cImg to tmp. only processWindow has to be copied
-
-        // We copy the whole srcRoI. This could be optimized to copy only renderWindow
-        for (int c=0; c < cimgSpectrum; ++c) {
-            const float *src = cimg.data(0,0,0,c);
-            float *dst = tmpPixelData + srcChannel[c];
-            for (unsigned int siz = cimgWidth * cimgHeight; siz; --siz, ++src, dst += srcNComponents) {
-                *dst = *src;
-            }
+        if ( abort() ) {
+            // the result may be incomplete, and the host will discard it anyway
+            return;
         }
-
     }
 
     //////////////////////////////////////////////////////////////////////////////////////////
-    // 5- copy+premult+max+mix tmp to dst (only processWindow)
+    // 3- copy+premult+max+mix the cimg and the unprocessed channels of src to dst (only processWindow)
 
     {
-        std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
-        if (dstPixelComponents == OFX::ePixelComponentRGBA) {
-            fred.reset(new OFX::PixelCopierPremultMaskMix<float, 4, 1, float, 4, 1>(*this));
-        } else if (dstPixelComponents == OFX::ePixelComponentRGB) {
-            // just copy, no premult
-            if (doMasking) {
-                fred.reset(new OFX::PixelCopierMaskMix<float, 3, 1, true>(*this));
-            } else {
-                fred.reset(new OFX::PixelCopierMaskMix<float, 3, 1, false>(*this));
-            }
-        }  else if (dstPixelComponents == OFX::ePixelComponentAlpha) {
-            // just copy, no premult
-            assert(srcPixelComponents == OFX::ePixelComponentAlpha);
-            if (doMasking) {
-                fred.reset(new OFX::PixelCopierMaskMix<float, 1, 1, true>(*this));
-            } else {
-                fred.reset(new OFX::PixelCopierMaskMix<float, 1, 1, false>(*this));
-            }
+        std::auto_ptr<CImgPlanarProcessorBase> fred;
+        if (pargs.srcNComponents == 4) {
+            fred.reset(new CImgPlanarToPixels<4>(*this, pargs.src, pargs.srcBoundary, pargs.premult, pargs.premultChannel, cimg, srcRoI, unpChannel,
+                                                 pargs.dst, pargs.mask, pargs.maskInvert, pargs.mix));
+        } else if (pargs.srcNComponents == 3) {
+            // no premult
+            fred.reset(new CImgPlanarToPixels<3>(*this, pargs.src, pargs.srcBoundary, pargs.premult, pargs.premultChannel, cimg, srcRoI, unpChannel,
+                                                 pargs.dst, pargs.mask, pargs.maskInvert, pargs.mix));
+        }  else {
+            // no premult
+            assert(pargs.srcNComponents == 1);
+            fred.reset(new CImgPlanarToPixels<1>(*this, pargs.src, pargs.srcBoundary, pargs.premult, pargs.premultChannel, cimg, srcRoI, unpChannel,
+                                                 pargs.dst, pargs.mask, pargs.maskInvert, pargs.mix));
         }
-        setupAndCopy(*fred, time, processWindow, src.get(), mask.get(),
-                     tmpPixelData, tmpBounds, tmpPixelComponents, tmpBitDepth, tmpRowBytes, 0,
-                     dstPixelData, dstBounds, dstPixelComponents, dstBitDepth, dstRowBytes,
-                     premult, premultChannel, mix, maskInvert);
+        fred->setRenderWindow(processWindow);
+        fred->process(multiThreaded);
     }
-
-    //////////////////////////////////////////////////////////////////////////////////////////
-    // done!
 }
 
 
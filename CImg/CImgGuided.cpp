@@ -157,13 +157,17 @@ public:
     // only called if mix != 0.
     virtual void getRoI(const OfxRectI& rect, const OfxPointD& renderScale, const CImgGuidedParams& params, OfxRectI* roi) OVERRIDE FINAL
     {
-        int delta_pix = (int)std::ceil(params.radius * renderScale.x);
+        // blur_guided box-filters twice (the means and variances, then the coefficients a and b),
+        // so its support is twice the radius
+        int delta_pix = 2 * (int)std::ceil(params.radius * renderScale.x) + 1;
         roi->x1 = rect.x1 - delta_pix;
         roi->x2 = rect.x2 + delta_pix;
         roi->y1 = rect.y1 - delta_pix;
         roi->y2 = rect.y2 + delta_pix;
     }
 
+    virtual bool supportsStrips(const CImgGuidedParams& /*params*/) OVERRIDE FINAL { return true; }
+
     virtual void render(const OFX::RenderArguments &args, const CImgGuidedParams& params, int /*x1*/, int /*y1*/, cimg_library::CImg<float>& cimg) OVERRIDE FINAL
     {
         // PROCESSING.
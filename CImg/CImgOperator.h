@@ -34,6 +34,8 @@ CLANG_DIAG_OFF(shorten-64-to-32)
 #include "CImg.h"
 CLANG_DIAG_ON(shorten-64-to-32)
 
+#include "CImgScratchPool.h"
+
 template <class Params>
 class CImgOperatorPluginHelper : public OFX::ImageEffect
 {
@@ -55,6 +57,7 @@ public:
     , _premultChannel(0)
     , _srcAClipName(srcAClipName)
     , _srcBClipName(srcBClipName)
+    , _scratchPool(this)
     , _supportsTiles(supportsTiles)
     , _supportsMultiResolution(supportsMultiResolution)
     , _supportsRenderScale(supportsRenderScale)
@@ -81,6 +84,9 @@ public:
     /* Override the render */
     virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
 
+    /* release the scratch buffers */
+    virtual void purgeCaches() OVERRIDE FINAL { _scratchPool.purge(); }
+
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip* &identityClip, double &identityTime) OVERRIDE FINAL;
 
     virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL
@@ -250,6 +256,12 @@ private:
 
     std::string _srcAClipName;
     std::string _srcBClipName;
+
+protected:
+    // scratch buffers for the temporary images, recycled across renders
+    CImgScratchPool _scratchPool;
+
+private:
     bool _supportsTiles;
     bool _supportsMultiResolution;
     bool _supportsRenderScale;
@@ -554,8 +566,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
     size_t tmpSize = tmpRowBytes * tmpHeight;
 
     assert(tmpSize > 0);
-    std::auto_ptr<OFX::ImageMemory> tmpAData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpAPixelData = (float*)tmpAData->lock();
+    CImgScratchBuffer tmpAData(_scratchPool, tmpSize);
+    float *tmpAPixelData = tmpAData.data();
 
     {
         std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
@@ -585,8 +597,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
                      premult, premultChannel);
     }
     
-    std::auto_ptr<OFX::ImageMemory> tmpBData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpBPixelData = (float*)tmpBData->lock();
+    CImgScratchBuffer tmpBData(_scratchPool, tmpSize);
+    float *tmpBPixelData = tmpBData.data();
 
     {
         std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
@@ -616,8 +628,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
                      premult, premultChannel);
     }
 
-    std::auto_ptr<OFX::ImageMemory> tmpData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpPixelData = (float*)tmpData->lock();
+    CImgScratchBuffer tmpData(_scratchPool, tmpSize);
+    float *tmpPixelData = tmpData.data();
 
     //////////////////////////////////////////////////////////////////////////////////////////
     // 2- extract channels to be processed from tmp to a cimg of size srcRoI (and do the interleaved to coplanar conversion)
@@ -630,8 +642,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
 
 
     if (cimgSize) { // may be zero if no channel is processed
-        std::auto_ptr<OFX::ImageMemory> cimgAData(new OFX::ImageMemory(cimgSize, this));
-        float *cimgAPixelData = (float*)cimgAData->lock();
+        CImgScratchBuffer cimgAData(_scratchPool, cimgSize);
+        float *cimgAPixelData = cimgAData.data();
         cimg_library::CImg<float> cimgA(cimgAPixelData, cimgWidth, cimgHeight, 1, cimgSpectrum, true);
 
         for (int c=0; c < cimgSpectrum; ++c) {
@@ -642,8 +654,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
             }
         }
 
-        std::auto_ptr<OFX::ImageMemory> cimgBData(new OFX::ImageMemory(cimgSize, this));
-        float *cimgBPixelData = (float*)cimgBData->lock();
+        CImgScratchBuffer cimgBData(_scratchPool, cimgSize);
+        float *cimgBPixelData = cimgBData.data();
         cimg_library::CImg<float> cimgB(cimgBPixelData, cimgWidth, cimgHeight, 1, cimgSpectrum, true);
 
         for (int c=0; c < cimgSpectrum; ++c) {
@@ -188,9 +188,10 @@ public:
         }
         // first iteration is Gaussian blur (equivalent to a bilateral filter with a constant image as the guide)
         cimg_library::CImg<float> guide = cimg.get_blur((float)(params.sigma_s * args.renderScale.x), true, true);
+        ProgressReport progress(*this, "Processing...");
         // next iterations use the bilateral filter
         for (int i = 1; i < params.iterations; ++i) {
-            if (abort()) {
+            if ( renderAborted((double)i / params.iterations) ) {
                 return;
             }
             // filter the original image using the updated guide
@@ -0,0 +1,181 @@
+//
+//  CImgScratchPool.h
+//
+//  A pool of scratch buffers, recycled across the renders of a CImg plugin instance.
+//
+
+#ifndef Misc_CImgScratchPool_h
+#define Misc_CImgScratchPool_h
+
+#include "ofxsImageEffect.h"
+#include "ofxsMultiThread.h"
+
+#include <cassert>
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#define kCImgScratchPoolSlack 8 // buffers are allocated 1/kCImgScratchPoolSlack larger than requested, so that they can be reused by slightly larger requests (e.g. strips that differ by one row)
+
+/**
+ @brief A pool of scratch buffers, owned by a plugin instance.
+
+ The buffers are allocated using the host's image memory suite, so that the host can account for them, and
+ they are kept (unlocked) after use, so that the next renders of the same size do not have to allocate, page-fault
+ and zero new memory. Several renders may use the pool concurrently.
+
+ The free buffers never take more memory than the peak amount of memory that was used simultaneously, so that
+ the pool does not grow when the render size changes. purge() releases all the free buffers, and should be called
+ from the effect's purgeCaches().
+ */
+class CImgScratchPool
+{
+public:
+    explicit CImgScratchPool(OFX::ImageEffect* effect)
+    : _effect(effect)
+    , _freeBytes(0)
+    , _usedBytes(0)
+    , _peakBytes(0)
+    {
+    }
+
+    ~CImgScratchPool()
+    {
+        assert(_usedBytes == 0);
+        for (std::list<Entry>::iterator it = _free.begin(); it != _free.end(); ++it) {
+            delete it->memory;
+        }
+    }
+
+    /** @brief release all the free buffers to the host */
+    void purge()
+    {
+        std::list<Entry> evicted;
+        {
+            OFX::MultiThread::AutoMutex lock(_mutex);
+            evicted.swap(_free);
+            _freeBytes = 0;
+            _peakBytes = _usedBytes;
+        }
+        for (std::list<Entry>::iterator it = evicted.begin(); it != evicted.end(); ++it) {
+            delete it->memory;
+        }
+    }
+
+private:
+    friend class CImgScratchBuffer;
+
+    struct Entry
+    {
+        OFX::ImageMemory* memory;
+        size_t size;
+    };
+
+    // get a buffer of at least nBytes, either a free buffer or a new one. The returned buffer is not locked.
+    Entry acquire(size_t nBytes)
+    {
+        std::vector<OFX::ImageMemory*> evicted;
+        Entry entry;
+        entry.memory = 0;
+        entry.size = nBytes + nBytes / kCImgScratchPoolSlack;
+        {
+            OFX::MultiThread::AutoMutex lock(_mutex);
+            // the most recently released buffers are first
+            for (std::list<Entry>::iterator it = _free.begin(); it != _free.end(); ++it) {
+                if (it->size >= nBytes && it->size <= entry.size) {
+                    entry = *it;
+                    _free.erase(it);
+                    _freeBytes -= entry.size;
+                    _usedBytes += entry.size;
+
+                    return entry;
+                }
+            }
+            // no buffer fits: release the least recently used ones, unless they fit in the peak usage
+            while ( !_free.empty() && (_usedBytes + _freeBytes + entry.size > _peakBytes) ) {
+                evicted.push_back(_free.back().memory);
+                _freeBytes -= _free.back().size;
+                _free.pop_back();
+            }
+            _usedBytes += entry.size;
+            _peakBytes = std::max(_peakBytes, _usedBytes + _freeBytes);
+        }
+        for (size_t i = 0; i < evicted.size(); ++i) {
+            delete evicted[i];
+        }
+        try {
+            entry.memory = new OFX::ImageMemory(entry.size, _effect);
+        } catch (...) {
+            OFX::MultiThread::AutoMutex lock(_mutex);
+            _usedBytes -= entry.size;
+            throw;
+        }
+
+        return entry;
+    }
+
+    // give back a buffer obtained from acquire(). The buffer must be unlocked.
+    void release(const Entry& entry)
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        assert(_usedBytes >= entry.size);
+        _usedBytes -= entry.size;
+        _freeBytes += entry.size;
+        _free.push_front(entry);
+    }
+
+    // non-copyable
+    CImgScratchPool(const CImgScratchPool&);
+    CImgScratchPool& operator=(const CImgScratchPool&);
+
+    OFX::ImageEffect* _effect;
+    OFX::MultiThread::Mutex _mutex; //!< protects the following members, since the pool is shared by concurrent renders
+    std::list<Entry> _free; //!< the free buffers, most recently released first
+    size_t _freeBytes; //!< the total size of the free buffers
+    size_t _usedBytes; //!< the total size of the buffers in use
+    size_t _peakBytes; //!< the maximum total size of the buffers held by the pool
+};
+
+/**
+ @brief A scratch buffer taken from a CImgScratchPool, which is locked while the object exists, and given back to
+ the pool when it is destroyed. Its content is undefined.
+
+ Typical usage, to get a CImg sharing the buffer:
+ CImgScratchBuffer data(_scratchPool, w * h * c * sizeof(float));
+ cimg_library::CImg<float> cimg(data.data(), w, h, 1, c, true);
+ */
+class CImgScratchBuffer
+{
+public:
+    CImgScratchBuffer(CImgScratchPool& pool, size_t nBytes)
+    : _pool(pool)
+    , _entry( pool.acquire(nBytes) )
+    , _data(0)
+    {
+        try {
+            _data = (float*)_entry.memory->lock();
+        } catch (...) {
+            _pool.release(_entry);
+            throw;
+        }
+    }
+
+    ~CImgScratchBuffer()
+    {
+        _entry.memory->unlock();
+        _pool.release(_entry);
+    }
+
+    float* data() const { return _data; }
+
+private:
+    // non-copyable
+    CImgScratchBuffer(const CImgScratchBuffer&);
+    CImgScratchBuffer& operator=(const CImgScratchBuffer&);
+
+    CImgScratchPool& _pool;
+    CImgScratchPool::Entry _entry;
+    float* _data;
+};
+
+#endif
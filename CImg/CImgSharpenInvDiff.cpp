@@ -167,8 +167,9 @@ public:
         if (params.iterations <= 0 || params.amplitude == 0.) {
             return;
         }
+        ProgressReport progress(*this, "Processing...");
         for (int i = 1; i < params.iterations; ++i) {
-            if (abort()) {
+            if ( renderAborted((double)i / params.iterations) ) {
                 return;
             }
             cimg.sharpen((float)params.amplitude);
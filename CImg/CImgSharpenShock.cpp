@@ -193,8 +193,9 @@ public:
         }
         double alpha = args.renderScale.x * params.alpha;
         double sigma = args.renderScale.x * params.sigma;
+        ProgressReport progress(*this, "Processing...");
         for (int i = 1; i < params.iterations; ++i) {
-            if (abort()) {
+            if ( renderAborted((double)i / params.iterations) ) {
                 return;
             }
             cimg.sharpen((float)params.amplitude, true, (float)params.edge, (float)alpha, (float)sigma);
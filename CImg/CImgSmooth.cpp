@@ -75,6 +75,7 @@
 #include <memory>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 #ifdef _WINDOWS
 #include <windows.h>
 #endif
@@ -111,6 +112,8 @@
 #define kSupportsRGB true
 #define kSupportsAlpha true
 
+#define kStripMinHeight 64 // minimum height of the strips between which the render can be aborted
+
 #define kParamAmplitude "amplitude"
 #define kParamAmplitudeLabel "Amplitude"
 #define kParamAmplitudeHint "Amplitude of the smoothing, in pixel units (>=0). This is the maximum length of streamlines used to smooth the data."
@@ -243,17 +246,49 @@ public:
     {
         // PROCESSING.
         // This is the only place where the actual processing takes place
-        cimg.blur_anisotropic((float)(params.amplitude * args.renderScale.x), // in pixels
-                              (float)params.sharpness,
-                              (float)params.anisotropy,
-                              (float)(params.alpha * args.renderScale.x), // in pixels
-                              (float)(params.sigma * args.renderScale.x), // in pixels
-                              (float)params.dl, // in pixel, but we don't discretize more
-                              (float)params.da,
-                              (float)params.gprec,
-                              params.interp_i,
-                              params.fast_approx);
-
+        const float amplitude = (float)(params.amplitude * args.renderScale.x); // in pixels
+        ProgressReport progress(*this, "Processing...");
+        // The diffusion tensors are computed on the image normalized to its value range, so they are computed
+        // once on the whole image, which gives the same result as blur_anisotropic(amplitude,sharpness,...).
+        const cimg_library::CImg<float> G = cimg.get_diffusion_tensors((float)params.sharpness,
+                                                                       (float)params.anisotropy,
+                                                                       (float)(params.alpha * args.renderScale.x), // in pixels
+                                                                       (float)(params.sigma * args.renderScale.x), // in pixels
+                                                                       params.interp_i != 3);
+        // The smoothing along the tensors only uses the pixels on the streamlines, which are at most
+        // max(amplitude, gprec*sqrt(2*amplitude)) pixels long (plus one pixel for the interpolation), so it is done by
+        // horizontal strips, with a halo of that size, and the render can be aborted between two strips.
+        const int halo = (int)std::ceil( std::max(params.amplitude * args.renderScale.x, params.gprec * std::sqrt(2. * amplitude)) ) + 2;
+        const int height = cimg.height();
+        const int nStrips = std::max(1, height / std::max(kStripMinHeight, 4 * halo));
+        cimg_library::CImg<float> done; // the result of the previous strip, which is still needed by the current strip
+        int doneY = 0;
+        for (int i = 0; i < nStrips; ++i) {
+            if ( renderAborted( (double)i / nStrips ) ) {
+                return;
+            }
+            const int y1 = height * i / nStrips;
+            const int y2 = height * (i + 1) / nStrips;
+            const int haloY1 = std::max(0, y1 - halo);
+            const int haloY2 = std::min(height, y2 + halo);
+            cimg_library::CImg<float> strip = cimg.get_rows(haloY1, haloY2 - 1);
+            if ( !done.is_empty() ) {
+                // the strips are at least 4*halo high, so the following strips do not need the input rows of the previous one
+                cimg.draw_image(0, doneY, 0, 0, done);
+            }
+            strip.blur_anisotropic(G.get_rows(haloY1, haloY2 - 1),
+                                   amplitude,
+                                   (float)params.dl, // in pixel, but we don't discretize more
+                                   (float)params.da,
+                                   (float)params.gprec,
+                                   params.interp_i,
+                                   params.fast_approx);
+            done = strip.get_rows(y1 - haloY1, y2 - haloY1 - 1);
+            doneY = y1;
+        }
+        if ( !done.is_empty() ) {
+            cimg.draw_image(0, doneY, 0, 0, done);
+        }
     }
 
     virtual bool isIdentity(const OFX::IsIdentityArguments &/*args*/, const CImgSmoothParams& params) OVERRIDE FINAL
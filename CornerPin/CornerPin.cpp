@@ -97,6 +97,8 @@
 
 #include "ofxsOGLTextRenderer.h"
 #include "ofxsTransform3x3.h"
+#include "SeparableTransform.h"
+#include "MipmapTransform.h"
 
 #define kPluginName "CornerPinOFX"
 #define kPluginMaskedName "CornerPinMaskedOFX"
@@ -347,6 +349,7 @@ public:
     , _copyFromButton(0)
     , _copyToButton(0)
     , _copyInputButton(0)
+    , _mipmap(0)
     {
         // NON-GENERIC
         for (int i = 0; i < 4; ++i) {
@@ -365,6 +368,9 @@ public:
         _copyToButton = fetchPushButtonParam(kParamCopyTo);
         _copyInputButton = fetchPushButtonParam(kParamCopyInputRoD);
         assert(_copyInputButton && _copyToButton && _copyFromButton);
+
+        _mipmap = fetchBooleanParam(kParamMipmap);
+        assert(_mipmap);
     }
 private:
     
@@ -396,6 +402,16 @@ private:
     /** @brief called when a clip has just been changed in some way (a rewire maybe) */
     //virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
 
+    /* the mipmap engine needs a larger source region than the generic render */
+    virtual void getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args, OFX::RegionOfInterestSetter &rois) OVERRIDE FINAL;
+
+    /* render with the mipmap or separable engines when possible, else with the generic Transform3x3 render */
+    virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
+
+    /* render a minifying transform with the mipmap engine if it is enabled, else a transform that is only
+       a scale and a translation with the separable engine. Returns false if it cannot. */
+    bool renderFast(const OFX::RenderArguments &args);
+
 private:
     // NON-GENERIC
     OFX::Double2DParam* _to[4];
@@ -408,6 +424,8 @@ private:
     OFX::PushButtonParam* _copyFromButton;
     OFX::PushButtonParam* _copyToButton;
     OFX::PushButtonParam* _copyInputButton;
+
+    OFX::BooleanParam* _mipmap;
 };
 
 
@@ -589,6 +607,46 @@ void CornerPinPlugin::changedParam(const OFX::InstanceChangedArgs &args, const s
 //    }
 //}
 
+void
+CornerPinPlugin::render(const OFX::RenderArguments &args)
+{
+    if ( !renderFast(args) ) {
+        Transform3x3Plugin::render(args);
+    }
+}
+
+void
+CornerPinPlugin::getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args, OFX::RegionOfInterestSetter &rois)
+{
+    Transform3x3Plugin::getRegionsOfInterest(args, rois);
+    const double time = args.time;
+    Transform3x3FastRenderValues values;
+    if ( !transform3x3FastRenderGetValues(time, _motionblur, _invert, _filter, _clamp, _blackOutside, _mix, _maskInvert, _mipmap, &values) ) {
+        return;
+    }
+    OFX::Matrix3x3 invtransform;
+    if ( !getInverseTransformCanonical(time, 1., values.invert, &invtransform) ) {
+        return;
+    }
+    transform3x3GetRegionsOfInterestFast(args, _srcClip, invtransform, values, rois);
+}
+
+bool
+CornerPinPlugin::renderFast(const OFX::RenderArguments &args)
+{
+    const double time = args.time;
+    Transform3x3FastRenderValues values;
+    if ( !transform3x3FastRenderGetValues(time, _motionblur, _invert, _filter, _clamp, _blackOutside, _mix, _maskInvert, _mipmap, &values) ) {
+        return false;
+    }
+    OFX::Matrix3x3 invtransform;
+    if ( !getInverseTransformCanonical(time, 1., values.invert, &invtransform) ) {
+        return false;
+    }
+
+    return transform3x3RenderFast(*this, args, _dstClip, _srcClip, _maskClip, invtransform, values);
+}
+
 class CornerPinTransformInteract : public OFX::OverlayInteract
 {
 public:
@@ -1193,6 +1251,9 @@ CornerPinPluginDescribeInContext(OFX::ImageEffectDescriptor &desc, OFX::ContextE
             page->addChild(*param);
         }
     }
+
+    // mipmap
+    mipmapTransformDescribeParams(desc, page);
 }
 
 mDeclarePluginFactory(CornerPinPluginFactory, {}, {});
@@ -77,11 +77,16 @@
 
 #ifdef WIN32
 #include <windows.h>
+#else
+#include <sys/time.h>
 #endif
  
 #include <cstring>
 #include <cstdlib>
+#include <iostream>
+#include <fstream>
 #include <sstream>
+#include <algorithm>
 #include <stdexcept>
 #include <new>
 #include <cassert>
@@ -289,6 +294,434 @@ static int (*OfxGetNumberOfPlugins_binary)(void) = 0;
 static OfxPlugin* (*OfxGetPlugin_binary)(int) = 0;
 static std::vector<OfxSetHost*> gPluginsSetHost;
 
+////////////////////////////////////////////////////////////////////////////////
+// profiling
+// If OFX_DEBUGPROXY_PROFILE is set, the wall-time of every action and of the image
+// effect suite calls is recorded, and a report is written to
+// $OFX_DEBUGPROXY_PROFILE.<pluginIdentifier>.csv and .json when the plugin is unloaded.
+// Tracing is disabled in that mode, since printing would bias the timings.
+
+// bucket k of the latency histograms counts the calls that took less than 2^k microseconds
+// (and at least 2^(k-1) microseconds), the last bucket counts all the longer calls
+#define kProfileBuckets 32
+
+struct ProfileEntry {
+    unsigned long count;
+    double total; // seconds
+    double host;  // seconds spent in host suite calls made during the action (same thread only)
+    double min;
+    double max;
+    unsigned long histogram[kProfileBuckets];
+
+    ProfileEntry() : count(0), total(0.), host(0.), min(0.), max(0.)
+    {
+        std::fill(histogram, histogram + kProfileBuckets, 0UL);
+    }
+};
+
+typedef std::map<std::string, ProfileEntry> ProfileMap;
+
+// for each plugin, the profile of each action and of each suite call
+static std::vector<ProfileMap> gProfileActions;
+static std::vector<ProfileMap> gProfileSuites;
+static std::vector<OfxMutexHandle> gProfileMutex;
+
+#if defined(_MSC_VER)
+#define OFX_DEBUG_PROXY_THREAD_LOCAL __declspec(thread)
+#else
+#define OFX_DEBUG_PROXY_THREAD_LOCAL __thread
+#endif
+// time spent in host suite calls by this thread since the current action started
+static OFX_DEBUG_PROXY_THREAD_LOCAL double gProfileHostTime = 0.;
+
+static std::ostream gNullStream(0);
+
+// the profile report path prefix, or NULL if profiling is disabled
+static const char*
+profilePath()
+{
+    static bool initialized = false;
+    static const char* path = 0;
+    if (!initialized) {
+        path = std::getenv("OFX_DEBUGPROXY_PROFILE");
+        if (path && *path == '\0') {
+            path = 0;
+        }
+        initialized = true;
+    }
+    return path;
+}
+
+// the stream used to trace the communication between the host and the plugin
+inline std::ostream&
+trace()
+{
+    return profilePath() ? gNullStream : std::cout;
+}
+
+static double
+profileNow()
+{
+#ifdef WIN32
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+inline double
+profileStart()
+{
+    return profilePath() ? profileNow() : 0.;
+}
+
+static void
+profileRecord(std::vector<ProfileMap>& maps, int nth, const std::string& name, double t, double host)
+{
+    OfxMutexHandle mutex = (nth < (int)gProfileMutex.size()) ? gProfileMutex[nth] : 0;
+    if (mutex) {
+        gThreadHost[nth]->mutexLock(mutex);
+    }
+    ProfileEntry& e = maps[nth][name];
+    if (e.count == 0 || t < e.min) {
+        e.min = t;
+    }
+    if (t > e.max) {
+        e.max = t;
+    }
+    ++e.count;
+    e.total += t;
+    e.host += host;
+    int bucket = 0;
+    for (double us = t * 1e6; us >= 1. && bucket < kProfileBuckets - 1; us *= 0.5) {
+        ++bucket;
+    }
+    ++e.histogram[bucket];
+    if (mutex) {
+        gThreadHost[nth]->mutexUnLock(mutex);
+    }
+}
+
+// record a host suite call that started at t0 (as returned by profileStart())
+inline void
+profileSuiteCall(int nth, const char* name, double t0)
+{
+    if (!profilePath()) {
+        return;
+    }
+    double t = profileNow() - t0;
+    gProfileHostTime += t;
+    profileRecord(gProfileSuites, nth, name, t, t);
+}
+
+static void
+profileWriteCSV(std::ostream& os, const char* kind, const ProfileMap& m)
+{
+    for (ProfileMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+        const ProfileEntry& e = it->second;
+        os << kind << ',' << it->first << ',' << e.count << ',' << e.total << ',' << (e.count ? e.total / e.count * 1e6 : 0.)
+           << ',' << e.min * 1e6 << ',' << e.max * 1e6 << ',' << e.host << ',' << e.total - e.host;
+        for (int k = 0; k < kProfileBuckets; ++k) {
+            os << ',' << e.histogram[k];
+        }
+        os << std::endl;
+    }
+}
+
+static void
+profileWriteJSON(std::ostream& os, const ProfileMap& m)
+{
+    bool first = true;
+    for (ProfileMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+        const ProfileEntry& e = it->second;
+        os << (first ? "\n" : ",\n");
+        first = false;
+        os << "    {\"name\": \"" << it->first << "\", \"count\": " << e.count << ", \"total\": " << e.total
+           << ", \"mean\": " << (e.count ? e.total / e.count : 0.) << ", \"min\": " << e.min << ", \"max\": " << e.max
+           << ", \"host\": " << e.host << ", \"plugin\": " << e.total - e.host << ", \"histogram\": [";
+        for (int k = 0; k < kProfileBuckets; ++k) {
+            os << (k ? ", " : "") << e.histogram[k];
+        }
+        os << "]}";
+    }
+    os << "\n  ]";
+}
+
+// write the profile report of a plugin (called on unload)
+static void
+profileDump(int nth)
+{
+    const std::string prefix = std::string(profilePath()) + "." + gPlugins[nth].pluginIdentifier;
+    {
+        const std::string filename = prefix + ".csv";
+        std::ofstream os(filename.c_str());
+        os << "kind,name,count,total_s,mean_us,min_us,max_us,host_s,plugin_s";
+        for (int k = 0; k < kProfileBuckets - 1; ++k) {
+            os << ",lt" << (1UL << k) << "us";
+        }
+        os << ",ge" << (1UL << (kProfileBuckets - 2)) << "us" << std::endl;
+        profileWriteCSV(os, "action", gProfileActions[nth]);
+        profileWriteCSV(os, "suite", gProfileSuites[nth]);
+        std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ": profile written to " << filename << std::endl;
+    }
+    {
+        const std::string filename = prefix + ".json";
+        std::ofstream os(filename.c_str());
+        os << "{\n  \"plugin\": \"" << gPlugins[nth].pluginIdentifier << "\",\n";
+        os << "  \"histogram_bounds_us\": [";
+        for (int k = 0; k < kProfileBuckets - 1; ++k) {
+            os << (k ? ", " : "") << (1UL << k);
+        }
+        os << "],\n  \"actions\": [";
+        profileWriteJSON(os, gProfileActions[nth]);
+        os << ",\n  \"suites\": [";
+        profileWriteJSON(os, gProfileSuites[nth]);
+        os << "\n}" << std::endl;
+        std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ": profile written to " << filename << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// image memory accounting
+// For each plugin instance, we keep track of the images fetched by clipGetImage and
+// clipGetImagePlane and of the memory allocated by imageMemoryAlloc, in order to know the
+// number of bytes fetched per render, and the peak number of images and bytes held at once.
+// Handles that were not released when the instance is destroyed are reported as leaks.
+// When profiling, the per-instance figures are written to
+// $OFX_DEBUGPROXY_PROFILE.<pluginIdentifier>.memory.csv when the plugin is unloaded.
+
+struct MemoryStats {
+    unsigned long renders;
+    unsigned long images;        // number of images fetched
+    double fetchedBytes;         // total bytes fetched
+    double renderFetchedBytesMax; // max bytes fetched by a single render action
+    unsigned long liveImages;
+    unsigned long peakImages;
+    unsigned long liveMemory;    // number of image memory handles
+    size_t liveBytes;            // bytes held in images and image memory
+    size_t peakBytes;
+
+    MemoryStats() : renders(0), images(0), fetchedBytes(0.), renderFetchedBytesMax(0.), liveImages(0), peakImages(0), liveMemory(0), liveBytes(0), peakBytes(0) {}
+};
+
+struct LiveHandle {
+    OfxImageEffectHandle instance;
+    size_t bytes;
+};
+
+// for each plugin, the stats of each live instance, the instance owning each clip, and the live handles.
+// the host may return the same image handle several times, hence the multimap.
+static std::vector<std::map<OfxImageEffectHandle, MemoryStats> > gMemoryStats;
+static std::vector<std::map<OfxImageClipHandle, OfxImageEffectHandle> > gClipInstances;
+static std::vector<std::multimap<OfxPropertySetHandle, LiveHandle> > gLiveImages;
+static std::vector<std::map<OfxImageMemoryHandle, LiveHandle> > gLiveMemory;
+// the stats of the destroyed instances, for the profile report
+static std::vector<std::list<std::pair<OfxImageEffectHandle, MemoryStats> > > gMemoryReports;
+static std::vector<OfxMutexHandle> gMemoryMutex;
+
+// bytes fetched by this thread since the current action started
+static OFX_DEBUG_PROXY_THREAD_LOCAL double gRenderFetchedBytes = 0.;
+
+class MemoryLocker
+{
+public:
+    explicit MemoryLocker(int nth) : _nth(nth)
+    {
+        if (gMemoryMutex[_nth]) {
+            gThreadHost[_nth]->mutexLock(gMemoryMutex[_nth]);
+        }
+    }
+    ~MemoryLocker()
+    {
+        if (gMemoryMutex[_nth]) {
+            gThreadHost[_nth]->mutexUnLock(gMemoryMutex[_nth]);
+        }
+    }
+private:
+    int _nth;
+};
+
+static size_t
+imageBytes(int nth, OfxPropertySetHandle imageHandle)
+{
+    int rowBytes = 0;
+    int bounds[4] = {0, 0, 0, 0};
+    gPropHost[nth]->propGetInt(imageHandle, kOfxImagePropRowBytes, 0, &rowBytes);
+    gPropHost[nth]->propGetIntN(imageHandle, kOfxImagePropBounds, 4, bounds);
+    if (bounds[3] <= bounds[1]) {
+        return 0;
+    }
+    return (size_t)std::abs(rowBytes) * (size_t)(bounds[3] - bounds[1]);
+}
+
+static void
+memoryAcquire(MemoryStats& m, size_t bytes)
+{
+    m.liveBytes += bytes;
+    if (m.liveBytes > m.peakBytes) {
+        m.peakBytes = m.liveBytes;
+    }
+}
+
+static void
+memoryClipHandle(int nth, OfxImageEffectHandle instance, OfxImageClipHandle clip)
+{
+    MemoryLocker l(nth);
+    gClipInstances[nth][clip] = instance;
+}
+
+static void
+memoryImageFetched(int nth, OfxImageClipHandle clip, OfxPropertySetHandle imageHandle)
+{
+    size_t bytes = imageBytes(nth, imageHandle);
+    gRenderFetchedBytes += bytes;
+    MemoryLocker l(nth);
+    std::map<OfxImageClipHandle, OfxImageEffectHandle>::const_iterator it = gClipInstances[nth].find(clip);
+    LiveHandle h;
+    h.instance = (it == gClipInstances[nth].end()) ? 0 : it->second;
+    h.bytes = bytes;
+    gLiveImages[nth].insert(std::make_pair(imageHandle, h));
+    MemoryStats& m = gMemoryStats[nth][h.instance];
+    ++m.images;
+    m.fetchedBytes += bytes;
+    ++m.liveImages;
+    if (m.liveImages > m.peakImages) {
+        m.peakImages = m.liveImages;
+    }
+    memoryAcquire(m, bytes);
+}
+
+static void
+memoryImageReleased(int nth, OfxPropertySetHandle imageHandle)
+{
+    MemoryLocker l(nth);
+    std::multimap<OfxPropertySetHandle, LiveHandle>::iterator it = gLiveImages[nth].find(imageHandle);
+    if (it == gLiveImages[nth].end()) {
+        std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipReleaseImage(" << imageHandle << "): Error: image was not fetched or already released" << std::endl;
+        return;
+    }
+    MemoryStats& m = gMemoryStats[nth][it->second.instance];
+    --m.liveImages;
+    m.liveBytes -= it->second.bytes;
+    gLiveImages[nth].erase(it);
+}
+
+static void
+memoryAllocated(int nth, OfxImageEffectHandle instance, size_t nBytes, OfxImageMemoryHandle memoryHandle)
+{
+    MemoryLocker l(nth);
+    LiveHandle h;
+    h.instance = instance;
+    h.bytes = nBytes;
+    gLiveMemory[nth][memoryHandle] = h;
+    MemoryStats& m = gMemoryStats[nth][instance];
+    ++m.liveMemory;
+    memoryAcquire(m, nBytes);
+}
+
+static void
+memoryFreed(int nth, OfxImageMemoryHandle memoryHandle)
+{
+    MemoryLocker l(nth);
+    std::map<OfxImageMemoryHandle, LiveHandle>::iterator it = gLiveMemory[nth].find(memoryHandle);
+    if (it == gLiveMemory[nth].end()) {
+        std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryFree(" << memoryHandle << "): Error: memory was not allocated or already freed" << std::endl;
+        return;
+    }
+    MemoryStats& m = gMemoryStats[nth][it->second.instance];
+    --m.liveMemory;
+    m.liveBytes -= it->second.bytes;
+    gLiveMemory[nth].erase(it);
+}
+
+// called at the end of the render action, with the number of bytes fetched by the action
+static void
+memoryRenderDone(int nth, OfxImageEffectHandle instance, double bytes)
+{
+    MemoryLocker l(nth);
+    MemoryStats& m = gMemoryStats[nth][instance];
+    ++m.renders;
+    if (bytes > m.renderFetchedBytesMax) {
+        m.renderFetchedBytesMax = bytes;
+    }
+}
+
+// print the stats of an instance, report the leaked handles and forget about them
+static void
+memoryInstanceDone(int nth, OfxImageEffectHandle instance)
+{
+    MemoryLocker l(nth);
+    std::map<OfxImageEffectHandle, MemoryStats>::iterator it = gMemoryStats[nth].find(instance);
+    if (it == gMemoryStats[nth].end()) {
+        return;
+    }
+    const MemoryStats& m = it->second;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "(" << instance << "): memory: renders=" << m.renders << " images=" << m.images
+            << " fetchedBytes=" << m.fetchedBytes << " renderFetchedBytesMax=" << m.renderFetchedBytesMax
+            << " peakImages=" << m.peakImages << " peakBytes=" << m.peakBytes << std::endl;
+    if (m.liveImages || m.liveMemory) {
+        std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "(" << instance << "): Error: leaked " << m.liveImages << " images and "
+                  << m.liveMemory << " image memory handles (" << m.liveBytes << " bytes):";
+        for (std::multimap<OfxPropertySetHandle, LiveHandle>::iterator i = gLiveImages[nth].begin(); i != gLiveImages[nth].end();) {
+            if (i->second.instance == instance) {
+                std::cout << ' ' << i->first;
+                gLiveImages[nth].erase(i++);
+            } else {
+                ++i;
+            }
+        }
+        for (std::map<OfxImageMemoryHandle, LiveHandle>::iterator i = gLiveMemory[nth].begin(); i != gLiveMemory[nth].end();) {
+            if (i->second.instance == instance) {
+                std::cout << ' ' << i->first;
+                gLiveMemory[nth].erase(i++);
+            } else {
+                ++i;
+            }
+        }
+        std::cout << std::endl;
+    }
+    for (std::map<OfxImageClipHandle, OfxImageEffectHandle>::iterator i = gClipInstances[nth].begin(); i != gClipInstances[nth].end();) {
+        if (i->second == instance) {
+            gClipInstances[nth].erase(i++);
+        } else {
+            ++i;
+        }
+    }
+    if (profilePath()) {
+        gMemoryReports[nth].push_back(*it);
+    }
+    gMemoryStats[nth].erase(it);
+}
+
+// write the memory report of a plugin (called on unload)
+static void
+memoryDump(int nth)
+{
+    // instances that were never destroyed
+    while (!gMemoryStats[nth].empty()) {
+        memoryInstanceDone(nth, gMemoryStats[nth].begin()->first);
+    }
+    if (!profilePath()) {
+        return;
+    }
+    const std::string filename = std::string(profilePath()) + "." + gPlugins[nth].pluginIdentifier + ".memory.csv";
+    std::ofstream os(filename.c_str());
+    os << "instance,renders,images,fetched_bytes,mean_render_fetched_bytes,max_render_fetched_bytes,peak_images,peak_bytes,leaked_images,leaked_memory,leaked_bytes" << std::endl;
+    for (std::list<std::pair<OfxImageEffectHandle, MemoryStats> >::const_iterator it = gMemoryReports[nth].begin(); it != gMemoryReports[nth].end(); ++it) {
+        const MemoryStats& m = it->second;
+        os << it->first << ',' << m.renders << ',' << m.images << ',' << m.fetchedBytes << ',' << (m.renders ? m.fetchedBytes / m.renders : 0.)
+           << ',' << m.renderFetchedBytesMax << ',' << m.peakImages << ',' << m.peakBytes
+           << ',' << m.liveImages << ',' << m.liveMemory << ',' << m.liveBytes << std::endl;
+    }
+    gMemoryReports[nth].clear();
+    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ": memory report written to " << filename << std::endl;
+}
+
 static const char* help_string =
 "OFX DebugProxy Help:\n"
 "- Specify the PATH to the plugin to be debugged using the environment variable\n"
@@ -326,6 +759,13 @@ static const char* help_string =
 "  or recompiled, the OFX host may not take this into account, since the \n"
 "  DebugProxy plugin itself is unchanged. You have to either clean up the OFX\n"
 "  Plugin cache in the host, or modify the date of the DebugProxy binary.\n"
+"- To profile the plugin, set the environment variable OFX_DEBUGPROXY_PROFILE to\n"
+"  a path prefix, e.g. OFX_DEBUGPROXY_PROFILE=/tmp/profile. Tracing is then\n"
+"  disabled, the time spent in each action and in the image effect suite calls is\n"
+"  recorded, and a report is written to /tmp/profile.<pluginIdentifier>.csv and\n"
+"  /tmp/profile.<pluginIdentifier>.json when the plugin is unloaded. The images\n"
+"  fetched and the image memory held by each instance are written to\n"
+"  /tmp/profile.<pluginIdentifier>.memory.csv.\n"
 #if defined(__linux__)
 "  On Linux, this can be done using the following command:\n"
 "  touch "OFX_PATH"DebugProxy.ofx.bundle/Contents/Linux-x86*/DebugProxy.ofx\n"
@@ -446,6 +886,15 @@ fetchHostSuites(int nth)
 #ifdef OFX_DEBUG_PROXY_CLIPS
         gClips.resize(nth+1);
 #endif
+        gProfileActions.resize(nth+1);
+        gProfileSuites.resize(nth+1);
+        gProfileMutex.resize(nth+1);
+        gMemoryStats.resize(nth+1);
+        gClipInstances.resize(nth+1);
+        gLiveImages.resize(nth+1);
+        gLiveMemory.resize(nth+1);
+        gMemoryReports.resize(nth+1);
+        gMemoryMutex.resize(nth+1);
     }
 
     gEffectHost[nth]                 = (OfxImageEffectSuiteV1 *) gHost[nth]->fetchSuite(gHost[nth]->host, kOfxImageEffectSuite, 1);
@@ -683,117 +1132,117 @@ inline void
 printHostDescription(int nth)
 {
     const ImageEffectHostDescription &hostDesc = gHostDescription[nth];
-    std::cout << "OFX DebugProxy: host description follows" << std::endl;
-    std::cout << "OFX API version " << hostDesc.APIVersionMajor << '.' << hostDesc.APIVersionMinor << std::endl;
-    std::cout << "type=" << hostDesc.type << std::endl;
-    std::cout << "hostName=" << hostDesc.hostName << std::endl;
-    std::cout << "hostLabel=" << hostDesc.hostLabel << std::endl;
-    std::cout << "hostVersion=" << hostDesc.versionMajor << '.' << hostDesc.versionMinor << '.' << hostDesc.versionMicro;
-    std::cout << " (" << hostDesc.versionLabel << ')' << std::endl;
-    std::cout << "hostIsBackground=" << hostDesc.hostIsBackground << std::endl;
-    std::cout << "supportsOverlays=" << hostDesc.supportsOverlays << std::endl;
-    std::cout << "supportsMultiResolution=" << hostDesc.supportsMultiResolution << std::endl;
-    std::cout << "supportsTiles=" << hostDesc.supportsTiles << std::endl;
-    std::cout << "temporalClipAccess=" << hostDesc.temporalClipAccess << std::endl;
+    trace() << "OFX DebugProxy: host description follows" << std::endl;
+    trace() << "OFX API version " << hostDesc.APIVersionMajor << '.' << hostDesc.APIVersionMinor << std::endl;
+    trace() << "type=" << hostDesc.type << std::endl;
+    trace() << "hostName=" << hostDesc.hostName << std::endl;
+    trace() << "hostLabel=" << hostDesc.hostLabel << std::endl;
+    trace() << "hostVersion=" << hostDesc.versionMajor << '.' << hostDesc.versionMinor << '.' << hostDesc.versionMicro;
+    trace() << " (" << hostDesc.versionLabel << ')' << std::endl;
+    trace() << "hostIsBackground=" << hostDesc.hostIsBackground << std::endl;
+    trace() << "supportsOverlays=" << hostDesc.supportsOverlays << std::endl;
+    trace() << "supportsMultiResolution=" << hostDesc.supportsMultiResolution << std::endl;
+    trace() << "supportsTiles=" << hostDesc.supportsTiles << std::endl;
+    trace() << "temporalClipAccess=" << hostDesc.temporalClipAccess << std::endl;
     bool first;
     first = true;
-    std::cout << "supportedComponents=";
+    trace() << "supportedComponents=";
     for (std::vector<std::string>::const_iterator it = hostDesc._supportedComponents.begin(); it != hostDesc._supportedComponents.end(); ++it) {
         if (!first) {
-            std::cout << ",";
+            trace() << ",";
         }
         first = false;
-        std::cout << *it;
+        trace() << *it;
     }
-    std::cout << std::endl;
+    trace() << std::endl;
     first = true;
-    std::cout << "supportedContexts=";
+    trace() << "supportedContexts=";
     for (std::vector<std::string>::const_iterator it = hostDesc._supportedContexts.begin(); it != hostDesc._supportedContexts.end(); ++it) {
         if (!first) {
-            std::cout << ",";
+            trace() << ",";
         }
         first = false;
-        std::cout << *it;
+        trace() << *it;
     }
-    std::cout << std::endl;
+    trace() << std::endl;
     first = true;
-    std::cout << "supportedPixelDepths=";
+    trace() << "supportedPixelDepths=";
     for (std::vector<std::string>::const_iterator it = hostDesc._supportedPixelDepths.begin(); it != hostDesc._supportedPixelDepths.end(); ++it) {
         if (!first) {
-            std::cout << ",";
+            trace() << ",";
         }
         first = false;
-        std::cout << *it;
-    }
-    std::cout << std::endl;
-    std::cout << "supportsMultipleClipDepths=" << hostDesc.supportsMultipleClipDepths << std::endl;
-    std::cout << "supportsMultipleClipPARs=" << hostDesc.supportsMultipleClipPARs << std::endl;
-    std::cout << "supportsSetableFrameRate=" << hostDesc.supportsSetableFrameRate << std::endl;
-    std::cout << "supportsSetableFielding=" << hostDesc.supportsSetableFielding << std::endl;
-    std::cout << "supportsStringAnimation=" << hostDesc.supportsStringAnimation << std::endl;
-    std::cout << "supportsCustomInteract=" << hostDesc.supportsCustomInteract << std::endl;
-    std::cout << "supportsChoiceAnimation=" << hostDesc.supportsChoiceAnimation << std::endl;
-    std::cout << "supportsBooleanAnimation=" << hostDesc.supportsBooleanAnimation << std::endl;
-    std::cout << "supportsCustomAnimation=" << hostDesc.supportsCustomAnimation << std::endl;
-    std::cout << "supportsParametricAnimation=" << hostDesc.supportsParametricAnimation << std::endl;
+        trace() << *it;
+    }
+    trace() << std::endl;
+    trace() << "supportsMultipleClipDepths=" << hostDesc.supportsMultipleClipDepths << std::endl;
+    trace() << "supportsMultipleClipPARs=" << hostDesc.supportsMultipleClipPARs << std::endl;
+    trace() << "supportsSetableFrameRate=" << hostDesc.supportsSetableFrameRate << std::endl;
+    trace() << "supportsSetableFielding=" << hostDesc.supportsSetableFielding << std::endl;
+    trace() << "supportsStringAnimation=" << hostDesc.supportsStringAnimation << std::endl;
+    trace() << "supportsCustomInteract=" << hostDesc.supportsCustomInteract << std::endl;
+    trace() << "supportsChoiceAnimation=" << hostDesc.supportsChoiceAnimation << std::endl;
+    trace() << "supportsBooleanAnimation=" << hostDesc.supportsBooleanAnimation << std::endl;
+    trace() << "supportsCustomAnimation=" << hostDesc.supportsCustomAnimation << std::endl;
+    trace() << "supportsParametricAnimation=" << hostDesc.supportsParametricAnimation << std::endl;
 #ifdef OFX_EXTENSIONS_NUKE
-    std::cout << "canTransform=" << hostDesc.canTransform << std::endl;
+    trace() << "canTransform=" << hostDesc.canTransform << std::endl;
 #endif
-    std::cout << "maxParameters=" << hostDesc.maxParameters << std::endl;
-    std::cout << "pageRowCount=" << hostDesc.pageRowCount << std::endl;
-    std::cout << "pageColumnCount=" << hostDesc.pageColumnCount << std::endl;
-    std::cout << "suites=";
+    trace() << "maxParameters=" << hostDesc.maxParameters << std::endl;
+    trace() << "pageRowCount=" << hostDesc.pageRowCount << std::endl;
+    trace() << "pageColumnCount=" << hostDesc.pageColumnCount << std::endl;
+    trace() << "suites=";
     if (gEffectHost[nth]) {
-        std::cout << kOfxImageEffectSuite << ',';
+        trace() << kOfxImageEffectSuite << ',';
     }
     if (gPropHost[nth]) {
-        std::cout << kOfxPropertySuite << ',';
+        trace() << kOfxPropertySuite << ',';
     }
     if (gParamHost[nth]) {
-        std::cout << kOfxParameterSuite << ',';
+        trace() << kOfxParameterSuite << ',';
     }
     if (gMemoryHost[nth]) {
-        std::cout << kOfxMemorySuite << ',';
+        trace() << kOfxMemorySuite << ',';
     }
     if (gMessageHost[nth]) {
-        std::cout << kOfxMessageSuite << ',';
+        trace() << kOfxMessageSuite << ',';
     }
     if (gMessageV2Host[nth]) {
-        std::cout << kOfxMessageSuite << "V2" << ',';
+        trace() << kOfxMessageSuite << "V2" << ',';
     }
     if (gProgressHost[nth]) {
-        std::cout << kOfxProgressSuite << ',';
+        trace() << kOfxProgressSuite << ',';
     }
     if (gTimeLineHost[nth]) {
-        std::cout << kOfxTimeLineSuite << ',';
+        trace() << kOfxTimeLineSuite << ',';
     }
     if (gParametricParameterHost[nth]) {
-        std::cout << kOfxParametricParameterSuite << ',';
+        trace() << kOfxParametricParameterSuite << ',';
     }
 #ifdef OFX_EXTENSIONS_NUKE
     if (gCameraHost[nth]) {
-        std::cout << kNukeOfxCameraSuite << ',';
+        trace() << kNukeOfxCameraSuite << ',';
     }
     if (gImageEffectPlaneV1Host[nth]) {
-        std::cout << kFnOfxImageEffectPlaneSuite << "V1" << ',';
+        trace() << kFnOfxImageEffectPlaneSuite << "V1" << ',';
     }
     if (gImageEffectPlaneV2Host[nth]) {
-        std::cout << kFnOfxImageEffectPlaneSuite << "V2" << ',';
+        trace() << kFnOfxImageEffectPlaneSuite << "V2" << ',';
     }
 #endif
 #ifdef OFX_EXTENSIONS_VEGAS
     if (gVegasProgressHost[nth]) {
-        std::cout << kOfxVegasProgressSuite << ',';
+        trace() << kOfxVegasProgressSuite << ',';
     }
     if (gVegasStereoscopicImageHost[nth]) {
-        std::cout << kOfxVegasStereoscopicImageEffectSuite << ',';
+        trace() << kOfxVegasStereoscopicImageEffectSuite << ',';
     }
     if (gVegasKeyframeHost[nth]) {
-        std::cout << kOfxVegasKeyframeSuite << ',';
+        trace() << kOfxVegasKeyframeSuite << ',';
     }
 #endif
-    std::cout << std::endl;
-    std::cout << "OFX DebugProxy: host description finished" << std::endl;
+    trace() << std::endl;
+    trace() << "OFX DebugProxy: host description finished" << std::endl;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -880,7 +1329,7 @@ overlayMain(int nth, const char *action, const void *handle, OfxPropertySetHandl
     }
 
 
-    std::cout << "OFX DebugProxy: " << ss.str() << std::endl;
+    trace() << "OFX DebugProxy: " << ss.str() << std::endl;
 
     st =  gPluginsOverlayMain[nth](action, handle, inArgs, outArgs);
 
@@ -932,9 +1381,9 @@ overlayMain(int nth, const char *action, const void *handle, OfxPropertySetHandl
   }
   
   if (ssr.str().empty()) {
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ".i." << action << "->" << OFX::StatStr(st) << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ".i." << action << "->" << OFX::StatStr(st) << std::endl;
   } else {
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ".i." << action << "->" << OFX::StatStr(st) << ": " << ssr.str() << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ".i." << action << "->" << OFX::StatStr(st) << ": " << ssr.str() << std::endl;
   }
 
   return st;
@@ -1017,6 +1466,12 @@ pluginMain(int nth, const char *action, const void *handle, OfxPropertySetHandle
       if ((stat = fetchHostDescription(nth)) != kOfxStatOK)
           return stat;
       printHostDescription(nth);
+      if (profilePath() && gThreadHost[nth] && !gProfileMutex[nth]) {
+          gThreadHost[nth]->mutexCreate(&gProfileMutex[nth], 0);
+      }
+      if (gThreadHost[nth] && !gMemoryMutex[nth]) {
+          gThreadHost[nth]->mutexCreate(&gMemoryMutex[nth], 0);
+      }
   }
 
   std::stringstream ss;
@@ -1287,10 +1742,43 @@ pluginMain(int nth, const char *action, const void *handle, OfxPropertySetHandle
       ss << "(" << handle << ") [UNKNOWN ACTION]";
     }
 
-    std::cout << "OFX DebugProxy: " << ss.str() << std::endl;
+    trace() << "OFX DebugProxy: " << ss.str() << std::endl;
 
     assert(gPluginsMainEntry[nth]);
-    st =  gPluginsMainEntry[nth](action, handle, inArgs, outArgs);
+    // actions may be nested, and images may be fetched outside of the render action (e.g. by an analysis):
+    // only count the bytes fetched by this action
+    double outerFetchedBytes = gRenderFetchedBytes;
+    gRenderFetchedBytes = 0.;
+    if (profilePath()) {
+      // actions may be nested (e.g. if a host call renders another instance)
+      double outerHostTime = gProfileHostTime;
+      gProfileHostTime = 0.;
+      double t0 = profileNow();
+      st =  gPluginsMainEntry[nth](action, handle, inArgs, outArgs);
+      double t = profileNow() - t0;
+      profileRecord(gProfileActions, nth, action, t, gProfileHostTime);
+      gProfileHostTime = outerHostTime;
+      if (strcmp(action, kOfxActionUnload) == 0) {
+        profileDump(nth);
+        gProfileActions[nth].clear();
+        gProfileSuites[nth].clear();
+        if (gProfileMutex[nth]) {
+          gThreadHost[nth]->mutexDestroy(gProfileMutex[nth]);
+          gProfileMutex[nth] = 0;
+        }
+      }
+    } else {
+      st =  gPluginsMainEntry[nth](action, handle, inArgs, outArgs);
+    }
+    double fetchedBytes = gRenderFetchedBytes;
+    gRenderFetchedBytes = outerFetchedBytes;
+    if (strcmp(action, kOfxActionUnload) == 0) {
+      memoryDump(nth);
+      if (gMemoryMutex[nth]) {
+        gThreadHost[nth]->mutexDestroy(gMemoryMutex[nth]);
+        gMemoryMutex[nth] = 0;
+      }
+    }
 
     
     // post-hooks on some actions (e.g. print or modify result)
@@ -1326,6 +1814,7 @@ pluginMain(int nth, const char *action, const void *handle, OfxPropertySetHandle
     } 
     else if (strcmp(action, kOfxActionDestroyInstance) == 0) {
       // no outArgs
+      memoryInstanceDone(nth, (OfxImageEffectHandle)handle);
     } 
     else if (strcmp(action, kOfxActionBeginInstanceChanged) == 0 ||
             strcmp(action, kOfxActionEndInstanceChanged) == 0) {
@@ -1519,6 +2008,8 @@ pluginMain(int nth, const char *action, const void *handle, OfxPropertySetHandle
     }    
     else if (strcmp(action, kOfxImageEffectActionRender) == 0) {
       // no outArgs
+      memoryRenderDone(nth, (OfxImageEffectHandle)handle, fetchedBytes);
+      ssr << "(fetched " << fetchedBytes << " bytes)";
     }    
     else if (strcmp(action, kOfxImageEffectActionBeginSequenceRender) == 0 ||
             strcmp(action, kOfxImageEffectActionEndSequenceRender) == 0) {
@@ -1636,9 +2127,9 @@ pluginMain(int nth, const char *action, const void *handle, OfxPropertySetHandle
   
 
   if (ssr.str().empty()) {
-    std::cout << "OFX DebugProxy: " << ss.str() << "->" << OFX::StatStr(st) << std::endl;
+    trace() << "OFX DebugProxy: " << ss.str() << "->" << OFX::StatStr(st) << std::endl;
   } else {
-    std::cout << "OFX DebugProxy: " << ss.str() << "->" << OFX::StatStr(st) << ": " << ssr.str() << std::endl;
+    trace() << "OFX DebugProxy: " << ss.str() << "->" << OFX::StatStr(st) << ": " << ssr.str() << std::endl;
   }
 
   return st;
@@ -1681,7 +2172,7 @@ const void* fetchSuiteNth(OfxPropertySetHandle host, const char *suiteName, int
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..fetchSuite(" << suiteName << "," << suiteVersion << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..fetchSuite(" << suiteName << "," << suiteVersion << ")->" << suite << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..fetchSuite(" << suiteName << "," << suiteVersion << ")->" << suite << std::endl;
     if (strcmp(suiteName, kOfxImageEffectSuite) == 0 && suiteVersion == 1) {
         assert(nth < gEffectHost.size() && suite == gEffectHost[nth]);
         return &gEffectProxy[nth];
@@ -1712,7 +2203,7 @@ getPropertySetNth(OfxImageEffectHandle imageEffect,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getPropertySet(" << imageEffect << ", " << propHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getPropertySet(" << imageEffect << ")->" << OFX::StatStr(st) << ": " << *propHandle << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getPropertySet(" << imageEffect << ")->" << OFX::StatStr(st) << ": " << *propHandle << std::endl;
     return st;
 }
 
@@ -1747,7 +2238,7 @@ getParamSetNth(OfxImageEffectHandle imageEffect,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getParamSet(" << imageEffect << ", " << paramSet << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getParamSet(" << imageEffect << ")->" << OFX::StatStr(st) << ": " << *paramSet << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getParamSet(" << imageEffect << ")->" << OFX::StatStr(st) << ": " << *paramSet << std::endl;
     return st;
 }
 
@@ -1783,7 +2274,7 @@ clipDefineNth(OfxImageEffectHandle imageEffect,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipDefine(" << imageEffect << ", " << name << ", " << propertySet << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipDefine(" << imageEffect << ", " << name << ")->" << OFX::StatStr(st) << ": " << *propertySet << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipDefine(" << imageEffect << ", " << name << ")->" << OFX::StatStr(st) << ": " << *propertySet << std::endl;
 #ifdef OFX_DEBUG_PROXY_CLIPS
     assert(!gContexts[imageEffect].empty());
     gClips[nth][gContexts[imageEffect]].push_back(name);
@@ -1824,11 +2315,14 @@ clipGetHandleNth(OfxImageEffectHandle imageEffect,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetHandle(" << imageEffect << ", " << name << ", " << clip << ", " << propertySet << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetHandle(" << imageEffect << ", " << name << ")->" << OFX::StatStr(st) << ": (" << *clip;
+    if (st == kOfxStatOK && *clip) {
+        memoryClipHandle(nth, imageEffect, *clip);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetHandle(" << imageEffect << ", " << name << ")->" << OFX::StatStr(st) << ": (" << *clip;
     if (propertySet) {
-        std::cout << ", " << *propertySet;
+        trace() << ", " << *propertySet;
     }
-    std::cout << ")" << std::endl;
+    trace() << ")" << std::endl;
     return st;
 }
 
@@ -1863,7 +2357,7 @@ clipGetPropertySetNth(OfxImageClipHandle clip,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetPropertySet(" << clip << ", " << propHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetPropertySet(" << clip << ")->" << OFX::StatStr(st) << ": " << *propHandle << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetPropertySet(" << clip << ")->" << OFX::StatStr(st) << ": " << *propHandle << std::endl;
     return st;
 }
 
@@ -1894,17 +2388,22 @@ clipGetImageNth(OfxImageClipHandle clip,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->clipGetImage(clip, time, region, imageHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImage(" << clip << ", " << time << ", " << region << ", " << imageHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImage(" << clip << ", " << time << ")->" << OFX::StatStr(st) << ": (";
+    profileSuiteCall(nth, "clipGetImage", t0);
+    if (st == kOfxStatOK && *imageHandle) {
+        memoryImageFetched(nth, clip, *imageHandle);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImage(" << clip << ", " << time << ")->" << OFX::StatStr(st) << ": (";
     if (region) {
-        std::cout << "(" << region->x1 << "," << region->y1 << "," << region->x2 << "," << region->y2 << "), ";
+        trace() << "(" << region->x1 << "," << region->y1 << "," << region->x2 << "," << region->y2 << "), ";
     }
-    std::cout << *imageHandle << ")" << std::endl;
+    trace() << *imageHandle << ")" << std::endl;
     return st;
 }
 
@@ -1932,13 +2431,18 @@ clipReleaseImageNth(OfxPropertySetHandle imageHandle)
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->clipReleaseImage(imageHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipReleaseImage(" << imageHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipReleaseImage(" << imageHandle << ")->" << OFX::StatStr(st) << std::endl;
+    profileSuiteCall(nth, "clipReleaseImage", t0);
+    if (st == kOfxStatOK) {
+        memoryImageReleased(nth, imageHandle);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipReleaseImage(" << imageHandle << ")->" << OFX::StatStr(st) << std::endl;
     return st;
 }
 
@@ -1968,17 +2472,19 @@ clipGetRegionOfDefinitionNth(OfxImageClipHandle clip,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->clipGetRegionOfDefinition(clip, time, bounds);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetRegionOfDefinition(" << clip << ", " << time << ", " << bounds << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetRegionOfDefinition(" << clip << ", " << time << ")->" << OFX::StatStr(st);
+    profileSuiteCall(nth, "clipGetRegionOfDefinition", t0);
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetRegionOfDefinition(" << clip << ", " << time << ")->" << OFX::StatStr(st);
     if (bounds) {
-        std::cout << ": (" << bounds->x1 << "," << bounds->y1 << "," << bounds->x2 << "," << bounds->y2 << ")";
+        trace() << ": (" << bounds->x1 << "," << bounds->y1 << "," << bounds->x2 << "," << bounds->y2 << ")";
     }
-    std::cout << std::endl;
+    trace() << std::endl;
     return st;
 }
 
@@ -2006,13 +2512,15 @@ abortNth(OfxImageEffectHandle imageEffect)
 {
     int st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->abort(imageEffect);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..abort(" << imageEffect << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..abort(" << imageEffect << ")->" << st << std::endl;
+    profileSuiteCall(nth, "abort", t0);
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..abort(" << imageEffect << ")->" << st << std::endl;
     return st;
 }
 
@@ -2042,13 +2550,18 @@ imageMemoryAllocNth(OfxImageEffectHandle instanceHandle,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->imageMemoryAlloc(instanceHandle, nBytes, memoryHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryAlloc(" << instanceHandle << ", " << nBytes << ", " << memoryHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryAlloc(" << instanceHandle << ", " << nBytes << ")->" << OFX::StatStr(st) << ": " << *memoryHandle << std::endl;
+    profileSuiteCall(nth, "imageMemoryAlloc", t0);
+    if (st == kOfxStatOK && *memoryHandle) {
+        memoryAllocated(nth, instanceHandle, nBytes, *memoryHandle);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryAlloc(" << instanceHandle << ", " << nBytes << ")->" << OFX::StatStr(st) << ": " << *memoryHandle << std::endl;
     return st;
 }
 
@@ -2076,13 +2589,18 @@ imageMemoryFreeNth(OfxImageMemoryHandle memoryHandle)
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->imageMemoryFree(memoryHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryFree(" << memoryHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryFree(" << memoryHandle << ")->" << OFX::StatStr(st) << std::endl;
+    profileSuiteCall(nth, "imageMemoryFree", t0);
+    if (st == kOfxStatOK) {
+        memoryFreed(nth, memoryHandle);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryFree(" << memoryHandle << ")->" << OFX::StatStr(st) << std::endl;
     return st;
 }
 
@@ -2111,13 +2629,15 @@ imageMemoryLockNth(OfxImageMemoryHandle memoryHandle,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->imageMemoryLock(memoryHandle, returnedPtr);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryLock(" << memoryHandle << ", " << returnedPtr << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryLock(" << memoryHandle << ")->" << OFX::StatStr(st) << ": " << *returnedPtr << std::endl;
+    profileSuiteCall(nth, "imageMemoryLock", t0);
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryLock(" << memoryHandle << ")->" << OFX::StatStr(st) << ": " << *returnedPtr << std::endl;
     return st;
 }
 
@@ -2145,13 +2665,15 @@ imageMemoryUnlockNth(OfxImageMemoryHandle memoryHandle)
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gEffectHost[nth]->imageMemoryUnlock(memoryHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryUnlock(" << memoryHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryUnlock(" << memoryHandle << ")->" << OFX::StatStr(st) << std::endl;
+    profileSuiteCall(nth, "imageMemoryUnlock", t0);
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..imageMemoryUnlock(" << memoryHandle << ")->" << OFX::StatStr(st) << std::endl;
     return st;
 }
 
@@ -2221,17 +2743,22 @@ clipGetImagePlaneV1Nth(OfxImageClipHandle clip,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gImageEffectPlaneV1Host[nth]->clipGetImagePlane(clip, time, plane, region, imageHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImagePlane(" << clip << ", " << time << ", " << plane << ", " << region << ", " << imageHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImagePlane(" << clip << ", " << time << ", " << plane << ")->" << OFX::StatStr(st) << ": (";
+    profileSuiteCall(nth, "clipGetImagePlane", t0);
+    if (st == kOfxStatOK && *imageHandle) {
+        memoryImageFetched(nth, clip, *imageHandle);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImagePlane(" << clip << ", " << time << ", " << plane << ")->" << OFX::StatStr(st) << ": (";
     if (region) {
-        std::cout << "(" << region->x1 << "," << region->y1 << "," << region->x2 << "," << region->y2 << "), ";
+        trace() << "(" << region->x1 << "," << region->y1 << "," << region->x2 << "," << region->y2 << "), ";
     }
-    std::cout << *imageHandle << ")" << std::endl;
+    trace() << *imageHandle << ")" << std::endl;
     return st;
 
 }
@@ -2269,17 +2796,22 @@ clipGetImagePlaneNth(OfxImageClipHandle clip,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gImageEffectPlaneV2Host[nth]->clipGetImagePlane(clip, time, view, plane, region, imageHandle);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImagePlane(" << clip << ", " << time << ", " << view << ", " << plane << ", " << region << ", " << imageHandle << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImagePlane(" << clip << ", " << time << ", " << view << ", " << plane << ")->" << OFX::StatStr(st) << ": (";
+    profileSuiteCall(nth, "clipGetImagePlane", t0);
+    if (st == kOfxStatOK && *imageHandle) {
+        memoryImageFetched(nth, clip, *imageHandle);
+    }
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetImagePlane(" << clip << ", " << time << ", " << view << ", " << plane << ")->" << OFX::StatStr(st) << ": (";
     if (region) {
-        std::cout << "(" << region->x1 << "," << region->y1 << "," << region->x2 << "," << region->y2 << "), ";
+        trace() << "(" << region->x1 << "," << region->y1 << "," << region->x2 << "," << region->y2 << "), ";
     }
-    std::cout << *imageHandle << ")" << std::endl;
+    trace() << *imageHandle << ")" << std::endl;
     return st;
 
 }
@@ -2311,17 +2843,19 @@ static OfxStatus fnClipGetRegionOfDefinitionNth(OfxImageClipHandle clip,
 {
     OfxStatus st;
     assert(nth < gHost.size() && nth < gPluginsSetHost.size());
+    double t0 = profileStart();
     try {
         st = gImageEffectPlaneV2Host[nth]->clipGetRegionOfDefinition(clip, time, view, bounds);
     } catch (...) {
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetRegionOfDefinition(plane suite)(" << clip << ", " << time << ", " << view << ", " << bounds << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetRegionOfDefinition(plane suite)(" << clip << ", " << time << ", " << view << ")->" << OFX::StatStr(st);
+    profileSuiteCall(nth, "clipGetRegionOfDefinition", t0);
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..clipGetRegionOfDefinition(plane suite)(" << clip << ", " << time << ", " << view << ")->" << OFX::StatStr(st);
     if (bounds) {
-        std::cout << ": (" << bounds->x1 << "," << bounds->y1 << "," << bounds->x2 << "," << bounds->y2 << ")";
+        trace() << ": (" << bounds->x1 << "," << bounds->y1 << "," << bounds->x2 << "," << bounds->y2 << ")";
     }
-    std::cout << std::endl;
+    trace() << std::endl;
     return st;
 }
 
@@ -2357,8 +2891,8 @@ static OfxStatus getViewNameNth(OfxImageEffectHandle effect,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getViewName(" << effect << ", " << view << ", " << *viewName << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getViewName(" << effect << ", " << view << ", " << *viewName << ")->" << OFX::StatStr(st);
-    std::cout << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getViewName(" << effect << ", " << view << ", " << *viewName << ")->" << OFX::StatStr(st);
+    trace() << std::endl;
     return st;
 
 }
@@ -2391,8 +2925,8 @@ static OfxStatus getViewCountNth(OfxImageEffectHandle effect,
         std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getViewCount(" << effect << ", " << *nViews << "): host exception!" << std::endl;
         throw;
     }
-    std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getViewCount(" << effect << ", " << *nViews << ")->" << OFX::StatStr(st);
-    std::cout << std::endl;
+    trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << "..getViewCount(" << effect << ", " << *nViews << ")->" << OFX::StatStr(st);
+    trace() << std::endl;
     return st;
 }
 
@@ -2450,7 +2984,7 @@ OfxGetPlugin(int nth)
   gPlugins[nth].mainEntry = pluginMainNthFunc(nth);
   gPluginsOverlayMain[nth] = 0;
 
-  std::cout << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ".OfxGetPlugin(" << nth << ") -> " << plugin << ", v"
+  trace() << "OFX DebugProxy: " << gPlugins[nth].pluginIdentifier << ".OfxGetPlugin(" << nth << ") -> " << plugin << ", v"
             << plugin->pluginVersionMajor << "." << plugin->pluginVersionMinor << std::endl;
 
   return &gPlugins[nth];
@@ -2464,7 +2998,7 @@ OfxGetNumberOfPlugins(void)
      gPluginsNb = 0;
   } else {
     gPluginsNb = (*OfxGetNumberOfPlugins_binary)();
-    std::cout << "OFX DebugProxy: found " << gPluginsNb << " plugins in " << gBinaryPath << std::endl;
+    trace() << "OFX DebugProxy: found " << gPluginsNb << " plugins in " << gBinaryPath << std::endl;
     assert(OfxGetPlugin_binary);
     gPlugins.reserve(gPluginsNb);
     gHost.reserve(gPluginsNb);
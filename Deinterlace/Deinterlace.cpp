@@ -75,11 +75,18 @@
 #include <cstring> // for memcpy
 #include <cmath>
 #include <algorithm>
+#include <vector>
 #include "ofxsImageEffect.h"
 #include "ofxsMultiThread.h"
 #include "ofxsProcessing.H"
 #include "ofxsMacros.h"
 
+// SSE2 is always available on x86-64
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEINTERLACE_SSE2
+#include <emmintrin.h>
+#endif
+
 #define kPluginName          "DeinterlaceOFX"
 #define kPluginGrouping      "Time"
 #define kPluginDescription \
@@ -173,6 +180,35 @@ enum YadifModeEnum {
     eYadifModeTemporal,
 };
 
+#define kParamCacheFrames "cacheFrames"
+#define kParamCacheFramesLabel "Cache Input Frames"
+#define kParamCacheFramesHint "Keep a copy of the three input frames used by the last render, so that rendering the next or the previous frame only fetches one new input frame instead of three. This reduces the input fetch and decode traffic on hosts that do not cache images. Renders of this effect are serialized when this is checked. The copies are discarded when the input clip is changed, but the plugin is not notified when an upstream effect is modified: uncheck this while editing the input."
+
+class DeinterlaceProcessorBase;
+
+// A copy of the source frame at a given time, kept between renders.
+struct DeinterlaceCachedFrame
+{
+    OfxTime time;
+    bool exists; // false if the host gave no image at that time
+    std::vector<unsigned char> data; // contiguous rows, from bottom to top
+};
+
+// The source frames used by the last render (at lastTime-1, lastTime and lastTime+1),
+// and the properties they were fetched with.
+struct DeinterlaceFrameCache
+{
+    bool valid;
+    OfxTime lastTime;
+    OfxPointD renderScale;
+    OFX::FieldEnum field;
+    OfxRectI bounds;
+    OFX::BitDepthEnum bitDepth;
+    OFX::PixelComponentEnum components;
+    int rowBytes;
+    DeinterlaceCachedFrame frames[3];
+};
+
 class DeinterlacePlugin : public OFX::ImageEffect 
 {
 public:
@@ -184,11 +220,57 @@ public:
         mode = fetchChoiceParam("mode");
         fieldOrder = fetchChoiceParam("fieldOrder");
         parity = fetchChoiceParam("parity");
+        _cacheFrames = fetchBooleanParam(kParamCacheFrames);
+        assert(_cacheFrames);
+
+        _frameCache.valid = false;
     }
 
 private:
     virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
 
+    /* fetch a source image and check its properties */
+    const OFX::Image* fetchSourceImage(const OFX::RenderArguments &args, OfxTime time);
+
+    /* bring the frame cache to the frames needed at args.time. _frameCacheMutex must be locked. */
+    void updateFrameCache(const OFX::RenderArguments &args,
+                          const OfxRectI &bounds,
+                          OFX::BitDepthEnum bitDepth,
+                          OFX::PixelComponentEnum components);
+
+    /* discard the frame cache and free its memory */
+    void clearFrameCache();
+
+    /* deinterlace the source pixels into dst */
+    void deinterlace(OFX::Image *dst,
+                     OFX::BitDepthEnum dstBitDepth,
+                     OFX::PixelComponentEnum dstComponents,
+                     int mode,
+                     const void *srcp,
+                     const void *src,
+                     const void *srcn,
+                     int srcRowBytes,
+                     int parity,
+                     int tff);
+
+    /* set up and run a processor */
+    void setupAndProcess(DeinterlaceProcessorBase &processor,
+                         int mode,
+                         OFX::Image *dst,
+                         const void *srcp,
+                         const void *src,
+                         const void *srcn,
+                         int srcRowBytes,
+                         int parity,
+                         int tff);
+
+    virtual void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
+
+    virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+
+    /** @brief called when the host wants the plugin to free its private caches */
+    virtual void purgeCaches() OVERRIDE FINAL;
+
     /** @brief get the clip preferences */
     virtual void getClipPreferences(OFX::ClipPreferencesSetter &clipPreferences) OVERRIDE FINAL;
 
@@ -207,7 +289,10 @@ private:
     OFX::Clip *_srcClip;
 
     OFX::ChoiceParam *fieldOrder, *mode, *parity;
-    
+    OFX::BooleanParam *_cacheFrames;
+
+    OFX::MultiThread::Mutex _frameCacheMutex;
+    DeinterlaceFrameCache _frameCache;
 };
 
 
@@ -378,13 +463,195 @@ inline void interpolate(float *dst, const float *cur0,  const float *cur2, int w
 }
 
 
+#ifdef DEINTERLACE_SSE2
+// SSE2 versions of the FILTER macro, which process all the components of a line at once: the
+// components are interleaved, so that the neighbours of a sample are always ch samples away.
+// The arithmetic is the same as in FILTER, so that the results are identical.
+
+// 8-bit samples are processed as 16-bit integers
+struct YadifSSE2UByte
+{
+    typedef unsigned char Comp;
+    typedef __m128i V;
+    enum { N = 8 };
+    static V load(const Comp *p) { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+    static void store(Comp *p, V a) { _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(a, a)); }
+    static V add(V a, V b) { return _mm_add_epi16(a, b); }
+    static V sub(V a, V b) { return _mm_sub_epi16(a, b); }
+    static V abs(V a) { return _mm_max_epi16(a, _mm_sub_epi16(_mm_setzero_si128(), a)); }
+    static V min(V a, V b) { return _mm_min_epi16(a, b); }
+    static V max(V a, V b) { return _mm_max_epi16(a, b); }
+    static V neg(V a) { return _mm_sub_epi16(_mm_setzero_si128(), a); }
+    static V halven(V a) { return _mm_srai_epi16(a, 1); }
+    static V one1() { return _mm_set1_epi16(1); }
+    static V lt(V a, V b) { return _mm_cmplt_epi16(a, b); }
+    static V and_(V a, V b) { return _mm_and_si128(a, b); }
+    static V select(V m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+};
+
+// 16-bit samples are processed as 32-bit integers, SSE2 has no 32-bit min, max or abs
+struct YadifSSE2UShort
+{
+    typedef unsigned short Comp;
+    typedef __m128i V;
+    enum { N = 4 };
+    static V load(const Comp *p) { return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+    static void store(Comp *p, V a)
+    {
+        // there is no unsigned saturated pack in SSE2: pack the signed values and restore the offset
+        a = _mm_sub_epi32(a, _mm_set1_epi32(32768));
+        _mm_storel_epi64((__m128i*)p, _mm_add_epi16(_mm_packs_epi32(a, a), _mm_set1_epi16((short)0x8000)));
+    }
+    static V add(V a, V b) { return _mm_add_epi32(a, b); }
+    static V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+    static V select(V m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+    static V lt(V a, V b) { return _mm_cmplt_epi32(a, b); }
+    static V neg(V a) { return _mm_sub_epi32(_mm_setzero_si128(), a); }
+    static V abs(V a) { return select(lt(a, _mm_setzero_si128()), neg(a), a); }
+    static V min(V a, V b) { return select(lt(b, a), b, a); }
+    static V max(V a, V b) { return select(lt(a, b), b, a); }
+    static V halven(V a) { return _mm_srai_epi32(a, 1); }
+    static V one1() { return _mm_set1_epi32(1); }
+    static V and_(V a, V b) { return _mm_and_si128(a, b); }
+};
+
+struct YadifSSE2Float
+{
+    typedef float Comp;
+    typedef __m128 V;
+    enum { N = 4 };
+    static V load(const Comp *p) { return _mm_loadu_ps(p); }
+    static void store(Comp *p, V a) { _mm_storeu_ps(p, a); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V select(V m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    static V lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+    static V neg(V a) { return _mm_sub_ps(_mm_setzero_ps(), a); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+    // same as std::min and std::max, including for signed zeros
+    static V min(V a, V b) { return select(lt(b, a), b, a); }
+    static V max(V a, V b) { return select(lt(a, b), b, a); }
+    static V halven(V a) { return _mm_mul_ps(a, _mm_set1_ps(0.5f)); }
+    static V one1() { return _mm_setzero_ps(); }
+    static V and_(V a, V b) { return _mm_and_ps(a, b); }
+};
+
+// Process the first samples of a line (n samples are available), and return the number of samples processed.
+template<int ch, class S>
+inline int filter_line_sse2(typename S::Comp *dst,
+                            const typename S::Comp *prev, const typename S::Comp *cur, const typename S::Comp *next,
+                            int n, int prefs, int mrefs, int parity, int mode)
+{
+    typedef typename S::Comp Comp;
+    typedef typename S::V V;
+    const Comp *prev2 = parity ? prev : cur ;
+    const Comp *next2 = parity ? cur  : next;
+    const bool spatialCheck = !(mode&2);
+    int x = 0;
+    for (; x + S::N <= n; x += S::N) {
+        V c = S::load(cur + x + mrefs);
+        V p2 = S::load(prev2 + x);
+        V n2 = S::load(next2 + x);
+        V d = S::halven(S::add(p2, n2));
+        V e = S::load(cur + x + prefs);
+        V temporal_diff0 = S::abs(S::sub(p2, n2));
+        V temporal_diff1 = S::halven(S::add(S::abs(S::sub(S::load(prev + x + mrefs), c)), S::abs(S::sub(S::load(prev + x + prefs), e))));
+        V temporal_diff2 = S::halven(S::add(S::abs(S::sub(S::load(next + x + mrefs), c)), S::abs(S::sub(S::load(next + x + prefs), e))));
+        V diff = S::max(S::max(S::halven(temporal_diff0), temporal_diff1), temporal_diff2);
+        V spatial_pred = S::halven(S::add(c, e));
+
+        V spatial_score = S::sub(S::add(S::add(S::abs(S::sub(S::load(cur + x + mrefs - ch), S::load(cur + x + prefs - ch))), S::abs(S::sub(c, e))),
+                                        S::abs(S::sub(S::load(cur + x + mrefs + ch), S::load(cur + x + prefs + ch)))),
+                                 S::one1());
+        // CHECK(-1) CHECK(-2) and CHECK(1) CHECK(2): the second check is only done if the first one succeeded
+        for (int side = -1; side <= 1; side += 2) {
+            V ok;
+            for (int k = 1; k <= 2; ++k) {
+                const int j = side * k;
+                V cm = S::load(cur + x + mrefs + ch * j);
+                V cp = S::load(cur + x + prefs - ch * j);
+                V score = S::add(S::add(S::abs(S::sub(S::load(cur + x + mrefs + ch * (-1 + j)), S::load(cur + x + prefs + ch * (-1 - j)))),
+                                        S::abs(S::sub(cm, cp))),
+                                 S::abs(S::sub(S::load(cur + x + mrefs + ch * (1 + j)), S::load(cur + x + prefs + ch * (1 - j)))));
+                V better = S::lt(score, spatial_score);
+                ok = (k == 1) ? better : S::and_(ok, better);
+                spatial_score = S::select(ok, score, spatial_score);
+                spatial_pred = S::select(ok, S::halven(S::add(cm, cp)), spatial_pred);
+            }
+        }
+
+        if (spatialCheck) {
+            V b = S::halven(S::add(S::load(prev2 + x + 2 * mrefs), S::load(next2 + x + 2 * mrefs)));
+            V f = S::halven(S::add(S::load(prev2 + x + 2 * prefs), S::load(next2 + x + 2 * prefs)));
+            V de = S::sub(d, e);
+            V dc = S::sub(d, c);
+            V bc = S::sub(b, c);
+            V fe = S::sub(f, e);
+            V max = S::max(S::max(de, dc), S::min(bc, fe));
+            V min = S::min(S::min(de, dc), S::max(bc, fe));
+
+            diff = S::max(S::max(diff, min), S::neg(max));
+        }
+
+        V hi = S::add(d, diff);
+        V lo = S::sub(d, diff);
+        spatial_pred = S::select(S::lt(hi, spatial_pred), hi, S::select(S::lt(spatial_pred, lo), lo, spatial_pred));
+
+        S::store(dst + x, spatial_pred);
+    }
+    return x;
+}
+#endif
+
+// Process the first samples of a line with SIMD instructions, if available, and return the number of samples processed.
+template<int ch>
+inline int filter_line_simd(unsigned char *dst,
+                            const unsigned char *prev, const unsigned char *cur, const unsigned char *next,
+                            int n, int prefs, int mrefs, int parity, int mode)
+{
+#ifdef DEINTERLACE_SSE2
+    return filter_line_sse2<ch, YadifSSE2UByte>(dst, prev, cur, next, n, prefs, mrefs, parity, mode);
+#else
+    (void)dst; (void)prev; (void)cur; (void)next; (void)n; (void)prefs; (void)mrefs; (void)parity; (void)mode;
+    return 0;
+#endif
+}
+
+template<int ch>
+inline int filter_line_simd(unsigned short *dst,
+                            const unsigned short *prev, const unsigned short *cur, const unsigned short *next,
+                            int n, int prefs, int mrefs, int parity, int mode)
+{
+#ifdef DEINTERLACE_SSE2
+    return filter_line_sse2<ch, YadifSSE2UShort>(dst, prev, cur, next, n, prefs, mrefs, parity, mode);
+#else
+    (void)dst; (void)prev; (void)cur; (void)next; (void)n; (void)prefs; (void)mrefs; (void)parity; (void)mode;
+    return 0;
+#endif
+}
+
+template<int ch>
+inline int filter_line_simd(float *dst,
+                            const float *prev, const float *cur, const float *next,
+                            int n, int prefs, int mrefs, int parity, int mode)
+{
+#ifdef DEINTERLACE_SSE2
+    return filter_line_sse2<ch, YadifSSE2Float>(dst, prev, cur, next, n, prefs, mrefs, parity, mode);
+#else
+    (void)dst; (void)prev; (void)cur; (void)next; (void)n; (void)prefs; (void)mrefs; (void)parity; (void)mode;
+    return 0;
+#endif
+}
+
+// process lines y1 to y2-1 of the plane
 template<int ch,typename Comp,typename Diff>
 static void filter_plane(int mode, Comp *dst, int dst_stride,
                          const Comp *prev0, const Comp *cur0, const Comp *next0,
-                         int refs, int w, int h, int parity, int tff)
+                         int refs, int w, int h, int parity, int tff,
+                         int y1, int y2)
 {
     int pix_3 = 3 * ch;
-    for (int y = 0; y < h; ++y) {
+    for (int y = y1; y < y2; ++y) {
         if (((y ^ parity) & 1)) {
             const Comp *prev= prev0 + y*refs;
             const Comp *cur = cur0 + y*refs;
@@ -392,8 +659,15 @@ static void filter_plane(int mode, Comp *dst, int dst_stride,
             Comp *dst2= dst + y*dst_stride;
             int mode2 = y == 1 || y + 2 == h ? 2 : mode;
 
+            // the SIMD version processes the first samples of the line, all components at once
+            int done = filter_line_simd<ch>(dst2 + pix_3, prev + pix_3, cur + pix_3, next + pix_3, (w - 6) * ch,
+                                            y + 1 < h ? refs : -refs,
+                                            y ? -refs : refs,
+                                            parity ^ tff, mode2);
             for (int c = 0; c < ch; ++c) {
-                filter_line_c<ch,Comp,Diff>(dst2 + c + pix_3, prev + c + pix_3, cur + c + pix_3, next + c + pix_3, w - 6,
+                // first pixel of component c which was not processed
+                int x0 = (done - c + ch - 1) / ch;
+                filter_line_c<ch,Comp,Diff>(dst2 + c + pix_3 + x0 * ch, prev + c + pix_3 + x0 * ch, cur + c + pix_3 + x0 * ch, next + c + pix_3 + x0 * ch, w - 6 - x0,
                                             y + 1 < h ? refs : -refs,
                                             y ? -refs : refs,
                                             parity ^ tff, mode2);
@@ -410,30 +684,307 @@ static void filter_plane(int mode, Comp *dst, int dst_stride,
     
 }
 
+// process lines y1 to y2-1 of the image, relative to the bottom of the image
 template<int ch,typename Comp,typename Diff>
 static void filter_plane_ofx(int mode,
                              OFX::Image *dst_,
-                             const OFX::Image *srcp,
-                             const OFX::Image *src,
-                             const OFX::Image *srcn,
-                             int parity, int tff)
+                             const void *srcp,
+                             const void *src,
+                             const void *srcn,
+                             int srcRowBytes,
+                             int parity, int tff,
+                             int y1, int y2)
 {
     Comp *dst = (Comp*)dst_->getPixelData(); // change this when we support renderWindow
     int dst_stride = dst_->getRowBytes() / sizeof(Comp);
-    const Comp *prev0 = (const Comp*)(srcp ? srcp->getPixelData() : src->getPixelData());
-    const Comp *cur0 = (const Comp*)src->getPixelData();
-    const Comp *next0 = (const Comp*)(srcn ? srcn->getPixelData() : src->getPixelData());
-    int refs = src->getRowBytes() / sizeof(Comp);
+    const Comp *prev0 = (const Comp*)(srcp ? srcp : src);
+    const Comp *cur0 = (const Comp*)src;
+    const Comp *next0 = (const Comp*)(srcn ? srcn : src);
+    int refs = srcRowBytes / (int)sizeof(Comp);
     const OfxRectI bounds = dst_->getBounds();
     filter_plane<ch, Comp, Diff>(mode, dst, dst_stride,
                                  prev0, cur0, next0,
                                  refs,
                                  bounds.x2 - bounds.x1, bounds.y2 - bounds.y1,
-                                 parity, tff);
+                                 parity, tff,
+                                 y1, y2);
 }
 
 // =========== GNU Lesser General Public License code end =================
 
+class DeinterlaceProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    int _mode;
+    const void *_srcp;
+    const void *_src;
+    const void *_srcn;
+    int _srcRowBytes;
+    int _parity;
+    int _tff;
+
+public:
+    DeinterlaceProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _mode(0)
+    , _srcp(0)
+    , _src(0)
+    , _srcn(0)
+    , _srcRowBytes(0)
+    , _parity(0)
+    , _tff(0)
+    {
+    }
+
+    void setValues(int mode,
+                   const void *srcp,
+                   const void *src,
+                   const void *srcn,
+                   int srcRowBytes,
+                   int parity,
+                   int tff)
+    {
+        _mode = mode;
+        _srcp = srcp;
+        _src = src;
+        _srcn = srcn;
+        _srcRowBytes = srcRowBytes;
+        _parity = parity;
+        _tff = tff;
+    }
+};
+
+// The lines of the output image are independent, so that each thread processes a slice of lines.
+template<int ch,typename Comp,typename Diff>
+class DeinterlaceProcessor : public DeinterlaceProcessorBase
+{
+public:
+    DeinterlaceProcessor(OFX::ImageEffect &instance)
+    : DeinterlaceProcessorBase(instance)
+    {
+    }
+
+private:
+    void multiThreadProcessImages(OfxRectI procWindow)
+    {
+        const OfxRectI &bounds = _dstImg->getBounds();
+        filter_plane_ofx<ch,Comp,Diff>(_mode, _dstImg, _srcp, _src, _srcn, _srcRowBytes, _parity, _tff,
+                                       procWindow.y1 - bounds.y1, procWindow.y2 - bounds.y1);
+    }
+};
+
+/* set up and run a processor */
+void
+DeinterlacePlugin::setupAndProcess(DeinterlaceProcessorBase &processor,
+                                   int mode,
+                                   OFX::Image *dst,
+                                   const void *srcp,
+                                   const void *src,
+                                   const void *srcn,
+                                   int srcRowBytes,
+                                   int parity,
+                                   int tff)
+{
+    processor.setDstImg(dst);
+    processor.setValues(mode, srcp, src, srcn, srcRowBytes, parity, tff);
+    // the whole image is processed (tiles are not supported)
+    processor.setRenderWindow(dst->getBounds());
+    processor.process();
+}
+
+const OFX::Image*
+DeinterlacePlugin::fetchSourceImage(const OFX::RenderArguments &args,
+                                    OfxTime time)
+{
+    if (!_srcClip || !_srcClip->isConnected()) {
+        return 0;
+    }
+    std::auto_ptr<const OFX::Image> src(_srcClip->fetchImage(time));
+    if (src.get()) {
+        if (src->getRenderScale().x != args.renderScale.x ||
+            src->getRenderScale().y != args.renderScale.y ||
+            (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+    }
+    return src.release();
+}
+
+void
+DeinterlacePlugin::updateFrameCache(const OFX::RenderArguments &args,
+                                    const OfxRectI &bounds,
+                                    OFX::BitDepthEnum bitDepth,
+                                    OFX::PixelComponentEnum components)
+{
+    DeinterlaceFrameCache &cache = _frameCache;
+    // the frames of the last render can only be reused when rendering the previous or the next frame,
+    // with the same image properties. Rendering the same frame again fetches everything, so that
+    // re-rendering after an upstream change gives up-to-date frames.
+    bool reuse = (cache.valid &&
+                  std::abs(args.time - cache.lastTime) == 1. &&
+                  cache.renderScale.x == args.renderScale.x &&
+                  cache.renderScale.y == args.renderScale.y &&
+                  cache.field == args.fieldToRender &&
+                  cache.bounds.x1 == bounds.x1 &&
+                  cache.bounds.y1 == bounds.y1 &&
+                  cache.bounds.x2 == bounds.x2 &&
+                  cache.bounds.y2 == bounds.y2 &&
+                  cache.bitDepth == bitDepth &&
+                  cache.components == components);
+    // the cache is only valid again once all frames are there
+    cache.valid = false;
+
+    int pixelComponents = (components == OFX::ePixelComponentRGBA) ? 4 : (components == OFX::ePixelComponentRGB) ? 3 : 1;
+    int componentBytes = (bitDepth == OFX::eBitDepthUByte) ? 1 : (bitDepth == OFX::eBitDepthUShort) ? 2 : 4;
+    int rowBytes = (bounds.x2 - bounds.x1) * pixelComponents * componentBytes;
+
+    for (int i = 0; i < 3; ++i) {
+        OfxTime time = args.time - 1 + i;
+        DeinterlaceCachedFrame frame;
+        frame.time = time;
+        frame.exists = false;
+        bool found = false;
+        if (reuse) {
+            for (int j = 0; j < 3 && !found; ++j) {
+                if (cache.frames[j].time == time) {
+                    frame.exists = cache.frames[j].exists;
+                    frame.data.swap(cache.frames[j].data);
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            std::auto_ptr<const OFX::Image> src(fetchSourceImage(args, time));
+            if (src.get()) {
+                const OfxRectI &srcBounds = src->getBounds();
+                if (srcBounds.x1 > bounds.x1 || srcBounds.y1 > bounds.y1 ||
+                    srcBounds.x2 < bounds.x2 || srcBounds.y2 < bounds.y2) {
+                    setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong bounds");
+                    OFX::throwSuiteStatusException(kOfxStatFailed);
+                }
+                frame.data.resize((size_t)rowBytes * (bounds.y2 - bounds.y1));
+                for (int y = bounds.y1; y < bounds.y2; ++y) {
+                    std::memcpy(&frame.data[(size_t)(y - bounds.y1) * rowBytes], src->getPixelAddress(bounds.x1, y), rowBytes);
+                }
+                frame.exists = true;
+            }
+        }
+        cache.frames[i].time = frame.time;
+        cache.frames[i].exists = frame.exists;
+        cache.frames[i].data.swap(frame.data);
+    }
+    // frames that were not reused are freed when frame goes out of scope
+
+    cache.lastTime = args.time;
+    cache.renderScale = args.renderScale;
+    cache.field = args.fieldToRender;
+    cache.bounds = bounds;
+    cache.bitDepth = bitDepth;
+    cache.components = components;
+    cache.rowBytes = rowBytes;
+    cache.valid = true;
+}
+
+void
+DeinterlacePlugin::clearFrameCache()
+{
+    OFX::MultiThread::AutoMutex lock(_frameCacheMutex);
+    _frameCache.valid = false;
+    // free the memory
+    for (int i = 0; i < 3; ++i) {
+        std::vector<unsigned char>().swap(_frameCache.frames[i].data);
+    }
+}
+
+void
+DeinterlacePlugin::deinterlace(OFX::Image *dst,
+                               OFX::BitDepthEnum dstBitDepth,
+                               OFX::PixelComponentEnum dstComponents,
+                               int mode,
+                               const void *srcp,
+                               const void *src,
+                               const void *srcn,
+                               int srcRowBytes,
+                               int parity,
+                               int tff)
+{
+    const OfxRectI rect = dst->getBounds();
+
+    int width=rect.x2-rect.x1;
+    int height=rect.y2-rect.y1;
+
+    if (width < 3 || height < 3) {
+        // Video of less than 3 columns or lines is not supported
+        // just copy sc to dst
+        for (int y=0; y<height; y++) {
+            std::memcpy(dst->getPixelAddress(rect.x1,rect.y1+y),(const char*)src+y*srcRowBytes,abs(srcRowBytes));
+        }
+    } else {
+        if (dstComponents == OFX::ePixelComponentRGBA) {
+            switch (dstBitDepth) {
+                case OFX::eBitDepthUByte: {
+                    DeinterlaceProcessor<4, unsigned char, int> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                case OFX::eBitDepthUShort: {
+                    DeinterlaceProcessor<4, unsigned short, int> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                case OFX::eBitDepthFloat: {
+                    DeinterlaceProcessor<4, float, float> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                default:
+                    break;
+            }
+        } else if (dstComponents == OFX::ePixelComponentRGB) {
+            switch (dstBitDepth) {
+                case OFX::eBitDepthUByte: {
+                    DeinterlaceProcessor<3, unsigned char, int> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                case OFX::eBitDepthUShort: {
+                    DeinterlaceProcessor<3, unsigned short, int> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                case OFX::eBitDepthFloat: {
+                    DeinterlaceProcessor<3, float, float> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                default:
+                    break;
+            }
+        } else if (dstComponents == OFX::ePixelComponentAlpha) {
+            switch (dstBitDepth) {
+                case OFX::eBitDepthUByte: {
+                    DeinterlaceProcessor<1, unsigned char, int> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                case OFX::eBitDepthUShort: {
+                    DeinterlaceProcessor<1, unsigned short, int> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                case OFX::eBitDepthFloat: {
+                    DeinterlaceProcessor<1, float, float> fred(*this);
+                    setupAndProcess(fred, mode, dst, srcp, src, srcn, srcRowBytes, parity, tff);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+}
+
 void DeinterlacePlugin::render(const OFX::RenderArguments &args)
 {
     if (!kSupportsRenderScale && (args.renderScale.x != 1. || args.renderScale.y != 1.)) {
@@ -456,49 +1007,19 @@ void DeinterlacePlugin::render(const OFX::RenderArguments &args)
         OFX::throwSuiteStatusException(kOfxStatFailed);
     }
 
-    std::auto_ptr<const OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
-                                        _srcClip->fetchImage(args.time) : 0);
-    std::auto_ptr<const OFX::Image> srcp((_srcClip && _srcClip->isConnected()) ?
-                                         _srcClip->fetchImage(args.time-1) : 0);
-    std::auto_ptr<const OFX::Image> srcn((_srcClip && _srcClip->isConnected()) ?
-                                         _srcClip->fetchImage(args.time+1) : 0);
-    if (src.get()) {
-        if (src->getRenderScale().x != args.renderScale.x ||
-            src->getRenderScale().y != args.renderScale.y ||
-            (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
-        }
-    }
-    if (srcp.get()) {
-        if (srcp->getRenderScale().x != args.renderScale.x ||
-            srcp->getRenderScale().y != args.renderScale.y ||
-            (srcp->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && srcp->getField() != args.fieldToRender)) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
-        }
-    }
-    if (srcn.get()) {
-        if (srcn->getRenderScale().x != args.renderScale.x ||
-            srcn->getRenderScale().y != args.renderScale.y ||
-            (srcn->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && srcn->getField() != args.fieldToRender)) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
-        }
-    }
-
     const OfxRectI rect = dst->getBounds();
 
     int width=rect.x2-rect.x1;
-    int height=rect.y2-rect.y1;
 
     int imode       = 0;
     int ifieldOrder = 2;
     int iparity     = 0;
+    bool cacheFrames = false;
 
     mode->getValueAtTime(args.time,imode);
     fieldOrder->getValueAtTime(args.time,ifieldOrder);
     parity->getValueAtTime(args.time,iparity);
+    _cacheFrames->getValue(cacheFrames);
 
     imode*=2;
 
@@ -510,96 +1031,58 @@ void DeinterlacePlugin::render(const OFX::RenderArguments &args)
         }
     }
 
-
-    if (width < 3 || height < 3) {
-        // Video of less than 3 columns or lines is not supported
-        // just copy sc to dst
-        for (int y=0; y<height; y++) {
-            std::memcpy(dst->getPixelAddress(0,y),src->getPixelAddress(0,y),abs(src->getRowBytes()));
+    if (cacheFrames) {
+        // the cached frames are used by the processor, so that renders must be serialized
+        OFX::MultiThread::AutoMutex lock(_frameCacheMutex);
+        updateFrameCache(args, rect, dstBitDepth, dstComponents);
+        const DeinterlaceCachedFrame *frames = _frameCache.frames;
+        if (!frames[1].exists) {
+            OFX::throwSuiteStatusException(kOfxStatFailed);
         }
+        const void *srcp = (frames[0].exists && !frames[0].data.empty()) ? &frames[0].data[0] : 0;
+        const void *src = frames[1].data.empty() ? 0 : &frames[1].data[0];
+        const void *srcn = (frames[2].exists && !frames[2].data.empty()) ? &frames[2].data[0] : 0;
+        deinterlace(dst.get(), dstBitDepth, dstComponents, imode, srcp, src, srcn, _frameCache.rowBytes, iparity, ifieldOrder);
     } else {
-        if (dstComponents == OFX::ePixelComponentRGBA) {
-            switch(dstBitDepth) {
-            case OFX::eBitDepthUByte:
-                filter_plane_ofx<4,unsigned char,int>(imode, // mode
-                                                      dst.get(),
-                                                      srcp.get(), src.get(), srcn.get(),
-                                                      iparity,ifieldOrder); // parity, tff
-                break;
-
-            case OFX::eBitDepthUShort:
-                filter_plane_ofx<4,unsigned short,int>(imode, // mode
-                                                       dst.get(),
-                                                       srcp.get(), src.get(), srcn.get(),
-                                                       iparity,ifieldOrder); // parity, tff
-                    break;
-                    
-            case OFX::eBitDepthFloat:
-                    filter_plane_ofx<4,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
-
-            default:
-                break;
-            }
-        } else if (dstComponents == OFX::ePixelComponentRGB) {
-            switch(dstBitDepth) {
-                case OFX::eBitDepthUByte:
-                    filter_plane_ofx<3,unsigned char,int>(imode, // mode
-                                                          dst.get(),
-                                                          srcp.get(), src.get(), srcn.get(),
-                                                          iparity,ifieldOrder); // parity, tff
-                    break;
-
-                case OFX::eBitDepthUShort:
-                    filter_plane_ofx<3,unsigned short,int>(imode, // mode
-                                                           dst.get(),
-                                                           srcp.get(), src.get(), srcn.get(),
-                                                           iparity,ifieldOrder); // parity, tff
-                    break;
-
-                case OFX::eBitDepthFloat:
-                    filter_plane_ofx<3,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
-
-                default:
-                    break;
-            }
-        } else if (dstComponents == OFX::ePixelComponentAlpha) {
-            switch(dstBitDepth) {
-            case OFX::eBitDepthUByte:
-                    filter_plane_ofx<1,unsigned char,int>(imode, // mode
-                                                          dst.get(),
-                                                          srcp.get(), src.get(), srcn.get(),
-                                                          iparity,ifieldOrder); // parity, tff
-                    break;
-
-            case OFX::eBitDepthUShort:
-                    filter_plane_ofx<1,unsigned short,int>(imode, // mode
-                                                           dst.get(),
-                                                           srcp.get(), src.get(), srcn.get(),
-                                                           iparity,ifieldOrder); // parity, tff
-                    break;
+        std::auto_ptr<const OFX::Image> src(fetchSourceImage(args, args.time));
+        std::auto_ptr<const OFX::Image> srcp(fetchSourceImage(args, args.time-1));
+        std::auto_ptr<const OFX::Image> srcn(fetchSourceImage(args, args.time+1));
+        if (!src.get()) {
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        deinterlace(dst.get(), dstBitDepth, dstComponents, imode,
+                    srcp.get() ? srcp->getPixelData() : 0,
+                    src->getPixelData(),
+                    srcn.get() ? srcn->getPixelData() : 0,
+                    src->getRowBytes(),
+                    iparity, ifieldOrder);
+    }
+}
 
-            case OFX::eBitDepthFloat:
-                    filter_plane_ofx<1,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
+void
+DeinterlacePlugin::changedParam(const OFX::InstanceChangedArgs &/*args*/, const std::string &paramName)
+{
+    if (paramName == kParamCacheFrames) {
+        // free the memory when the cache is disabled, and start from fresh frames when it is enabled
+        clearFrameCache();
+    }
+}
 
-            default:
-                break;
-            }
-        }
+void
+DeinterlacePlugin::changedClip(const OFX::InstanceChangedArgs &/*args*/, const std::string &clipName)
+{
+    if (clipName == kOfxImageEffectSimpleSourceClipName) {
+        // the input frames may have changed
+        clearFrameCache();
     }
 }
 
+void
+DeinterlacePlugin::purgeCaches()
+{
+    clearFrameCache();
+}
+
 /* Override the clip preferences */
 void
 DeinterlacePlugin::getClipPreferences(OFX::ClipPreferencesSetter &clipPreferences)
@@ -778,6 +1261,17 @@ void DeinterlacePluginFactory::describeInContext(OFX::ImageEffectDescriptor &des
             page->addChild(*param);
         }
     }
+
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamCacheFrames);
+        param->setLabel(kParamCacheFramesLabel);
+        param->setHint(kParamCacheFramesHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 ImageEffect* DeinterlacePluginFactory::createInstance(OfxImageEffectHandle handle, OFX::ContextEnum /*context*/)
@@ -76,7 +76,6 @@
  */
 
 // TODO:
-// - fetch Images and process them one by one
 // - compute count only if necessary (i.e. it is asked on output or operation is average)
 // - show progress
 
@@ -85,6 +84,9 @@
 #include <cmath> // for floor
 #include <climits> // for INT_MAX
 #include <cassert>
+#include <cstdlib> // for abs
+#include <vector>
+#include <algorithm>
 
 #include "ofxsImageEffect.h"
 #include "ofxsMultiThread.h"
@@ -164,6 +166,12 @@ enum OperationEnum {
 };
 
 
+#define kParamSlidingWindowName  "slidingWindow"
+#define kParamSlidingWindowLabel "Sliding Window"
+#define kParamSlidingWindowHint  "Average and Sum only: keep the sum of the frames in the range between renders, and when rendering the next frame only add the frames entering the range and subtract the frames leaving it, so that the cost of rendering consecutive frames does not depend on the size of the range. The sum is computed from scratch when the range moves by more than half its size, when the render window changes, and every " kSlidingWindowMaxSlidesStr " frames. Modified input frames are not read again while they stay in the range: disable this while the input is being edited."
+#define kSlidingWindowMaxSlides 64 // number of frames added to the sliding window before it is computed from scratch, to limit rounding errors
+#define kSlidingWindowMaxSlidesStr "64"
+
 #define kParamOutputCountName  "outputCount"
 #define kParamOutputCountLabel "Output Count to Alpha"
 #define kParamOutputCountHint  "Output image count at each pixel to alpha."
@@ -176,9 +184,10 @@ class FrameBlendProcessorBase : public OFX::PixelProcessor
 {
 protected:
     const OFX::Image *_srcImg;
-    std::vector<const OFX::Image*> _srcImgs;
-    std::vector<const OFX::Image*> _fgMImgs;
     const OFX::Image *_maskImg;
+    const float *_accumSum; // the values accumulated by FrameBlendAccumulator over the frame range
+    const float *_accumCount;
+    OfxRectI _accumBounds;
     bool _processR;
     bool _processG;
     bool _processB;
@@ -193,9 +202,9 @@ public:
     FrameBlendProcessorBase(OFX::ImageEffect &instance)
     : OFX::PixelProcessor(instance)
     , _srcImg(0)
-    , _srcImgs(0)
-    , _fgMImgs(0)
     , _maskImg(0)
+    , _accumSum(0)
+    , _accumCount(0)
     , _processR(true)
     , _processG(true)
     , _processB(true)
@@ -207,8 +216,14 @@ public:
     {
     }
 
-    void setSrcImgs(const OFX::Image *src, const std::vector<const OFX::Image*> &v) {_srcImg = src; _srcImgs = v;}
-    void setFgMImgs(const std::vector<const OFX::Image*> &v) {_fgMImgs = v;}
+    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
+
+    void setAccumulator(const float *sum, const float *count, const OfxRectI &bounds)
+    {
+        _accumSum = sum;
+        _accumCount = count;
+        _accumBounds = bounds;
+    }
 
     void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
 
@@ -339,7 +354,9 @@ private:
     {
         assert(nComponents == 1 || nComponents == 3 || nComponents == 4);
         assert(_dstPixelData);
-        assert(_srcImgs.size() == _fgMImgs.size());
+        assert(_accumSum && _accumCount);
+        assert(_accumBounds.x1 <= procWindow.x1 && procWindow.x2 <= _accumBounds.x2 &&
+               _accumBounds.y1 <= procWindow.y1 && procWindow.y2 <= _accumBounds.y2);
         float tmpPix[nComponents];
         for (int y = procWindow.y1; y < procWindow.y2; y++) {
             if (_effect.abort()) {
@@ -351,58 +368,15 @@ private:
             if (!dstPix) {
                 continue;
             }
-            float initVal = 0.;
-            switch (operation) {
-                case eOperationAverage:
-                    initVal = 0.;
-                    break;
-                case eOperationMin:
-                    initVal = std::numeric_limits<float>::infinity();
-                    break;
-                case eOperationMax:
-                    initVal = -std::numeric_limits<float>::infinity();
-                    break;
-                case eOperationSum:
-                    initVal = 0.;
-                    break;
-                case eOperationProduct:
-                    initVal = 1.;
-                    break;
-            }
+            size_t i = (size_t)(y - _accumBounds.y1) * (_accumBounds.x2 - _accumBounds.x1) + (procWindow.x1 - _accumBounds.x1);
+            const float *accumPix = _accumSum + i * nComponents;
+            const float *accumCountPix = _accumCount + i;
 
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
+            for (int x = procWindow.x1; x < procWindow.x2; x++, accumPix += nComponents, ++accumCountPix) {
                 const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-                int count = 0;
-                std::fill(tmpPix, tmpPix+nComponents, initVal);
-                // accumulate
-                for (unsigned i = 0; i < _srcImgs.size(); ++i) {
-                    const PIX *fgMPix = (const PIX *)  (_fgMImgs[i] ? _fgMImgs[i]->getPixelAddress(x, y) : 0);
-                    if (!fgMPix || *fgMPix <= 0) {
-                        const PIX *srcPixi = (const PIX *)  (_srcImgs[i] ? _srcImgs[i]->getPixelAddress(x, y) : 0);
-                        if (srcPixi) {
-                            for (int c = 0; c < nComponents; ++c) {
-                                switch (operation) {
-                                    case eOperationAverage:
-                                        tmpPix[c] += srcPixi[c];
-                                        break;
-                                    case eOperationMin:
-                                        tmpPix[c] = std::min(tmpPix[c], (float)srcPixi[c]);
-                                        break;
-                                    case eOperationMax:
-                                        tmpPix[c] = std::max(tmpPix[c], (float)srcPixi[c]);
-                                        break;
-                                    case eOperationSum:
-                                        tmpPix[c] += srcPixi[c];
-                                        break;
-                                    case eOperationProduct:
-                                        tmpPix[c] *= srcPixi[c];
-                                        break;
-                                }
-                            }
-                        }
-                        ++count;
-                    }
-                }
+                // the values were accumulated by FrameBlendAccumulator
+                std::copy(accumPix, accumPix + nComponents, tmpPix);
+                int count = (int)*accumCountPix;
                 // copy back original values from unprocessed channels
                 if (nComponents == 1) {
                     int c = 0;
@@ -454,6 +428,158 @@ private:
     }
 };
 
+// Folds a source frame into the values and counts accumulated over the frame range.
+// For Average and Sum, a frame can also be subtracted (see the sliding window).
+class FrameBlendAccumulatorBase : public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_srcImg;
+    const OFX::Image *_fgMImg;
+    float *_sum;
+    float *_count;
+    OfxRectI _bounds; // bounds of _sum and _count
+    float _sign;
+
+public:
+
+    FrameBlendAccumulatorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _srcImg(0)
+    , _fgMImg(0)
+    , _sum(0)
+    , _count(0)
+    , _sign(1.)
+    {
+        _bounds.x1 = _bounds.y1 = _bounds.x2 = _bounds.y2 = 0;
+    }
+
+    /** @brief the number of accumulated values per pixel */
+    virtual int getNComponents() const = 0;
+
+    /** @brief the accumulated value before any frame is folded */
+    virtual float getInitialValue() const = 0;
+
+    void setValues(const OFX::Image *src,
+                   const OFX::Image *fgM,
+                   float *sum,
+                   float *count,
+                   const OfxRectI &bounds,
+                   bool subtract)
+    {
+        _srcImg = src;
+        _fgMImg = fgM;
+        _sum = sum;
+        _count = count;
+        _bounds = bounds;
+        _sign = subtract ? -1. : 1.;
+    }
+};
+
+template <class PIX, int nComponents, OperationEnum operation>
+class FrameBlendAccumulator : public FrameBlendAccumulatorBase
+{
+public:
+    FrameBlendAccumulator(OFX::ImageEffect &instance)
+    : FrameBlendAccumulatorBase(instance)
+    {
+    }
+
+    virtual int getNComponents() const OVERRIDE FINAL { return nComponents; }
+
+    virtual float getInitialValue() const OVERRIDE FINAL
+    {
+        switch (operation) {
+            case eOperationAverage:
+            case eOperationSum:
+                return 0.;
+            case eOperationMin:
+                return std::numeric_limits<float>::infinity();
+            case eOperationMax:
+                return -std::numeric_limits<float>::infinity();
+            case eOperationProduct:
+                return 1.;
+        }
+        return 0.;
+    }
+
+private:
+
+    void multiThreadProcessImages(OfxRectI procWindow)
+    {
+        assert(_sum && _count);
+        assert(_sign > 0 || operation == eOperationAverage || operation == eOperationSum);
+        assert(_bounds.x1 <= procWindow.x1 && procWindow.x2 <= _bounds.x2 &&
+               _bounds.y1 <= procWindow.y1 && procWindow.y2 <= _bounds.y2);
+        for (int y = procWindow.y1; y < procWindow.y2; y++) {
+            if (_effect.abort()) {
+                break;
+            }
+
+            size_t i = (size_t)(y - _bounds.y1) * (_bounds.x2 - _bounds.x1) + (procWindow.x1 - _bounds.x1);
+            float *sumPix = _sum + i * nComponents;
+            float *countPix = _count + i;
+            for (int x = procWindow.x1; x < procWindow.x2; x++, sumPix += nComponents, ++countPix) {
+                const PIX *fgMPix = (const PIX *)  (_fgMImg ? _fgMImg->getPixelAddress(x, y) : 0);
+                if (!fgMPix || *fgMPix <= 0) {
+                    const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
+                    if (srcPix) {
+                        for (int c = 0; c < nComponents; ++c) {
+                            switch (operation) {
+                                case eOperationAverage:
+                                case eOperationSum:
+                                    sumPix[c] += _sign * srcPix[c];
+                                    break;
+                                case eOperationMin:
+                                    sumPix[c] = std::min(sumPix[c], (float)srcPix[c]);
+                                    break;
+                                case eOperationMax:
+                                    sumPix[c] = std::max(sumPix[c], (float)srcPix[c]);
+                                    break;
+                                case eOperationProduct:
+                                    sumPix[c] *= srcPix[c];
+                                    break;
+                            }
+                        }
+                    }
+                    *countPix += _sign;
+                }
+            }
+        }
+    }
+};
+
+// The sums and counts of the frames of the previous render, kept for the sliding window
+struct FrameBlendSlidingWindow
+{
+    bool valid;
+    OfxRectI bounds; // the render window
+    OfxPointD renderScale;
+    OFX::BitDepthEnum bitDepth;
+    OFX::PixelComponentEnum components;
+    bool fgM; // true if the foreground matte was connected
+    int first; // the frames are first + i*interval, 0 <= i < n
+    int interval;
+    int n;
+    int slides; // number of frames added since the sums were computed from scratch
+    std::vector<float> sum;
+    std::vector<float> count;
+
+    FrameBlendSlidingWindow()
+    : valid(false)
+    , bitDepth(OFX::eBitDepthNone)
+    , components(OFX::ePixelComponentNone)
+    , fgM(false)
+    , first(0)
+    , interval(1)
+    , n(0)
+    , slides(0)
+    , sum()
+    , count()
+    {
+        bounds.x1 = bounds.y1 = bounds.x2 = bounds.y2 = 0;
+        renderScale.x = renderScale.y = 1.;
+    }
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
@@ -476,6 +602,7 @@ public:
     , _inputRange(0)
     , _frameInterval(0)
     , _operation(0)
+    , _slidingWindow(0)
     , _outputCount(0)
     , _mix(0)
     , _maskInvert(0)
@@ -498,8 +625,9 @@ public:
         _inputRange = fetchPushButtonParam(kParamInputRangeName);
         _frameInterval = fetchIntParam(kParamFrameIntervalName);
         _operation = fetchChoiceParam(kParamOperation);
+        _slidingWindow = fetchBooleanParam(kParamSlidingWindowName);
         _outputCount = fetchBooleanParam(kParamOutputCountName);
-        assert(_frameRange && _absolute && _inputRange && _operation && _outputCount);
+        assert(_frameRange && _absolute && _inputRange && _operation && _slidingWindow && _outputCount);
         _mix = fetchDoubleParam(kParamMix);
         _maskInvert = fetchBooleanParam(kParamMaskInvert);
         assert(_mix && _maskInvert);
@@ -510,7 +638,27 @@ private:
     virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
 
     /* set up and run a processor */
-    void setupAndProcess(FrameBlendProcessorBase &, const OFX::RenderArguments &args);
+    void setupAndProcess(FrameBlendProcessorBase &, FrameBlendAccumulatorBase &, const OFX::RenderArguments &args);
+
+    /* bring the sums of the sliding window to the given frames. _slidingWindowMutex must be locked. */
+    void updateSlidingWindow(FrameBlendAccumulatorBase &accumulator,
+                             const OFX::RenderArguments &args,
+                             OFX::BitDepthEnum dstBitDepth,
+                             OFX::PixelComponentEnum dstComponents,
+                             int first,
+                             int interval,
+                             int n);
+
+    /* fetch a frame and fold it into the accumulated values, or subtract it */
+    void accumulateFrame(FrameBlendAccumulatorBase &accumulator,
+                         const OFX::RenderArguments &args,
+                         OFX::BitDepthEnum dstBitDepth,
+                         OFX::PixelComponentEnum dstComponents,
+                         int frame,
+                         float *accumSum,
+                         float *accumCount,
+                         const OfxRectI &accumBounds,
+                         bool subtract);
 
     virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime) OVERRIDE FINAL;
 
@@ -520,6 +668,12 @@ private:
     /** @brief called when a param has just had its value changed */
     virtual void changedParam(const InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
 
+    /** @brief called when a clip has just been changed in some way (a rewire maybe) */
+    virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+
+    /** @brief free the sliding window */
+    virtual void purgeCaches() OVERRIDE FINAL;
+
 private:
 
     template<int nComponents>
@@ -545,9 +699,13 @@ private:
     PushButtonParam* _inputRange;
     IntParam* _frameInterval;
     ChoiceParam* _operation;
+    BooleanParam* _slidingWindow;
     BooleanParam* _outputCount;
     OFX::DoubleParam* _mix;
     OFX::BooleanParam* _maskInvert;
+
+    OFX::MultiThread::Mutex _slidingWindowMutex;
+    FrameBlendSlidingWindow _slidingWindowState;
 };
 
 
@@ -557,31 +715,9 @@ private:
 ////////////////////////////////////////////////////////////////////////////////
 // basic plugin render function, just a skelington to instantiate templates from
 
-namespace {
-// Since we cannot hold a std::auto_ptr in the vector we must hold a raw pointer.
-// To ensure that images are always freed even in case of exceptions, use a RAII class.
-struct OptionalImagesHolder_RAII
-{
-    std::vector<const OFX::Image*> images;
-    
-    OptionalImagesHolder_RAII()
-    : images()
-    {
-        
-    }
-    
-    ~OptionalImagesHolder_RAII()
-    {
-        for (unsigned int i = 0; i < images.size(); ++i) {
-            delete images[i];
-        }
-    }
-};
-}
-
 /* set up and run a processor */
 void
-FrameBlendPlugin::setupAndProcess(FrameBlendProcessorBase &processor, const OFX::RenderArguments &args)
+FrameBlendPlugin::setupAndProcess(FrameBlendProcessorBase &processor, FrameBlendAccumulatorBase &accumulator, const OFX::RenderArguments &args)
 {
     const double time = args.time;
     std::auto_ptr<OFX::Image> dst(_dstClip->fetchImage(time));
@@ -634,44 +770,42 @@ FrameBlendPlugin::setupAndProcess(FrameBlendProcessorBase &processor, const OFX:
             OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
         }
     }
-    OptionalImagesHolder_RAII srcImgs;
-    for (int i = 0; i < n; ++i) {
-        if (abort()) {
-            throwSuiteStatusException(kOfxStatFailed);
+    // the sliding window can only be used if frames can be subtracted
+    bool slidingWindow = false;
+    if (n > 0) {
+        int operation_i;
+        _operation->getValueAtTime(time, operation_i);
+        OperationEnum operation = (OperationEnum)operation_i;
+        if (operation == eOperationAverage || operation == eOperationSum) {
+            _slidingWindow->getValueAtTime(time, slidingWindow);
         }
-        const OFX::Image* src = _srcClip ? _srcClip->fetchImage(min + i*interval) : 0;
-        if (src) {
-            if (src->getRenderScale().x != args.renderScale.x ||
-                src->getRenderScale().y != args.renderScale.y ||
-                (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
-                setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                OFX::throwSuiteStatusException(kOfxStatFailed);
-            }
-            OFX::BitDepthEnum    srcBitDepth      = src->getPixelDepth();
-            OFX::PixelComponentEnum srcComponents = src->getPixelComponents();
-            if (srcBitDepth != dstBitDepth || srcComponents != dstComponents) {
-                OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
-            }
-        }
-        srcImgs.images.push_back(src);
     }
-    // fetch the foreground mattes
-    OptionalImagesHolder_RAII fgMImgs;
-    for (int i = 0; i < n; ++i) {
-        if (abort()) {
-            throwSuiteStatusException(kOfxStatFailed);
+    // the sliding window is shared by all renders, which are serialized
+    std::auto_ptr<OFX::MultiThread::AutoMutex> slidingWindowLock;
+    // the values accumulated over the frame range, if the sliding window is not used
+    std::auto_ptr<OFX::ImageMemory> accumSumMem;
+    std::auto_ptr<OFX::ImageMemory> accumCountMem;
+    const OfxRectI &renderWindow = args.renderWindow;
+    if (slidingWindow) {
+        slidingWindowLock.reset(new OFX::MultiThread::AutoMutex(_slidingWindowMutex));
+        updateSlidingWindow(accumulator, args, dstBitDepth, dstComponents, min, interval, n);
+        if (!_slidingWindowState.sum.empty()) {
+            processor.setAccumulator(&_slidingWindowState.sum[0], &_slidingWindowState.count[0], _slidingWindowState.bounds);
         }
-        const OFX::Image* mask = (_fgMClip && _fgMClip->isConnected()) ? _fgMClip->fetchImage(min + i*interval) : 0;
-        if (mask) {
-            assert(_fgMClip->isConnected());
-            if (mask->getRenderScale().x != args.renderScale.x ||
-                mask->getRenderScale().y != args.renderScale.y ||
-                (mask->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && mask->getField() != args.fieldToRender)) {
-                setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                OFX::throwSuiteStatusException(kOfxStatFailed);
-            }
+    } else if (renderWindow.x1 < renderWindow.x2 && renderWindow.y1 < renderWindow.y2) {
+        // fetch the frames one by one and fold them into the accumulated values, so that only one
+        // source image and one foreground matte are held in memory whatever the frame range
+        const size_t nPixels = (size_t)(renderWindow.x2 - renderWindow.x1) * (renderWindow.y2 - renderWindow.y1);
+        accumSumMem.reset(new OFX::ImageMemory(nPixels * accumulator.getNComponents() * sizeof(float), this));
+        accumCountMem.reset(new OFX::ImageMemory(nPixels * sizeof(float), this));
+        float *accumSum = (float*)accumSumMem->lock();
+        float *accumCount = (float*)accumCountMem->lock();
+        std::fill(accumSum, accumSum + nPixels * accumulator.getNComponents(), accumulator.getInitialValue());
+        std::fill(accumCount, accumCount + nPixels, 0.f);
+        for (int i = 0; i < n; ++i) {
+            accumulateFrame(accumulator, args, dstBitDepth, dstComponents, min + i*interval, accumSum, accumCount, renderWindow, false);
         }
-        fgMImgs.images.push_back(mask);
+        processor.setAccumulator(accumSum, accumCount, renderWindow);
     }
     // fetch the mask
     std::auto_ptr<const OFX::Image> mask((getContext() != OFX::eContextFilter && _maskClip && _maskClip->isConnected()) ?
@@ -694,8 +828,7 @@ FrameBlendPlugin::setupAndProcess(FrameBlendProcessorBase &processor, const OFX:
 
     // set the images
     processor.setDstImg(dst.get());
-    processor.setSrcImgs(src.get(), srcImgs.images);
-    processor.setFgMImgs(fgMImgs.images);
+    processor.setSrcImg(src.get());
     // set the render window
     processor.setRenderWindow(args.renderWindow);
 
@@ -715,6 +848,126 @@ FrameBlendPlugin::setupAndProcess(FrameBlendProcessorBase &processor, const OFX:
     processor.process();
 }
 
+void
+FrameBlendPlugin::updateSlidingWindow(FrameBlendAccumulatorBase &accumulator,
+                                      const OFX::RenderArguments &args,
+                                      OFX::BitDepthEnum dstBitDepth,
+                                      OFX::PixelComponentEnum dstComponents,
+                                      int first,
+                                      int interval,
+                                      int n)
+{
+    FrameBlendSlidingWindow &w = _slidingWindowState;
+    const OfxRectI &bounds = args.renderWindow;
+    const bool fgM = _fgMClip && _fgMClip->isConnected();
+
+    // the frames to add and to subtract
+    std::vector<int> added;
+    std::vector<int> subtracted;
+    bool reset = !(w.valid &&
+                   w.bounds.x1 == bounds.x1 && w.bounds.y1 == bounds.y1 && w.bounds.x2 == bounds.x2 && w.bounds.y2 == bounds.y2 &&
+                   w.renderScale.x == args.renderScale.x && w.renderScale.y == args.renderScale.y &&
+                   w.bitDepth == dstBitDepth && w.components == dstComponents &&
+                   w.fgM == fgM && w.interval == interval && w.n == n &&
+                   (first - w.first) % interval == 0);
+    if (!reset) {
+        const int shift = (first - w.first) / interval;
+        // computing the sums from scratch is cheaper if more than half of the frames changed
+        if (2 * std::abs(shift) >= n || w.slides + std::abs(shift) > kSlidingWindowMaxSlides) {
+            reset = true;
+        } else {
+            for (int k = 0; k < std::abs(shift); ++k) {
+                if (shift > 0) {
+                    subtracted.push_back(w.first + k * interval);
+                    added.push_back(w.first + (n + k) * interval);
+                } else {
+                    subtracted.push_back(w.first + (n - 1 - k) * interval);
+                    added.push_back(first + k * interval);
+                }
+            }
+            w.slides += std::abs(shift);
+        }
+    }
+    if (reset) {
+        const size_t nPixels = (size_t)(bounds.x2 - bounds.x1) * (bounds.y2 - bounds.y1);
+        w.sum.assign(nPixels * accumulator.getNComponents(), accumulator.getInitialValue());
+        w.count.assign(nPixels, 0.f);
+        w.bounds = bounds;
+        w.renderScale = args.renderScale;
+        w.bitDepth = dstBitDepth;
+        w.components = dstComponents;
+        w.fgM = fgM;
+        w.interval = interval;
+        w.n = n;
+        w.slides = 0;
+        for (int i = 0; i < n; ++i) {
+            added.push_back(first + i * interval);
+        }
+    }
+    w.first = first;
+    if (w.sum.empty()) {
+        w.valid = true;
+        return;
+    }
+
+    // the sums are invalid until all frames are processed
+    w.valid = false;
+    for (unsigned i = 0; i < subtracted.size(); ++i) {
+        accumulateFrame(accumulator, args, dstBitDepth, dstComponents, subtracted[i], &w.sum[0], &w.count[0], w.bounds, true);
+    }
+    for (unsigned i = 0; i < added.size(); ++i) {
+        accumulateFrame(accumulator, args, dstBitDepth, dstComponents, added[i], &w.sum[0], &w.count[0], w.bounds, false);
+    }
+    if (abort()) {
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+    w.valid = true;
+}
+
+void
+FrameBlendPlugin::accumulateFrame(FrameBlendAccumulatorBase &accumulator,
+                                  const OFX::RenderArguments &args,
+                                  OFX::BitDepthEnum dstBitDepth,
+                                  OFX::PixelComponentEnum dstComponents,
+                                  int frame,
+                                  float *accumSum,
+                                  float *accumCount,
+                                  const OfxRectI &accumBounds,
+                                  bool subtract)
+{
+    if (abort()) {
+        throwSuiteStatusException(kOfxStatFailed);
+    }
+    std::auto_ptr<const OFX::Image> src(_srcClip ? _srcClip->fetchImage(frame) : 0);
+    if (src.get()) {
+        if (src->getRenderScale().x != args.renderScale.x ||
+            src->getRenderScale().y != args.renderScale.y ||
+            (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        OFX::BitDepthEnum    srcBitDepth      = src->getPixelDepth();
+        OFX::PixelComponentEnum srcComponents = src->getPixelComponents();
+        if (srcBitDepth != dstBitDepth || srcComponents != dstComponents) {
+            OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+        }
+    }
+    // fetch the foreground matte
+    std::auto_ptr<const OFX::Image> mask((_fgMClip && _fgMClip->isConnected()) ? _fgMClip->fetchImage(frame) : 0);
+    if (mask.get()) {
+        if (mask->getRenderScale().x != args.renderScale.x ||
+            mask->getRenderScale().y != args.renderScale.y ||
+            (mask->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && mask->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+    }
+    accumulator.setValues(src.get(), mask.get(), accumSum, accumCount, accumBounds, subtract);
+    accumulator.setRenderWindow(accumBounds);
+    accumulator.process();
+    // the images are released here
+}
+
 // the overridden render function
 void
 FrameBlendPlugin::render(const OFX::RenderArguments &args)
@@ -765,31 +1018,21 @@ FrameBlendPlugin::renderForBitDepth(const OFX::RenderArguments &args)
     OperationEnum operation = (OperationEnum)operation_i;
 
     switch (operation) {
-        case eOperationAverage: {
-            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationAverage> fred(*this);
-            setupAndProcess(fred, args);
+        case eOperationAverage:
+            renderForOperation<PIX, nComponents, maxValue, eOperationAverage>(args);
             break;
-        }
-        case eOperationMin: {
-            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationMin> fred(*this);
-            setupAndProcess(fred, args);
+        case eOperationMin:
+            renderForOperation<PIX, nComponents, maxValue, eOperationMin>(args);
             break;
-        }
-        case eOperationMax: {
-            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationMax> fred(*this);
-            setupAndProcess(fred, args);
+        case eOperationMax:
+            renderForOperation<PIX, nComponents, maxValue, eOperationMax>(args);
             break;
-        }
-        case eOperationSum: {
-            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationSum> fred(*this);
-            setupAndProcess(fred, args);
+        case eOperationSum:
+            renderForOperation<PIX, nComponents, maxValue, eOperationSum>(args);
             break;
-        }
-        case eOperationProduct: {
-            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationProduct> fred(*this);
-            setupAndProcess(fred, args);
+        case eOperationProduct:
+            renderForOperation<PIX, nComponents, maxValue, eOperationProduct>(args);
             break;
-        }
     }
 }
 
@@ -797,8 +1040,9 @@ template <class PIX, int nComponents, int maxValue, OperationEnum operation>
 void
 FrameBlendPlugin::renderForOperation(const OFX::RenderArguments &args)
 {
-    FrameBlendProcessor<PIX, nComponents, maxValue, eOperationAverage> fred(*this);
-    setupAndProcess(fred, args);
+    FrameBlendProcessor<PIX, nComponents, maxValue, operation> fred(*this);
+    FrameBlendAccumulator<PIX, nComponents, operation> accumulator(*this);
+    setupAndProcess(fred, accumulator, args);
 }
 
 bool
@@ -902,6 +1146,26 @@ FrameBlendPlugin::changedParam(const InstanceChangedArgs &args, const std::strin
     }
 }
 
+void
+FrameBlendPlugin::changedClip(const InstanceChangedArgs &args, const std::string &/*clipName*/)
+{
+    if (args.reason == eChangeUserEdit) {
+        // the input frames may have changed
+        OFX::MultiThread::AutoMutex lock(_slidingWindowMutex);
+        _slidingWindowState.valid = false;
+    }
+}
+
+void
+FrameBlendPlugin::purgeCaches()
+{
+    OFX::MultiThread::AutoMutex lock(_slidingWindowMutex);
+    _slidingWindowState.valid = false;
+    // free the memory
+    std::vector<float>().swap(_slidingWindowState.sum);
+    std::vector<float>().swap(_slidingWindowState.count);
+}
+
 
 mDeclarePluginFactory(FrameBlendPluginFactory, {}, {});
 
@@ -1077,6 +1341,16 @@ void FrameBlendPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc
         }
     }
 
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamSlidingWindowName);
+        param->setLabel(kParamSlidingWindowLabel);
+        param->setHint(kParamSlidingWindowHint);
+        param->setDefault(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     {
         BooleanParamDescriptor *param = desc.defineBooleanParam(kParamOutputCountName);
         param->setLabel(kParamOutputCountLabel);
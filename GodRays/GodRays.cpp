@@ -113,6 +113,19 @@
 #define kParamSteps "steps"
 #define kParamStepsLabel "Steps"
 #define kParamStepsHint "The number of intermediate images is 2^steps, i.e. 32 for steps=5."
+
+#define kParamMethod "method"
+#define kParamMethodLabel "Method"
+#define kParamMethodHint "Algorithm used to compute the intermediate images."
+#define kParamMethodOptionSampling "Sampling"
+#define kParamMethodOptionSamplingHint "Transform the input 2^steps times at each output pixel. The render time is proportional to 2^steps."
+#define kParamMethodOptionDoubling "Recursive Doubling"
+#define kParamMethodOptionDoublingHint "Build the result in steps passes, each pass adding to the previous result a transformed copy of itself, using twice the transform of the previous pass. The render time is proportional to steps. The result is the same as with sampling (except for filtering, since intermediate passes use bilinear filtering) for a scale and rotation around the center or for a translation, and is approximate for other transforms and for gamma values different from 1. Sampling is used instead when it is faster, e.g. when rendering small tiles."
+
+enum MethodEnum {
+    eMethodSampling = 0,
+    eMethodDoubling,
+};
 #endif
 
 #define kParamMax "max"
@@ -123,8 +136,21 @@
 #define kTransform3x3MotionBlurCount 1000 // number of transforms used in the motion
 #endif
 
+#define kGodRaysMotionBlurBlockSize 16 // number of pixels of a row processed together by the motion blur loop
+
 using namespace OFX;
 
+// The passes run by the processor.
+// The recursive doubling method computes the sum of the intermediate images in an accumulation buffer:
+// the first pass puts the input transformed by the smallest transform in the buffer, then each step
+// adds to the buffer a transformed copy of itself, using twice the transform of the previous step.
+enum GodRaysPassEnum {
+    ePassSampling,       // sample all the transforms at each output pixel
+    ePassDoublingFirst,  // first intermediate image, into the accumulation buffer
+    ePassDoublingStep,   // add a transformed copy of the accumulation buffer to itself
+    ePassDoublingOutput, // output the accumulation buffer
+};
+
 class GodRaysProcessorBase
 : public Transform3x3ProcessorBase
 {
@@ -136,6 +162,12 @@ protected:
     int _steps;
 #endif
     bool _max;
+    GodRaysPassEnum _pass;
+    int _doublingStep;
+    OFX::Matrix3x3 _passInvtransform; // transform used by a recursive doubling pass, in pixel coordinates
+    const float *_accumSrc;
+    float *_accumDst;
+    OfxRectI _accumBounds;
 
 public:
 
@@ -145,10 +177,33 @@ public:
     , _steps(5)
 #endif
     , _max(false)
+    , _pass(ePassSampling)
+    , _doublingStep(0)
+    , _passInvtransform()
+    , _accumSrc(0)
+    , _accumDst(0)
     {
         for (int c=0; c < 4; ++c) {
             _fromColor[c] = _toColor[c] = _gamma[c] = 1.;
         }
+        _accumBounds.x1 = _accumBounds.y1 = _accumBounds.x2 = _accumBounds.y2 = 0;
+    }
+
+    /** @brief set the recursive doubling pass run by the next call to process().
+     accumSrc and accumDst are float buffers with one pixel per pixel of accumBounds. */
+    void setDoublingPass(GodRaysPassEnum pass,
+                         int step,
+                         const OFX::Matrix3x3 &invtransform,
+                         const float *accumSrc,
+                         float *accumDst,
+                         const OfxRectI &accumBounds)
+    {
+        _pass = pass;
+        _doublingStep = step;
+        _passInvtransform = invtransform;
+        _accumSrc = accumSrc;
+        _accumDst = accumDst;
+        _accumBounds = accumBounds;
     }
 
     virtual void setValues(const OFX::Matrix3x3* invtransform, //!< non-generic - must be in PIXEL coords
@@ -260,10 +315,19 @@ private:
     void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE
     {
         assert(_invtransform);
-        if (_motionblur == 0.) { // no motion blur
-            return multiThreadProcessImagesNoBlur(procWindow);
-        } else { // motion blur
-            return multiThreadProcessImagesMotionBlur(procWindow);
+        switch (_pass) {
+            case ePassSampling:
+                if (_motionblur == 0.) { // no motion blur
+                    return multiThreadProcessImagesNoBlur(procWindow);
+                } else { // motion blur
+                    return multiThreadProcessImagesMotionBlur(procWindow);
+                }
+            case ePassDoublingFirst:
+                return multiThreadProcessImagesDoublingFirst(procWindow);
+            case ePassDoublingStep:
+                return multiThreadProcessImagesDoublingStep(procWindow);
+            case ePassDoublingOutput:
+                return multiThreadProcessImagesDoublingOutput(procWindow);
         }
     } // multiThreadProcessImages
 
@@ -309,14 +373,32 @@ private:
         }
     }
 
+    // The pixels of each row are processed by blocks of kGodRaysMotionBlurBlockSize pixels, which share one
+    // sample sequence: the transformed coordinates of the first pixel of the block are computed once per transform,
+    // and those of the other pixels are obtained by stepping along the row, so that neighbouring pixels read
+    // neighbouring source pixels.
     void multiThreadProcessImagesMotionBlur(const OfxRectI &procWindow)
     {
+        const int blockSize = kGodRaysMotionBlurBlockSize;
+        // the transformed coordinates of the first pixel of the current block, for each transform already used by
+        // the block (origin[t] is valid if originBlock[t] is the index of the current block)
+        std::vector<OFX::Point3D> origin(_invtransformsize);
+        std::vector<int> originBlock(_invtransformsize, -1);
+        int block = 0;
         float tmpPix[nComponents];
+        float max[blockSize][nComponents];
+        double accPix[blockSize][nComponents];
+        double mean[nComponents];
 #ifndef USE_STEPS
+        double accPix2[blockSize][nComponents];
         const double maxErr2 = kTransform3x3ProcessorMotionBlurMaxError * kTransform3x3ProcessorMotionBlurMaxError; // maximum expected squared error
         const int maxIt = kTransform3x3ProcessorMotionBlurMaxIterations; // maximum number of iterations
+        double offset[blockSize];
         // Monte Carlo integration, starting with at least 13 regularly spaced samples, and then low discrepancy
         // samples from the van der Corput sequence.
+        // All the pixels of a block use the same sequence, rotated by a random offset for each pixel
+        // (Cranley-Patterson rotation), so that the errors of neighbouring pixels are not correlated. The block is
+        // done when the error bound is met for all its pixels.
 #endif
         for (int y = procWindow.y1; y < procWindow.y2; ++y) {
             if ( _effect.abort() ) {
@@ -331,110 +413,271 @@ private:
             canonicalCoords.z = 1;
             canonicalCoords.y = (double)y + 0.5;
 
-            for (int x = procWindow.x1; x < procWindow.x2; ++x, dstPix += nComponents) {
-                float max[nComponents];
-                double accPix[nComponents];
-                double mean[nComponents];
+            for (int bx = procWindow.x1; bx < procWindow.x2; bx += blockSize, ++block) {
+                const int bn = std::min(blockSize, procWindow.x2 - bx);
+                canonicalCoords.x = (double)bx + 0.5;
+                for (int i = 0; i < bn; ++i) {
 #ifndef USE_STEPS
-                double accPix2[nComponents];
-                double var[nComponents];
+                    offset[i] = hash(hash(bx + i + (unsigned int)(0x10000 * _motionblur)) + y) / 4294967296.;
 #endif
-                for (int c = 0; c < nComponents; ++c) {
-                    max[c] = 0;
-                    accPix[c] = 0;
-                    mean[c] = 0.;
+                    for (int c = 0; c < nComponents; ++c) {
+                        max[i][c] = 0;
+                        accPix[i][c] = 0;
 #ifndef USE_STEPS
-                    accPix2[c] = 0;
-                    var[c] = (double)maxValue * maxValue;
+                        accPix2[i][c] = 0;
 #endif
+                    }
                 }
                 int sample = 0;
 #ifdef USE_STEPS
                 const int minsamples = _invtransformsize;
 #else
                 const int minsamples = kTransform3x3ProcessorMotionBlurMinIterations; // minimum number of samples (at most maxIt/3
-                unsigned int seed = (unsigned int)(hash(hash(x + (unsigned int)(0x10000 * _motionblur)) + y));
+                unsigned int seed = (unsigned int)(hash(hash(bx + (unsigned int)(0x10000 * _motionblur)) + y));
 #endif
                 int maxsamples = minsamples;
                 while (sample < maxsamples) {
                     for (; sample < maxsamples; ++sample) {
-                        int t;
 #ifdef USE_STEPS
-                        t = sample;
+                        const int t = sample;
 #else
+                        // the position of the sample in the sequence shared by the block
+                        double u;
                         //int t = 0.5*(van_der_corput<2>(seed1) + van_der_corput<3>(seed2)) * _invtransform.size();
                         if (sample < minsamples) {
                             // distribute the first samples evenly over the interval
-                            t = (int)(( sample  + van_der_corput<2>(seed) ) * _invtransformsize / (double)minsamples);
+                            u = ( sample  + van_der_corput<2>(seed) ) / (double)minsamples;
                         } else {
-                            t = (int)(van_der_corput<2>(seed) * _invtransformsize);
+                            u = van_der_corput<2>(seed);
                         }
                         ++seed;
 #endif
-                        // NON-GENERIC TRANSFORM
-
-                        // the coordinates of the center of the pixel in canonical coordinates
-                        // see http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#CanonicalCoordinates
-                        canonicalCoords.x = (double)x + 0.5;
-                        OFX::Point3D transformed = _invtransform[t] * canonicalCoords;
-                        if ( !_srcImg || (transformed.z == 0.) ) {
-                            // the back-transformed point is at infinity
-                            for (int c = 0; c < nComponents; ++c) {
-                                tmpPix[c] = 0;
+                        for (int i = 0; i < bn; ++i) {
+#ifndef USE_STEPS
+                            // rotate the sample by the offset of the pixel
+                            double ui = u + offset[i];
+                            if (ui >= 1.) {
+                                ui -= 1.;
                             }
-                        } else {
-                            double fx = transformed.z != 0 ? transformed.x / transformed.z : transformed.x;
-                            double fy = transformed.z != 0 ? transformed.y / transformed.z : transformed.y;
-
-                            ofxsFilterInterpolate2D<PIX,nComponents,filter,clamp>(fx, fy, _srcImg, _blackOutside, tmpPix);
-                        }
-                        for (int c = 0; c < nComponents; ++c) {
-                            // multiply by color
-                            tmpPix[c] *= _color[t][c];
-                            if (_max) {
-                                max[c] = std::max(max[c], tmpPix[c]);
+                            const int t = std::min( (int)(ui * _invtransformsize), (int)_invtransformsize - 1 );
+#endif
+                            // NON-GENERIC TRANSFORM
+
+                            // Moving one pixel to the right adds the first column of the matrix to the transformed
+                            // coordinates of the first pixel of the block.
+                            const OFX::Matrix3x3 &H = _invtransform[t];
+                            if (originBlock[t] != block) {
+                                origin[t] = H * canonicalCoords;
+                                originBlock[t] = block;
                             }
-                            accPix[c] += tmpPix[c];
+                            const Pix &color = _color[t];
+                            OFX::Point3D transformed;
+                            transformed.x = origin[t].x + i * H.a;
+                            transformed.y = origin[t].y + i * H.d;
+                            transformed.z = origin[t].z + i * H.g;
+                            if ( !_srcImg || (transformed.z == 0.) ) {
+                                // the back-transformed point is at infinity
+                                for (int c = 0; c < nComponents; ++c) {
+                                    tmpPix[c] = 0;
+                                }
+                            } else {
+                                double fx = transformed.x / transformed.z;
+                                double fy = transformed.y / transformed.z;
+
+                                ofxsFilterInterpolate2D<PIX,nComponents,filter,clamp>(fx, fy, _srcImg, _blackOutside, tmpPix);
+                            }
+                            for (int c = 0; c < nComponents; ++c) {
+                                // multiply by color
+                                tmpPix[c] *= color[c];
+                                if (_max) {
+                                    max[i][c] = std::max(max[i][c], tmpPix[c]);
+                                }
+                                accPix[i][c] += tmpPix[c];
 #ifndef USE_STEPS
-                            accPix2[c] += tmpPix[c] * tmpPix[c];
+                                accPix2[i][c] += tmpPix[c] * tmpPix[c];
 #endif
+                            }
                         }
                     }
 #ifndef USE_STEPS
-                    // compute mean and variance (unbiased)
-                    for (int c = 0; c < nComponents; ++c) {
-                        mean[c] = sample ? accPix[c] / sample : 0;
-                        if (sample <= 1) {
-                            var[c] = (double)maxValue * maxValue;
-                        } else {
-                            var[c] = (accPix2[c] - mean[c] * mean[c] * sample) / (sample - 1);
-                            // the variance of the mean is var[c]/n, so compute n so that it falls below some threashold (maxErr2).
-                            // Note that this could be improved/optimized further by variance reduction and importance sampling
-                            // http://www.scratchapixel.com/lessons/3d-basic-lessons/lesson-17-monte-carlo-methods-in-practice/variance-reduction-methods-a-quick-introduction-to-importance-sampling/
-                            // http://www.scratchapixel.com/lessons/3d-basic-lessons/lesson-xx-introduction-to-importance-sampling/
-                            // The threshold is computed by a simple rule of thumb:
-                            // - the error should be less than motionblur*maxValue/100
-                            // - the total number of iterations should be less than motionblur*100
-                            if (maxsamples < maxIt) {
-                                maxsamples = std::max( maxsamples, std::min( (int)(var[c] / maxErr2),maxIt ) );
+                    // compute the variance (unbiased) of each pixel of the block
+                    for (int i = 0; i < bn && maxsamples < maxIt; ++i) {
+                        for (int c = 0; c < nComponents; ++c) {
+                            if (sample <= 1) {
+                                maxsamples = maxIt;
+                            } else {
+                                double m = accPix[i][c] / sample;
+                                double var = (accPix2[i][c] - m * m * sample) / (sample - 1);
+                                // the variance of the mean is var/n, so compute n so that it falls below some threashold (maxErr2).
+                                // Note that this could be improved/optimized further by variance reduction and importance sampling
+                                // http://www.scratchapixel.com/lessons/3d-basic-lessons/lesson-17-monte-carlo-methods-in-practice/variance-reduction-methods-a-quick-introduction-to-importance-sampling/
+                                // http://www.scratchapixel.com/lessons/3d-basic-lessons/lesson-xx-introduction-to-importance-sampling/
+                                // The threshold is computed by a simple rule of thumb:
+                                // - the error should be less than motionblur*maxValue/100
+                                // - the total number of iterations should be less than motionblur*100
+                                maxsamples = std::max( maxsamples, std::min( (int)(var / maxErr2),maxIt ) );
                             }
                         }
                     }
 #endif
                 }
-                if (_max) {
-                    for (int c = 0; c < nComponents; ++c) {
-                        tmpPix[c] = (float)max[c];
+                for (int i = 0; i < bn; ++i, dstPix += nComponents) {
+                    if (_max) {
+                        for (int c = 0; c < nComponents; ++c) {
+                            tmpPix[c] = (float)max[i][c];
+                        }
+                    } else {
+                        for (int c = 0; c < nComponents; ++c) {
+                            mean[c] = sample ? accPix[i][c] / sample : 0;
+                            tmpPix[c] = (float)mean[c];
+                        }
                     }
-                } else {
-#ifdef USE_STEPS
+                    ofxsMaskMix<PIX, nComponents, maxValue, true>(tmpPix, bx + i, y, _srcImg, _domask, _maskImg, (float)_mix, _maskInvert, dstPix);
+                }
+            }
+        }
+    }
+
+    float *accumPixelAddress(const float *accum, int x, int y) const
+    {
+        return (float*)accum + ((size_t)(y - _accumBounds.y1) * (_accumBounds.x2 - _accumBounds.x1) + (x - _accumBounds.x1)) * nComponents;
+    }
+
+    // bilinear interpolation in the accumulation buffer, which is black outside of its bounds
+    void accumInterpolate(double fx, double fy, float *pix) const
+    {
+        for (int c = 0; c < nComponents; ++c) {
+            pix[c] = 0.f;
+        }
+        // pixel centers are at (x+0.5,y+0.5)
+        const double x = fx - 0.5;
+        const double y = fy - 0.5;
+        if (!(x > _accumBounds.x1 - 1 && x < _accumBounds.x2 && y > _accumBounds.y1 - 1 && y < _accumBounds.y2)) {
+            return;
+        }
+        const int ix = (int)std::floor(x);
+        const int iy = (int)std::floor(y);
+        const float dx = (float)(x - ix);
+        const float dy = (float)(y - iy);
+        for (int j = 0; j < 2; ++j) {
+            const int yj = iy + j;
+            if (yj < _accumBounds.y1 || _accumBounds.y2 <= yj) {
+                continue;
+            }
+            const float wy = j ? dy : 1.f - dy;
+            for (int i = 0; i < 2; ++i) {
+                const int xi = ix + i;
+                if (xi < _accumBounds.x1 || _accumBounds.x2 <= xi) {
+                    continue;
+                }
+                const float w = wy * (i ? dx : 1.f - dx);
+                const float *p = accumPixelAddress(_accumSrc, xi, yj);
+                for (int c = 0; c < nComponents; ++c) {
+                    pix[c] += w * p[c];
+                }
+            }
+        }
+    }
+
+    // first intermediate image: the input transformed by the smallest transform, multiplied by its color
+    void multiThreadProcessImagesDoublingFirst(const OfxRectI &procWindow)
+    {
+        float tmpPix[nComponents];
+        const OFX::Matrix3x3 & H = _passInvtransform;
+        const Pix &color = _color[_invtransformsize - 1];
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+
+            float *accPix = accumPixelAddress(_accumDst, procWindow.x1, y);
+
+            OFX::Point3D canonicalCoords;
+            canonicalCoords.z = 1;
+            canonicalCoords.y = (double)y + 0.5;
+
+            for (int x = procWindow.x1; x < procWindow.x2; ++x, accPix += nComponents) {
+                canonicalCoords.x = (double)x + 0.5;
+                OFX::Point3D transformed = H * canonicalCoords;
+                if ( !_srcImg || (transformed.z == 0.) ) {
+                    // the back-transformed point is at infinity
                     for (int c = 0; c < nComponents; ++c) {
-                        mean[c] = sample ? accPix[c] / sample : 0;
+                        tmpPix[c] = 0;
                     }
-#endif
+                } else {
+                    double fx = transformed.x / transformed.z;
+                    double fy = transformed.y / transformed.z;
+
+                    ofxsFilterInterpolate2D<PIX,nComponents,filter,clamp>(fx, fy, _srcImg, _blackOutside, tmpPix);
+                }
+                for (int c = 0; c < nComponents; ++c) {
+                    accPix[c] = tmpPix[c] * color[c];
+                }
+            }
+        }
+    }
+
+    // step k adds intermediate images 2^k+1 to 2^(k+1), which are the images 1 to 2^k transformed by
+    // the transform of image 2^k, and multiplied by the color ratio between images 2^k+1 and 1.
+    // The color ratio is exact when the colors decrease exponentially (gamma=1).
+    void multiThreadProcessImagesDoublingStep(const OfxRectI &procWindow)
+    {
+        float tmpPix[nComponents];
+        float colorRatio[nComponents];
+        const OFX::Matrix3x3 & H = _passInvtransform;
+        // image i (counting from 1) uses the color _color[n-i]
+        const int n = (int)_invtransformsize;
+        const Pix &color1 = _color[n - 1];
+        const Pix &color2 = _color[n - 1 - (1 << _doublingStep)];
+        for (int c = 0; c < nComponents; ++c) {
+            colorRatio[c] = (color1[c] != 0.f) ? color2[c] / color1[c] : 0.f;
+        }
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+
+            const float *srcPix = accumPixelAddress(_accumSrc, procWindow.x1, y);
+            float *accPix = accumPixelAddress(_accumDst, procWindow.x1, y);
+
+            OFX::Point3D canonicalCoords;
+            canonicalCoords.z = 1;
+            canonicalCoords.y = (double)y + 0.5;
+
+            for (int x = procWindow.x1; x < procWindow.x2; ++x, srcPix += nComponents, accPix += nComponents) {
+                canonicalCoords.x = (double)x + 0.5;
+                OFX::Point3D transformed = H * canonicalCoords;
+                if (transformed.z == 0.) {
+                    // the back-transformed point is at infinity
                     for (int c = 0; c < nComponents; ++c) {
-                        tmpPix[c] = (float)mean[c];
+                        tmpPix[c] = 0;
                     }
+                } else {
+                    accumInterpolate(transformed.x / transformed.z, transformed.y / transformed.z, tmpPix);
+                }
+                for (int c = 0; c < nComponents; ++c) {
+                    float v = tmpPix[c] * colorRatio[c];
+                    accPix[c] = _max ? std::max(srcPix[c], v) : (srcPix[c] + v);
+                }
+            }
+        }
+    }
+
+    void multiThreadProcessImagesDoublingOutput(const OfxRectI &procWindow)
+    {
+        float tmpPix[nComponents];
+        const float norm = _max ? 1.f : 1.f / _invtransformsize;
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+
+            const float *accPix = accumPixelAddress(_accumSrc, procWindow.x1, y);
+            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
+
+            for (int x = procWindow.x1; x < procWindow.x2; ++x, accPix += nComponents, dstPix += nComponents) {
+                for (int c = 0; c < nComponents; ++c) {
+                    tmpPix[c] = accPix[c] * norm;
                 }
                 ofxsMaskMix<PIX, nComponents, maxValue, true>(tmpPix, x, y, _srcImg, _domask, _maskImg, (float)_mix, _maskInvert, dstPix);
             }
@@ -514,6 +757,7 @@ public:
     , _gamma(0)
 #ifdef USE_STEPS
     , _steps(0)
+    , _method(0)
 #endif
     , _max(0)
     {
@@ -534,7 +778,8 @@ public:
         _gamma = fetchRGBAParam(kParamGamma);
 #ifdef USE_STEPS
         _steps = fetchIntParam(kParamSteps);
-        assert(_steps);
+        _method = fetchChoiceParam(kParamMethod);
+        assert(_steps && _method);
 #endif
         _max = fetchBooleanParam(kParamMax);
 
@@ -566,6 +811,18 @@ private:
     /* set up and run a processor */
     void setupAndProcess(GodRaysProcessorBase &, const OFX::RenderArguments &args);
 
+#ifdef USE_STEPS
+    /* run the recursive doubling passes of a processor. Returns false if sampling should be used instead. */
+    bool processDoubling(GodRaysProcessorBase &processor,
+                         const OFX::RenderArguments &args,
+                         int steps,
+                         bool invert,
+                         bool fielded,
+                         double pixelAspectRatio,
+                         const OFX::Matrix3x3 *srcTransformInverse,
+                         int nComponents);
+#endif
+
     // NON-GENERIC
     OFX::Double2DParam* _translate;
     OFX::DoubleParam* _rotate;
@@ -580,6 +837,9 @@ private:
     RGBAParam* _toColor;
     RGBAParam* _gamma;
     IntParam* _steps;
+#ifdef USE_STEPS
+    ChoiceParam* _method;
+#endif
     BooleanParam* _max;
 };
 
@@ -803,6 +1063,11 @@ GodRaysPlugin::setupAndProcess(GodRaysProcessorBase &processor,
 #ifdef USE_STEPS
     int steps = 5;
 #endif
+    bool invert = false;
+    bool fielded = false;
+    double pixelAspectRatio = 1.;
+    bool hasSrcTransformInverse = false;
+    OFX::Matrix3x3 srcTransformInverse;
 
     if ( !src.get() ) {
         // no source image, use a dummy transform
@@ -827,7 +1092,6 @@ GodRaysPlugin::setupAndProcess(GodRaysProcessorBase &processor,
             OFX::throwSuiteStatusException(kOfxStatFailed);
         }
 
-        bool invert;
         _invert->getValueAtTime(time, invert);
 
         _blackOutside->getValueAtTime(time, blackOutside);
@@ -835,8 +1099,8 @@ GodRaysPlugin::setupAndProcess(GodRaysProcessorBase &processor,
 #ifndef USE_STEPS
         _motionblur->getValueAtTime(time, motionblur);
 #endif
-        const bool fielded = args.fieldToRender == OFX::eFieldLower || args.fieldToRender == OFX::eFieldUpper;
-        const double pixelAspectRatio = src->getPixelAspectRatio();
+        fielded = args.fieldToRender == OFX::eFieldLower || args.fieldToRender == OFX::eFieldUpper;
+        pixelAspectRatio = src->getPixelAspectRatio();
 
 #ifdef USE_STEPS
         _steps->getValueAtTime(time, steps);
@@ -866,7 +1130,8 @@ GodRaysPlugin::setupAndProcess(GodRaysProcessorBase &processor,
             // invert it
             double det = ofxsMatDeterminant(srcTransformMat);
             if (det != 0.) {
-                OFX::Matrix3x3 srcTransformInverse = ofxsMatInverse(srcTransformMat, det);
+                srcTransformInverse = ofxsMatInverse(srcTransformMat, det);
+                hasSrcTransformInverse = true;
 
                 for (size_t i = 0; i < invtransformsize; ++i) {
                     invtransform[i] = srcTransformInverse * invtransform[i];
@@ -926,10 +1191,158 @@ GodRaysPlugin::setupAndProcess(GodRaysProcessorBase &processor,
 #endif
                         max);
 
+#ifdef USE_STEPS
+    int method = eMethodSampling;
+    _method->getValueAtTime(time, method);
+    if (method == eMethodDoubling && src.get() && invtransformsize > 1 && invtransformsize == invtransformsizealloc) {
+        int nComponents = (dstComponents == OFX::ePixelComponentRGBA) ? 4 : (dstComponents == OFX::ePixelComponentRGB) ? 3 : 1;
+        if (processDoubling(processor, args, steps, invert, fielded, pixelAspectRatio,
+                            hasSrcTransformInverse ? &srcTransformInverse : 0, nComponents)) {
+            return;
+        }
+    }
+#endif
+
     // Call the base class process member, this will call the derived templated process code
     processor.process();
 } // setupAndProcess
 
+#ifdef USE_STEPS
+// bounding box of the image of rect by the transform H (in pixel coordinates),
+// enlarged by one pixel so that it contains the pixels used by bilinear interpolation.
+// Returns false if the image is not bounded.
+static bool
+getTransformedRegion(const OFX::Matrix3x3 &H,
+                     const OfxRectI &rect,
+                     OfxRectI *bbox)
+{
+    double xmin = 0., xmax = 0., ymin = 0., ymax = 0.;
+    for (int i = 0; i < 4; ++i) {
+        OFX::Point3D p;
+        p.x = (i & 1) ? rect.x2 : rect.x1;
+        p.y = (i & 2) ? rect.y2 : rect.y1;
+        p.z = 1.;
+        p = H * p;
+        if (p.z <= 0.) {
+            // the point is at infinity or behind the camera
+            return false;
+        }
+        double x = p.x / p.z;
+        double y = p.y / p.z;
+        if (i == 0 || x < xmin) {
+            xmin = x;
+        }
+        if (i == 0 || x > xmax) {
+            xmax = x;
+        }
+        if (i == 0 || y < ymin) {
+            ymin = y;
+        }
+        if (i == 0 || y > ymax) {
+            ymax = y;
+        }
+    }
+    // reject huge regions before converting to int
+    const double maxCoord = 1e7;
+    if (!(-maxCoord < xmin && xmax < maxCoord && -maxCoord < ymin && ymax < maxCoord)) {
+        return false;
+    }
+    bbox->x1 = (int)std::floor(xmin) - 1;
+    bbox->x2 = (int)std::ceil(xmax) + 1;
+    bbox->y1 = (int)std::floor(ymin) - 1;
+    bbox->y2 = (int)std::ceil(ymax) + 1;
+
+    return true;
+}
+
+static double
+regionArea(const OfxRectI &rect)
+{
+    return (double)std::max(0, rect.x2 - rect.x1) * (double)std::max(0, rect.y2 - rect.y1);
+}
+
+bool
+GodRaysPlugin::processDoubling(GodRaysProcessorBase &processor,
+                               const OFX::RenderArguments &args,
+                               int steps,
+                               bool invert,
+                               bool fielded,
+                               double pixelAspectRatio,
+                               const OFX::Matrix3x3 *srcTransformInverse,
+                               int nComponents)
+{
+    const double time = args.time;
+    const int n = 1 << steps;
+
+    // the transform of step k is the transform of intermediate image 2^k, i.e. with amount 2^k/n
+    OFX::Matrix3x3 canonicalToPixel = OFX::ofxsMatCanonicalToPixel(pixelAspectRatio, args.renderScale.x, args.renderScale.y, fielded);
+    OFX::Matrix3x3 pixelToCanonical = OFX::ofxsMatPixelToCanonical(pixelAspectRatio, args.renderScale.x, args.renderScale.y, fielded);
+    std::vector<OFX::Matrix3x3> stepInvtransform(steps);
+    for (int k = 0; k < steps; ++k) {
+        OFX::Matrix3x3 invtransformCanonical;
+        if ( !getInverseTransformCanonical(time, (1 << k) / (double)n, invert, &invtransformCanonical) ) {
+            return false;
+        }
+        stepInvtransform[k] = canonicalToPixel * invtransformCanonical * pixelToCanonical;
+    }
+    // the first intermediate image is read from the source image
+    OFX::Matrix3x3 firstInvtransform = stepInvtransform[0];
+    if (srcTransformInverse) {
+        firstInvtransform = *srcTransformInverse * firstInvtransform;
+    }
+
+    // step k computes region[k+1] from region[k] (the render window is region[steps])
+    std::vector<OfxRectI> region(steps + 1);
+    region[steps] = args.renderWindow;
+    double cost = 2 * regionArea(args.renderWindow); // output pass and last step
+    for (int k = steps - 1; k >= 0; --k) {
+        OfxRectI transformedRegion;
+        if ( !getTransformedRegion(stepInvtransform[k], region[k+1], &transformedRegion) ) {
+            return false;
+        }
+        region[k].x1 = std::min(region[k+1].x1, transformedRegion.x1);
+        region[k].y1 = std::min(region[k+1].y1, transformedRegion.y1);
+        region[k].x2 = std::max(region[k+1].x2, transformedRegion.x2);
+        region[k].y2 = std::max(region[k+1].y2, transformedRegion.y2);
+        cost += regionArea(region[k]);
+    }
+    // sampling costs n samples per output pixel
+    if ( cost >= n * regionArea(args.renderWindow) ) {
+        return false;
+    }
+
+    // two accumulation buffers, used alternately as source and destination
+    const OfxRectI &accumBounds = region[0];
+    size_t accumSize = (size_t)(accumBounds.x2 - accumBounds.x1) * (accumBounds.y2 - accumBounds.y1) * nComponents;
+    OFX::ImageMemory accumMem0(accumSize * sizeof(float), this);
+    OFX::ImageMemory accumMem1(accumSize * sizeof(float), this);
+    float *accum[2] = { (float*)accumMem0.lock(), (float*)accumMem1.lock() };
+    if (!accum[0] || !accum[1]) {
+        OFX::throwSuiteStatusException(kOfxStatErrMemory);
+    }
+
+    processor.setDoublingPass(ePassDoublingFirst, 0, firstInvtransform, 0, accum[0], accumBounds);
+    processor.setRenderWindow(region[0]);
+    processor.process();
+    for (int k = 0; k < steps; ++k) {
+        if ( abort() ) {
+            return true;
+        }
+        processor.setDoublingPass(ePassDoublingStep, k, stepInvtransform[k], accum[k & 1], accum[(k + 1) & 1], accumBounds);
+        processor.setRenderWindow(region[k+1]);
+        processor.process();
+    }
+    if ( abort() ) {
+        return true;
+    }
+    processor.setDoublingPass(ePassDoublingOutput, steps, firstInvtransform, accum[steps & 1], 0, accumBounds);
+    processor.setRenderWindow(args.renderWindow);
+    processor.process();
+
+    return true;
+} // processDoubling
+#endif
+
 template <class PIX, int nComponents, int maxValue>
 void
 GodRaysPlugin::renderInternalForBitDepth(const OFX::RenderArguments &args)
@@ -1273,6 +1686,21 @@ void GodRaysPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc, O
             page->addChild(*param);
         }
     }
+
+    // method
+    {
+        ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamMethod);
+        param->setLabel(kParamMethodLabel);
+        param->setHint(kParamMethodHint);
+        assert(param->getNOptions() == eMethodSampling);
+        param->appendOption(kParamMethodOptionSampling, kParamMethodOptionSamplingHint);
+        assert(param->getNOptions() == eMethodDoubling);
+        param->appendOption(kParamMethodOptionDoubling, kParamMethodOptionDoublingHint);
+        param->setDefault((int)eMethodSampling);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 #else
     // motionBlur
     {
@@ -73,7 +73,15 @@
 
 #include <cmath>
 #include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <algorithm>
+#include <vector>
+#include <list>
+#include <map>
+#include <string>
+#include <fstream>
 
 #include "ofxsProcessing.H"
 #include "ofxsRectangleInteract.h"
@@ -118,6 +126,11 @@ using std::isnan;
 #define kSupportsMultipleClipDepths false
 #define kRenderThreadSafety eRenderFullySafe
 
+#define kSequenceAnalysisMaxMemory (512 * 1024 * 1024) // max memory held by the frames being analyzed and the frames being fetched
+#define kCacheBlockSize 256 // size of the blocks of the statistics cache, aligned on pixel coordinates 0
+#define kCacheFileMagic "ImageStatisticsOFXCache"
+#define kCacheFileVersion 2
+
 
 #define kParamRestrictToRectangle "restrictToRectangle"
 #define kParamRestrictToRectangleLabel "Restrict to Rectangle"
@@ -143,6 +156,14 @@ using std::isnan;
 #define kParamAutoUpdateLabel "Auto Update"
 #define kParamAutoUpdateHint "Automatically update values when input or rectangle changes if an analysis was performed at current frame. If not checked, values are only updated if the plugin parameters change. "
 
+#define kParamPercentiles "percentiles"
+#define kParamPercentilesLabel "Percentiles"
+#define kParamPercentilesHint "Also compute the median and the 1st, 5th, 95th and 99th percentiles. These are computed from a histogram built in the same pass as the other statistics, with one bin per value for 8-bit and 16-bit images, and logarithmically spaced bins (with a relative precision of 1/128) for floating-point images and HSVL values."
+
+#define kParamCacheFile "cacheFile"
+#define kParamCacheFileLabel "Cache File"
+#define kParamCacheFileHint "File where the statistics cache is saved, so that it persists across sessions. If empty, the cache is only kept in memory. The cache holds, for each analyzed frame, the statistics of each block of 256x256 pixels of the analyzed area, so that analyzing a frame again after the rectangle changed does not require analyzing the frame again, as long as the rectangle edges are on the block grid or on the image edges. The statistics of a frame are only taken from the cache if the region of definition, first frame, bit depth and components of the input did not change, and, if the host gives unique identifiers to images, if the identifier of the image did not change (in which case the image is fetched, but not analyzed). \"Clear Frame\" or \"Clear Sequence\" discard the cached statistics."
+
 #define kParamGroupRGBA "RGBA"
 
 #define kParamStatMin "statMin"
@@ -183,6 +204,26 @@ using std::isnan;
 "• Any threshold or rule of thumb is arbitrary, but here is one: If the skewness is greater than 1.0 (or less than -1.0), the skewness is substantial and the distribution is far from symmetrical."
 
 
+#define kParamStatMedian "statMedian"
+#define kParamStatMedianLabel "Median"
+#define kParamStatMedianHint "The median is the value separating the higher half from the lower half of the values."
+
+#define kParamStatP1 "statP1"
+#define kParamStatP1Label "P1"
+#define kParamStatP1Hint "The 1st percentile: 1% of the values are below it. It is a robust estimate of the minimum, which is insensitive to outliers."
+
+#define kParamStatP5 "statP5"
+#define kParamStatP5Label "P5"
+#define kParamStatP5Hint "The 5th percentile: 5% of the values are below it."
+
+#define kParamStatP95 "statP95"
+#define kParamStatP95Label "P95"
+#define kParamStatP95Hint "The 95th percentile: 95% of the values are below it."
+
+#define kParamStatP99 "statP99"
+#define kParamStatP99Label "P99"
+#define kParamStatP99Hint "The 99th percentile: 99% of the values are below it. It is a robust estimate of the maximum, which is insensitive to outliers."
+
 #define kParamGroupHSVL "HSVL"
 
 #define kParamAnalyzeFrameHSVL "analyzeFrameHSVL"
@@ -238,8 +279,30 @@ using std::isnan;
 "• The skewness is unitless.\n" \
 "• Any threshold or rule of thumb is arbitrary, but here is one: If the skewness is greater than 1.0 (or less than -1.0), the skewness is substantial and the distribution is far from symmetrical."
 
+#define kParamStatHSVLMedian "statHSVLMedian"
+#define kParamStatHSVLMedianLabel "HSVL Median"
+#define kParamStatHSVLMedianHint "The median is the value separating the higher half from the lower half of the values."
+
+#define kParamStatHSVLP1 "statHSVLP1"
+#define kParamStatHSVLP1Label "HSVL P1"
+#define kParamStatHSVLP1Hint "The 1st percentile: 1% of the values are below it. It is a robust estimate of the minimum, which is insensitive to outliers."
+
+#define kParamStatHSVLP5 "statHSVLP5"
+#define kParamStatHSVLP5Label "HSVL P5"
+#define kParamStatHSVLP5Hint "The 5th percentile: 5% of the values are below it."
+
+#define kParamStatHSVLP95 "statHSVLP95"
+#define kParamStatHSVLP95Label "HSVL P95"
+#define kParamStatHSVLP95Hint "The 95th percentile: 95% of the values are below it."
+
+#define kParamStatHSVLP99 "statHSVLP99"
+#define kParamStatHSVLP99Label "HSVL P99"
+#define kParamStatHSVLP99Hint "The 99th percentile: 99% of the values are below it. It is a robust estimate of the maximum, which is insensitive to outliers."
+
 using namespace OFX;
 
+class ImageStatisticsProcessorBase;
+
 namespace {
     struct RGBAValues {
         double r,g,b,a;
@@ -254,526 +317,699 @@ namespace {
         RGBAValues sdev;
         RGBAValues skewness;
         RGBAValues kurtosis;
+        bool percentiles; // the following values were computed
+        RGBAValues median;
+        RGBAValues p1;
+        RGBAValues p5;
+        RGBAValues p95;
+        RGBAValues p99;
+
+        Results() : percentiles(false) {}
     };
-}
 
-class ImageStatisticsProcessorBase : public OFX::ImageProcessor
-{
-protected:
-    OFX::MultiThread::Mutex _mutex; //< this is used so we can multi-thread the analysis and protect the shared results
-    unsigned long _count;
+    struct FrameResults {
+        bool analyzed;
+        size_t bytes; // memory used by the source image
+        Results rgba;
+        Results hsvl;
 
-public:
-    ImageStatisticsProcessorBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _mutex()
-    , _count(0)
-    {
-    }
+        FrameResults() : analyzed(false), bytes(0) {}
+    };
 
-    virtual ~ImageStatisticsProcessorBase()
-    {
-    }
+    // Min, max, mean and central moments of a set of values, computed in a single pass.
+    // Values are added one at a time using Welford's update (extended to the third and
+    // fourth moments by Terriberry), and partial moments are merged using the pairwise
+    // formulas from Chan et al. and Pebay, which are numerically stable.
+    struct Moments {
+        double n;
+        double min;
+        double max;
+        double mean;
+        double m2; // sum of (x-mean)^2
+        double m3; // sum of (x-mean)^3
+        double m4; // sum of (x-mean)^4
+
+        Moments()
+        : n(0.)
+        , min(+std::numeric_limits<double>::infinity())
+        , max(-std::numeric_limits<double>::infinity())
+        , mean(0.)
+        , m2(0.)
+        , m3(0.)
+        , m4(0.)
+        {
+        }
 
-    virtual void setPrevResults(const Results &results) = 0;
+        void add(double x)
+        {
+            min = std::min(min, x);
+            max = std::max(max, x);
+            double n1 = n;
+            n += 1.;
+            double delta = x - mean;
+            double delta_n = delta / n;
+            double delta_n2 = delta_n * delta_n;
+            double term1 = delta * delta_n * n1;
+            mean += delta_n;
+            m4 += term1 * delta_n2 * (n * n - 3 * n + 3) + 6 * delta_n2 * m2 - 4 * delta_n * m3;
+            m3 += term1 * delta_n * (n - 2) - 3 * delta_n * m2;
+            m2 += term1;
+        }
 
-    virtual void getResults(Results *results) = 0;
+        void merge(const Moments &b)
+        {
+            if (b.n == 0.) {
+                return;
+            }
+            if (n == 0.) {
+                *this = b;
+                return;
+            }
+            double na = n;
+            double nb = b.n;
+            double nn = na + nb;
+            double delta = b.mean - mean;
+            double delta2 = delta * delta;
+            double delta3 = delta * delta2;
+            double delta4 = delta2 * delta2;
+            double m4ab = m4 + b.m4 + delta4 * na * nb * (na * na - na * nb + nb * nb) / (nn * nn * nn)
+                          + 6 * delta2 * (na * na * b.m2 + nb * nb * m2) / (nn * nn)
+                          + 4 * delta * (na * b.m3 - nb * m3) / nn;
+            double m3ab = m3 + b.m3 + delta3 * na * nb * (na - nb) / (nn * nn)
+                          + 3 * delta * (na * b.m2 - nb * m2) / nn;
+            m2 += b.m2 + delta2 * na * nb / nn;
+            m3 = m3ab;
+            m4 = m4ab;
+            mean += delta * nb / nn;
+            n = nn;
+            min = std::min(min, b.min);
+            max = std::max(max, b.max);
+        }
 
-protected:
+        // sdev^2 is an unbiased estimator for the population variance
+        double sdev() const
+        {
+            return (n > 1.) ? std::sqrt(std::max(0., m2 / (n - 1))) : 0.;
+        }
 
-    template<class PIX, int nComponents, int maxValue>
-    void toRGBA(const PIX *p, RGBAValues* rgba)
-    {
-        if (nComponents == 4) {
-            rgba->r = p[0]/(double)maxValue;
-            rgba->g = p[1]/(double)maxValue;
-            rgba->b = p[2]/(double)maxValue;
-            rgba->a = p[3]/(double)maxValue;
-        } else if (nComponents == 3) {
-            rgba->r = p[0]/(double)maxValue;
-            rgba->g = p[1]/(double)maxValue;
-            rgba->b = p[2]/(double)maxValue;
-            rgba->a = 0;
-        } else if (nComponents == 1) {
-            rgba->r = 0;
-            rgba->g = 0;
-            rgba->b = 0;
-            rgba->a = p[0]/(double)maxValue;
-        } else {
-            rgba->r = 0;
-            rgba->g = 0;
-            rgba->b = 0;
-            rgba->a = 0;
+        // the adjusted Fisher-Pearson standardized moment coefficient G_1
+        double skewness() const
+        {
+            if (n <= 2.) {
+                return 0.;
+            }
+            double s = sdev();
+            if (s <= 0.) {
+                return 0.;
+            }
+            double skewfac = (n * n) / ((n - 1) * (n - 2));
+            return skewfac * m3 / (s * s * s) / n;
         }
-    }
 
-    template<class PIX, int nComponents, int maxValue>
-    void
-    pixToHSVL(const PIX *p, float hsvl[4])
-    {
-        if (nComponents == 4 || nComponents == 3) {
-            float r, g, b;
-            r = p[0]/(float)maxValue;
-            g = p[1]/(float)maxValue;
-            b = p[2]/(float)maxValue;
-            OFX::Color::rgb_to_hsv(r, g, b, &hsvl[0], &hsvl[1], &hsvl[2]);
-            float min = std::min(std::min(r, g), b);
-            float max = std::max(std::max(r, g), b);
-            hsvl[3] = (min + max)/2;
-        } else {
-            hsvl[0] = hsvl[1] = hsvl[2] = hsvl[3] = 0.f;
+        // the excess kurtosis
+        double kurtosis() const
+        {
+            if (n <= 3.) {
+                return 0.;
+            }
+            double s = sdev();
+            double s2 = s * s;
+            double kurtfac = ((n + 1) * n) / ((n - 1) * (n - 2) * (n - 3));
+            double kurtshift = -3 * ((n - 1) * (n - 1)) / ((n - 2) * (n - 3));
+            return kurtfac * ((s > 0.) ? m4 / (s2 * s2) : 0.) + kurtshift;
         }
-    }
+    };
 
-    template<class PIX, int nComponents, int maxValue>
-    void toComponents(const RGBAValues& rgba, PIX *p)
+    // Histogram binning, used to compute percentiles: integer values use one bin per value.
+    template<int maxValue>
+    struct HistogramBinning
     {
-        if (nComponents == 4) {
-            p[0] = rgba.r * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[1] = rgba.g * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[2] = rgba.b * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[3] = rgba.a * maxValue + ((maxValue != 1) ? 0.5 : 0);
-        } else if (nComponents == 3) {
-            p[0] = rgba.r * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[1] = rgba.g * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[2] = rgba.b * maxValue + ((maxValue != 1) ? 0.5 : 0);
-        } else if (nComponents == 1) {
-            p[0] = rgba.a * maxValue + ((maxValue != 1) ? 0.5 : 0);
+        enum { nBins = maxValue + 1 };
+
+        static int bin(double v)
+        {
+            return std::max(0, std::min(maxValue, (int)v));
         }
-    }
-};
 
+        // value at position frac (in [0,1]) within bin b
+        static double value(int b, double /*frac*/)
+        {
+            return b;
+        }
+    };
 
-template <class PIX, int nComponents, int maxValue>
-class ImageMinMaxMeanProcessor : public ImageStatisticsProcessorBase
-{
-private:
-    double _min[nComponents];
-    double _max[nComponents];
-    double _sum[nComponents];
-public:
-    ImageMinMaxMeanProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
+    // Float values use the 16 most significant bits of their IEEE 754 representation, remapped so
+    // that the bin index is monotonic. This gives logarithmically spaced bins over the whole float
+    // range, with 128 bins per octave.
+    template<>
+    struct HistogramBinning<1>
     {
-        std::fill(_min, _min+nComponents, +std::numeric_limits<double>::infinity());
-        std::fill(_max, _max+nComponents, -std::numeric_limits<double>::infinity());
-        std::fill(_sum, _sum+nComponents, 0.);
-    }
+        enum { nBins = 65536 };
 
-    ~ImageMinMaxMeanProcessor()
-    {
-    }
+        static int bin(double v)
+        {
+            union { float f; unsigned int i; } u;
+            u.f = (float)v;
+            unsigned int k = u.i >> 16;
+            return (k & 0x8000) ? (~k & 0xFFFF) : (k | 0x8000);
+        }
 
-    void setPrevResults(const Results &/*results*/) OVERRIDE FINAL {}
+        static double value(int b, double frac)
+        {
+            unsigned int k = (b & 0x8000) ? (b & 0x7FFF) : (~b & 0xFFFF);
+            union { float f; unsigned int i; } lo, hi;
+            lo.i = k << 16;
+            hi.i = (k << 16) | 0xFFFF;
+            double a = std::min(lo.f, hi.f);
+            double z = std::max(lo.f, hi.f);
+            if (isnan(a) || isnan(z) || std::abs(z - a) == std::numeric_limits<double>::infinity()) {
+                return lo.f;
+            }
+            return a + frac * (z - a);
+        }
+    };
 
-    void getResults(Results *results) OVERRIDE FINAL
+    // the value below which a fraction p of the n values counted in the histogram fall
+    template<class Binning>
+    double histogramPercentile(const unsigned long *histogram, double n, double p)
     {
-        if (_count > 0) {
-            toRGBA<double, nComponents, 1>(_min, &results->min);
-            toRGBA<double, nComponents, 1>(_max, &results->max);
-            double mean[nComponents];
-            for (int c = 0; c < nComponents; ++c) {
-                mean[c] = _sum[c]/_count;
+        double rank = std::max(1., std::ceil(p * n)); // nearest rank
+        double cumul = 0.;
+        for (int b = 0; b < Binning::nBins; ++b) {
+            if (histogram[b] > 0 && cumul + histogram[b] >= rank) {
+                return Binning::value(b, (rank - cumul - 0.5) / histogram[b]);
             }
-            toRGBA<double, nComponents, 1>(mean, &results->mean);
+            cumul += histogram[b];
         }
+        return 0.;
     }
 
-private:
-
-    void addResults(double min[nComponents], double max[nComponents], double sum[nComponents], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponents; ++c) {
-            _min[c] = std::min(_min[c], min[c]);
-            _max[c] = std::max(_max[c], max[c]);
-            _sum[c] += sum[c];
-        }
-        _count += count;
-        _mutex.unlock();
-    }
+    // partial moments of a block of kCacheBlockSize x kCacheBlockSize pixels
+    struct BlockMoments {
+        Moments c[4];
+    };
 
+    // block moments, indexed by block coordinates
+    typedef std::map<std::pair<int, int>, BlockMoments> BlockMomentsMap;
 
-    void multiThreadProcessImages(OfxRectI procWindow)
+    // block coordinate of pixel coordinate x (rounded towards -inf)
+    inline int blockIndex(int x)
     {
-        double min[nComponents], max[nComponents], sum[nComponents];
-        std::fill(min, min+nComponents, +std::numeric_limits<double>::infinity());
-        std::fill(max, max+nComponents, -std::numeric_limits<double>::infinity());
-        std::fill(sum, sum + nComponents, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
+        return (x >= 0) ? (x / kCacheBlockSize) : (-((-x - 1) / kCacheBlockSize) - 1);
+    }
 
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
+    inline bool rectEqual(const OfxRectI &a, const OfxRectI &b)
+    {
+        return a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2;
+    }
 
-            double sumLine[nComponents]; // partial sum to avoid underflows
-            std::fill(sumLine, sumLine + nComponents, 0.);
+    // the identity of the input of a cached analysis: the cached statistics are only used if it did not change
+    struct CacheInput {
+        OfxRectD rod; // region of definition of the source clip
+        double firstFrame; // first frame of the source clip, which changes if the input is slipped
+        int depth; // OFX::BitDepthEnum of the source clip
+        int components; // OFX::PixelComponentEnum of the source clip
+        std::string uid; // unique identifier of the image, empty if the host does not set it
 
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                for (int c = 0; c < nComponents; ++c) {
-                    double v = *dstPix;
-                    min[c] = std::min(min[c], v);
-                    max[c] = std::max(max[c], v);
-                    sumLine[c] += v;
-                    ++dstPix;
-                }
-            }
-            for (int c = 0; c < nComponents; ++c) {
-                sum[c] += sumLine[c];
-            }
-            count += procWindow.x2 - procWindow.x1;
+        CacheInput()
+        : firstFrame(0.)
+        , depth(0)
+        , components(0)
+        {
+            rod.x1 = rod.y1 = rod.x2 = rod.y2 = 0.;
         }
+    };
 
-        addResults(min, max, sum, count);
+    // the cached entry and the input match, except for the unique identifier of the image
+    inline bool cacheInputMatches(const CacheInput &a, const CacheInput &b)
+    {
+        return (a.rod.x1 == b.rod.x1 && a.rod.y1 == b.rod.y1 && a.rod.x2 == b.rod.x2 && a.rod.y2 == b.rod.y2 &&
+                a.firstFrame == b.firstFrame && a.depth == b.depth && a.components == b.components);
     }
-};
 
+    struct CacheKey {
+        double time;
+        double scaleX;
+        double scaleY;
+        int hsvl;
 
+        CacheKey(double t, const OfxPointD &renderScale, bool isHSVL)
+        : time(t), scaleX(renderScale.x), scaleY(renderScale.y), hsvl(isHSVL) {}
 
+        bool operator<(const CacheKey &k) const
+        {
+            if (time != k.time) {
+                return time < k.time;
+            }
+            if (scaleX != k.scaleX) {
+                return scaleX < k.scaleX;
+            }
+            if (scaleY != k.scaleY) {
+                return scaleY < k.scaleY;
+            }
+            return hsvl < k.hsvl;
+        }
+    };
 
-template <class PIX, int nComponents, int maxValue>
-class ImageSDevProcessor : public ImageStatisticsProcessorBase
-{
-private:
-    double _mean[nComponents];
-    double _sum_p2[nComponents];
-public:
-    ImageSDevProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_mean, _mean+nComponents, 0.);
-        std::fill(_sum_p2, _sum_p2+nComponents, 0.);
-    }
+    // the cached analysis of a frame
+    struct CacheEntry {
+        CacheInput input; // input of the analysis
+        OfxRectI bounds; // bounds of the analyzed image
+        double par; // pixel aspect ratio of the analyzed image
+        int nComponents; // number of components of the statistics
+        BlockMomentsMap blocks; // each block is complete (within bounds)
+        double imageBytes; // memory used by the analyzed image
+        bool hasResults;
+        OfxRectI window; // window of the last results
+        Results results; // last results, which may also have percentiles
+
+        CacheEntry()
+        : par(1.)
+        , nComponents(0)
+        , imageBytes(0.)
+        , hasResults(false)
+        {
+            bounds.x1 = bounds.y1 = bounds.x2 = bounds.y2 = 0;
+            window = bounds;
+        }
+    };
 
-    ~ImageSDevProcessor()
+    typedef std::map<CacheKey, CacheEntry> StatisticsCache;
+
+    // a frame fetched by the main thread, whose statistics may be computed by several threads.
+    // The processors keep pointers to the blocks, so a job must not be copied once it is set up.
+    struct FrameJob {
+        double time;
+        OfxPointD renderScale;
+        const OFX::Image* src; // 0 if all the statistics were in the cache
+        OfxRectI analysisWindow;
+        CacheInput input;
+        bool percentiles;
+        bool doRGBA; // the RGBA statistics were not in the cache
+        bool doHSVL; // the HSVL statistics were not in the cache
+        ImageStatisticsProcessorBase* processorRGBA;
+        ImageStatisticsProcessorBase* processorHSVL;
+        bool failed; // a strip could not be computed by a spawned thread
+        BlockMomentsMap blocksRGBA;
+        BlockMomentsMap blocksHSVL;
+
+        FrameJob()
+        : time(0.)
+        , src(0)
+        , percentiles(false)
+        , doRGBA(false)
+        , doHSVL(false)
+        , processorRGBA(0)
+        , processorHSVL(0)
+        , failed(false)
+        {
+            renderScale.x = renderScale.y = 1.;
+            analysisWindow.x1 = analysisWindow.y1 = analysisWindow.x2 = analysisWindow.y2 = 0;
+        }
+    };
+
+    // The cache file is a raw dump of the cache in the native byte order, preceded by a header which
+    // is used to detect files written by another version or on another architecture.
+    template<class T>
+    void cacheWriteValue(std::ostream &f, const T &v)
     {
+        f.write(reinterpret_cast<const char*>(&v), sizeof(T));
     }
 
-    void setPrevResults(const Results &results) OVERRIDE FINAL
+    template<class T>
+    bool cacheReadValue(std::istream &f, T *v)
     {
-        toComponents<double, nComponents, 1>(results.mean, _mean);
+        f.read(reinterpret_cast<char*>(v), sizeof(T));
+        return f.good();
     }
 
-    void getResults(Results *results) OVERRIDE FINAL
+    // write the cache to a file, return false on error
+    bool cacheWrite(const std::string &path, const StatisticsCache &cache)
     {
-        if (_count > 1) {
-            double sdev[nComponents];
-            for (int c = 0; c < nComponents; ++c) {
-                // sdev^2 is an unbiased estimator for the population variance
-                sdev[c] = std::sqrt(std::max(0., _sum_p2[c]/(_count-1)));
+        std::ofstream f(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!f) {
+            return false;
+        }
+        f.write(kCacheFileMagic, sizeof(kCacheFileMagic));
+        cacheWriteValue(f, (int)kCacheFileVersion);
+        cacheWriteValue(f, (unsigned int)0x01020304); // byte order
+        cacheWriteValue(f, (unsigned int)sizeof(BlockMoments));
+        cacheWriteValue(f, (unsigned int)sizeof(Results));
+        cacheWriteValue(f, (unsigned int)cache.size());
+        for (StatisticsCache::const_iterator it = cache.begin(); it != cache.end(); ++it) {
+            const CacheEntry &e = it->second;
+            cacheWriteValue(f, it->first.time);
+            cacheWriteValue(f, it->first.scaleX);
+            cacheWriteValue(f, it->first.scaleY);
+            cacheWriteValue(f, it->first.hsvl);
+            cacheWriteValue(f, e.input.rod);
+            cacheWriteValue(f, e.input.firstFrame);
+            cacheWriteValue(f, e.input.depth);
+            cacheWriteValue(f, e.input.components);
+            cacheWriteValue(f, (unsigned int)e.input.uid.size());
+            f.write(e.input.uid.data(), e.input.uid.size());
+            cacheWriteValue(f, e.bounds);
+            cacheWriteValue(f, e.par);
+            cacheWriteValue(f, e.nComponents);
+            cacheWriteValue(f, e.imageBytes);
+            cacheWriteValue(f, (int)e.hasResults);
+            cacheWriteValue(f, e.window);
+            cacheWriteValue(f, e.results);
+            cacheWriteValue(f, (unsigned int)e.blocks.size());
+            for (BlockMomentsMap::const_iterator b = e.blocks.begin(); b != e.blocks.end(); ++b) {
+                cacheWriteValue(f, b->first.first);
+                cacheWriteValue(f, b->first.second);
+                cacheWriteValue(f, b->second);
             }
-            toRGBA<double, nComponents, 1>(sdev, &results->sdev);
         }
-    }
 
-private:
-
-    void addResults(double sum_p2[nComponents], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponents; ++c) {
-            _sum_p2[c] += sum_p2[c];
-        }
-        _count += count;
-        _mutex.unlock();
+        return f.good();
     }
 
-
-    void multiThreadProcessImages(OfxRectI procWindow)
+    // read the cache from a file, return false if the file is missing or invalid
+    bool cacheRead(const std::string &path, StatisticsCache *cache)
     {
-        double sum_p2[nComponents];
-        std::fill(sum_p2, sum_p2 + nComponents, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
+        cache->clear();
+        std::ifstream f(path.c_str(), std::ios::in | std::ios::binary);
+        if (!f) {
+            return false;
+        }
+        char magic[sizeof(kCacheFileMagic)];
+        int version;
+        unsigned int byteOrder, blockSize, resultsSize, nEntries;
+        f.read(magic, sizeof(magic));
+        if (!f.good() || std::memcmp(magic, kCacheFileMagic, sizeof(magic)) != 0 ||
+            !cacheReadValue(f, &version) || version != kCacheFileVersion ||
+            !cacheReadValue(f, &byteOrder) || byteOrder != 0x01020304 ||
+            !cacheReadValue(f, &blockSize) || blockSize != sizeof(BlockMoments) ||
+            !cacheReadValue(f, &resultsSize) || resultsSize != sizeof(Results) ||
+            !cacheReadValue(f, &nEntries)) {
+            return false;
+        }
+        for (unsigned int i = 0; i < nEntries; ++i) {
+            OfxPointD renderScale;
+            double time;
+            int hsvl, hasResults;
+            unsigned int uidSize, nBlocks;
+            CacheEntry e;
+            if (!cacheReadValue(f, &time) ||
+                !cacheReadValue(f, &renderScale.x) ||
+                !cacheReadValue(f, &renderScale.y) ||
+                !cacheReadValue(f, &hsvl) ||
+                !cacheReadValue(f, &e.input.rod) ||
+                !cacheReadValue(f, &e.input.firstFrame) ||
+                !cacheReadValue(f, &e.input.depth) ||
+                !cacheReadValue(f, &e.input.components) ||
+                !cacheReadValue(f, &uidSize) ||
+                uidSize > 4096) {
+                cache->clear();
+                return false;
             }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p2[nComponents]; // partial sum to avoid underflows
-            std::fill(sumLine_p2, sumLine_p2 + nComponents, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                for (int c = 0; c < nComponents; ++c) {
-                    double v = (*dstPix - _mean[c]);
-                    sumLine_p2[c] += v * v;
-                    ++dstPix;
-                }
+            std::vector<char> uid(uidSize + 1, 0);
+            f.read(&uid[0], uidSize);
+            e.input.uid = &uid[0];
+            if (!f.good() ||
+                !cacheReadValue(f, &e.bounds) ||
+                !cacheReadValue(f, &e.par) ||
+                !cacheReadValue(f, &e.nComponents) ||
+                !cacheReadValue(f, &e.imageBytes) ||
+                !cacheReadValue(f, &hasResults) ||
+                !cacheReadValue(f, &e.window) ||
+                !cacheReadValue(f, &e.results) ||
+                !cacheReadValue(f, &nBlocks)) {
+                cache->clear();
+                return false;
             }
-            for (int c = 0; c < nComponents; ++c) {
-                sum_p2[c] += sumLine_p2[c];
+            e.hasResults = hasResults;
+            for (unsigned int j = 0; j < nBlocks; ++j) {
+                std::pair<int, int> b;
+                BlockMoments m;
+                if (!cacheReadValue(f, &b.first) ||
+                    !cacheReadValue(f, &b.second) ||
+                    !cacheReadValue(f, &m)) {
+                    cache->clear();
+                    return false;
+                }
+                e.blocks[b] = m;
             }
-            count += procWindow.x2 - procWindow.x1;
+            (*cache)[CacheKey(time, renderScale, hsvl)] = e;
         }
 
-        addResults(sum_p2, count);
+        return true;
     }
-};
+}
 
+class ImageStatisticsProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    OFX::MultiThread::Mutex _mutex; //< this is used so we can multi-thread the analysis and protect the shared results
+    bool _percentiles; //< also build a histogram to compute percentiles
+    OfxRectI _statWindow; //< the statistics are computed over this window, which is within the render window
+    BlockMomentsMap* _blocks; //< if not NULL, also compute the moments of each block of the render window
 
+public:
+    ImageStatisticsProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _mutex()
+    , _percentiles(false)
+    , _blocks(0)
+    {
+        _statWindow.x1 = _statWindow.y1 = INT_MIN;
+        _statWindow.x2 = _statWindow.y2 = INT_MAX;
+    }
 
+    void setPercentiles(bool percentiles)
+    {
+        _percentiles = percentiles;
+    }
 
-template <class PIX, int nComponents, int maxValue>
-class ImageSkewnessKurtosisProcessor : public ImageStatisticsProcessorBase
-{
-private:
-    double _mean[nComponents];
-    double _sdev[nComponents];
-    double _sum_p3[nComponents];
-    double _sum_p4[nComponents];
-public:
-    ImageSkewnessKurtosisProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
+    // the render window must be aligned on the block grid, or on the image bounds
+    void setBlocks(const OfxRectI &statWindow, BlockMomentsMap* blocks)
     {
-        std::fill(_mean, _mean+nComponents, 0.);
-        std::fill(_sdev, _sdev+nComponents, 0.);
-        std::fill(_sum_p3, _sum_p3+nComponents, 0.);
-        std::fill(_sum_p4, _sum_p4+nComponents, 0.);
+        _statWindow = statWindow;
+        _blocks = blocks;
     }
 
-    ~ImageSkewnessKurtosisProcessor()
+    virtual ~ImageStatisticsProcessorBase()
     {
     }
 
-    void setPrevResults(const Results &results) OVERRIDE FINAL
+    virtual void getResults(Results *results) = 0;
+
+    // process strip i of the n horizontal strips of the render window in the calling thread.
+    // The strips of a window may be processed concurrently, and their results are merged.
+    void processStrip(int i, int n)
     {
-        toComponents<double, nComponents, 1>(results.mean, _mean);
-        toComponents<double, nComponents, 1>(results.sdev, _sdev);
+        OfxRectI window = _renderWindow;
+        const double h = _renderWindow.y2 - _renderWindow.y1;
+        window.y1 = _renderWindow.y1 + (int)(h * i / n);
+        window.y2 = _renderWindow.y1 + (int)(h * (i + 1) / n);
+        if (window.y1 < window.y2) {
+            multiThreadProcessImages(window);
+        }
     }
 
-    void getResults(Results *results) OVERRIDE FINAL
+    template<class PIX, int nComponents, int maxValue>
+    static void toRGBA(const PIX *p, RGBAValues* rgba)
     {
-        if (_count > 2) {
+        if (nComponents == 4) {
+            rgba->r = p[0]/(double)maxValue;
+            rgba->g = p[1]/(double)maxValue;
+            rgba->b = p[2]/(double)maxValue;
+            rgba->a = p[3]/(double)maxValue;
+        } else if (nComponents == 3) {
+            rgba->r = p[0]/(double)maxValue;
+            rgba->g = p[1]/(double)maxValue;
+            rgba->b = p[2]/(double)maxValue;
+            rgba->a = 0;
+        } else if (nComponents == 1) {
+            rgba->r = 0;
+            rgba->g = 0;
+            rgba->b = 0;
+            rgba->a = p[0]/(double)maxValue;
+        } else {
+            rgba->r = 0;
+            rgba->g = 0;
+            rgba->b = 0;
+            rgba->a = 0;
+        }
+    }
+
+    template<int nComponents>
+    static void momentsToResults(const Moments moments[nComponents], Results *results)
+    {
+        if (moments[0].n > 0) {
+            double min[nComponents], max[nComponents], mean[nComponents];
+            for (int c = 0; c < nComponents; ++c) {
+                min[c] = moments[c].min;
+                max[c] = moments[c].max;
+                mean[c] = moments[c].mean;
+            }
+            toRGBA<double, nComponents, 1>(min, &results->min);
+            toRGBA<double, nComponents, 1>(max, &results->max);
+            toRGBA<double, nComponents, 1>(mean, &results->mean);
+        }
+        if (moments[0].n > 1) {
+            double sdev[nComponents];
+            for (int c = 0; c < nComponents; ++c) {
+                sdev[c] = moments[c].sdev();
+            }
+            toRGBA<double, nComponents, 1>(sdev, &results->sdev);
+        }
+        if (moments[0].n > 2) {
             double skewness[nComponents];
-            // factor for the adjusted Fisher-Pearson standardized moment coefficient G_1
-            double skewfac = ((double)_count*_count) / ((double)(_count-1)*(_count-2));
-            assert(!isnan(skewfac));
             for (int c = 0; c < nComponents; ++c) {
-                skewness[c] = skewfac * _sum_p3[c] / _count;
+                skewness[c] = moments[c].skewness();
             }
             toRGBA<double, nComponents, 1>(skewness, &results->skewness);
             assert(!isnan(results->skewness.r) && !isnan(results->skewness.g) && !isnan(results->skewness.b) && !isnan(results->skewness.a));
         }
-        if (_count > 3) {
+        if (moments[0].n > 3) {
             double kurtosis[nComponents];
-            double kurtfac = ((double)(_count+1)*_count) / ((double)(_count-1)*(_count-2)*(_count-3));
-            double kurtshift = -3 * ((double)(_count-1)*(_count-1)) / ((double)(_count-2)*(_count-3));
-            assert(!isnan(kurtfac) && !isnan(kurtshift));
             for (int c = 0; c < nComponents; ++c) {
-                kurtosis[c] = kurtfac * _sum_p4[c] + kurtshift;
+                kurtosis[c] = moments[c].kurtosis();
             }
             toRGBA<double, nComponents, 1>(kurtosis, &results->kurtosis);
             assert(!isnan(results->kurtosis.r) && !isnan(results->kurtosis.g) && !isnan(results->kurtosis.b) && !isnan(results->kurtosis.a));
         }
     }
 
-private:
+protected:
 
-    void addResults(double sum_p3[nComponents], double sum_p4[nComponents], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponents; ++c) {
-            _sum_p3[c] += sum_p3[c];
-            _sum_p4[c] += sum_p4[c];
+    template<class PIX, int nComponents, int maxValue>
+    void
+    pixToHSVL(const PIX *p, float hsvl[4])
+    {
+        if (nComponents == 4 || nComponents == 3) {
+            float r, g, b;
+            r = p[0]/(float)maxValue;
+            g = p[1]/(float)maxValue;
+            b = p[2]/(float)maxValue;
+            OFX::Color::rgb_to_hsv(r, g, b, &hsvl[0], &hsvl[1], &hsvl[2]);
+            float min = std::min(std::min(r, g), b);
+            float max = std::max(std::max(r, g), b);
+            hsvl[3] = (min + max)/2;
+        } else {
+            hsvl[0] = hsvl[1] = hsvl[2] = hsvl[3] = 0.f;
         }
-        _count += count;
-        _mutex.unlock();
     }
 
-
-    void multiThreadProcessImages(OfxRectI procWindow)
+    // the x coordinates where each row of procWindow is cut into segments: the segments
+    // are either fully inside or fully outside the statistics window, and within a single block
+    std::vector<int> rowSegments(const OfxRectI &procWindow)
     {
-        double sum_p3[nComponents];
-        double sum_p4[nComponents];
-        std::fill(sum_p3, sum_p3 + nComponents, 0.);
-        std::fill(sum_p4, sum_p4 + nComponents, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p3[nComponents]; // partial sum to avoid underflows
-            double sumLine_p4[nComponents]; // partial sum to avoid underflows
-            std::fill(sumLine_p3, sumLine_p3 + nComponents, 0.);
-            std::fill(sumLine_p4, sumLine_p4 + nComponents, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                for (int c = 0; c < nComponents; ++c) {
-                    if (_sdev[c] > 0.) {
-                        double v = (*dstPix - _mean[c])/_sdev[c];
-                        double v2 = v * v;
-                        sumLine_p3[c] += v2 * v;
-                        sumLine_p4[c] += v2 * v2;
-                    }
-                    ++dstPix;
-                }
-            }
-            for (int c = 0; c < nComponents; ++c) {
-                sum_p3[c] += sumLine_p3[c];
-                sum_p4[c] += sumLine_p4[c];
+        std::vector<int> cuts;
+        cuts.push_back(procWindow.x1);
+        if (procWindow.x1 < _statWindow.x1 && _statWindow.x1 < procWindow.x2) {
+            cuts.push_back(_statWindow.x1);
+        }
+        if (procWindow.x1 < _statWindow.x2 && _statWindow.x2 < procWindow.x2) {
+            cuts.push_back(_statWindow.x2);
+        }
+        if (_blocks) {
+            for (int x = (blockIndex(procWindow.x1) + 1) * kCacheBlockSize; x < procWindow.x2; x += kCacheBlockSize) {
+                cuts.push_back(x);
             }
-            count += procWindow.x2 - procWindow.x1;
         }
-        
-        addResults(sum_p3, sum_p4, count);
-    }
-};
-
-#define nComponentsHSVL 4
-
-template <class PIX, int nComponents, int maxValue>
-class ImageHSVLMinMaxMeanProcessor : public ImageStatisticsProcessorBase
-{
-private:
-    double _min[nComponentsHSVL];
-    double _max[nComponentsHSVL];
-    double _sum[nComponentsHSVL];
-public:
-    ImageHSVLMinMaxMeanProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_min, _min+nComponentsHSVL, +std::numeric_limits<double>::infinity());
-        std::fill(_max, _max+nComponentsHSVL, -std::numeric_limits<double>::infinity());
-        std::fill(_sum, _sum+nComponentsHSVL, 0.);
-    }
+        cuts.push_back(procWindow.x2);
+        std::sort(cuts.begin(), cuts.end());
+        cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
 
-    ~ImageHSVLMinMaxMeanProcessor()
-    {
+        return cuts;
     }
 
-    void setPrevResults(const Results &/*results*/) OVERRIDE FINAL {}
-
-    void getResults(Results *results) OVERRIDE FINAL
+    // merge the partial moments and histogram computed by one thread into the shared ones
+    template<int nComponents>
+    void addResults(const Moments moments[nComponents], Moments sharedMoments[nComponents],
+                    const std::vector<unsigned long> &histogram, std::vector<unsigned long> &sharedHistogram,
+                    const BlockMomentsMap &blocks)
     {
-        if (_count > 0) {
-            toRGBA<double, nComponentsHSVL, 1>(_min, &results->min);
-            toRGBA<double, nComponentsHSVL, 1>(_max, &results->max);
-            double mean[nComponentsHSVL];
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                mean[c] = _sum[c]/_count;
+        _mutex.lock();
+        for (int c = 0; c < nComponents; ++c) {
+            sharedMoments[c].merge(moments[c]);
+        }
+        if (!histogram.empty()) {
+            if (sharedHistogram.empty()) {
+                sharedHistogram = histogram;
+            } else {
+                assert(sharedHistogram.size() == histogram.size());
+                for (size_t i = 0; i < histogram.size(); ++i) {
+                    sharedHistogram[i] += histogram[i];
+                }
             }
-            toRGBA<double, nComponentsHSVL, 1>(mean, &results->mean);
         }
-    }
-
-private:
-
-    void addResults(double min[nComponentsHSVL], double max[nComponentsHSVL], double sum[nComponentsHSVL], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponentsHSVL; ++c) {
-            _min[c] = std::min(_min[c], min[c]);
-            _max[c] = std::max(_max[c], max[c]);
-            _sum[c] += sum[c];
+        if (_blocks) {
+            // a block may be shared by several threads
+            for (BlockMomentsMap::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+                BlockMoments &b = (*_blocks)[it->first];
+                for (int c = 0; c < nComponents; ++c) {
+                    b.c[c].merge(it->second.c[c]);
+                }
+            }
         }
-        _count += count;
         _mutex.unlock();
     }
 
-
-    void multiThreadProcessImages(OfxRectI procWindow)
+    template<int nComponents, class Binning>
+    void histogramToResults(const std::vector<unsigned long> &histogram, double n, Results *results)
     {
-        double min[nComponentsHSVL], max[nComponentsHSVL], sum[nComponentsHSVL];
-        std::fill(min, min+nComponentsHSVL, +std::numeric_limits<double>::infinity());
-        std::fill(max, max+nComponentsHSVL, -std::numeric_limits<double>::infinity());
-        std::fill(sum, sum + nComponentsHSVL, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine[nComponentsHSVL]; // partial sum to avoid underflows
-            std::fill(sumLine, sumLine + nComponentsHSVL, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                float hsvl[nComponentsHSVL];
-                pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
-                for (int c = 0; c < nComponentsHSVL; ++c) {
-                    double v = hsvl[c];
-                    min[c] = std::min(min[c], v);
-                    max[c] = std::max(max[c], v);
-                    sumLine[c] += v;
-                }
-                dstPix += nComponents;
-            }
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                sum[c] += sumLine[c];
-            }
-            count += procWindow.x2 - procWindow.x1;
+        if (histogram.empty() || n <= 0) {
+            return;
         }
-
-        addResults(min, max, sum, count);
+        assert(histogram.size() == (size_t)nComponents * Binning::nBins);
+        double median[nComponents], p1[nComponents], p5[nComponents], p95[nComponents], p99[nComponents];
+        for (int c = 0; c < nComponents; ++c) {
+            const unsigned long *h = &histogram[c * Binning::nBins];
+            median[c] = histogramPercentile<Binning>(h, n, 0.5);
+            p1[c] = histogramPercentile<Binning>(h, n, 0.01);
+            p5[c] = histogramPercentile<Binning>(h, n, 0.05);
+            p95[c] = histogramPercentile<Binning>(h, n, 0.95);
+            p99[c] = histogramPercentile<Binning>(h, n, 0.99);
+        }
+        toRGBA<double, nComponents, 1>(median, &results->median);
+        toRGBA<double, nComponents, 1>(p1, &results->p1);
+        toRGBA<double, nComponents, 1>(p5, &results->p5);
+        toRGBA<double, nComponents, 1>(p95, &results->p95);
+        toRGBA<double, nComponents, 1>(p99, &results->p99);
+        results->percentiles = true;
     }
 };
 
 
-
-
+// computes all the RGBA statistics in a single pass over the image
 template <class PIX, int nComponents, int maxValue>
-class ImageHSVLSDevProcessor : public ImageStatisticsProcessorBase
+class ImageMomentsProcessor : public ImageStatisticsProcessorBase
 {
 private:
-    double _mean[nComponentsHSVL];
-    double _sum_p2[nComponentsHSVL];
+    typedef HistogramBinning<maxValue> Binning;
+
+    Moments _moments[nComponents];
+    std::vector<unsigned long> _histogram; // nComponents histograms of Binning::nBins bins
+
 public:
-    ImageHSVLSDevProcessor(OFX::ImageEffect &instance)
+    ImageMomentsProcessor(OFX::ImageEffect &instance)
     : ImageStatisticsProcessorBase(instance)
     {
-        std::fill(_mean, _mean+nComponentsHSVL, 0.);
-        std::fill(_sum_p2, _sum_p2+nComponentsHSVL, 0.);
     }
 
-    ~ImageHSVLSDevProcessor()
+    ~ImageMomentsProcessor()
     {
     }
 
-    void setPrevResults(const Results &results) OVERRIDE FINAL
-    {
-        toComponents<double, nComponentsHSVL, 1>(results.mean, _mean);
-    }
-
     void getResults(Results *results) OVERRIDE FINAL
     {
-        if (_count > 1) {
-            double sdev[nComponentsHSVL];
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                // sdev^2 is an unbiased estimator for the population variance
-                sdev[c] = std::sqrt(std::max(0., _sum_p2[c]/(_count-1)));
-            }
-            toRGBA<double, nComponentsHSVL, 1>(sdev, &results->sdev);
-        }
+        momentsToResults<nComponents>(_moments, results);
+        histogramToResults<nComponents, Binning>(_histogram, _moments[0].n, results);
     }
 
 private:
 
-    void addResults(double sum_p2[nComponentsHSVL], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponentsHSVL; ++c) {
-            _sum_p2[c] += sum_p2[c];
-        }
-        _count += count;
-        _mutex.unlock();
-    }
-
-
     void multiThreadProcessImages(OfxRectI procWindow)
     {
-        double sum_p2[nComponentsHSVL];
-        std::fill(sum_p2, sum_p2 + nComponentsHSVL, 0.);
-        unsigned long count = 0;
+        Moments moments[nComponents];
+        std::vector<unsigned long> histogram(_percentiles ? nComponents * Binning::nBins : 0, 0UL);
+        BlockMomentsMap blocks;
+        const std::vector<int> cuts = rowSegments(procWindow);
         assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
                _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
         for (int y = procWindow.y1; y < procWindow.y2; ++y) {
@@ -781,103 +1017,79 @@ private:
                 break;
             }
 
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p2[nComponentsHSVL]; // partial sum to avoid underflows
-            std::fill(sumLine_p2, sumLine_p2 + nComponentsHSVL, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                float hsvl[nComponentsHSVL];
-                pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
-                for (int c = 0; c < nComponentsHSVL; ++c) {
-                    double v = (hsvl[c] - _mean[c]);
-                    sumLine_p2[c] += v * v;
+            const bool rowInStat = (_statWindow.y1 <= y && y < _statWindow.y2);
+            Moments momentsLine[nComponents]; // partial moments to avoid rounding errors
+            for (size_t s = 0; s + 1 < cuts.size(); ++s) {
+                const bool inStat = rowInStat && _statWindow.x1 <= cuts[s] && cuts[s+1] <= _statWindow.x2;
+                PIX *dstPix = (PIX *) _dstImg->getPixelAddress(cuts[s], y);
+
+                Moments momentsSegment[nComponents];
+                for (int x = cuts[s]; x < cuts[s+1]; ++x) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        momentsSegment[c].add(*dstPix);
+                        if (_percentiles && inStat) {
+                            ++histogram[c * Binning::nBins + Binning::bin(*dstPix)];
+                        }
+                        ++dstPix;
+                    }
+                }
+                if (inStat) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        momentsLine[c].merge(momentsSegment[c]);
+                    }
+                }
+                if (_blocks) {
+                    BlockMoments &b = blocks[std::make_pair(blockIndex(cuts[s]), blockIndex(y))];
+                    for (int c = 0; c < nComponents; ++c) {
+                        b.c[c].merge(momentsSegment[c]);
+                    }
                 }
-                dstPix += nComponents;
             }
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                sum_p2[c] += sumLine_p2[c];
+            for (int c = 0; c < nComponents; ++c) {
+                moments[c].merge(momentsLine[c]);
             }
-            count += procWindow.x2 - procWindow.x1;
         }
 
-        addResults(sum_p2, count);
+        addResults<nComponents>(moments, _moments, histogram, _histogram, blocks);
     }
 };
 
+#define nComponentsHSVL 4
 
-
-
+// computes all the HSVL statistics in a single pass over the image
 template <class PIX, int nComponents, int maxValue>
-class ImageHSVLSkewnessKurtosisProcessor : public ImageStatisticsProcessorBase
+class ImageHSVLMomentsProcessor : public ImageStatisticsProcessorBase
 {
 private:
-    double _mean[nComponentsHSVL];
-    double _sdev[nComponentsHSVL];
-    double _sum_p3[nComponentsHSVL];
-    double _sum_p4[nComponentsHSVL];
+    typedef HistogramBinning<1> Binning; // HSVL values are floats
+
+    Moments _moments[nComponentsHSVL];
+    std::vector<unsigned long> _histogram; // nComponentsHSVL histograms of Binning::nBins bins
+
 public:
-    ImageHSVLSkewnessKurtosisProcessor(OFX::ImageEffect &instance)
+    ImageHSVLMomentsProcessor(OFX::ImageEffect &instance)
     : ImageStatisticsProcessorBase(instance)
     {
-        std::fill(_mean, _mean+nComponentsHSVL, 0.);
-        std::fill(_sdev, _sdev+nComponentsHSVL, 0.);
-        std::fill(_sum_p3, _sum_p3+nComponentsHSVL, 0.);
-        std::fill(_sum_p4, _sum_p4+nComponentsHSVL, 0.);
     }
 
-    ~ImageHSVLSkewnessKurtosisProcessor()
+    ~ImageHSVLMomentsProcessor()
     {
     }
 
-    void setPrevResults(const Results &results) OVERRIDE FINAL
-    {
-        toComponents<double, nComponentsHSVL, 1>(results.mean, _mean);
-        toComponents<double, nComponentsHSVL, 1>(results.sdev, _sdev);
-    }
-
     void getResults(Results *results) OVERRIDE FINAL
     {
-        if (_count > 2) {
-            double skewness[nComponentsHSVL];
-            // factor for the adjusted Fisher-Pearson standardized moment coefficient G_1
-            double skewfac = ((double)_count*_count) / ((double)(_count-1)*(_count-2));
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                skewness[c] = skewfac * _sum_p3[c] / _count;
-            }
-            toRGBA<double, nComponentsHSVL, 1>(skewness, &results->skewness);
-        }
-        if (_count > 3) {
-            double kurtosis[nComponentsHSVL];
-            double kurtfac = ((double)(_count+1)*_count) / ((double)(_count-1)*(_count-2)*(_count-3));
-            double kurtshift = -3 * ((double)(_count-1)*(_count-1)) / ((double)(_count-2)*(_count-3));
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                kurtosis[c] = kurtfac * _sum_p4[c] + kurtshift;
-            }
-            toRGBA<double, nComponentsHSVL, 1>(kurtosis, &results->kurtosis);
-        }
+        momentsToResults<nComponentsHSVL>(_moments, results);
+        histogramToResults<nComponentsHSVL, Binning>(_histogram, _moments[0].n, results);
     }
 
 private:
 
-    void addResults(double sum_p3[nComponentsHSVL], double sum_p4[nComponentsHSVL], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponentsHSVL; ++c) {
-            _sum_p3[c] += sum_p3[c];
-            _sum_p4[c] += sum_p4[c];
-        }
-        _count += count;
-        _mutex.unlock();
-    }
-
-
     void multiThreadProcessImages(OfxRectI procWindow)
     {
-        double sum_p3[nComponentsHSVL];
-        double sum_p4[nComponentsHSVL];
-        std::fill(sum_p3, sum_p3 + nComponentsHSVL, 0.);
-        std::fill(sum_p4, sum_p4 + nComponentsHSVL, 0.);
-        unsigned long count = 0;
+        Moments moments[nComponentsHSVL];
+        std::vector<unsigned long> histogram(_percentiles ? nComponentsHSVL * Binning::nBins : 0, 0UL);
+        BlockMomentsMap blocks;
+        const std::vector<int> cuts = rowSegments(procWindow);
         assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
                _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
         for (int y = procWindow.y1; y < procWindow.y2; ++y) {
@@ -885,34 +1097,42 @@ private:
                 break;
             }
 
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p3[nComponentsHSVL]; // partial sum to avoid underflows
-            double sumLine_p4[nComponentsHSVL]; // partial sum to avoid underflows
-            std::fill(sumLine_p3, sumLine_p3 + nComponentsHSVL, 0.);
-            std::fill(sumLine_p4, sumLine_p4 + nComponentsHSVL, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                float hsvl[nComponentsHSVL];
-                pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
-                for (int c = 0; c < nComponentsHSVL; ++c) {
-                    if (_sdev[c] > 0.) {
-                        double v = (hsvl[c] - _mean[c])/_sdev[c];
-                        double v2 = v * v;
-                        sumLine_p3[c] += v2 * v;
-                        sumLine_p4[c] += v2 * v2;
+            const bool rowInStat = (_statWindow.y1 <= y && y < _statWindow.y2);
+            Moments momentsLine[nComponentsHSVL]; // partial moments to avoid rounding errors
+            for (size_t s = 0; s + 1 < cuts.size(); ++s) {
+                const bool inStat = rowInStat && _statWindow.x1 <= cuts[s] && cuts[s+1] <= _statWindow.x2;
+                PIX *dstPix = (PIX *) _dstImg->getPixelAddress(cuts[s], y);
+
+                Moments momentsSegment[nComponentsHSVL];
+                for (int x = cuts[s]; x < cuts[s+1]; ++x) {
+                    float hsvl[nComponentsHSVL];
+                    pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
+                    for (int c = 0; c < nComponentsHSVL; ++c) {
+                        momentsSegment[c].add(hsvl[c]);
+                        if (_percentiles && inStat) {
+                            ++histogram[c * Binning::nBins + Binning::bin(hsvl[c])];
+                        }
+                    }
+                    dstPix += nComponents;
+                }
+                if (inStat) {
+                    for (int c = 0; c < nComponentsHSVL; ++c) {
+                        momentsLine[c].merge(momentsSegment[c]);
+                    }
+                }
+                if (_blocks) {
+                    BlockMoments &b = blocks[std::make_pair(blockIndex(cuts[s]), blockIndex(y))];
+                    for (int c = 0; c < nComponentsHSVL; ++c) {
+                        b.c[c].merge(momentsSegment[c]);
                     }
                 }
-                dstPix += nComponents;
             }
             for (int c = 0; c < nComponentsHSVL; ++c) {
-                sum_p3[c] += sumLine_p3[c];
-                sum_p4[c] += sumLine_p4[c];
+                moments[c].merge(momentsLine[c]);
             }
-            count += procWindow.x2 - procWindow.x1;
         }
-        
-        addResults(sum_p3, sum_p4, count);
+
+        addResults<nComponentsHSVL>(moments, _moments, histogram, _histogram, blocks);
     }
 };
 
@@ -930,6 +1150,11 @@ public:
     , _size(0)
     , _interactive(0)
     , _restrictToRectangle(0)
+    , _cacheFile(0)
+    , _cacheMutex()
+    , _cache()
+    , _cachePath()
+    , _cacheDirty(false)
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentAlpha || _dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA));
@@ -941,7 +1166,9 @@ public:
         _interactive = fetchBooleanParam(kParamRectangleInteractInteractive);
         _restrictToRectangle = fetchBooleanParam(kParamRestrictToRectangle);
         _autoUpdate = fetchBooleanParam(kParamAutoUpdate);
-        assert(_btmLeft && _size && _interactive && _restrictToRectangle && _autoUpdate);
+        _percentiles = fetchBooleanParam(kParamPercentiles);
+        _cacheFile = fetchStringParam(kParamCacheFile);
+        assert(_btmLeft && _size && _interactive && _restrictToRectangle && _autoUpdate && _percentiles && _cacheFile);
         _statMin = fetchRGBAParam(kParamStatMin);
         _statMax = fetchRGBAParam(kParamStatMax);
         _statMean = fetchRGBAParam(kParamStatMean);
@@ -949,6 +1176,12 @@ public:
         _statSkewness = fetchRGBAParam(kParamStatSkewness);
         _statKurtosis = fetchRGBAParam(kParamStatKurtosis);
         assert(_statMin && _statMax && _statMean && _statSDev && _statSkewness);
+        _statMedian = fetchRGBAParam(kParamStatMedian);
+        _statP1 = fetchRGBAParam(kParamStatP1);
+        _statP5 = fetchRGBAParam(kParamStatP5);
+        _statP95 = fetchRGBAParam(kParamStatP95);
+        _statP99 = fetchRGBAParam(kParamStatP99);
+        assert(_statMedian && _statP1 && _statP5 && _statP95 && _statP99);
         _analyzeFrame = fetchPushButtonParam(kParamAnalyzeFrame);
         _analyzeSequence = fetchPushButtonParam(kParamAnalyzeSequence);
         assert(_analyzeFrame && _analyzeSequence);
@@ -959,6 +1192,12 @@ public:
         _statHSVLSkewness = fetchRGBAParam(kParamStatHSVLSkewness);
         _statHSVLKurtosis = fetchRGBAParam(kParamStatHSVLKurtosis);
         assert(_statHSVLMin && _statHSVLMax && _statHSVLMean && _statHSVLSDev && _statHSVLSkewness);
+        _statHSVLMedian = fetchRGBAParam(kParamStatHSVLMedian);
+        _statHSVLP1 = fetchRGBAParam(kParamStatHSVLP1);
+        _statHSVLP5 = fetchRGBAParam(kParamStatHSVLP5);
+        _statHSVLP95 = fetchRGBAParam(kParamStatHSVLP95);
+        _statHSVLP99 = fetchRGBAParam(kParamStatHSVLP99);
+        assert(_statHSVLMedian && _statHSVLP1 && _statHSVLP5 && _statHSVLP95 && _statHSVLP99);
         _analyzeFrameHSVL = fetchPushButtonParam(kParamAnalyzeFrameHSVL);
         _analyzeSequenceHSVL = fetchPushButtonParam(kParamAnalyzeSequenceHSVL);
         assert(_analyzeFrameHSVL && _analyzeSequenceHSVL);
@@ -990,60 +1229,101 @@ private:
 
     virtual void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
 
-    /* set up and run a processor */
-    void setupAndProcess(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results &prevResults, Results *results);
+    virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+
+    virtual void purgeCaches(void) OVERRIDE FINAL;
+
+    /* set up a processor. If blocks is not NULL, the processor also computes the moments
+     of all the cache blocks which intersect analysisWindow */
+    void setupProcessor(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, bool percentiles, const OfxRectI &analysisWindow, BlockMomentsMap* blocks);
 
     // compute computation window in srcImg
     void computeWindow(const OFX::Image* srcImg, double time, OfxRectI *analysisWindow);
 
+    // compute computation window in an image with the given properties
+    void computeWindow(double time, const OfxPointD &renderScale, double par, const OfxRectI &bounds, OfxRectI *analysisWindow);
+
     // update image statistics
     void update(const OFX::Image* srcImg, double time, const OfxRectI& analysisWindow);
     void updateHSVL(const OFX::Image* srcImg, double time, const OfxRectI& analysisWindow);
 
-    template <template<class PIX, int nComponents, int maxValue> class Processor, class PIX, int nComponents, int maxValue>
-    void updateSubComponentsDepth(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results& prevResults, Results* results)
-    {
-        Processor<PIX, nComponents, maxValue> fred(*this);
-        setupAndProcess(fred, srcImg, time, analysisWindow, prevResults, results);
-    }
+    // set the statistics parameters (must be called within an edit block)
+    void setStatistics(double time, const Results& results);
+    void setStatisticsHSVL(double time, const Results& results);
+
+    // fetch and analyze a frame, return false if it could not be analyzed
+    bool analyzeFrame(double time, const OfxPointD& renderScale, bool doRGBA, bool doHSVL, FrameResults* frameResults);
+
+    // get the statistics of a frame from the cache, and fetch the frame and set up its processors if some of
+    // them are not in the cache. Must be called from the main thread, since it reads the parameters and fetches
+    // the image. Returns false if the frame could not be fetched. The job must then be finished by finishFrame(),
+    // or released by releaseFrame().
+    bool fetchFrame(double time, const OfxPointD& renderScale, bool doRGBA, bool doHSVL, FrameJob* job, FrameResults* frameResults);
+
+    // (re)create the processors of a fetched frame (main thread)
+    void setupFrame(FrameJob* job);
+
+    // compute the statistics of a fetched frame that were not in the cache, using all threads
+    void computeFrame(FrameJob* job);
+
+    // compute strip i of the n strips of a fetched frame. This only runs the statistics processors, and may
+    // be called from a spawned thread, concurrently with the other strips.
+    void computeFrameStrip(FrameJob* job, int i, int n);
+
+    // get the computed statistics, store them in the cache and release the frame (main thread)
+    void finishFrame(FrameJob* job, FrameResults* frameResults);
+
+    // release the image and the processors of a frame
+    void releaseFrame(FrameJob* job);
+
+    // analyze all frames from the input, and set the keyframes at the end
+    void analyzeSequence(const OfxPointD& renderScale, bool doRGBA, bool doHSVL);
+
+    // statistics cache: the lookup and store functions may be called from several threads.
+    // If fetched is false, the image was not fetched yet, and the entries of images with a unique identifier do not match.
+    void cacheGetInput(double time, CacheInput *input);
+    bool cacheLookup(const CacheKey &key, const CacheInput &input, bool fetched, bool percentiles, Results *results, size_t *bytes);
+    void cacheStore(const CacheKey &key, const CacheInput &input, const OFX::Image* srcImg, int nComponents, const OfxRectI &analysisWindow, const BlockMomentsMap &blocks, const Results &results);
+    void cacheLoad();
+    void cacheSave();
+    void cacheClear(bool allFrames, double time, bool rgba, bool hsvl);
+
+    friend class SequenceAnalyzer;
 
+    // create the processor for the depth and components of srcImg
     template <template<class PIX, int nComponents, int maxValue> class Processor, int nComponents>
-    void updateSubComponents(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results& prevResults, Results* results)
+    ImageStatisticsProcessorBase* createProcessorComponents(const OFX::Image* srcImg)
     {
         OFX::BitDepthEnum srcBitDepth = srcImg->getPixelDepth();
         switch (srcBitDepth) {
-            case OFX::eBitDepthUByte: {
-                updateSubComponentsDepth<Processor, unsigned char, nComponents, 255>(srcImg, time, analysisWindow, prevResults, results);
-                break;
-            }
-            case OFX::eBitDepthUShort: {
-                updateSubComponentsDepth<Processor, unsigned short, nComponents, 65535>(srcImg, time, analysisWindow, prevResults, results);
-                break;
-            }
-            case OFX::eBitDepthFloat: {
-                updateSubComponentsDepth<Processor, float, nComponents, 1>(srcImg, time, analysisWindow, prevResults, results);
-                break;
-            }
+            case OFX::eBitDepthUByte:
+                return new Processor<unsigned char, nComponents, 255>(*this);
+            case OFX::eBitDepthUShort:
+                return new Processor<unsigned short, nComponents, 65535>(*this);
+            case OFX::eBitDepthFloat:
+                return new Processor<float, nComponents, 1>(*this);
             default:
                 OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
         }
+        return 0;
     }
 
     template <template<class PIX, int nComponents, int maxValue> class Processor>
-    void updateSub(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results& prevResults, Results* results)
+    ImageStatisticsProcessorBase* createProcessor(const OFX::Image* srcImg)
     {
         OFX::PixelComponentEnum srcComponents  = srcImg->getPixelComponents();
         assert(srcComponents == OFX::ePixelComponentAlpha ||srcComponents == OFX::ePixelComponentRGB || srcComponents == OFX::ePixelComponentRGBA);
         if (srcComponents == OFX::ePixelComponentAlpha) {
-            updateSubComponents<Processor, 1>(srcImg, time, analysisWindow, prevResults, results);
+            return createProcessorComponents<Processor, 1>(srcImg);
         } else if (srcComponents == OFX::ePixelComponentRGBA) {
-            updateSubComponents<Processor, 4>(srcImg, time, analysisWindow, prevResults, results);
+            return createProcessorComponents<Processor, 4>(srcImg);
         } else if (srcComponents == OFX::ePixelComponentRGB) {
-            updateSubComponents<Processor, 3>(srcImg, time, analysisWindow, prevResults, results);
+            return createProcessorComponents<Processor, 3>(srcImg);
         } else {
             // coverity[dead_error_line]
             OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
         }
+        return 0;
     }
 
 private:
@@ -1057,12 +1337,18 @@ private:
     BooleanParam* _interactive;
     BooleanParam* _restrictToRectangle;
     BooleanParam* _autoUpdate;
+    BooleanParam* _percentiles;
     RGBAParam* _statMin;
     RGBAParam* _statMax;
     RGBAParam* _statMean;
     RGBAParam* _statSDev;
     RGBAParam* _statSkewness;
     RGBAParam* _statKurtosis;
+    RGBAParam* _statMedian;
+    RGBAParam* _statP1;
+    RGBAParam* _statP5;
+    RGBAParam* _statP95;
+    RGBAParam* _statP99;
     PushButtonParam* _analyzeFrame;
     PushButtonParam* _analyzeSequence;
     RGBAParam* _statHSVLMin;
@@ -1071,8 +1357,130 @@ private:
     RGBAParam* _statHSVLSDev;
     RGBAParam* _statHSVLSkewness;
     RGBAParam* _statHSVLKurtosis;
+    RGBAParam* _statHSVLMedian;
+    RGBAParam* _statHSVLP1;
+    RGBAParam* _statHSVLP5;
+    RGBAParam* _statHSVLP95;
+    RGBAParam* _statHSVLP99;
     PushButtonParam* _analyzeFrameHSVL;
     PushButtonParam* _analyzeSequenceHSVL;
+    StringParam* _cacheFile;
+
+    OFX::MultiThread::Mutex _cacheMutex; //< protects the cache, which may be accessed by several analysis threads
+    StatisticsCache _cache;
+    std::string _cachePath; //< the file the cache was read from, and is saved to
+    bool _cacheDirty; //< the cache was modified since it was saved
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/** @brief analyzes a batch of fetched frames with several threads, while the next batch is fetched.
+ Each frame is cut into strips, so that all threads are busy even if the batch has fewer frames than threads.
+ Images may only be fetched by the main thread: if the host runs one of the threads in the calling thread
+ (which is not a spawned thread), that thread first fetches the next batch, so that fetching overlaps with
+ the analysis. Otherwise the caller fetches it afterwards. Frames whose strips failed are left to the main thread. */
+class SequenceAnalyzer : public OFX::MultiThread::Processor
+{
+public:
+    SequenceAnalyzer(ImageStatisticsPlugin &plugin, const OfxPointD &renderScale, bool doRGBA, bool doHSVL, int tmin, std::vector<FrameResults> &results)
+    : _plugin(plugin)
+    , _renderScale(renderScale)
+    , _doRGBA(doRGBA)
+    , _doHSVL(doHSVL)
+    , _tmin(tmin)
+    , _results(results)
+    , _mutex()
+    , _frames()
+    , _nStrips(1)
+    , _nextStrip(0)
+    , _next(0)
+    , _fetchTime(0)
+    , _fetchEnd(0)
+    {
+    }
+
+    // analyze the frames of jobs with at most nThreads threads, and fetch the frames [t1,t2) into next
+    // meanwhile if possible. Returns the first frame that was not fetched.
+    int analyze(std::list<FrameJob> &jobs, std::list<FrameJob> &next, int t1, int t2, unsigned int nThreads)
+    {
+        _frames.clear();
+        for (std::list<FrameJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+            if (it->src) {
+                _frames.push_back(&*it);
+            }
+        }
+        _nStrips = _frames.empty() ? 1 : (int)((nThreads + _frames.size() - 1) / _frames.size());
+        _nextStrip = 0;
+        _next = &next;
+        _fetchTime = t1;
+        _fetchEnd = t2;
+        if (!_frames.empty()) {
+            multiThread( std::min( nThreads, (unsigned int)(_frames.size() * _nStrips) ) );
+        }
+
+        return _fetchTime;
+    }
+
+private:
+    virtual void multiThreadFunction(unsigned int /*threadId*/, unsigned int /*nThreads*/) OVERRIDE FINAL
+    {
+        if (!OFX::MultiThread::isSpawnedThread()) {
+            fetchNext();
+        }
+        for (;;) {
+            _mutex.lock();
+            int i = _nextStrip++;
+            _mutex.unlock();
+            if (i >= (int)_frames.size() * _nStrips || _plugin.abort()) {
+                return;
+            }
+            FrameJob &job = *_frames[i / _nStrips];
+            try {
+                _plugin.computeFrameStrip(&job, i % _nStrips, _nStrips);
+            } catch (...) {
+                // the main thread will compute the frame again
+                _mutex.lock();
+                job.failed = true;
+                _mutex.unlock();
+            }
+        }
+    }
+
+    // fetch the next frames (calling thread only)
+    void fetchNext()
+    {
+        for (; _fetchTime < _fetchEnd && !_plugin.abort(); ++_fetchTime) {
+            FrameJob* job = 0;
+            try {
+                _next->push_back(FrameJob());
+                job = &_next->back();
+                if (!_plugin.fetchFrame(_fetchTime, _renderScale, _doRGBA, _doHSVL, job, &_results[_fetchTime - _tmin])) {
+                    _next->pop_back();
+                }
+            } catch (...) {
+                // the caller will fetch this frame again, and report the error
+                if (job) {
+                    _plugin.releaseFrame(job);
+                    _next->pop_back();
+                }
+
+                return;
+            }
+        }
+    }
+
+    ImageStatisticsPlugin &_plugin;
+    OfxPointD _renderScale;
+    bool _doRGBA;
+    bool _doHSVL;
+    int _tmin;
+    std::vector<FrameResults> &_results;
+    OFX::MultiThread::Mutex _mutex;
+    std::vector<FrameJob*> _frames; // the frames being analyzed
+    int _nStrips; // number of strips per frame
+    int _nextStrip; // the next strip to analyze, in all frames
+    std::list<FrameJob> *_next; // the frames being fetched
+    int _fetchTime;
+    int _fetchEnd;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1205,7 +1613,6 @@ ImageStatisticsPlugin::changedParam(const OFX::InstanceChangedArgs &args,
     bool doAnalyzeHSVL = false;
     bool doAnalyzeSequenceRGBA = false;
     bool doAnalyzeSequenceHSVL = false;
-    OfxRectI analysisWindow;
 
     if (paramName == kParamRestrictToRectangle) {
         // update visibility
@@ -1244,36 +1651,72 @@ ImageStatisticsPlugin::changedParam(const OFX::InstanceChangedArgs &args,
         doAnalyzeSequenceHSVL = true;
     }
     if (paramName == kParamClearFrame) {
+        cacheLoad();
+        cacheClear(false, args.time, true, false);
+        cacheSave();
         _statMin->deleteKeyAtTime(args.time);
         _statMax->deleteKeyAtTime(args.time);
         _statMean->deleteKeyAtTime(args.time);
         _statSDev->deleteKeyAtTime(args.time);
         _statSkewness->deleteKeyAtTime(args.time);
         _statKurtosis->deleteKeyAtTime(args.time);
+        _statMedian->deleteKeyAtTime(args.time);
+        _statP1->deleteKeyAtTime(args.time);
+        _statP5->deleteKeyAtTime(args.time);
+        _statP95->deleteKeyAtTime(args.time);
+        _statP99->deleteKeyAtTime(args.time);
     }
     if (paramName == kParamClearSequence) {
+        cacheLoad();
+        cacheClear(true, args.time, true, false);
+        cacheSave();
         _statMin->deleteAllKeys();
         _statMax->deleteAllKeys();
         _statMean->deleteAllKeys();
         _statSDev->deleteAllKeys();
         _statSkewness->deleteAllKeys();
         _statKurtosis->deleteAllKeys();
+        _statMedian->deleteAllKeys();
+        _statP1->deleteAllKeys();
+        _statP5->deleteAllKeys();
+        _statP95->deleteAllKeys();
+        _statP99->deleteAllKeys();
     }
     if (paramName == kParamClearFrameHSVL) {
+        cacheLoad();
+        cacheClear(false, args.time, false, true);
+        cacheSave();
         _statHSVLMin->deleteKeyAtTime(args.time);
         _statHSVLMax->deleteKeyAtTime(args.time);
         _statHSVLMean->deleteKeyAtTime(args.time);
         _statHSVLSDev->deleteKeyAtTime(args.time);
         _statHSVLSkewness->deleteKeyAtTime(args.time);
         _statHSVLKurtosis->deleteKeyAtTime(args.time);
+        _statHSVLMedian->deleteKeyAtTime(args.time);
+        _statHSVLP1->deleteKeyAtTime(args.time);
+        _statHSVLP5->deleteKeyAtTime(args.time);
+        _statHSVLP95->deleteKeyAtTime(args.time);
+        _statHSVLP99->deleteKeyAtTime(args.time);
     }
     if (paramName == kParamClearSequenceHSVL) {
+        cacheLoad();
+        cacheClear(true, args.time, false, true);
+        cacheSave();
         _statHSVLMin->deleteAllKeys();
         _statHSVLMax->deleteAllKeys();
         _statHSVLMean->deleteAllKeys();
         _statHSVLSDev->deleteAllKeys();
         _statHSVLSkewness->deleteAllKeys();
         _statHSVLKurtosis->deleteAllKeys();
+        _statHSVLMedian->deleteAllKeys();
+        _statHSVLP1->deleteAllKeys();
+        _statHSVLP5->deleteAllKeys();
+        _statHSVLP95->deleteAllKeys();
+        _statHSVLP99->deleteAllKeys();
+    }
+    if (paramName == kParamCacheFile) {
+        cacheLoad();
+        cacheSave();
     }
     if (doUpdate) {
         // check if there is already a Keyframe, if yes update it
@@ -1284,81 +1727,85 @@ ImageStatisticsPlugin::changedParam(const OFX::InstanceChangedArgs &args,
     }
     // RGBA analysis
     if ((doAnalyzeRGBA || doAnalyzeHSVL) && _srcClip && _srcClip->isConnected()) {
-        std::auto_ptr<OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
-                                      _srcClip->fetchImage(args.time) : 0);
-        if (src.get()) {
-            if (src->getRenderScale().x != args.renderScale.x ||
-                src->getRenderScale().y != args.renderScale.y) {
-                setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                OFX::throwSuiteStatusException(kOfxStatFailed);
-            }
-            computeWindow(src.get(), args.time, &analysisWindow);
-            getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 1, false);
+        cacheLoad();
+        FrameResults results;
+        getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 1, false);
+        if (analyzeFrame(args.time, args.renderScale, doAnalyzeRGBA, doAnalyzeHSVL, &results)) {
+            beginEditBlock("analyzeFrame");
             if (doAnalyzeRGBA) {
-                update(src.get(), args.time, analysisWindow);
+                setStatistics(args.time, results.rgba);
             }
             if (doAnalyzeHSVL) {
-                updateHSVL(src.get(), args.time, analysisWindow);
+                setStatisticsHSVL(args.time, results.hsvl);
             }
-            getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 0, false);
+            endEditBlock();
         }
+        getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 0, false);
+        cacheSave();
     }
     if ((doAnalyzeSequenceRGBA || doAnalyzeSequenceHSVL) && _srcClip && _srcClip->isConnected()) {
         getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 1, false);
-        progressStart("Analyzing sequence...");
-        OfxRangeD range = _srcClip->getFrameRange();
-        //timeLineGetBounds(range.min, range.max); // wrong: we want the input frame range only
-        int tmin = (int)std::ceil(range.min);
-        int tmax = (int)std::floor(range.max);
-        for (int t = tmin; t <= tmax; ++t) {
-            std::auto_ptr<OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
-                                          _srcClip->fetchImage(t) : 0);
-            if (src.get()) {
-                if (src->getRenderScale().x != args.renderScale.x ||
-                    src->getRenderScale().y != args.renderScale.y) {
-                    setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                    OFX::throwSuiteStatusException(kOfxStatFailed);
-                }
-                computeWindow(src.get(), t, &analysisWindow);
-                if (doAnalyzeSequenceRGBA) {
-                    update(src.get(), t, analysisWindow);
-                }
-                if (doAnalyzeSequenceHSVL) {
-                    updateHSVL(src.get(), t, analysisWindow);
-                }
-            }
-            if (tmax != tmin) {
-                progressUpdate((t-tmin)/(double)(tmax-tmin));
-            }
-        }
-        progressEnd();
+        analyzeSequence(args.renderScale, doAnalyzeSequenceRGBA, doAnalyzeSequenceHSVL);
         getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 0, false);
     }
 }
 
+void
+ImageStatisticsPlugin::changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName)
+{
+    if (clipName == kOfxImageEffectSimpleSourceClipName && args.reason == OFX::eChangeUserEdit) {
+        // the cached statistics belong to the previous input
+        cacheLoad();
+        cacheClear(true, args.time, true, true);
+        cacheSave();
+    }
+}
+
+void
+ImageStatisticsPlugin::purgeCaches()
+{
+    // the cache is read again from the file when needed
+    cacheSave();
+    OFX::MultiThread::AutoMutex lock(_cacheMutex);
+    _cache.clear();
+    _cachePath.clear();
+    _cacheDirty = false;
+}
+
 /* set up and run a processor */
 void
-ImageStatisticsPlugin::setupAndProcess(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, double /*time*/, const OfxRectI &analysisWindow, const Results &prevResults, Results *results)
+ImageStatisticsPlugin::setupProcessor(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, bool percentiles, const OfxRectI &analysisWindow, BlockMomentsMap* blocks)
 {
 
     // set the images
     processor.setDstImg(const_cast<OFX::Image*>(srcImg)); // not a bug: we only set dst
 
     // set the render window
-    processor.setRenderWindow(analysisWindow);
-
-    processor.setPrevResults(prevResults);
-
-    // Call the base class process member, this will call the derived templated process code
-    processor.process();
-
-    if (!abort()) {
-        processor.getResults(results);
+    if (blocks && analysisWindow.x1 < analysisWindow.x2 && analysisWindow.y1 < analysisWindow.y2) {
+        // process all the blocks that intersect the analysis window, so that they are complete
+        OfxRectI blocksWindow;
+        blocksWindow.x1 = blockIndex(analysisWindow.x1) * kCacheBlockSize;
+        blocksWindow.y1 = blockIndex(analysisWindow.y1) * kCacheBlockSize;
+        blocksWindow.x2 = (blockIndex(analysisWindow.x2 - 1) + 1) * kCacheBlockSize;
+        blocksWindow.y2 = (blockIndex(analysisWindow.y2 - 1) + 1) * kCacheBlockSize;
+        MergeImages2D::rectIntersection(blocksWindow, srcImg->getBounds(), &blocksWindow);
+        processor.setRenderWindow(blocksWindow);
+        processor.setBlocks(analysisWindow, blocks);
+    } else {
+        processor.setRenderWindow(analysisWindow);
     }
+
+    processor.setPercentiles(percentiles);
 }
 
 void
 ImageStatisticsPlugin::computeWindow(const OFX::Image* srcImg, double time, OfxRectI *analysisWindow)
+{
+    computeWindow(time, srcImg->getRenderScale(), srcImg->getPixelAspectRatio(), srcImg->getBounds(), analysisWindow);
+}
+
+void
+ImageStatisticsPlugin::computeWindow(double time, const OfxPointD &renderScale, double par, const OfxRectI &bounds, OfxRectI *analysisWindow)
 {
     OfxRectD regionOfInterest;
     bool restrictToRectangle;
@@ -1387,10 +1834,10 @@ ImageStatisticsPlugin::computeWindow(const OFX::Image* srcImg, double time, OfxR
         regionOfInterest.y2 += regionOfInterest.y1;
     }
     MergeImages2D::toPixelEnclosing(regionOfInterest,
-                                    srcImg->getRenderScale(),
-                                    srcImg->getPixelAspectRatio(),
+                                    renderScale,
+                                    par,
                                     analysisWindow);
-    MergeImages2D::rectIntersection(*analysisWindow, srcImg->getBounds(), analysisWindow);
+    MergeImages2D::rectIntersection(*analysisWindow, bounds, analysisWindow);
 }
 // update image statistics
 void
@@ -1398,19 +1845,28 @@ ImageStatisticsPlugin::update(const OFX::Image* srcImg, double time, const OfxRe
 {
     // TODO: CHECK if checkDoubleAnalysis param is true and analysisWindow is the same as btmLeft/sizeAnalysis
     Results results;
+    bool percentiles;
+    _percentiles->getValueAtTime(time, percentiles);
     if (!abort()) {
-        updateSub<ImageMinMaxMeanProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageSDevProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageSkewnessKurtosisProcessor>(srcImg, time, analysisWindow, results, &results);
+        std::auto_ptr<ImageStatisticsProcessorBase> processor(createProcessor<ImageMomentsProcessor>(srcImg));
+        setupProcessor(*processor, srcImg, percentiles, analysisWindow, 0);
+        // Call the base class process member, this will call the derived templated process code
+        processor->process();
+        if (!abort()) {
+            processor->getResults(&results);
+        }
     }
     if (abort()) {
         return;
     }
     beginEditBlock("updateStatisticsRGBA");
+    setStatistics(time, results);
+    endEditBlock();
+}
+
+void
+ImageStatisticsPlugin::setStatistics(double time, const Results &results)
+{
     _statMin->setValueAtTime(time, results.min.r, results.min.g, results.min.b, results.min.a);
     _statMax->setValueAtTime(time, results.max.r, results.max.g, results.max.b, results.max.a);
     _statMean->setValueAtTime(time, results.mean.r, results.mean.g, results.mean.b, results.mean.a);
@@ -1418,33 +1874,455 @@ ImageStatisticsPlugin::update(const OFX::Image* srcImg, double time, const OfxRe
     _statSkewness->setValueAtTime(time, results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
    // printf("skewness = %g %g %g %g\n", results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
     _statKurtosis->setValueAtTime(time, results.kurtosis.r, results.kurtosis.g, results.kurtosis.b, results.kurtosis.a);
-    endEditBlock();
+    if (results.percentiles) {
+        _statMedian->setValueAtTime(time, results.median.r, results.median.g, results.median.b, results.median.a);
+        _statP1->setValueAtTime(time, results.p1.r, results.p1.g, results.p1.b, results.p1.a);
+        _statP5->setValueAtTime(time, results.p5.r, results.p5.g, results.p5.b, results.p5.a);
+        _statP95->setValueAtTime(time, results.p95.r, results.p95.g, results.p95.b, results.p95.a);
+        _statP99->setValueAtTime(time, results.p99.r, results.p99.g, results.p99.b, results.p99.a);
+    }
 }
 
 void
 ImageStatisticsPlugin::updateHSVL(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow)
 {
     Results results;
+    bool percentiles;
+    _percentiles->getValueAtTime(time, percentiles);
     if (!abort()) {
-        updateSub<ImageHSVLMinMaxMeanProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageHSVLSDevProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageHSVLSkewnessKurtosisProcessor>(srcImg, time, analysisWindow, results, &results);
+        std::auto_ptr<ImageStatisticsProcessorBase> processor(createProcessor<ImageHSVLMomentsProcessor>(srcImg));
+        setupProcessor(*processor, srcImg, percentiles, analysisWindow, 0);
+        // Call the base class process member, this will call the derived templated process code
+        processor->process();
+        if (!abort()) {
+            processor->getResults(&results);
+        }
     }
     if (abort()) {
         return;
     }
     beginEditBlock("updateStatisticsHSVL");
+    setStatisticsHSVL(time, results);
+    endEditBlock();
+}
+
+void
+ImageStatisticsPlugin::setStatisticsHSVL(double time, const Results &results)
+{
     _statHSVLMin->setValueAtTime(time, results.min.r, results.min.g, results.min.b, results.min.a);
     _statHSVLMax->setValueAtTime(time, results.max.r, results.max.g, results.max.b, results.max.a);
     _statHSVLMean->setValueAtTime(time, results.mean.r, results.mean.g, results.mean.b, results.mean.a);
     _statHSVLSDev->setValueAtTime(time, results.sdev.r, results.sdev.g, results.sdev.b, results.sdev.a);
     _statHSVLSkewness->setValueAtTime(time, results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
     _statHSVLKurtosis->setValueAtTime(time, results.kurtosis.r, results.kurtosis.g, results.kurtosis.b, results.kurtosis.a);
+    if (results.percentiles) {
+        _statHSVLMedian->setValueAtTime(time, results.median.r, results.median.g, results.median.b, results.median.a);
+        _statHSVLP1->setValueAtTime(time, results.p1.r, results.p1.g, results.p1.b, results.p1.a);
+        _statHSVLP5->setValueAtTime(time, results.p5.r, results.p5.g, results.p5.b, results.p5.a);
+        _statHSVLP95->setValueAtTime(time, results.p95.r, results.p95.g, results.p95.b, results.p95.a);
+        _statHSVLP99->setValueAtTime(time, results.p99.r, results.p99.g, results.p99.b, results.p99.a);
+    }
+}
+
+bool
+ImageStatisticsPlugin::analyzeFrame(double time, const OfxPointD &renderScale, bool doRGBA, bool doHSVL, FrameResults *frameResults)
+{
+    FrameJob job;
+    try {
+        if (!fetchFrame(time, renderScale, doRGBA, doHSVL, &job, frameResults)) {
+            return false;
+        }
+        computeFrame(&job);
+    } catch (...) {
+        releaseFrame(&job);
+        throw;
+    }
+    finishFrame(&job, frameResults);
+
+    return frameResults->analyzed;
+}
+
+bool
+ImageStatisticsPlugin::fetchFrame(double time, const OfxPointD &renderScale, bool doRGBA, bool doHSVL, FrameJob *job, FrameResults *frameResults)
+{
+    job->time = time;
+    job->renderScale = renderScale;
+    job->src = 0;
+    job->failed = false;
+    _percentiles->getValueAtTime(time, job->percentiles);
+
+    // first try to get the results from the cache, without fetching the image
+    cacheGetInput(time, &job->input);
+    job->doRGBA = doRGBA && !cacheLookup(CacheKey(time, renderScale, false), job->input, false, job->percentiles, &frameResults->rgba, &frameResults->bytes);
+    job->doHSVL = doHSVL && !cacheLookup(CacheKey(time, renderScale, true), job->input, false, job->percentiles, &frameResults->hsvl, &frameResults->bytes);
+    if (!job->doRGBA && !job->doHSVL) {
+        return true;
+    }
+
+    std::auto_ptr<OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
+                                  _srcClip->fetchImage(time) : 0);
+    if (!src.get()) {
+        return false;
+    }
+    if (src->getRenderScale().x != renderScale.x ||
+        src->getRenderScale().y != renderScale.y) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    const OfxRectI& bounds = src->getBounds();
+    frameResults->bytes = (size_t)std::abs(src->getRowBytes()) * (size_t)std::max(0, bounds.y2 - bounds.y1);
+    // the entries which belong to an image with a unique identifier can only be checked once it is fetched
+    job->input.uid = src->getUniqueIdentifier();
+    if (!job->input.uid.empty()) {
+        job->doRGBA = job->doRGBA && !cacheLookup(CacheKey(time, renderScale, false), job->input, true, job->percentiles, &frameResults->rgba, &frameResults->bytes);
+        job->doHSVL = job->doHSVL && !cacheLookup(CacheKey(time, renderScale, true), job->input, true, job->percentiles, &frameResults->hsvl, &frameResults->bytes);
+        if (!job->doRGBA && !job->doHSVL) {
+            return true;
+        }
+    }
+    computeWindow(src.get(), time, &job->analysisWindow);
+    job->src = src.release();
+    setupFrame(job);
+
+    return true;
+}
+
+void
+ImageStatisticsPlugin::setupFrame(FrameJob *job)
+{
+    assert(job->src);
+    delete job->processorRGBA;
+    job->processorRGBA = 0;
+    delete job->processorHSVL;
+    job->processorHSVL = 0;
+    job->blocksRGBA.clear();
+    job->blocksHSVL.clear();
+    job->failed = false;
+    std::auto_ptr<ImageStatisticsProcessorBase> processorRGBA;
+    std::auto_ptr<ImageStatisticsProcessorBase> processorHSVL;
+    if (job->doRGBA) {
+        processorRGBA.reset(createProcessor<ImageMomentsProcessor>(job->src));
+        setupProcessor(*processorRGBA, job->src, job->percentiles, job->analysisWindow, &job->blocksRGBA);
+    }
+    if (job->doHSVL) {
+        processorHSVL.reset(createProcessor<ImageHSVLMomentsProcessor>(job->src));
+        setupProcessor(*processorHSVL, job->src, job->percentiles, job->analysisWindow, &job->blocksHSVL);
+    }
+    job->processorRGBA = processorRGBA.release();
+    job->processorHSVL = processorHSVL.release();
+}
+
+void
+ImageStatisticsPlugin::computeFrame(FrameJob *job)
+{
+    if (job->processorRGBA && !abort()) {
+        job->processorRGBA->process();
+    }
+    if (job->processorHSVL && !abort()) {
+        job->processorHSVL->process();
+    }
+}
+
+void
+ImageStatisticsPlugin::computeFrameStrip(FrameJob *job, int i, int n)
+{
+    if (job->processorRGBA && !abort()) {
+        job->processorRGBA->processStrip(i, n);
+    }
+    if (job->processorHSVL && !abort()) {
+        job->processorHSVL->processStrip(i, n);
+    }
+}
+
+void
+ImageStatisticsPlugin::finishFrame(FrameJob *job, FrameResults *frameResults)
+{
+    frameResults->analyzed = !abort() && !job->failed;
+    if (frameResults->analyzed && job->src) {
+        if (job->processorRGBA) {
+            job->processorRGBA->getResults(&frameResults->rgba);
+            OFX::PixelComponentEnum srcComponents = job->src->getPixelComponents();
+            int nComponents = (srcComponents == OFX::ePixelComponentAlpha) ? 1 : ((srcComponents == OFX::ePixelComponentRGB) ? 3 : 4);
+            cacheStore(CacheKey(job->time, job->renderScale, false), job->input, job->src, nComponents, job->analysisWindow, job->blocksRGBA, frameResults->rgba);
+        }
+        if (job->processorHSVL) {
+            job->processorHSVL->getResults(&frameResults->hsvl);
+            cacheStore(CacheKey(job->time, job->renderScale, true), job->input, job->src, nComponentsHSVL, job->analysisWindow, job->blocksHSVL, frameResults->hsvl);
+        }
+    }
+    releaseFrame(job);
+}
+
+void
+ImageStatisticsPlugin::releaseFrame(FrameJob *job)
+{
+    delete job->processorRGBA;
+    job->processorRGBA = 0;
+    delete job->processorHSVL;
+    job->processorHSVL = 0;
+    delete job->src;
+    job->src = 0;
+}
+
+// get the identity of the input at the given time, except for the unique identifier of the image (main thread)
+void
+ImageStatisticsPlugin::cacheGetInput(double time, CacheInput *input)
+{
+    input->rod = _srcClip->getRegionOfDefinition(time);
+    input->firstFrame = _srcClip->getFrameRange().min;
+    input->depth = (int)_srcClip->getPixelDepth();
+    input->components = (int)_srcClip->getPixelComponents();
+    input->uid.clear();
+}
+
+// get the statistics of a frame from the cache, either from the last results if the window did not
+// change, or by merging the moments of the cached blocks if the window is on the block grid.
+bool
+ImageStatisticsPlugin::cacheLookup(const CacheKey &key, const CacheInput &input, bool fetched, bool percentiles, Results *results, size_t *bytes)
+{
+    OfxRectI bounds;
+    double par;
+    {
+        OFX::MultiThread::AutoMutex lock(_cacheMutex);
+        StatisticsCache::const_iterator it = _cache.find(key);
+        if (it == _cache.end() || !cacheInputMatches(it->second.input, input)) {
+            return false;
+        }
+        if (!it->second.input.uid.empty() && (!fetched || it->second.input.uid != input.uid)) {
+            // the analyzed image had a unique identifier, which must be the same
+            return false;
+        }
+        bounds = it->second.bounds;
+        par = it->second.par;
+    }
+    // the parameters are read outside of the lock
+    OfxPointD renderScale;
+    renderScale.x = key.scaleX;
+    renderScale.y = key.scaleY;
+    OfxRectI window;
+    computeWindow(key.time, renderScale, par, bounds, &window);
+
+    OFX::MultiThread::AutoMutex lock(_cacheMutex);
+    StatisticsCache::const_iterator it = _cache.find(key);
+    if (it == _cache.end() || !cacheInputMatches(it->second.input, input) || (!it->second.input.uid.empty() && it->second.input.uid != input.uid) ||
+        !rectEqual(it->second.bounds, bounds) || it->second.par != par) {
+        // the entry was modified by another thread
+        return false;
+    }
+    const CacheEntry &e = it->second;
+    if (e.hasResults && rectEqual(e.window, window) && (e.results.percentiles || !percentiles)) {
+        *results = e.results;
+        results->percentiles = percentiles;
+        *bytes = std::max(*bytes, (size_t)e.imageBytes);
+
+        return true;
+    }
+    // percentiles cannot be computed from the block moments
+    if (percentiles) {
+        return false;
+    }
+    if ((window.x1 % kCacheBlockSize != 0 && window.x1 != bounds.x1) ||
+        (window.y1 % kCacheBlockSize != 0 && window.y1 != bounds.y1) ||
+        (window.x2 % kCacheBlockSize != 0 && window.x2 != bounds.x2) ||
+        (window.y2 % kCacheBlockSize != 0 && window.y2 != bounds.y2)) {
+        return false;
+    }
+    Moments moments[4];
+    for (int by = blockIndex(window.y1); window.y1 < window.y2 && by <= blockIndex(window.y2 - 1); ++by) {
+        for (int bx = blockIndex(window.x1); window.x1 < window.x2 && bx <= blockIndex(window.x2 - 1); ++bx) {
+            BlockMomentsMap::const_iterator b = e.blocks.find(std::make_pair(bx, by));
+            if (b == e.blocks.end()) {
+                return false;
+            }
+            for (int c = 0; c < e.nComponents; ++c) {
+                moments[c].merge(b->second.c[c]);
+            }
+        }
+    }
+    switch (e.nComponents) {
+        case 1:
+            ImageStatisticsProcessorBase::momentsToResults<1>(moments, results);
+            break;
+        case 3:
+            ImageStatisticsProcessorBase::momentsToResults<3>(moments, results);
+            break;
+        case 4:
+            ImageStatisticsProcessorBase::momentsToResults<4>(moments, results);
+            break;
+        default:
+            return false;
+    }
+    *bytes = std::max(*bytes, (size_t)e.imageBytes);
+
+    return true;
+}
+
+void
+ImageStatisticsPlugin::cacheStore(const CacheKey &key, const CacheInput &input, const OFX::Image* srcImg, int nComponents, const OfxRectI &analysisWindow, const BlockMomentsMap &blocks, const Results &results)
+{
+    const OfxRectI& bounds = srcImg->getBounds();
+    OFX::MultiThread::AutoMutex lock(_cacheMutex);
+    CacheEntry &e = _cache[key];
+    if (!cacheInputMatches(e.input, input) || e.input.uid != input.uid ||
+        !rectEqual(e.bounds, bounds) || e.par != srcImg->getPixelAspectRatio() || e.nComponents != nComponents) {
+        // the input changed, the cached blocks are not valid anymore
+        e = CacheEntry();
+        e.input = input;
+        e.bounds = bounds;
+        e.par = srcImg->getPixelAspectRatio();
+        e.nComponents = nComponents;
+    }
+    e.imageBytes = (double)std::abs(srcImg->getRowBytes()) * std::max(0, bounds.y2 - bounds.y1);
+    for (BlockMomentsMap::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        e.blocks[it->first] = it->second;
+    }
+    e.hasResults = true;
+    e.window = analysisWindow;
+    e.results = results;
+    _cacheDirty = true;
+}
+
+// read the cache file if it changed. If the file cannot be read, the cache is kept and will be saved to the new file.
+// If there is no file, the cache is only kept in memory.
+void
+ImageStatisticsPlugin::cacheLoad()
+{
+    std::string path;
+    _cacheFile->getValue(path);
+    OFX::MultiThread::AutoMutex lock(_cacheMutex);
+    if (path == _cachePath) {
+        return;
+    }
+    StatisticsCache cache;
+    if (!path.empty() && cacheRead(path, &cache)) {
+        _cache.swap(cache);
+        _cacheDirty = false;
+    } else {
+        _cacheDirty = !path.empty();
+    }
+    _cachePath = path;
+}
+
+void
+ImageStatisticsPlugin::cacheSave()
+{
+    OFX::MultiThread::AutoMutex lock(_cacheMutex);
+    if (_cachePath.empty() || !_cacheDirty) {
+        return;
+    }
+    if (!cacheWrite(_cachePath, _cache)) {
+        sendMessage(OFX::Message::eMessageError, "", "Cannot write statistics cache file " + _cachePath);
+    }
+    _cacheDirty = false;
+}
+
+// clear the RGBA and/or HSVL statistics from the cache, for all frames or for the given time only
+void
+ImageStatisticsPlugin::cacheClear(bool allFrames, double time, bool rgba, bool hsvl)
+{
+    OFX::MultiThread::AutoMutex lock(_cacheMutex);
+    for (StatisticsCache::iterator it = _cache.begin(); it != _cache.end();) {
+        if ((allFrames || it->first.time == time) && (it->first.hsvl ? hsvl : rgba)) {
+            _cache.erase(it++);
+            _cacheDirty = true;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+ImageStatisticsPlugin::analyzeSequence(const OfxPointD &renderScale, bool doRGBA, bool doHSVL)
+{
+    progressStart("Analyzing sequence...");
+    OfxRangeD range = _srcClip->getFrameRange();
+    //timeLineGetBounds(range.min, range.max); // wrong: we want the input frame range only
+    int tmin = (int)std::ceil(range.min);
+    int tmax = (int)std::floor(range.max);
+    if (tmax < tmin) {
+        progressEnd();
+        return;
+    }
+    std::vector<FrameResults> results(tmax - tmin + 1);
+    cacheLoad();
+
+    // the first frame is analyzed in the main thread, and tells how many frames fit in memory
+    analyzeFrame(tmin, renderScale, doRGBA, doHSVL, &results[0]);
+    const unsigned int nThreads = OFX::MultiThread::getNumCPUs();
+    int batchSize = std::max(1U, nThreads);
+    if (results[0].bytes > 0) {
+        // two batches are held in memory: the one being analyzed, and the one being fetched
+        batchSize = std::min(batchSize, (int)std::max((size_t)1, (size_t)kSequenceAnalysisMaxMemory / 2 / results[0].bytes));
+    }
+
+    // analyze the other frames by batches: the spawned threads compute the statistics of a batch while the main
+    // thread reads the parameters and fetches the frames of the next batch.
+    // Progress is reported by the main thread after each batch.
+    std::list<FrameJob> jobs; // the batch being analyzed
+    std::list<FrameJob> next; // the batch being fetched
+    SequenceAnalyzer analyzer(*this, renderScale, doRGBA, doHSVL, tmin, results);
+    try {
+        int tJobs = tmin + 1; // the frames of jobs are before tJobs
+        int t = tmin + 1; // the next frame to fetch
+        bool aborted = abort();
+        while (!aborted && (!jobs.empty() || t <= tmax)) {
+            const int t2 = std::min(t + batchSize, tmax + 1);
+            t = analyzer.analyze(jobs, next, t, t2, nThreads);
+            // the frames that could not be fetched while analyzing are fetched now
+            for (; t < t2 && !abort(); ++t) {
+                next.push_back(FrameJob());
+                if (!fetchFrame(t, renderScale, doRGBA, doHSVL, &next.back(), &results[t - tmin])) {
+                    next.pop_back();
+                }
+            }
+            // frames that could not be analyzed by the spawned threads are analyzed by the main thread
+            for (std::list<FrameJob>::iterator it = jobs.begin(); it != jobs.end() && !abort(); ++it) {
+                if (it->src && it->failed) {
+                    setupFrame(&*it);
+                    computeFrame(&*it);
+                }
+            }
+            for (std::list<FrameJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+                finishFrame(&*it, &results[(int)it->time - tmin]);
+            }
+            jobs.clear();
+            aborted = abort() || !progressUpdate((tJobs - 1 - tmin) / (double)(tmax - tmin));
+            jobs.swap(next);
+            tJobs = t;
+        }
+    } catch (...) {
+        for (std::list<FrameJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+            releaseFrame(&*it);
+        }
+        for (std::list<FrameJob>::iterator it = next.begin(); it != next.end(); ++it) {
+            releaseFrame(&*it);
+        }
+        throw;
+    }
+    // frames left after an abort
+    for (std::list<FrameJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+        releaseFrame(&*it);
+    }
+    for (std::list<FrameJob>::iterator it = next.begin(); it != next.end(); ++it) {
+        releaseFrame(&*it);
+    }
+
+    // set all keyframes at once
+    beginEditBlock("analyzeSequence");
+    for (int t = tmin; t <= tmax; ++t) {
+        const FrameResults& r = results[t - tmin];
+        if (r.analyzed) {
+            if (doRGBA) {
+                setStatistics(t, r.rgba);
+            }
+            if (doHSVL) {
+                setStatisticsHSVL(t, r.hsvl);
+            }
+        }
+    }
     endEditBlock();
+    cacheSave();
+    progressEnd();
 }
 
 class ImageStatisticsInteract : public RectangleInteract
@@ -1631,6 +2509,34 @@ void ImageStatisticsPluginFactory::describeInContext(OFX::ImageEffectDescriptor
         }
     }
 
+    // percentiles
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamPercentiles);
+        param->setLabel(kParamPercentilesLabel);
+        param->setHint(kParamPercentilesHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // cacheFile
+    {
+        StringParamDescriptor* param = desc.defineStringParam(kParamCacheFile);
+        param->setLabel(kParamCacheFileLabel);
+        param->setHint(kParamCacheFileHint);
+        param->setStringType(eStringTypeFilePath);
+        param->setFilePathExists(false);
+        param->setDefault("");
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     // interactive
     {
         BooleanParamDescriptor* param = desc.defineBooleanParam(kParamRectangleInteractInteractive);
@@ -1722,6 +2628,71 @@ void ImageStatisticsPluginFactory::describeInContext(OFX::ImageEffectDescriptor
             if (page) {
                 page->addChild(*param);
             }
+
+        // statMedian
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatMedian);
+            param->setLabel(kParamStatMedianLabel);
+            param->setHint(kParamStatMedianHint);
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statP1
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatP1);
+            param->setLabel(kParamStatP1Label);
+            param->setHint(kParamStatP1Hint);
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statP5
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatP5);
+            param->setLabel(kParamStatP5Label);
+            param->setHint(kParamStatP5Hint);
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statP95
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatP95);
+            param->setLabel(kParamStatP95Label);
+            param->setHint(kParamStatP95Hint);
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statP99
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatP99);
+            param->setLabel(kParamStatP99Label);
+            param->setHint(kParamStatP99Hint);
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
         }
 
         // analyzeFrame
@@ -1857,6 +2828,76 @@ void ImageStatisticsPluginFactory::describeInContext(OFX::ImageEffectDescriptor
             if (page) {
                 page->addChild(*param);
             }
+
+        // statHSVLMedian
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatHSVLMedian);
+            param->setLabel(kParamStatHSVLMedianLabel);
+            param->setHint(kParamStatHSVLMedianHint);
+            param->setDimensionLabels("h", "s", "v", "l");
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statHSVLP1
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatHSVLP1);
+            param->setLabel(kParamStatHSVLP1Label);
+            param->setHint(kParamStatHSVLP1Hint);
+            param->setDimensionLabels("h", "s", "v", "l");
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statHSVLP5
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatHSVLP5);
+            param->setLabel(kParamStatHSVLP5Label);
+            param->setHint(kParamStatHSVLP5Hint);
+            param->setDimensionLabels("h", "s", "v", "l");
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statHSVLP95
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatHSVLP95);
+            param->setLabel(kParamStatHSVLP95Label);
+            param->setHint(kParamStatHSVLP95Hint);
+            param->setDimensionLabels("h", "s", "v", "l");
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+
+        // statHSVLP99
+        {
+            RGBAParamDescriptor* param = desc.defineRGBAParam(kParamStatHSVLP99);
+            param->setLabel(kParamStatHSVLP99Label);
+            param->setHint(kParamStatHSVLP99Hint);
+            param->setDimensionLabels("h", "s", "v", "l");
+            param->setEvaluateOnChange(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
         }
 
         // analyzeFrameHSVL
@@ -0,0 +1,710 @@
+/*
+ OFX mipmap transform helper.
+ Render a minifying transform by sampling a pyramid of prefiltered, downscaled copies of the source.
+
+ Copyright (C) 2014-2015 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+#ifndef Misc_MipmapTransform_h
+#define Misc_MipmapTransform_h
+
+#include <cmath>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "ofxsImageEffect.h"
+#include "ofxsProcessing.H"
+#include "ofxsMaskMix.h"
+#include "ofxsMatrix2D.h"
+#include "SeparableTransform.h"
+
+#define kParamMipmap "mipmap"
+#define kParamMipmapLabel "Mipmap Minification"
+#define kParamMipmapHint "When the transform shrinks the image, sample a pyramid of prefiltered, downscaled copies of the source, instead of filtering the full resolution source. " \
+"This avoids aliasing on strong downscales without blurring the input first, and the filtering cost depends on the output size rather than on the source size. " \
+"Stretched areas (e.g. in perspective) are sampled anisotropically along their long axis. " \
+"The filter and clamp parameters are not used on this path: magnified areas are filtered bilinearly. " \
+"Motion blur is not supported on this path: if it is enabled, the regular filter is used."
+
+#define kMipmapTransformMaxAnisotropy 8 // max number of probes along the long axis of the pixel footprint
+#define kMipmapTransformMinification 1.01 // use the pyramid only if a pixel footprint is larger than this (in source pixels)
+
+namespace OFX {
+
+/** @brief describe the parameter that enables the mipmap path. Call it from describeInContext(). */
+inline void
+mipmapTransformDescribeParams(OFX::ImageEffectDescriptor &desc,
+                              OFX::PageParamDescriptor *page)
+{
+    OFX::BooleanParamDescriptor* param = desc.defineBooleanParam(kParamMipmap);
+    param->setLabel(kParamMipmapLabel);
+    param->setHint(kParamMipmapHint);
+    param->setDefault(false);
+    param->setAnimates(false);
+    if (page) {
+        page->addChild(*param);
+    }
+}
+
+enum MipmapTransformPassEnum
+{
+    eMipmapTransformPassReduce = 0, // compute a pyramid level from the previous one
+    eMipmapTransformPassSample      // sample the pyramid to render the destination image
+};
+
+// One level of the pyramid. The levels are anchored to the pixel grid, not to the source bounds, so that they do
+// not depend on the region of the source that was fetched (which depends on the render window):
+// level l pixel (i,j) covers the source pixels [i*2^l, (i+1)*2^l) x [j*2^l, (j+1)*2^l).
+// bounds are the level pixels that cover at least one pixel of the source image.
+// Level 0 is the source image itself, the other levels are packed float images with nComponents per pixel.
+struct MipmapTransformLevel
+{
+    OfxRectI bounds;
+    const float *data; // 0 for level 0
+};
+
+// the bounds of the level above the level with the given bounds
+inline OfxRectI
+mipmapTransformLevelBounds(const OfxRectI &bounds)
+{
+    OfxRectI ret;
+    // round down x1,y1 and round up x2,y2 (integer division rounds towards zero)
+    ret.x1 = (bounds.x1 < 0) ? -( (1 - bounds.x1) / 2 ) : bounds.x1 / 2;
+    ret.y1 = (bounds.y1 < 0) ? -( (1 - bounds.y1) / 2 ) : bounds.y1 / 2;
+    ret.x2 = (bounds.x2 < 0) ? -( -bounds.x2 / 2 ) : (bounds.x2 + 1) / 2;
+    ret.y2 = (bounds.y2 < 0) ? -( -bounds.y2 / 2 ) : (bounds.y2 + 1) / 2;
+
+    return ret;
+}
+
+class MipmapTransformProcessorBase
+: public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_srcImg;
+    const OFX::Image *_maskImg;
+    bool _domask;
+    bool _maskInvert;
+    double _mix;
+    bool _blackOutside;
+    OFX::Matrix3x3 _invtransform; // inverse transform in pixel coordinates
+    std::vector<MipmapTransformLevel> _levels;
+    MipmapTransformPassEnum _pass;
+    int _reduceLevel; // the level computed by eMipmapTransformPassReduce
+    float *_reduceDst;
+
+public:
+    MipmapTransformProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _srcImg(0)
+    , _maskImg(0)
+    , _domask(false)
+    , _maskInvert(false)
+    , _mix(1.)
+    , _blackOutside(true)
+    , _invtransform()
+    , _levels()
+    , _pass(eMipmapTransformPassSample)
+    , _reduceLevel(0)
+    , _reduceDst(0)
+    {
+    }
+
+    void setSrcImg(const OFX::Image *v) { _srcImg = v; }
+
+    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
+
+    void doMasking(bool v) { _domask = v; }
+
+    void setValues(const OFX::Matrix3x3 &invtransform,
+                   const std::vector<MipmapTransformLevel> &levels,
+                   bool blackOutside,
+                   double mix)
+    {
+        _invtransform = invtransform;
+        _levels = levels;
+        _blackOutside = blackOutside;
+        _mix = mix;
+    }
+
+    /** @brief set the pass run by the next call to process().
+     For eMipmapTransformPassReduce, the render window is in level coordinates, and level is computed into dst. */
+    void setPass(MipmapTransformPassEnum pass,
+                 int level,
+                 float *dst)
+    {
+        assert(pass == eMipmapTransformPassSample || (level > 0 && dst));
+        _pass = pass;
+        _reduceLevel = level;
+        _reduceDst = dst;
+        if (pass == eMipmapTransformPassReduce) {
+            _levels[level].data = dst;
+        }
+    }
+};
+
+template <class PIX, int nComponents, int maxValue>
+class MipmapTransformProcessor
+: public MipmapTransformProcessorBase
+{
+public:
+    MipmapTransformProcessor(OFX::ImageEffect &instance)
+    : MipmapTransformProcessorBase(instance)
+    {
+    }
+
+private:
+    // the value of pixel (i,j) of level l, added to pix with weight w.
+    // Pixels outside of the level are black, or the nearest edge pixel if !_blackOutside.
+    void accumulatePixel(int l, int i, int j, float w, float *pix) const
+    {
+        const OfxRectI &bounds = _levels[l].bounds;
+        if (i < bounds.x1 || bounds.x2 <= i || j < bounds.y1 || bounds.y2 <= j) {
+            if (_blackOutside) {
+                return;
+            }
+            i = std::max(bounds.x1, std::min(i, bounds.x2 - 1));
+            j = std::max(bounds.y1, std::min(j, bounds.y2 - 1));
+        }
+        if (l == 0) {
+            const PIX *p = (const PIX *) _srcImg->getPixelAddress(i, j);
+            assert(p);
+            for (int c = 0; c < nComponents; ++c) {
+                pix[c] += w * p[c];
+            }
+        } else {
+            const float *p = _levels[l].data + ( (size_t)(j - bounds.y1) * (bounds.x2 - bounds.x1) + (i - bounds.x1) ) * nComponents;
+            for (int c = 0; c < nComponents; ++c) {
+                pix[c] += w * p[c];
+            }
+        }
+    }
+
+    // bilinear interpolation in level l at source pixel coordinates (x,y), added to pix with weight w
+    void accumulateBilinear(int l, double x, double y, float w, float *pix) const
+    {
+        const double levelScale = std::ldexp(1., -l);
+        // level pixel centers are at integer coordinates
+        const double lx = x * levelScale - 0.5;
+        const double ly = y * levelScale - 0.5;
+        const int i = (int)std::floor(lx);
+        const int j = (int)std::floor(ly);
+        const float dx = (float)(lx - i);
+        const float dy = (float)(ly - j);
+        accumulatePixel(l, i,     j,     w * (1.f - dx) * (1.f - dy), pix);
+        accumulatePixel(l, i + 1, j,     w * dx * (1.f - dy), pix);
+        accumulatePixel(l, i,     j + 1, w * (1.f - dx) * dy, pix);
+        accumulatePixel(l, i + 1, j + 1, w * dx * dy, pix);
+    }
+
+    void multiThreadProcessImages(OfxRectI procWindow)
+    {
+        if (_pass == eMipmapTransformPassReduce) {
+            multiThreadProcessImagesReduce(procWindow);
+        } else {
+            multiThreadProcessImagesSample(procWindow);
+        }
+    }
+
+    // box-filter 2x2 pixels of the previous level into each pixel of _reduceLevel.
+    // At the edges of the source image, only the pixels inside the previous level are averaged.
+    void multiThreadProcessImagesReduce(const OfxRectI &procWindow)
+    {
+        const int l = _reduceLevel;
+        const OfxRectI &bounds = _levels[l].bounds;
+        const OfxRectI &prevBounds = _levels[l - 1].bounds;
+        float tmpPix[nComponents];
+
+        for (int j = procWindow.y1; j < procWindow.y2; ++j) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            float *dstPix = _reduceDst + ( (size_t)(j - bounds.y1) * (bounds.x2 - bounds.x1) + (procWindow.x1 - bounds.x1) ) * nComponents;
+            const int pj1 = std::max(2 * j, prevBounds.y1);
+            const int pj2 = std::min(2 * j + 2, prevBounds.y2);
+            for (int i = procWindow.x1; i < procWindow.x2; ++i, dstPix += nComponents) {
+                const int pi1 = std::max(2 * i, prevBounds.x1);
+                const int pi2 = std::min(2 * i + 2, prevBounds.x2);
+                for (int c = 0; c < nComponents; ++c) {
+                    tmpPix[c] = 0.f;
+                }
+                const float w = 1.f / ( (pi2 - pi1) * (pj2 - pj1) );
+                for (int pj = pj1; pj < pj2; ++pj) {
+                    for (int pi = pi1; pi < pi2; ++pi) {
+                        accumulatePixel(l - 1, pi, pj, w, tmpPix);
+                    }
+                }
+                for (int c = 0; c < nComponents; ++c) {
+                    dstPix[c] = tmpPix[c];
+                }
+            }
+        }
+    }
+
+    void multiThreadProcessImagesSample(const OfxRectI &procWindow)
+    {
+        const OFX::Matrix3x3 &H = _invtransform;
+        const int maxLevel = (int)_levels.size() - 1;
+        float tmpPix[nComponents];
+
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
+            assert(dstPix);
+            // pixel centers are at half-integer coordinates
+            const double yc = y + 0.5;
+            for (int x = procWindow.x1; x < procWindow.x2; ++x, dstPix += nComponents) {
+                const double xc = x + 0.5;
+                for (int c = 0; c < nComponents; ++c) {
+                    tmpPix[c] = 0.f;
+                }
+                const double w = H.g * xc + H.h * yc + H.i;
+                if (w > 0.) {
+                    const double sx = (H.a * xc + H.b * yc + H.c) / w;
+                    const double sy = (H.d * xc + H.e * yc + H.f) / w;
+                    // the Jacobian of the inverse homography: the footprint of the destination pixel in the source
+                    const double dsxdx = (H.a - sx * H.g) / w;
+                    const double dsydx = (H.d - sy * H.g) / w;
+                    const double dsxdy = (H.b - sx * H.h) / w;
+                    const double dsydy = (H.e - sy * H.h) / w;
+                    const double lenx = std::sqrt(dsxdx * dsxdx + dsydx * dsydx);
+                    const double leny = std::sqrt(dsxdy * dsxdy + dsydy * dsydy);
+                    double major = lenx;
+                    double minor = leny;
+                    double ax = dsxdx;
+                    double ay = dsydx;
+                    if (leny > lenx) {
+                        major = leny;
+                        minor = lenx;
+                        ax = dsxdy;
+                        ay = dsydy;
+                    }
+                    // anisotropic filtering: several probes along the major axis, each filtering a footprint
+                    // of size major/nProbes
+                    int nProbes = 1;
+                    if (major > minor) {
+                        nProbes = (minor > 0.) ? (int)std::ceil(major / minor) : kMipmapTransformMaxAnisotropy;
+                        nProbes = std::max(1, std::min(nProbes, kMipmapTransformMaxAnisotropy));
+                    }
+                    double lod = (major > nProbes) ? std::log(major / nProbes) / std::log(2.) : 0.;
+                    int l0 = (int)lod;
+                    float t = (float)(lod - l0);
+                    if (l0 >= maxLevel) {
+                        l0 = maxLevel;
+                        t = 0.f;
+                    }
+                    const float probeWeight = 1.f / nProbes;
+                    for (int k = 0; k < nProbes; ++k) {
+                        const double u = (k + 0.5) / nProbes - 0.5;
+                        const double px = sx + u * ax;
+                        const double py = sy + u * ay;
+                        accumulateBilinear(l0, px, py, probeWeight * (1.f - t), tmpPix);
+                        if (t > 0.f) {
+                            accumulateBilinear(l0 + 1, px, py, probeWeight * t, tmpPix);
+                        }
+                    }
+                }
+                ofxsMaskMix<PIX, nComponents, maxValue, true>(tmpPix, x, y, _srcImg, _domask, _maskImg, (float)_mix, _maskInvert, dstPix);
+            }
+        }
+    }
+};
+
+// the size of the footprint of destination pixel (x,y) in the source, along its major axis, after anisotropic
+// probing. Returns 0 if the pixel is not visible (behind the camera).
+inline double
+mipmapTransformFootprint(const OFX::Matrix3x3 &H,
+                         double x,
+                         double y)
+{
+    const double w = H.g * x + H.h * y + H.i;
+    if (w <= 0.) {
+        return 0.;
+    }
+    const double sx = (H.a * x + H.b * y + H.c) / w;
+    const double sy = (H.d * x + H.e * y + H.f) / w;
+    const double lenx = std::sqrt( (H.a - sx * H.g) * (H.a - sx * H.g) + (H.d - sy * H.g) * (H.d - sy * H.g) ) / w;
+    const double leny = std::sqrt( (H.b - sx * H.h) * (H.b - sx * H.h) + (H.e - sy * H.h) * (H.e - sy * H.h) ) / w;
+    const double major = std::max(lenx, leny);
+    const double minor = std::min(lenx, leny);
+
+    return std::max(minor, major / kMipmapTransformMaxAnisotropy);
+}
+
+// the largest footprint over the window (in pixel coordinates). The footprint of a homography varies with the
+// inverse of the homogeneous coordinate, which is affine, so its maximum is at one of the corners.
+inline double
+mipmapTransformMaxFootprint(const OFX::Matrix3x3 &H,
+                            const OfxRectD &window)
+{
+    double maxFootprint = 0.;
+    for (int i = 0; i < 4; ++i) {
+        const double x = (i & 1) ? window.x2 : window.x1;
+        const double y = (i & 2) ? window.y2 : window.y1;
+        maxFootprint = std::max( maxFootprint, mipmapTransformFootprint(H, x, y) );
+    }
+
+    return maxFootprint;
+}
+
+// the number of levels used for the given largest footprint: the level of the footprint, plus one for trilinear
+// interpolation
+inline int
+mipmapTransformNumLevels(double maxFootprint)
+{
+    return 2 + (int)( std::log(maxFootprint) / std::log(2.) );
+}
+
+template <class PIX, int nComponents, int maxValue>
+void
+mipmapTransformProcessForBitDepth(OFX::ImageEffect &effect,
+                                  OFX::Image *dst,
+                                  const OFX::Image *src,
+                                  const OFX::Image *mask,
+                                  bool maskInvert,
+                                  const OFX::Matrix3x3 &invtransform,
+                                  int nLevels,
+                                  bool blackOutside,
+                                  double mix,
+                                  const OfxRectI &renderWindow)
+{
+    std::vector<MipmapTransformLevel> levels(nLevels);
+    size_t pyramidSize = 0;
+    for (int l = 0; l < nLevels; ++l) {
+        MipmapTransformLevel &level = levels[l];
+        if (l == 0) {
+            level.bounds = src->getBounds();
+        } else {
+            level.bounds = mipmapTransformLevelBounds(levels[l - 1].bounds);
+            pyramidSize += (size_t)(level.bounds.x2 - level.bounds.x1) * (level.bounds.y2 - level.bounds.y1) * nComponents;
+        }
+        level.data = 0;
+    }
+    OFX::ImageMemory pyramidMem(std::max((size_t)1, pyramidSize) * sizeof(float), &effect);
+    float *pyramid = (float*)pyramidMem.lock();
+
+    MipmapTransformProcessor<PIX, nComponents, maxValue> processor(effect);
+    if (mask) {
+        processor.doMasking(true);
+        processor.setMaskImg(mask, maskInvert);
+    }
+    processor.setDstImg(dst);
+    processor.setSrcImg(src);
+    processor.setValues(invtransform, levels, blackOutside, mix);
+
+    // build the pyramid, from the source resolution down
+    float *levelData = pyramid;
+    for (int l = 1; l < nLevels; ++l) {
+        const OfxRectI &levelWindow = levels[l].bounds;
+        processor.setPass(eMipmapTransformPassReduce, l, levelData);
+        processor.setRenderWindow(levelWindow);
+        processor.process();
+        if ( effect.abort() ) {
+            return;
+        }
+        levelData += (size_t)(levelWindow.x2 - levelWindow.x1) * (levelWindow.y2 - levelWindow.y1) * nComponents;
+    }
+
+    processor.setPass(eMipmapTransformPassSample, 0, 0);
+    processor.setRenderWindow(renderWindow);
+    processor.process();
+}
+
+template <int nComponents>
+void
+mipmapTransformProcessForComponents(OFX::BitDepthEnum bitDepth,
+                                    OFX::ImageEffect &effect,
+                                    OFX::Image *dst,
+                                    const OFX::Image *src,
+                                    const OFX::Image *mask,
+                                    bool maskInvert,
+                                    const OFX::Matrix3x3 &invtransform,
+                                    int nLevels,
+                                    bool blackOutside,
+                                    double mix,
+                                    const OfxRectI &renderWindow)
+{
+    switch (bitDepth) {
+        case OFX::eBitDepthUByte:
+            mipmapTransformProcessForBitDepth<unsigned char, nComponents, 255>(effect, dst, src, mask, maskInvert, invtransform, nLevels, blackOutside, mix, renderWindow);
+            break;
+        case OFX::eBitDepthUShort:
+            mipmapTransformProcessForBitDepth<unsigned short, nComponents, 65535>(effect, dst, src, mask, maskInvert, invtransform, nLevels, blackOutside, mix, renderWindow);
+            break;
+        case OFX::eBitDepthFloat:
+            mipmapTransformProcessForBitDepth<float, nComponents, 1>(effect, dst, src, mask, maskInvert, invtransform, nLevels, blackOutside, mix, renderWindow);
+            break;
+        default:
+            OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+    }
+}
+
+/** @brief render a minifying transform by sampling a mipmap pyramid of the source.
+
+ invtransformCanonical is the inverse transform in canonical coordinates, as given by
+ Transform3x3Plugin::getInverseTransformCanonical(). The pyramid is built for each render from the source image
+ (which covers the source region of interest, see mipmapTransformGetRegionOfInterest()), down to the coarsest level
+ used in the render window. Each
+ destination pixel picks the pyramid level from the Jacobian of the inverse transform at that pixel, and is
+ sampled trilinearly, with several probes along the major axis of its footprint if it is anisotropic.
+ Returns false, without rendering anything, if the transform does not minify the source anywhere in the render
+ window. The caller should then use its regular render. */
+inline bool
+mipmapTransformRender(OFX::ImageEffect &effect,
+                      const OFX::RenderArguments &args,
+                      OFX::Clip *dstClip,
+                      OFX::Clip *srcClip,
+                      OFX::Clip *maskClip,
+                      const OFX::Matrix3x3 &invtransformCanonical,
+                      bool blackOutside,
+                      double mix,
+                      bool maskInvert)
+{
+    if ( !srcClip || !srcClip->isConnected() ) {
+        return false;
+    }
+
+    // the inverse transform in pixel coordinates
+    const bool fielded = args.fieldToRender == OFX::eFieldLower || args.fieldToRender == OFX::eFieldUpper;
+    const double pixelAspectRatio = srcClip->getPixelAspectRatio();
+    const OFX::Matrix3x3 canonicalToPixel = OFX::ofxsMatCanonicalToPixel(pixelAspectRatio, args.renderScale.x, args.renderScale.y, fielded);
+    const OFX::Matrix3x3 pixelToCanonical = OFX::ofxsMatPixelToCanonical(pixelAspectRatio, args.renderScale.x, args.renderScale.y, fielded);
+    const OFX::Matrix3x3 H = canonicalToPixel * invtransformCanonical * pixelToCanonical;
+
+    const OfxRectI &renderWindow = args.renderWindow;
+    OfxRectD window;
+    window.x1 = renderWindow.x1;
+    window.y1 = renderWindow.y1;
+    window.x2 = renderWindow.x2;
+    window.y2 = renderWindow.y2;
+    const double maxFootprint = mipmapTransformMaxFootprint(H, window);
+    if (maxFootprint <= kMipmapTransformMinification) {
+        return false;
+    }
+
+    std::auto_ptr<const OFX::Image> src(srcClip->fetchImage(args.time));
+    if ( !src.get() ) {
+        return false;
+    }
+    const OfxRectI &srcBounds = src->getBounds();
+    if ( !src->getTransformIsIdentity() || srcBounds.x1 >= srcBounds.x2 || srcBounds.y1 >= srcBounds.y2 ) {
+        // let the regular render concatenate the source transform, or fill with black
+        return false;
+    }
+    if ( (src->getRenderScale().x != args.renderScale.x) ||
+         ( src->getRenderScale().y != args.renderScale.y) ||
+         ( (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) ) {
+        effect.setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    std::auto_ptr<OFX::Image> dst( dstClip->fetchImage(args.time) );
+    if ( !dst.get() ) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OFX::BitDepthEnum dstBitDepth = dst->getPixelDepth();
+    OFX::PixelComponentEnum dstComponents = dst->getPixelComponents();
+    if (dstBitDepth != dstClip->getPixelDepth() ||
+        dstComponents != dstClip->getPixelComponents()) {
+        effect.setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong depth or components");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if ( (dst->getRenderScale().x != args.renderScale.x) ||
+         ( dst->getRenderScale().y != args.renderScale.y) ||
+         ( (dst->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && dst->getField() != args.fieldToRender)) ) {
+        effect.setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if ( (src->getPixelDepth() != dstBitDepth) || (src->getPixelComponents() != dstComponents) ) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    // the levels used in the render window, stopping when a level does not get smaller (one pixel, or two
+    // pixels straddling a multiple of 2^l)
+    int nLevels = mipmapTransformNumLevels(maxFootprint);
+    OfxRectI levelBounds = srcBounds;
+    for (int l = 1; l < nLevels; ++l) {
+        const OfxRectI nextBounds = mipmapTransformLevelBounds(levelBounds);
+        if ( (nextBounds.x2 - nextBounds.x1 == levelBounds.x2 - levelBounds.x1) &&
+             (nextBounds.y2 - nextBounds.y1 == levelBounds.y2 - levelBounds.y1) ) {
+            nLevels = l;
+            break;
+        }
+        levelBounds = nextBounds;
+    }
+
+    std::auto_ptr<const OFX::Image> mask((effect.getContext() != OFX::eContextFilter && maskClip && maskClip->isConnected()) ?
+                                         maskClip->fetchImage(args.time) : 0);
+
+    if (dstComponents == OFX::ePixelComponentRGBA) {
+        mipmapTransformProcessForComponents<4>(dstBitDepth, effect, dst.get(), src.get(), mask.get(), maskInvert, H, nLevels, blackOutside, mix, renderWindow);
+    } else if (dstComponents == OFX::ePixelComponentRGB) {
+        mipmapTransformProcessForComponents<3>(dstBitDepth, effect, dst.get(), src.get(), mask.get(), maskInvert, H, nLevels, blackOutside, mix, renderWindow);
+    } else {
+        assert(dstComponents == OFX::ePixelComponentAlpha);
+        mipmapTransformProcessForComponents<1>(dstBitDepth, effect, dst.get(), src.get(), mask.get(), maskInvert, H, nLevels, blackOutside, mix, renderWindow);
+    }
+
+    return true;
+}
+
+// apply the homography H to (x,y). Returns false if the point is behind the camera.
+inline bool
+mipmapTransformApply(const OFX::Matrix3x3 &H,
+                     double x,
+                     double y,
+                     double *sx,
+                     double *sy)
+{
+    const double w = H.g * x + H.h * y + H.i;
+    if (w <= 0.) {
+        return false;
+    }
+    *sx = (H.a * x + H.b * y + H.c) / w;
+    *sy = (H.d * x + H.e * y + H.f) / w;
+
+    return true;
+}
+
+/** @brief the source region of interest of mipmapTransformRender() for the output region roi (both in canonical
+ coordinates).
+
+ This is the bounding box of the inverse transform of roi, padded by the size of a pixel of the coarsest level used
+ in roi, so that the levels sampled in roi are computed from the same source pixels whatever the render window
+ (e.g. when the host renders by tiles).
+ Returns false if the mipmap engine is not used for roi, because the transform does not minify the source or roi
+ is partly behind the camera. The caller should then keep the region of interest of its regular render. */
+inline bool
+mipmapTransformGetRegionOfInterest(const OFX::Matrix3x3 &invtransformCanonical,
+                                   const OfxRectD &roi,
+                                   const OfxPointD &renderScale,
+                                   double pixelAspectRatio,
+                                   OfxRectD *srcRoI)
+{
+    // the inverse transform in pixel coordinates, as in mipmapTransformRender() (the field is not known here)
+    const OFX::Matrix3x3 canonicalToPixel = OFX::ofxsMatCanonicalToPixel(pixelAspectRatio, renderScale.x, renderScale.y, false);
+    const OFX::Matrix3x3 pixelToCanonical = OFX::ofxsMatPixelToCanonical(pixelAspectRatio, renderScale.x, renderScale.y, false);
+    const OFX::Matrix3x3 H = canonicalToPixel * invtransformCanonical * pixelToCanonical;
+
+    OfxRectD window;
+    if ( !mipmapTransformApply(canonicalToPixel, roi.x1, roi.y1, &window.x1, &window.y1) ||
+         !mipmapTransformApply(canonicalToPixel, roi.x2, roi.y2, &window.x2, &window.y2) ) {
+        return false;
+    }
+    const double maxFootprint = mipmapTransformMaxFootprint(H, window);
+    if (maxFootprint <= kMipmapTransformMinification) {
+        return false;
+    }
+
+    // the image of a convex region by a homography is convex if the region is in front of the camera,
+    // so the bounding box of the corners contains the whole region
+    OfxRectD srcWindow;
+    srcWindow.x1 = srcWindow.y1 = kOfxFlagInfiniteMax;
+    srcWindow.x2 = srcWindow.y2 = kOfxFlagInfiniteMin;
+    for (int i = 0; i < 4; ++i) {
+        double sx, sy;
+        if ( !mipmapTransformApply(H, (i & 1) ? window.x2 : window.x1, (i & 2) ? window.y2 : window.y1, &sx, &sy) ) {
+            return false;
+        }
+        srcWindow.x1 = std::min(srcWindow.x1, sx);
+        srcWindow.y1 = std::min(srcWindow.y1, sy);
+        srcWindow.x2 = std::max(srcWindow.x2, sx);
+        srcWindow.y2 = std::max(srcWindow.y2, sy);
+    }
+    // a pixel of the coarsest level is 2^(nLevels-1) source pixels wide, and bilinear interpolation reads the
+    // pixels next to the sample: pad by 2^nLevels source pixels
+    const double padding = std::ldexp( 1., mipmapTransformNumLevels(maxFootprint) );
+    srcWindow.x1 = std::floor(srcWindow.x1 - padding);
+    srcWindow.y1 = std::floor(srcWindow.y1 - padding);
+    srcWindow.x2 = std::ceil(srcWindow.x2 + padding);
+    srcWindow.y2 = std::ceil(srcWindow.y2 + padding);
+
+    mipmapTransformApply(pixelToCanonical, srcWindow.x1, srcWindow.y1, &srcRoI->x1, &srcRoI->y1);
+    mipmapTransformApply(pixelToCanonical, srcWindow.x2, srcWindow.y2, &srcRoI->x2, &srcRoI->y2);
+
+    return true;
+}
+
+/** @brief set the source region of interest of a Transform3x3Plugin rendered by transform3x3RenderFast(), after the
+ regions of interest of the generic render were set: if the mipmap engine is used, its source region of interest
+ is larger.
+ values are given by transform3x3FastRenderGetValues(), and invtransformCanonical by
+ Transform3x3Plugin::getInverseTransformCanonical(). */
+inline void
+transform3x3GetRegionsOfInterestFast(const OFX::RegionsOfInterestArguments &args,
+                                     OFX::Clip *srcClip,
+                                     const OFX::Matrix3x3 &invtransformCanonical,
+                                     const Transform3x3FastRenderValues &values,
+                                     OFX::RegionOfInterestSetter &rois)
+{
+    if ( !values.mipmap || !srcClip || !srcClip->isConnected() ) {
+        return;
+    }
+    OfxRectD srcRoI;
+    if ( mipmapTransformGetRegionOfInterest(invtransformCanonical, args.regionOfInterest, args.renderScale,
+                                            srcClip->getPixelAspectRatio(), &srcRoI) ) {
+        rois.setRegionOfInterest(*srcClip, srcRoI);
+    }
+}
+
+/** @brief render a Transform3x3Plugin with the mipmap engine if it is enabled and the transform minifies the
+ source, else with the separable engine if the transform is a scale and a translation.
+ values are given by transform3x3FastRenderGetValues(), and invtransformCanonical by
+ Transform3x3Plugin::getInverseTransformCanonical().
+ Returns false, without rendering anything, if neither engine can be used: the caller should then use the
+ generic Transform3x3 render. */
+inline bool
+transform3x3RenderFast(OFX::ImageEffect &effect,
+                       const OFX::RenderArguments &args,
+                       OFX::Clip *dstClip,
+                       OFX::Clip *srcClip,
+                       OFX::Clip *maskClip,
+                       const OFX::Matrix3x3 &invtransformCanonical,
+                       const Transform3x3FastRenderValues &values)
+{
+    if ( values.mipmap && mipmapTransformRender(effect, args, dstClip, srcClip, maskClip, invtransformCanonical,
+                                                values.blackOutside, values.mix, values.maskInvert) ) {
+        return true;
+    }
+
+    return separableTransformRender(effect, args, dstClip, srcClip, maskClip, invtransformCanonical,
+                                    values.filter, values.clamp, values.blackOutside, values.mix, values.maskInvert);
+}
+
+} // namespace OFX
+
+#endif // Misc_MipmapTransform_h
@@ -0,0 +1,581 @@
+/*
+ OFX separable transform helper.
+ Render a transform that is only a scale and a translation in pixel coordinates
+ by two separable 1D resampling passes.
+
+ Copyright (C) 2014-2015 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+#ifndef Misc_SeparableTransform_h
+#define Misc_SeparableTransform_h
+
+#include <cmath>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "ofxsImageEffect.h"
+#include "ofxsProcessing.H"
+#include "ofxsMaskMix.h"
+#include "ofxsFilter.h"
+#include "ofxsMatrix2D.h"
+
+#define kSeparableTransformChunkSize 64 // number of output rows that share the horizontal pass
+#define kSeparableTransformAxisAlignedTolerance 1e-6 // max deviation (in pixels) from an axis-aligned transform
+
+namespace OFX {
+
+// The source pixels used by one output column (or row), and their weights.
+// The filter support is at most 4 pixels.
+struct SeparableTransformTaps
+{
+    int index[4];
+    float weight[4];
+};
+
+// Number of source pixels used by each output pixel, along each direction.
+inline int
+separableTransformFilterTaps(FilterEnum filter)
+{
+    switch (filter) {
+        case eFilterImpulse:
+            return 1;
+        case eFilterBilinear:
+        case eFilterCubic:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+// The cubic filters are Mitchell-Netravali BC-splines.
+inline void
+separableTransformFilterBC(FilterEnum filter, double *B, double *C)
+{
+    switch (filter) {
+        case eFilterKeys:
+            *B = 0.; *C = 0.5;
+            break;
+        case eFilterSimon:
+            *B = 0.; *C = 0.75;
+            break;
+        case eFilterRifman:
+            *B = 0.; *C = 1.;
+            break;
+        case eFilterMitchell:
+            *B = 1./3.; *C = 1./3.;
+            break;
+        case eFilterParzen:
+            *B = 1.; *C = 0.;
+            break;
+        case eFilterNotch:
+            *B = 1.5; *C = -0.25;
+            break;
+        default:
+            // eFilterCubic
+            *B = 0.; *C = 0.;
+            break;
+    }
+}
+
+inline double
+separableTransformBCSpline(double B, double C, double x)
+{
+    x = std::abs(x);
+    if (x < 1.) {
+        return ((12. - 9. * B - 6. * C) * x * x * x + (-18. + 12. * B + 6. * C) * x * x + (6. - 2. * B)) / 6.;
+    } else if (x < 2.) {
+        return ((-B - 6. * C) * x * x * x + (6. * B + 30. * C) * x * x + (-12. * B - 48. * C) * x + (8. * B + 24. * C)) / 6.;
+    }
+    return 0.;
+}
+
+// Compute the taps of each output pixel center x+0.5, x in [x1,x2), which is sampled at
+// source position scale*(x+0.5)+offset, in a source image spanning [b1,b2).
+// Source pixels outside of [b1,b2) are black if blackOutside, else the nearest edge pixel.
+inline void
+separableTransformComputeTaps(FilterEnum filter,
+                              double scale,
+                              double offset,
+                              int x1,
+                              int x2,
+                              int b1,
+                              int b2,
+                              bool blackOutside,
+                              std::vector<SeparableTransformTaps> *taps)
+{
+    assert(b1 < b2);
+    const int nTaps = separableTransformFilterTaps(filter);
+    double B = 0., C = 0.;
+    separableTransformFilterBC(filter, &B, &C);
+    taps->resize(std::max(0, x2 - x1));
+    for (int x = x1; x < x2; ++x) {
+        SeparableTransformTaps &t = (*taps)[x - x1];
+        const double fx = scale * (x + 0.5) + offset;
+        int first;
+        double w[4] = {0., 0., 0., 0.};
+        if (filter == eFilterImpulse) {
+            first = (int)std::floor(fx);
+            w[0] = 1.;
+        } else {
+            // pixel centers are at integer+0.5
+            const double sx = fx - 0.5;
+            const int ix = (int)std::floor(sx);
+            const double d = sx - ix;
+            if (filter == eFilterBilinear) {
+                first = ix;
+                w[0] = 1. - d;
+                w[1] = d;
+            } else if (nTaps == 2) {
+                // eFilterCubic: the outer taps of the B=C=0 spline are zero
+                first = ix;
+                w[0] = separableTransformBCSpline(B, C, d);
+                w[1] = separableTransformBCSpline(B, C, 1. - d);
+            } else {
+                first = ix - 1;
+                w[0] = separableTransformBCSpline(B, C, 1. + d);
+                w[1] = separableTransformBCSpline(B, C, d);
+                w[2] = separableTransformBCSpline(B, C, 1. - d);
+                w[3] = separableTransformBCSpline(B, C, 2. - d);
+            }
+        }
+        for (int k = 0; k < 4; ++k) {
+            const int i = first + k;
+            if (k >= nTaps) {
+                t.index[k] = b1;
+                t.weight[k] = 0.f;
+            } else if (i < b1 || b2 <= i) {
+                t.index[k] = (i < b1) ? b1 : (b2 - 1);
+                t.weight[k] = blackOutside ? 0.f : (float)w[k];
+            } else {
+                t.index[k] = i;
+                t.weight[k] = (float)w[k];
+            }
+        }
+    }
+}
+
+class SeparableTransformProcessorBase
+: public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_srcImg;
+    const OFX::Image *_maskImg;
+    bool _domask;
+    bool _maskInvert;
+    double _mix;
+    OfxRectI _window; // the window the taps were computed for
+    std::vector<SeparableTransformTaps> _xTaps;
+    std::vector<SeparableTransformTaps> _yTaps;
+
+public:
+    SeparableTransformProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _srcImg(0)
+    , _maskImg(0)
+    , _domask(false)
+    , _maskInvert(false)
+    , _mix(1.)
+    {
+        _window.x1 = _window.y1 = _window.x2 = _window.y2 = 0;
+    }
+
+    void setSrcImg(const OFX::Image *v) { _srcImg = v; }
+
+    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
+
+    void doMasking(bool v) { _domask = v; }
+
+    /** @brief set the transform, given by the source pixel position sx = scale.x*x+offset.x, sy = scale.y*y+offset.y
+     of each destination pixel position (x,y). _srcImg must be set. */
+    void setValues(const OfxPointD &scale,
+                   const OfxPointD &offset,
+                   FilterEnum filter,
+                   bool blackOutside,
+                   double mix,
+                   const OfxRectI &window)
+    {
+        assert(_srcImg);
+        const OfxRectI &srcBounds = _srcImg->getBounds();
+        _mix = mix;
+        _window = window;
+        separableTransformComputeTaps(filter, scale.x, offset.x, window.x1, window.x2, srcBounds.x1, srcBounds.x2, blackOutside, &_xTaps);
+        separableTransformComputeTaps(filter, scale.y, offset.y, window.y1, window.y2, srcBounds.y1, srcBounds.y2, blackOutside, &_yTaps);
+    }
+};
+
+template <class PIX, int nComponents, int maxValue, int nTaps>
+class SeparableTransformProcessor
+: public SeparableTransformProcessorBase
+{
+public:
+    SeparableTransformProcessor(OFX::ImageEffect &instance)
+    : SeparableTransformProcessorBase(instance)
+    {
+    }
+
+private:
+    void multiThreadProcessImages(OfxRectI procWindow)
+    {
+        assert(_window.x1 <= procWindow.x1 && procWindow.x2 <= _window.x2 &&
+               _window.y1 <= procWindow.y1 && procWindow.y2 <= _window.y2);
+        const OfxRectI &srcBounds = _srcImg->getBounds();
+        const int width = procWindow.x2 - procWindow.x1;
+        const size_t rowSize = (size_t)width * nComponents;
+        std::vector<float> rows; // horizontally resampled source rows
+        std::vector<int> rowSlot; // the position in rows of each source row, or -1
+        float tmpPix[nComponents];
+
+        // the output rows are processed by chunks, which share the horizontal pass of the source rows they use
+        for (int cy1 = procWindow.y1; cy1 < procWindow.y2; cy1 += kSeparableTransformChunkSize) {
+            if ( _effect.abort() ) {
+                break;
+            }
+            const int cy2 = std::min(cy1 + kSeparableTransformChunkSize, procWindow.y2);
+
+            // the source rows used by the chunk
+            int rmin = srcBounds.y2;
+            int rmax = srcBounds.y1 - 1;
+            for (int y = cy1; y < cy2; ++y) {
+                const SeparableTransformTaps &yt = _yTaps[y - _window.y1];
+                for (int k = 0; k < nTaps; ++k) {
+                    rmin = std::min(rmin, yt.index[k]);
+                    rmax = std::max(rmax, yt.index[k]);
+                }
+            }
+            rowSlot.assign(std::max(0, rmax - rmin + 1), -1);
+            int nSlots = 0;
+            for (int y = cy1; y < cy2; ++y) {
+                const SeparableTransformTaps &yt = _yTaps[y - _window.y1];
+                for (int k = 0; k < nTaps; ++k) {
+                    if (yt.weight[k] != 0.f && rowSlot[yt.index[k] - rmin] < 0) {
+                        rowSlot[yt.index[k] - rmin] = nSlots++;
+                    }
+                }
+            }
+            rows.resize(std::max(1, nSlots) * rowSize);
+
+            // horizontal pass
+            for (int r = rmin; r <= rmax; ++r) {
+                const int slot = rowSlot[r - rmin];
+                if (slot < 0) {
+                    continue;
+                }
+                const PIX *srcRow = (const PIX *) _srcImg->getPixelAddress(srcBounds.x1, r);
+                assert(srcRow);
+                float *rowPix = &rows[slot * rowSize];
+                for (int x = procWindow.x1; x < procWindow.x2; ++x, rowPix += nComponents) {
+                    const SeparableTransformTaps &xt = _xTaps[x - _window.x1];
+                    for (int c = 0; c < nComponents; ++c) {
+                        rowPix[c] = 0.f;
+                    }
+                    for (int k = 0; k < nTaps; ++k) {
+                        const PIX *srcPix = srcRow + (size_t)(xt.index[k] - srcBounds.x1) * nComponents;
+                        const float w = xt.weight[k];
+                        for (int c = 0; c < nComponents; ++c) {
+                            rowPix[c] += w * srcPix[c];
+                        }
+                    }
+                }
+            }
+
+            // vertical pass
+            for (int y = cy1; y < cy2; ++y) {
+                const SeparableTransformTaps &yt = _yTaps[y - _window.y1];
+                const float *rowPix[nTaps];
+                for (int k = 0; k < nTaps; ++k) {
+                    const int slot = (yt.weight[k] != 0.f) ? rowSlot[yt.index[k] - rmin] : -1;
+                    rowPix[k] = (slot < 0) ? 0 : &rows[slot * rowSize];
+                }
+                PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
+                for (int x = procWindow.x1; x < procWindow.x2; ++x, dstPix += nComponents) {
+                    const size_t offset = (size_t)(x - procWindow.x1) * nComponents;
+                    for (int c = 0; c < nComponents; ++c) {
+                        tmpPix[c] = 0.f;
+                    }
+                    for (int k = 0; k < nTaps; ++k) {
+                        if (rowPix[k]) {
+                            const float w = yt.weight[k];
+                            for (int c = 0; c < nComponents; ++c) {
+                                tmpPix[c] += w * rowPix[k][offset + c];
+                            }
+                        }
+                    }
+                    ofxsMaskMix<PIX, nComponents, maxValue, true>(tmpPix, x, y, _srcImg, _domask, _maskImg, (float)_mix, _maskInvert, dstPix);
+                }
+            }
+        }
+    }
+};
+
+template <class PIX, int nComponents, int maxValue>
+void
+separableTransformProcessForBitDepth(OFX::ImageEffect &effect,
+                                     OFX::Image *dst,
+                                     const OFX::Image *src,
+                                     const OFX::Image *mask,
+                                     bool maskInvert,
+                                     const OfxPointD &scale,
+                                     const OfxPointD &offset,
+                                     FilterEnum filter,
+                                     bool blackOutside,
+                                     double mix,
+                                     const OfxRectI &renderWindow)
+{
+    std::auto_ptr<SeparableTransformProcessorBase> processor;
+    switch (separableTransformFilterTaps(filter)) {
+        case 1:
+            processor.reset(new SeparableTransformProcessor<PIX, nComponents, maxValue, 1>(effect));
+            break;
+        case 2:
+            processor.reset(new SeparableTransformProcessor<PIX, nComponents, maxValue, 2>(effect));
+            break;
+        default:
+            processor.reset(new SeparableTransformProcessor<PIX, nComponents, maxValue, 4>(effect));
+            break;
+    }
+    if (mask) {
+        processor->doMasking(true);
+        processor->setMaskImg(mask, maskInvert);
+    }
+    processor->setDstImg(dst);
+    processor->setSrcImg(src);
+    processor->setRenderWindow(renderWindow);
+    processor->setValues(scale, offset, filter, blackOutside, mix, renderWindow);
+    processor->process();
+}
+
+template <int nComponents>
+void
+separableTransformProcessForComponents(OFX::BitDepthEnum bitDepth,
+                                       OFX::ImageEffect &effect,
+                                       OFX::Image *dst,
+                                       const OFX::Image *src,
+                                       const OFX::Image *mask,
+                                       bool maskInvert,
+                                       const OfxPointD &scale,
+                                       const OfxPointD &offset,
+                                       FilterEnum filter,
+                                       bool blackOutside,
+                                       double mix,
+                                       const OfxRectI &renderWindow)
+{
+    switch (bitDepth) {
+        case OFX::eBitDepthUByte:
+            separableTransformProcessForBitDepth<unsigned char, nComponents, 255>(effect, dst, src, mask, maskInvert, scale, offset, filter, blackOutside, mix, renderWindow);
+            break;
+        case OFX::eBitDepthUShort:
+            separableTransformProcessForBitDepth<unsigned short, nComponents, 65535>(effect, dst, src, mask, maskInvert, scale, offset, filter, blackOutside, mix, renderWindow);
+            break;
+        case OFX::eBitDepthFloat:
+            separableTransformProcessForBitDepth<float, nComponents, 1>(effect, dst, src, mask, maskInvert, scale, offset, filter, blackOutside, mix, renderWindow);
+            break;
+        default:
+            OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+    }
+}
+
+/** @brief render the transform with two separable resampling passes, if it is only a scale and a translation
+ in pixel coordinates (no rotation, skew or perspective) over the render window.
+
+ invtransformCanonical is the inverse transform in canonical coordinates, as given by
+ Transform3x3Plugin::getInverseTransformCanonical(). The result is the same as the Transform3x3 processor
+ without motion blur, since its filters are separable.
+ Returns false, without rendering anything, if the transform cannot be rendered this way (including when the
+ filter needs clamping, since clamping is not separable). The caller should then use the generic render. */
+inline bool
+separableTransformRender(OFX::ImageEffect &effect,
+                         const OFX::RenderArguments &args,
+                         OFX::Clip *dstClip,
+                         OFX::Clip *srcClip,
+                         OFX::Clip *maskClip,
+                         const OFX::Matrix3x3 &invtransformCanonical,
+                         FilterEnum filter,
+                         bool clamp,
+                         bool blackOutside,
+                         double mix,
+                         bool maskInvert)
+{
+    if ( clamp && (filter == eFilterKeys || filter == eFilterSimon || filter == eFilterRifman || filter == eFilterMitchell) ) {
+        return false;
+    }
+    if ( !srcClip || !srcClip->isConnected() ) {
+        return false;
+    }
+
+    // the inverse transform in pixel coordinates
+    const bool fielded = args.fieldToRender == OFX::eFieldLower || args.fieldToRender == OFX::eFieldUpper;
+    const double pixelAspectRatio = srcClip->getPixelAspectRatio();
+    const OFX::Matrix3x3 canonicalToPixel = OFX::ofxsMatCanonicalToPixel(pixelAspectRatio, args.renderScale.x, args.renderScale.y, fielded);
+    const OFX::Matrix3x3 pixelToCanonical = OFX::ofxsMatPixelToCanonical(pixelAspectRatio, args.renderScale.x, args.renderScale.y, fielded);
+    OFX::Matrix3x3 H = canonicalToPixel * invtransformCanonical * pixelToCanonical;
+    if (H.i == 0.) {
+        return false;
+    }
+    // check that the rotation, skew and perspective terms are negligible over the render window
+    const double eps = kSeparableTransformAxisAlignedTolerance;
+    const OfxRectI &renderWindow = args.renderWindow;
+    for (int i = 0; i < 4; ++i) {
+        const double x = (i & 1) ? renderWindow.x2 : renderWindow.x1;
+        const double y = (i & 2) ? renderWindow.y2 : renderWindow.y1;
+        if (std::abs(H.b * y) > eps * std::abs(H.i) ||
+            std::abs(H.d * x) > eps * std::abs(H.i) ||
+            std::abs(H.g * x + H.h * y) > eps * std::abs(H.i)) {
+            return false;
+        }
+    }
+    OfxPointD scale, offset;
+    scale.x = H.a / H.i;
+    offset.x = H.c / H.i;
+    scale.y = H.e / H.i;
+    offset.y = H.f / H.i;
+
+    std::auto_ptr<const OFX::Image> src(srcClip->fetchImage(args.time));
+    if ( !src.get() ) {
+        return false;
+    }
+    const OfxRectI &srcBounds = src->getBounds();
+    if ( !src->getTransformIsIdentity() || srcBounds.x1 >= srcBounds.x2 || srcBounds.y1 >= srcBounds.y2 ) {
+        // let the generic render concatenate the source transform, or fill with black
+        return false;
+    }
+    if ( (src->getRenderScale().x != args.renderScale.x) ||
+         ( src->getRenderScale().y != args.renderScale.y) ||
+         ( (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) ) {
+        effect.setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    std::auto_ptr<OFX::Image> dst( dstClip->fetchImage(args.time) );
+    if ( !dst.get() ) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OFX::BitDepthEnum dstBitDepth = dst->getPixelDepth();
+    OFX::PixelComponentEnum dstComponents = dst->getPixelComponents();
+    if (dstBitDepth != dstClip->getPixelDepth() ||
+        dstComponents != dstClip->getPixelComponents()) {
+        effect.setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong depth or components");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if ( (dst->getRenderScale().x != args.renderScale.x) ||
+         ( dst->getRenderScale().y != args.renderScale.y) ||
+         ( (dst->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && dst->getField() != args.fieldToRender)) ) {
+        effect.setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if ( (src->getPixelDepth() != dstBitDepth) || (src->getPixelComponents() != dstComponents) ) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    std::auto_ptr<const OFX::Image> mask((effect.getContext() != OFX::eContextFilter && maskClip && maskClip->isConnected()) ?
+                                         maskClip->fetchImage(args.time) : 0);
+
+    if (dstComponents == OFX::ePixelComponentRGBA) {
+        separableTransformProcessForComponents<4>(dstBitDepth, effect, dst.get(), src.get(), mask.get(), maskInvert, scale, offset, filter, blackOutside, mix, renderWindow);
+    } else if (dstComponents == OFX::ePixelComponentRGB) {
+        separableTransformProcessForComponents<3>(dstBitDepth, effect, dst.get(), src.get(), mask.get(), maskInvert, scale, offset, filter, blackOutside, mix, renderWindow);
+    } else {
+        assert(dstComponents == OFX::ePixelComponentAlpha);
+        separableTransformProcessForComponents<1>(dstBitDepth, effect, dst.get(), src.get(), mask.get(), maskInvert, scale, offset, filter, blackOutside, mix, renderWindow);
+    }
+
+    return true;
+}
+
+/** @brief the values of the Transform3x3Plugin parameters used by the fast renders (separable and mipmap) */
+struct Transform3x3FastRenderValues
+{
+    bool invert;
+    FilterEnum filter;
+    bool clamp;
+    bool blackOutside;
+    double mix;
+    bool maskInvert;
+    bool mipmap;
+};
+
+/** @brief get the parameter values used by the fast renders at the given time, from the Transform3x3Plugin
+ parameters of the plugin and its mipmap parameter. Any of the optional parameters (motionblur, invert, mix,
+ maskInvert, mipmap) may be NULL.
+ Returns false if the fast renders cannot be used, i.e. if motion blur is enabled (motion blur has no effect if
+ the transform is not animated, but the generic render checks that). */
+inline bool
+transform3x3FastRenderGetValues(double time,
+                                OFX::DoubleParam *motionblur,
+                                OFX::BooleanParam *invert,
+                                OFX::ChoiceParam *filter,
+                                OFX::BooleanParam *clamp,
+                                OFX::BooleanParam *blackOutside,
+                                OFX::DoubleParam *mix,
+                                OFX::BooleanParam *maskInvert,
+                                OFX::BooleanParam *mipmap,
+                                Transform3x3FastRenderValues *values)
+{
+    if (motionblur) {
+        double motionblurValue = 0.;
+        motionblur->getValueAtTime(time, motionblurValue);
+        if (motionblurValue != 0.) {
+            return false;
+        }
+    }
+    values->invert = false;
+    if (invert) {
+        invert->getValueAtTime(time, values->invert);
+    }
+    int filterValue = eFilterCubic;
+    filter->getValueAtTime(time, filterValue);
+    values->filter = (FilterEnum)filterValue;
+    values->clamp = false;
+    clamp->getValueAtTime(time, values->clamp);
+    values->blackOutside = true;
+    blackOutside->getValueAtTime(time, values->blackOutside);
+    values->mix = 1.;
+    if (mix) {
+        mix->getValueAtTime(time, values->mix);
+    }
+    values->maskInvert = false;
+    if (maskInvert) {
+        maskInvert->getValueAtTime(time, values->maskInvert);
+    }
+    values->mipmap = false;
+    if (mipmap) {
+        mipmap->getValueAtTime(time, values->mipmap);
+    }
+
+    return true;
+}
+
+} // namespace OFX
+
+#endif // Misc_SeparableTransform_h
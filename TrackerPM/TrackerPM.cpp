@@ -72,13 +72,30 @@
 #include "TrackerPM.h"
 
 #include <cmath>
+#include <complex>
 #include <map>
+#include <set>
+#include <vector>
 #include <limits>
+#include <algorithm>
 
 #include "ofxsProcessing.H"
 #include "ofxsTracking.h"
 #include "ofxsMerging.h"
 
+// SSE2 is always available on x86-64. AVX kernels are compiled separately with GCC and clang,
+// and selected at runtime if the CPU supports them.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRACKERPM_SSE2
+#include <emmintrin.h>
+#if (defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || \
+    (defined(__clang__) && !defined(__apple_build_version__) && (__clang_major__ > 3 || (__clang_major__ == 3 && __clang_minor__ >= 8))) || \
+    (defined(__apple_build_version__) && __clang_major__ >= 8)
+#define TRACKERPM_AVX
+#include <immintrin.h>
+#endif
+#endif
+
 #define kPluginName "TrackerPM"
 #define kPluginGrouping "Transform"
 #define kPluginDescription \
@@ -111,6 +128,33 @@
 #define kParamScoreOptionZNCC "ZNCC"
 #define kParamScoreOptionZNCCHint "Zero-mean Normalized Cross-Correlation, less sensitive to illumination changes"
 
+#define kParamPyramidLevels "pyramidLevels"
+#define kParamPyramidLevelsLabel "Pyramid Levels"
+#define kParamPyramidLevelsHint "Number of coarse-to-fine levels used by the search. Each level halves the resolution of the pattern and of the search area. The search is exhaustive at the coarsest level only, and the best candidates are refined in a small neighborhood at each finer level, using the same score. 0 means an exhaustive search at full resolution, which is slower but cannot miss the best match. The number of levels is reduced so that the pattern is at least 4 pixels wide and high at the coarsest level."
+
+#define kParamMotionModel "motionModel"
+#define kParamMotionModelLabel "Motion Model"
+#define kParamMotionModelHint "Model used to predict the position of the pattern in the next frame from the last tracked positions. When a prediction is available, the search window is centered on the predicted position and shrunk to a quarter of its width and height, i.e. 1/16 of its area (but never smaller than the pattern plus a few pixels), which is much faster. The full search window is used again if the match is on the border of the predicted window or if the score is much worse than at the previous frame."
+#define kParamMotionModelOptionNone "None"
+#define kParamMotionModelOptionNoneHint "The search window is centered on the last tracked position."
+#define kParamMotionModelOptionVelocity "Constant Velocity"
+#define kParamMotionModelOptionVelocityHint "The pattern moves by the same amount as between the two last tracked frames."
+#define kParamMotionModelOptionAcceleration "Constant Acceleration"
+#define kParamMotionModelOptionAccelerationHint "The motion of the pattern is extrapolated from the three last tracked frames. Falls back to Constant Velocity if only two frames were tracked."
+
+#define kPyramidMinPatternSize 4 // minimum size of the pattern at the coarsest pyramid level
+#define kPyramidCandidates 4 // number of candidates refined at each pyramid level
+#define kPyramidRadius 2 // size of the neighborhood searched around each candidate when going to a finer level
+#define kFFTCostFactor 4. // relative cost of a FFT butterfly with respect to a pattern pixel in a direct NCC score
+#define kKernelAlignment 8 // the rows of the SSD/SAD kernels are padded to a multiple of this number of floats
+#define kPredictionSearchScale 0.25 // size of the predicted search window, relative to the search window
+#define kPredictionMargin 4 // minimum number of pixels between the pattern and the border of the predicted search window
+#define kPredictionScoreTolerance 0.5 // a predicted match is rejected if its score is worse than the previous score by this relative amount
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846264338327950288
+#endif
+
 using namespace OFX;
 
 enum TrackerScoreEnum
@@ -121,6 +165,30 @@ enum TrackerScoreEnum
     eTrackerZNCC
 };
 
+enum MotionModelEnum
+{
+    eMotionModelNone = 0,
+    eMotionModelVelocity,
+    eMotionModelAcceleration
+};
+
+// The state of a track which is carried from one step to the next by trackRange
+struct TrackerPMState
+{
+    std::auto_ptr<const OFX::Image> lastImage; // the image fetched by the previous step, which covers the search area around the tracked point
+    OfxTime lastImageTime;
+    bool hasLastScore; // true if the previous step found a match
+    double lastScore; // the score of that match
+
+    TrackerPMState()
+    : lastImage()
+    , lastImageTime(0.)
+    , hasLastScore(false)
+    , lastScore(0.)
+    {
+    }
+};
+
 class TrackerPMProcessorBase;
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
@@ -131,11 +199,15 @@ public:
     TrackerPMPlugin(OfxImageEffectHandle handle)
     : GenericTrackerPlugin(handle)
     , _score(0)
+    , _pyramidLevels(0)
+    , _motionModel(0)
     {
         _maskClip = getContext() == OFX::eContextFilter ? NULL : fetchClip(getContext() == OFX::eContextPaint ? "Brush" : "Mask");
         assert(!_maskClip || _maskClip->getPixelComponents() == ePixelComponentAlpha);
         _score = fetchChoiceParam(kParamScore);
-        assert(_score);
+        _pyramidLevels = fetchIntParam(kParamPyramidLevels);
+        _motionModel = fetchChoiceParam(kParamMotionModel);
+        assert(_score && _pyramidLevels && _motionModel);
     }
     
     
@@ -148,11 +220,22 @@ private:
      **/
     virtual void trackRange(const OFX::TrackArguments& args);
     
+    /**
+     * @brief Track from refTime to otherTime. state.lastImage is the image fetched at state.lastImageTime by the
+     * previous step, if any: it is used as the reference image if it contains the pattern, and is
+     * replaced by the image fetched at otherTime, which is the reference image of the next step.
+     **/
     template <int nComponents>
-    void trackInternal(OfxTime refTime, OfxTime otherTime, const OFX::TrackArguments& args);
+    void trackInternal(OfxTime refTime, OfxTime otherTime, const OFX::TrackArguments& args, TrackerPMState& state);
+
+    /**
+     * @brief Predict the displacement of the pattern between refTime and otherTime from the keyframes
+     * of the center before refTime, using the motion model. Returns false if there is no prediction.
+     **/
+    bool predictMotion(OfxTime refTime, OfxTime otherTime, const OfxPointD& refCenterWithOffset, OfxPointD* displacement);
 
     template <class PIX, int nComponents, int maxValue>
-    void trackInternalForDepth(OfxTime refTime,
+    bool trackInternalForDepth(OfxTime refTime,
                                const OfxRectD& refBounds,
                                const OfxPointD& refCenter,
                                const OfxPointD& refCenterWithOffset,
@@ -160,10 +243,12 @@ private:
                                const OFX::Image* maskImg,
                                OfxTime otherTime,
                                const OfxRectD& trackSearchBounds,
-                               const OFX::Image* otherImg);
+                               const OFX::Image* otherImg,
+                               bool predicted,
+                               TrackerPMState& state);
 
-    /* set up and run a processor */
-    void setupAndProcess(TrackerPMProcessorBase &processor,
+    /* set up and run a processor. Returns false if a predicted match was rejected. */
+    bool setupAndProcess(TrackerPMProcessorBase &processor,
                          OfxTime refTime,
                          const OfxRectD& refBounds,
                          const OfxPointD& refCenter,
@@ -172,12 +257,273 @@ private:
                          const OFX::Image* maskImg,
                          OfxTime otherTime,
                          const OfxRectD& trackSearchBounds,
-                         const OFX::Image* otherImg);
+                         const OFX::Image* otherImg,
+                         bool predicted,
+                         TrackerPMState& state);
 
     OFX::Clip *_maskClip;
     ChoiceParam* _score;
+    IntParam* _pyramidLevels;
+    ChoiceParam* _motionModel;
 };
 
+// A level of the coarse-to-fine search pyramid: the pattern and the search area of the other
+// image, downscaled by 2^level. Only the components used by the score are stored.
+struct TrackerPMPyramidLevel
+{
+    OfxRectI patternRect; // pattern pixels, relative to the pattern center
+    std::vector<float> pattern; // nComps values per pixel
+    std::vector<float> weight;
+    double weightTotal;
+    OfxRectI otherRect; // pixels of the other image
+    std::vector<float> other; // nComps values per pixel
+};
+
+// floor(x / 2^level)
+static inline int
+pyramidDown(int x, int level)
+{
+    return (x >= 0) ? (x >> level) : (-((-x - 1) >> level) - 1);
+}
+
+// the rectangle containing the downscaled pixels of rect
+static OfxRectI
+pyramidDownRect(const OfxRectI& rect, int level)
+{
+    OfxRectI r;
+    r.x1 = pyramidDown(rect.x1, level);
+    r.y1 = pyramidDown(rect.y1, level);
+    r.x2 = pyramidDown(rect.x2 - 1, level) + 1;
+    r.y2 = pyramidDown(rect.y2 - 1, level) + 1;
+    return r;
+}
+
+// downscale a pyramid level by a factor 2. Pattern pixels are averaged using the weights,
+// and the weight is the average of the weights.
+static void
+pyramidDownLevel(const TrackerPMPyramidLevel& src, int nComps, TrackerPMPyramidLevel* dst)
+{
+    dst->patternRect = pyramidDownRect(src.patternRect, 1);
+    int pw = dst->patternRect.x2 - dst->patternRect.x1;
+    int ph = dst->patternRect.y2 - dst->patternRect.y1;
+    dst->pattern.assign((size_t)pw * ph * nComps, 0.f);
+    dst->weight.assign((size_t)pw * ph, 0.f);
+    int srcpw = src.patternRect.x2 - src.patternRect.x1;
+    for (int i = src.patternRect.y1; i < src.patternRect.y2; ++i) {
+        for (int j = src.patternRect.x1; j < src.patternRect.x2; ++j) {
+            size_t srcIdx = (size_t)(i - src.patternRect.y1) * srcpw + (j - src.patternRect.x1);
+            size_t dstIdx = (size_t)(pyramidDown(i, 1) - dst->patternRect.y1) * pw + (pyramidDown(j, 1) - dst->patternRect.x1);
+            float w = src.weight[srcIdx];
+            dst->weight[dstIdx] += w;
+            for (int c = 0; c < nComps; ++c) {
+                dst->pattern[dstIdx * nComps + c] += w * src.pattern[srcIdx * nComps + c];
+            }
+        }
+    }
+    dst->weightTotal = 0.;
+    for (size_t k = 0; k < dst->weight.size(); ++k) {
+        if (dst->weight[k] > 0.f) {
+            for (int c = 0; c < nComps; ++c) {
+                dst->pattern[k * nComps + c] /= dst->weight[k];
+            }
+        }
+        dst->weight[k] /= 4;
+        dst->weightTotal += dst->weight[k];
+    }
+
+    dst->otherRect = pyramidDownRect(src.otherRect, 1);
+    int ow = dst->otherRect.x2 - dst->otherRect.x1;
+    int oh = dst->otherRect.y2 - dst->otherRect.y1;
+    dst->other.assign((size_t)ow * oh * nComps, 0.f);
+    std::vector<int> count((size_t)ow * oh, 0);
+    int srcow = src.otherRect.x2 - src.otherRect.x1;
+    for (int y = src.otherRect.y1; y < src.otherRect.y2; ++y) {
+        for (int x = src.otherRect.x1; x < src.otherRect.x2; ++x) {
+            size_t srcIdx = (size_t)(y - src.otherRect.y1) * srcow + (x - src.otherRect.x1);
+            size_t dstIdx = (size_t)(pyramidDown(y, 1) - dst->otherRect.y1) * ow + (pyramidDown(x, 1) - dst->otherRect.x1);
+            ++count[dstIdx];
+            for (int c = 0; c < nComps; ++c) {
+                dst->other[dstIdx * nComps + c] += src.other[srcIdx * nComps + c];
+            }
+        }
+    }
+    for (size_t k = 0; k < count.size(); ++k) {
+        for (int c = 0; c < nComps; ++c) {
+            dst->other[k * nComps + c] /= count[k];
+        }
+    }
+}
+
+
+// in-place radix-2 FFT of n complex values, n must be a power of 2. The inverse transform is not normalized.
+static void
+fft1D(std::complex<double>* data, int n, bool inverse)
+{
+    // bit reversal permutation
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[i], data[j]);
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        double angle = 2 * M_PI / len * (inverse ? 1 : -1);
+        std::complex<double> wlen(std::cos(angle), std::sin(angle));
+        for (int i = 0; i < n; i += len) {
+            std::complex<double> w(1.);
+            for (int j = 0; j < len / 2; ++j) {
+                std::complex<double> u = data[i + j];
+                std::complex<double> v = data[i + j + len / 2] * w;
+                data[i + j] = u + v;
+                data[i + j + len / 2] = u - v;
+                w *= wlen;
+            }
+        }
+    }
+}
+
+// in-place 2D FFT of a nx*ny row-major array, nx and ny must be powers of 2.
+// The inverse transform is normalized.
+static void
+fft2D(std::vector<std::complex<double> >& data, int nx, int ny, bool inverse)
+{
+    for (int y = 0; y < ny; ++y) {
+        fft1D(&data[(size_t)y * nx], nx, inverse);
+    }
+    std::vector<std::complex<double> > column(ny);
+    for (int x = 0; x < nx; ++x) {
+        for (int y = 0; y < ny; ++y) {
+            column[y] = data[(size_t)y * nx + x];
+        }
+        fft1D(&column[0], ny, inverse);
+        for (int y = 0; y < ny; ++y) {
+            data[(size_t)y * nx + x] = column[y];
+        }
+    }
+    if (inverse) {
+        const double norm = 1. / ((double)nx * ny);
+        for (size_t k = 0; k < data.size(); ++k) {
+            data[k] *= norm;
+        }
+    }
+}
+
+static int
+nextPowerOf2(int n)
+{
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// SSD/SAD row kernels: sum over n floats of weight*(pattern-other)^2 or weight*|pattern-other|.
+// n must be a multiple of kKernelAlignment.
+typedef float (*TrackerPMKernel)(const float *pattern, const float *other, const float *weight, int n);
+
+#ifndef TRACKERPM_SSE2
+static float
+kernelSSDScalar(const float *pattern, const float *other, const float *weight, int n)
+{
+    float acc = 0.f;
+    for (int k = 0; k < n; ++k) {
+        float d = pattern[k] - other[k];
+        acc += weight[k] * d * d;
+    }
+    return acc;
+}
+
+static float
+kernelSADScalar(const float *pattern, const float *other, const float *weight, int n)
+{
+    float acc = 0.f;
+    for (int k = 0; k < n; ++k) {
+        acc += weight[k] * std::abs(pattern[k] - other[k]);
+    }
+    return acc;
+}
+#endif
+
+#ifdef TRACKERPM_SSE2
+static float
+kernelSSDSSE2(const float *pattern, const float *other, const float *weight, int n)
+{
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < n; k += 4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(pattern + k), _mm_loadu_ps(other + k));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(weight + k), _mm_mul_ps(d, d)));
+    }
+    float r[4];
+    _mm_storeu_ps(r, acc);
+    return (r[0] + r[1]) + (r[2] + r[3]);
+}
+
+static float
+kernelSADSSE2(const float *pattern, const float *other, const float *weight, int n)
+{
+    const __m128 signMask = _mm_set1_ps(-0.f);
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < n; k += 4) {
+        __m128 d = _mm_andnot_ps(signMask, _mm_sub_ps(_mm_loadu_ps(pattern + k), _mm_loadu_ps(other + k)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(weight + k), d));
+    }
+    float r[4];
+    _mm_storeu_ps(r, acc);
+    return (r[0] + r[1]) + (r[2] + r[3]);
+}
+#endif
+
+#ifdef TRACKERPM_AVX
+__attribute__((target("avx"))) static float
+kernelSSDAVX(const float *pattern, const float *other, const float *weight, int n)
+{
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < n; k += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(pattern + k), _mm256_loadu_ps(other + k));
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(weight + k), _mm256_mul_ps(d, d)));
+    }
+    float r[8];
+    _mm256_storeu_ps(r, acc);
+    return ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+}
+
+__attribute__((target("avx"))) static float
+kernelSADAVX(const float *pattern, const float *other, const float *weight, int n)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < n; k += 8) {
+        __m256 d = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(pattern + k), _mm256_loadu_ps(other + k)));
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(weight + k), d));
+    }
+    float r[8];
+    _mm256_storeu_ps(r, acc);
+    return ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+}
+#endif
+
+// the fastest kernel supported by the CPU
+static TrackerPMKernel
+getKernel(TrackerScoreEnum scoreType)
+{
+    assert(scoreType == eTrackerSSD || scoreType == eTrackerSAD);
+#ifdef TRACKERPM_AVX
+    static const bool hasAVX = __builtin_cpu_supports("avx");
+    if (hasAVX) {
+        return (scoreType == eTrackerSSD) ? kernelSSDAVX : kernelSADAVX;
+    }
+#endif
+#ifdef TRACKERPM_SSE2
+    return (scoreType == eTrackerSSD) ? kernelSSDSSE2 : kernelSADSSE2;
+#else
+    return (scoreType == eTrackerSSD) ? kernelSSDScalar : kernelSADScalar;
+#endif
+}
 
 class TrackerPMProcessorBase : public OFX::ImageProcessor
 {
@@ -207,6 +553,10 @@ public:
     virtual bool setValues(const OFX::Image *ref, const OFX::Image *other, const OFX::Image *mask,
                            const OfxRectI& pattern, const OfxPointI& centeri) = 0;
 
+    /** @brief search the render window using a coarse-to-fine pyramid with at most nLevels levels
+        below full resolution. Like process(), this must be called after setValues(). */
+    virtual void processPyramid(int nLevels) = 0;
+
     /**
      * @brief Retrieves the results of the track. Must be called once process() returns so it is thread safe.
      **/
@@ -226,6 +576,15 @@ protected:
     std::auto_ptr<OFX::ImageMemory> _weightImg;
     float *_weightData;
     double _weightTotal;
+    std::vector<double> _scores; //< the scores computed by FFT, if any
+    OfxRectI _scoresWindow; //< the positions of _scores
+    TrackerPMKernel _kernel; //< the SSD/SAD kernel, if the kernel data was set up
+    std::vector<float> _kernelPattern; //< pattern rows for the kernel
+    std::vector<float> _kernelWeight; //< weight rows for the kernel
+    int _kernelRowLength; //< length of the pattern and weight rows
+    std::vector<float> _kernelOther; //< other image rows for the kernel
+    int _kernelOtherStride; //< length of the other image rows
+    OfxRectI _kernelWindow; //< the positions for which _kernelOther is valid
 public:
     TrackerPMProcessor(OFX::ImageEffect &instance)
     : TrackerPMProcessorBase(instance)
@@ -234,6 +593,15 @@ public:
     , _weightImg(0)
     , _weightData(0)
     , _weightTotal(0.)
+    , _scores()
+    , _scoresWindow()
+    , _kernel(0)
+    , _kernelPattern()
+    , _kernelWeight()
+    , _kernelRowLength(0)
+    , _kernelOther()
+    , _kernelOtherStride(0)
+    , _kernelWindow()
     {
     }
 
@@ -301,6 +669,538 @@ private:
         return (_weightTotal > 0);
     }
 
+    /** @brief search the render window using a coarse-to-fine pyramid */
+    virtual void processPyramid(int nLevels)
+    {
+        assert(_patternImg.get() && _patternData && _weightImg.get() && _weightData && _otherImg && _weightTotal > 0.);
+        const int scoreComps = std::min(nComponents, 3);
+        const OfxRectI searchWindow = _renderWindow;
+
+        // the pattern must keep a few pixels at the coarsest level
+        while (nLevels > 0 &&
+               (((_refRectPixel.x2 - _refRectPixel.x1) >> nLevels) < kPyramidMinPatternSize ||
+                ((_refRectPixel.y2 - _refRectPixel.y1) >> nLevels) < kPyramidMinPatternSize)) {
+            --nLevels;
+        }
+
+        // the part of the other image covered by the pattern at all positions of the search window
+        OfxRectI otherRect;
+        otherRect.x1 = searchWindow.x1 + _refRectPixel.x1;
+        otherRect.y1 = searchWindow.y1 + _refRectPixel.y1;
+        otherRect.x2 = searchWindow.x2 - 1 + _refRectPixel.x2;
+        otherRect.y2 = searchWindow.y2 - 1 + _refRectPixel.y2;
+        if (nLevels <= 0 || !MergeImages2D::rectIntersection(otherRect, _otherImg->getBounds(), &otherRect)) {
+            process();
+            return;
+        }
+
+        // full resolution level
+        std::vector<TrackerPMPyramidLevel> levels(nLevels + 1);
+        {
+            TrackerPMPyramidLevel& l0 = levels[0];
+            l0.patternRect = _refRectPixel;
+            size_t nPix = (size_t)(_refRectPixel.x2 - _refRectPixel.x1) * (_refRectPixel.y2 - _refRectPixel.y1);
+            l0.pattern.resize(nPix * scoreComps);
+            l0.weight.assign(_weightData, _weightData + nPix);
+            l0.weightTotal = _weightTotal;
+            for (size_t k = 0; k < nPix; ++k) {
+                for (int c = 0; c < scoreComps; ++c) {
+                    l0.pattern[k * scoreComps + c] = _patternData[k * nComponents + c];
+                }
+            }
+            l0.otherRect = otherRect;
+            l0.other.resize((size_t)(otherRect.x2 - otherRect.x1) * (otherRect.y2 - otherRect.y1) * scoreComps);
+            float *otherPtr = &l0.other[0];
+            for (int y = otherRect.y1; y < otherRect.y2; ++y) {
+                const PIX *otherPix = (const PIX *) _otherImg->getPixelAddress(otherRect.x1, y);
+                assert(otherPix);
+                for (int x = otherRect.x1; x < otherRect.x2; ++x, otherPix += nComponents, otherPtr += scoreComps) {
+                    for (int c = 0; c < scoreComps; ++c) {
+                        otherPtr[c] = otherPix[c];
+                    }
+                }
+            }
+        }
+        for (int l = 1; l <= nLevels; ++l) {
+            pyramidDownLevel(levels[l - 1], scoreComps, &levels[l]);
+        }
+
+        // exhaustive search at the coarsest level
+        std::map<std::pair<int, int>, double> scores; // scores at the current level
+        {
+            const TrackerPMPyramidLevel& level = levels[nLevels];
+            double refMean[3];
+            computeLevelPatternMean(level, refMean);
+            const OfxRectI levelWindow = pyramidDownRect(searchWindow, nLevels);
+            for (int y = levelWindow.y1; y < levelWindow.y2; ++y) {
+                if (_effect.abort()) {
+                    return;
+                }
+                for (int x = levelWindow.x1; x < levelWindow.x2; ++x) {
+                    scores[std::make_pair(x, y)] = computeLevelScore(level, x, y, refMean);
+                }
+            }
+        }
+
+        // refine the best candidates at each finer level
+        for (int l = nLevels - 1; l >= 0; --l) {
+            std::vector<std::pair<double, std::pair<int, int> > > candidates;
+            for (std::map<std::pair<int, int>, double>::const_iterator it = scores.begin(); it != scores.end(); ++it) {
+                candidates.push_back(std::make_pair(it->second, it->first));
+            }
+            size_t nCandidates = std::min((size_t)kPyramidCandidates, candidates.size());
+            std::partial_sort(candidates.begin(), candidates.begin() + nCandidates, candidates.end());
+            candidates.resize(nCandidates);
+
+            const OfxRectI levelWindow = pyramidDownRect(searchWindow, l);
+            const TrackerPMPyramidLevel& level = levels[l];
+            double refMean[3];
+            computeLevelPatternMean(level, refMean);
+            scores.clear();
+            for (size_t k = 0; k < candidates.size(); ++k) {
+                OfxRectI window;
+                window.x1 = 2 * candidates[k].second.first - kPyramidRadius;
+                window.y1 = 2 * candidates[k].second.second - kPyramidRadius;
+                window.x2 = 2 * candidates[k].second.first + 2 + kPyramidRadius;
+                window.y2 = 2 * candidates[k].second.second + 2 + kPyramidRadius;
+                if (!MergeImages2D::rectIntersection(window, levelWindow, &window)) {
+                    continue;
+                }
+                if (l == 0) {
+                    // full resolution: the regular search gives the best match and its subpixel position
+                    setRenderWindow(window);
+                    process();
+                    continue;
+                }
+                for (int y = window.y1; y < window.y2; ++y) {
+                    for (int x = window.x1; x < window.x2; ++x) {
+                        std::pair<int, int> pos(x, y);
+                        if (scores.find(pos) == scores.end()) {
+                            scores[pos] = computeLevelScore(level, x, y, refMean);
+                        }
+                    }
+                }
+            }
+            if (_effect.abort()) {
+                break;
+            }
+        }
+        setRenderWindow(searchWindow);
+    }
+
+    void computeLevelPatternMean(const TrackerPMPyramidLevel& level, double refMean[3])
+    {
+        const int scoreComps = std::min(nComponents, 3);
+        for (int c = 0; c < 3; ++c) {
+            refMean[c] = 0;
+        }
+        if (scoreType != eTrackerZNCC) {
+            return;
+        }
+        for (size_t k = 0; k < level.weight.size(); ++k) {
+            for (int c = 0; c < scoreComps; ++c) {
+                refMean[c] += level.weight[k] * level.pattern[k * scoreComps + c];
+            }
+        }
+        for (int c = 0; c < scoreComps; ++c) {
+            refMean[c] /= level.weightTotal;
+        }
+    }
+
+    // same as computeScore, on a pyramid level
+    double computeLevelScore(const TrackerPMPyramidLevel& level, int x, int y, const double refMean[3])
+    {
+        const int scoreComps = std::min(nComponents, 3);
+        const OfxRectI& otherRect = level.otherRect;
+        const int otherWidth = otherRect.x2 - otherRect.x1;
+        double otherMean[3] = {0., 0., 0.};
+        if (scoreType == eTrackerZNCC) {
+            const float *weightPtr = &level.weight[0];
+            for (int i = level.patternRect.y1; i < level.patternRect.y2; ++i) {
+                const int othery = std::max(otherRect.y1, std::min(y + i, otherRect.y2 - 1));
+                for (int j = level.patternRect.x1; j < level.patternRect.x2; ++j, ++weightPtr) {
+                    const int otherx = std::max(otherRect.x1, std::min(x + j, otherRect.x2 - 1));
+                    const float *otherPix = &level.other[((size_t)(othery - otherRect.y1) * otherWidth + (otherx - otherRect.x1)) * scoreComps];
+                    for (int c = 0; c < scoreComps; ++c) {
+                        otherMean[c] += *weightPtr * otherPix[c];
+                    }
+                }
+            }
+            for (int c = 0; c < scoreComps; ++c) {
+                otherMean[c] /= level.weightTotal;
+            }
+        }
+
+        double score = 0.;
+        double otherSsq = 0.;
+        const float *patternPtr = &level.pattern[0];
+        const float *weightPtr = &level.weight[0];
+        for (int i = level.patternRect.y1; i < level.patternRect.y2; ++i) {
+            // take nearest pixel in other image
+            const int othery = std::max(otherRect.y1, std::min(y + i, otherRect.y2 - 1));
+            for (int j = level.patternRect.x1; j < level.patternRect.x2; ++j, ++weightPtr, patternPtr += scoreComps) {
+                const int otherx = std::max(otherRect.x1, std::min(x + j, otherRect.x2 - 1));
+                const float *otherPix = &level.other[((size_t)(othery - otherRect.y1) * otherWidth + (otherx - otherRect.x1)) * scoreComps];
+                const double weight = *weightPtr;
+                for (int c = 0; c < scoreComps; ++c) {
+                    const double refVal = patternPtr[c];
+                    const double otherVal = otherPix[c];
+                    switch (scoreType) {
+                        case eTrackerSSD:
+                            score += weight * weight * (refVal - otherVal) * (refVal - otherVal);
+                            break;
+                        case eTrackerSAD:
+                            score += weight * std::abs(refVal - otherVal);
+                            break;
+                        case eTrackerNCC:
+                            score -= weight * refVal * otherVal;
+                            otherSsq += weight * otherVal * otherVal;
+                            break;
+                        case eTrackerZNCC:
+                            score -= weight * (refVal - refMean[c]) * (otherVal - otherMean[c]);
+                            otherSsq += weight * (otherVal - otherMean[c]) * (otherVal - otherMean[c]);
+                            break;
+                    }
+                }
+            }
+        }
+        if (scoreType == eTrackerNCC || scoreType == eTrackerZNCC) {
+            double sdev = std::sqrt(otherSsq);
+            if (sdev != 0.) {
+                score /= sdev;
+            } else {
+                score = std::numeric_limits<double>::infinity();
+            }
+        }
+        return score;
+    }
+
+    // FFT correlation is only used for NCC and ZNCC, when it is cheaper than the direct computation.
+    // SSD and SAD use the vectorized kernels.
+    virtual void preProcess()
+    {
+        _scores.clear();
+        _scoresWindow.x1 = _scoresWindow.y1 = _scoresWindow.x2 = _scoresWindow.y2 = 0;
+        _kernel = 0;
+        if ((scoreType == eTrackerNCC || scoreType == eTrackerZNCC) && fftIsFaster(_renderWindow)) {
+            computeScoresFFT(_renderWindow);
+        }
+        if (scoreType == eTrackerSSD || scoreType == eTrackerSAD) {
+            setupKernel(_renderWindow);
+        }
+    }
+
+    // Prepare the float rows used by the SSD/SAD kernels: the pattern and the weights (squared for SSD)
+    // have the same layout as the rows of the other image, and the part of the other image covered by
+    // the pattern at all positions of the window is converted to float (taking the nearest pixel, as in
+    // computeScore).
+    void setupKernel(const OfxRectI& window)
+    {
+        const int scoreComps = std::min(nComponents, 3);
+        const int pw = _refRectPixel.x2 - _refRectPixel.x1;
+        const int ph = _refRectPixel.y2 - _refRectPixel.y1;
+        const int sw = window.x2 - window.x1;
+        const int sh = window.y2 - window.y1;
+        if (sw <= 0 || sh <= 0) {
+            return;
+        }
+        const int ow = sw + pw - 1;
+        const int oh = sh + ph - 1;
+        const int ox1 = window.x1 + _refRectPixel.x1;
+        const int oy1 = window.y1 + _refRectPixel.y1;
+
+        _kernelRowLength = ((pw * nComponents + kKernelAlignment - 1) / kKernelAlignment) * kKernelAlignment;
+        _kernelPattern.assign((size_t)ph * _kernelRowLength, 0.f);
+        _kernelWeight.assign((size_t)ph * _kernelRowLength, 0.f);
+        for (int i = 0; i < ph; ++i) {
+            for (int j = 0; j < pw; ++j) {
+                const size_t patternIdx = (size_t)i * pw + j;
+                const float weight = _weightData[patternIdx];
+                for (int c = 0; c < scoreComps; ++c) {
+                    const size_t k = (size_t)i * _kernelRowLength + j * nComponents + c;
+                    _kernelPattern[k] = _patternData[patternIdx * nComponents + c];
+                    // reference is squared in SSD, so is the weight
+                    _kernelWeight[k] = (scoreType == eTrackerSSD) ? weight * weight : weight;
+                }
+            }
+        }
+
+        // the kernel may read up to kKernelAlignment floats after the last row
+        _kernelOtherStride = ow * nComponents;
+        _kernelOther.assign((size_t)oh * _kernelOtherStride + kKernelAlignment, 0.f);
+        const OfxRectI& bounds = _otherImg->getBounds();
+        float *otherPtr = &_kernelOther[0];
+        for (int v = 0; v < oh; ++v) {
+            const int othery = std::max(bounds.y1, std::min(oy1 + v, bounds.y2 - 1));
+            for (int u = 0; u < ow; ++u, otherPtr += nComponents) {
+                const int otherx = std::max(bounds.x1, std::min(ox1 + u, bounds.x2 - 1));
+                const PIX *otherPix = (const PIX *) _otherImg->getPixelAddress(otherx, othery);
+                for (int c = 0; c < nComponents; ++c) {
+                    otherPtr[c] = otherPix[c];
+                }
+            }
+        }
+        _kernelWindow = window;
+        _kernel = getKernel(scoreType);
+    }
+
+    // SSD/SAD score using the kernels. The computation stops as soon as the score exceeds bound
+    // (partial distance elimination), since the score can only increase.
+    double kernelScore(int x, int y, double bound)
+    {
+        const int ph = _refRectPixel.y2 - _refRectPixel.y1;
+        const float *patternPtr = &_kernelPattern[0];
+        const float *weightPtr = &_kernelWeight[0];
+        const float *otherPtr = &_kernelOther[(size_t)(y - _kernelWindow.y1) * _kernelOtherStride + (x - _kernelWindow.x1) * nComponents];
+        double score = 0.;
+        for (int i = 0; i < ph; ++i) {
+            score += _kernel(patternPtr, otherPtr, weightPtr, _kernelRowLength);
+            if (score > bound) {
+                break;
+            }
+            patternPtr += _kernelRowLength;
+            weightPtr += _kernelRowLength;
+            otherPtr += _kernelOtherStride;
+        }
+        return score;
+    }
+
+    bool fftIsFaster(const OfxRectI& window) const
+    {
+        const int scoreComps = std::min(nComponents, 3);
+        const double pw = _refRectPixel.x2 - _refRectPixel.x1;
+        const double ph = _refRectPixel.y2 - _refRectPixel.y1;
+        const double sw = window.x2 - window.x1;
+        const double sh = window.y2 - window.y1;
+        if (sw <= 0 || sh <= 0) {
+            return false;
+        }
+        const double n = (double)nextPowerOf2((int)(sw + pw - 1)) * nextPowerOf2((int)(sh + ph - 1));
+        // two forward transforms per component, the weight transform and three inverse transforms
+        const double nFFT = 2 * scoreComps + 4 + (scoreType == eTrackerZNCC ? scoreComps : 0);
+        const double costFFT = kFFTCostFactor * nFFT * n * std::log(n) / std::log(2.);
+        const double costDirect = sw * sh * pw * ph * scoreComps * (scoreType == eTrackerZNCC ? 2 : 1);
+
+        return costFFT < costDirect;
+    }
+
+    // Compute the score at all positions of the window at once. The correlation of the pattern
+    // with the other image is computed by FFT, and so are the weighted sums of the other image used
+    // for normalization, unless the weights are uniform, in which case integral images (summed-area
+    // tables) are used.
+    // The scores are the same as those given by computeScore, up to rounding errors.
+    void computeScoresFFT(const OfxRectI& window)
+    {
+        const int scoreComps = std::min(nComponents, 3);
+        const int pw = _refRectPixel.x2 - _refRectPixel.x1;
+        const int ph = _refRectPixel.y2 - _refRectPixel.y1;
+        const int sw = window.x2 - window.x1;
+        const int sh = window.y2 - window.y1;
+        // the part of the other image covered by the pattern at all positions of the window
+        const int ow = sw + pw - 1;
+        const int oh = sh + ph - 1;
+        const int ox1 = window.x1 + _refRectPixel.x1;
+        const int oy1 = window.y1 + _refRectPixel.y1;
+        // the circular correlation has no wrap-around on the positions of the window
+        const int nx = nextPowerOf2(ow);
+        const int ny = nextPowerOf2(oh);
+        const size_t n = (size_t)nx * ny;
+        const size_t nPix = (size_t)pw * ph;
+
+        bool uniform = true;
+        for (size_t k = 1; k < nPix && uniform; ++k) {
+            uniform = (_weightData[k] == _weightData[0]);
+        }
+        double refMean[3] = {0., 0., 0.};
+        if (scoreType == eTrackerZNCC) {
+            for (size_t k = 0; k < nPix; ++k) {
+                for (int c = 0; c < scoreComps; ++c) {
+                    refMean[c] += _weightData[k] * _patternData[k * nComponents + c];
+                }
+            }
+            for (int c = 0; c < scoreComps; ++c) {
+                refMean[c] /= _weightTotal;
+            }
+        }
+
+        // other image, take nearest pixel as in computeScore
+        std::vector<double> other((size_t)ow * oh * scoreComps);
+        double otherMax = 0.;
+        const OfxRectI& bounds = _otherImg->getBounds();
+        for (int v = 0; v < oh; ++v) {
+            const int othery = std::max(bounds.y1, std::min(oy1 + v, bounds.y2 - 1));
+            for (int u = 0; u < ow; ++u) {
+                const int otherx = std::max(bounds.x1, std::min(ox1 + u, bounds.x2 - 1));
+                const PIX *otherPix = (const PIX *) _otherImg->getPixelAddress(otherx, othery);
+                for (int c = 0; c < scoreComps; ++c) {
+                    other[((size_t)v * ow + u) * scoreComps + c] = otherPix[c];
+                    otherMax = std::max(otherMax, std::abs((double)otherPix[c]));
+                }
+            }
+        }
+
+        std::vector<std::complex<double> > weightFFT;
+        if (!uniform) {
+            weightFFT.assign(n, 0.);
+            for (int i = 0; i < ph; ++i) {
+                for (int j = 0; j < pw; ++j) {
+                    weightFFT[(size_t)i * nx + j] = _weightData[(size_t)i * pw + j];
+                }
+            }
+            fft2D(weightFFT, nx, ny, false);
+        }
+
+        // numerator: sum over components of the correlation of weight*(pattern-refMean) with the other image
+        // ssq: sum over components of the weighted sum of squares of the other image
+        // meanTerm (ZNCC only): sum over components of (weighted sum of the other image)^2/weightTotal
+        std::vector<std::complex<double> > numerator(n, 0.);
+        std::vector<std::complex<double> > otherFFT(n);
+        std::vector<std::complex<double> > patternFFT(n);
+        std::vector<std::complex<double> > tmp;
+        std::vector<double> meanTerm;
+        if (scoreType == eTrackerZNCC) {
+            meanTerm.assign((size_t)sw * sh, 0.);
+        }
+        for (int c = 0; c < scoreComps; ++c) {
+            std::fill(otherFFT.begin(), otherFFT.end(), std::complex<double>(0.));
+            for (int v = 0; v < oh; ++v) {
+                for (int u = 0; u < ow; ++u) {
+                    otherFFT[(size_t)v * nx + u] = other[((size_t)v * ow + u) * scoreComps + c];
+                }
+            }
+            fft2D(otherFFT, nx, ny, false);
+            std::fill(patternFFT.begin(), patternFFT.end(), std::complex<double>(0.));
+            for (int i = 0; i < ph; ++i) {
+                for (int j = 0; j < pw; ++j) {
+                    size_t k = (size_t)i * pw + j;
+                    patternFFT[(size_t)i * nx + j] = _weightData[k] * (_patternData[k * nComponents + c] - refMean[c]);
+                }
+            }
+            fft2D(patternFFT, nx, ny, false);
+            for (size_t k = 0; k < n; ++k) {
+                numerator[k] += std::conj(patternFFT[k]) * otherFFT[k];
+            }
+            if (scoreType == eTrackerZNCC) {
+                std::vector<double> sums;
+                if (uniform) {
+                    integralBoxSums(other, ow, oh, scoreComps, c, false, pw, ph, sw, sh, &sums);
+                    for (size_t k = 0; k < sums.size(); ++k) {
+                        sums[k] *= _weightData[0];
+                    }
+                } else {
+                    tmp.resize(n);
+                    for (size_t k = 0; k < n; ++k) {
+                        tmp[k] = std::conj(weightFFT[k]) * otherFFT[k];
+                    }
+                    fft2D(tmp, nx, ny, true);
+                    sums.resize((size_t)sw * sh);
+                    for (int y = 0; y < sh; ++y) {
+                        for (int x = 0; x < sw; ++x) {
+                            sums[(size_t)y * sw + x] = tmp[(size_t)y * nx + x].real();
+                        }
+                    }
+                }
+                for (size_t k = 0; k < sums.size(); ++k) {
+                    meanTerm[k] += sums[k] * sums[k] / _weightTotal;
+                }
+            }
+        }
+        fft2D(numerator, nx, ny, true);
+
+        std::vector<double> ssq;
+        if (uniform) {
+            integralBoxSums(other, ow, oh, scoreComps, -1, true, pw, ph, sw, sh, &ssq);
+            for (size_t k = 0; k < ssq.size(); ++k) {
+                ssq[k] *= _weightData[0];
+            }
+        } else {
+            tmp.assign(n, 0.);
+            for (int v = 0; v < oh; ++v) {
+                for (int u = 0; u < ow; ++u) {
+                    double sq = 0.;
+                    for (int c = 0; c < scoreComps; ++c) {
+                        double o = other[((size_t)v * ow + u) * scoreComps + c];
+                        sq += o * o;
+                    }
+                    tmp[(size_t)v * nx + u] = sq;
+                }
+            }
+            fft2D(tmp, nx, ny, false);
+            for (size_t k = 0; k < n; ++k) {
+                tmp[k] *= std::conj(weightFFT[k]);
+            }
+            fft2D(tmp, nx, ny, true);
+            ssq.resize((size_t)sw * sh);
+            for (int y = 0; y < sh; ++y) {
+                for (int x = 0; x < sw; ++x) {
+                    ssq[(size_t)y * sw + x] = tmp[(size_t)y * nx + x].real();
+                }
+            }
+        }
+
+        // below this, the variance of the other image is considered as zero (FFT rounding errors)
+        const double ssqEpsilon = 1e-10 * _weightTotal * scoreComps * std::max(1., otherMax * otherMax);
+        _scores.resize((size_t)sw * sh);
+        for (int y = 0; y < sh; ++y) {
+            for (int x = 0; x < sw; ++x) {
+                size_t k = (size_t)y * sw + x;
+                double otherSsq = ssq[k];
+                if (scoreType == eTrackerZNCC) {
+                    otherSsq -= meanTerm[k];
+                }
+                if (otherSsq > ssqEpsilon) {
+                    _scores[k] = -numerator[(size_t)y * nx + x].real() / std::sqrt(otherSsq);
+                } else {
+                    _scores[k] = std::numeric_limits<double>::infinity();
+                }
+            }
+        }
+        _scoresWindow = window;
+    }
+
+    // sums of the values of component c (or of the squares of all components if c < 0)
+    // over all pw*ph boxes of a ow*oh image, using an integral image
+    static void integralBoxSums(const std::vector<double>& img, int ow, int oh, int nComps, int c, bool squares,
+                                int pw, int ph, int sw, int sh, std::vector<double>* sums)
+    {
+        std::vector<double> sat((size_t)(ow + 1) * (oh + 1), 0.);
+        for (int v = 0; v < oh; ++v) {
+            double rowSum = 0.;
+            for (int u = 0; u < ow; ++u) {
+                const double *pix = &img[((size_t)v * ow + u) * nComps];
+                if (squares) {
+                    for (int k = 0; k < nComps; ++k) {
+                        rowSum += pix[k] * pix[k];
+                    }
+                } else {
+                    rowSum += pix[c];
+                }
+                sat[(size_t)(v + 1) * (ow + 1) + (u + 1)] = sat[(size_t)v * (ow + 1) + (u + 1)] + rowSum;
+            }
+        }
+        sums->resize((size_t)sw * sh);
+        for (int y = 0; y < sh; ++y) {
+            for (int x = 0; x < sw; ++x) {
+                (*sums)[(size_t)y * sw + x] = (sat[(size_t)(y + ph) * (ow + 1) + (x + pw)] - sat[(size_t)y * (ow + 1) + (x + pw)]
+                                               - sat[(size_t)(y + ph) * (ow + 1) + x] + sat[(size_t)y * (ow + 1) + x]);
+            }
+        }
+    }
+
+    // the score at a given position, from the FFT scores or using the kernels if they were set up.
+    // If the score is above bound, a partial score above bound may be returned.
+    template<enum TrackerScoreEnum scoreTypeE>
+    double getScore(int x, int y, const double refMean[3], double bound = std::numeric_limits<double>::infinity())
+    {
+        if (_scoresWindow.x1 <= x && x < _scoresWindow.x2 && _scoresWindow.y1 <= y && y < _scoresWindow.y2) {
+            return _scores[(size_t)(y - _scoresWindow.y1) * (_scoresWindow.x2 - _scoresWindow.x1) + (x - _scoresWindow.x1)];
+        }
+        if (_kernel && _kernelWindow.x1 <= x && x < _kernelWindow.x2 && _kernelWindow.y1 <= y && y < _kernelWindow.y2) {
+            return kernelScore(x, y, bound);
+        }
+        return computeScore<scoreTypeE>(x, y, refMean);
+    }
+
     void multiThreadProcessImages(OfxRectI procWindow) {
         switch (scoreType) {
             case eTrackerSSD:
@@ -448,7 +1348,7 @@ private:
             }
             
             for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                double score = computeScore<scoreTypeE>(x, y, refMean);
+                double score = getScore<scoreTypeE>(x, y, refMean, bestScore);
                 if (score < bestScore) {
                     bestScore = score;
                     point.x = x;
@@ -469,8 +1369,8 @@ private:
             // don't block other threads
             _bestMatchMutex.unlock();
             // compute subpixel position.
-            double scorepc = computeScore<scoreTypeE>(point.x - 1, point.y, refMean);
-            double scorenc = computeScore<scoreTypeE>(point.x + 1, point.y, refMean);
+            double scorepc = getScore<scoreTypeE>(point.x - 1, point.y, refMean);
+            double scorenc = getScore<scoreTypeE>(point.x + 1, point.y, refMean);
             if (bestScore < scorepc && bestScore <= scorenc) {
                 // don't simplify the denominator in the following expression,
                 // 2*bestScore - scorenc - scorepc may cause an underflow.
@@ -480,8 +1380,8 @@ private:
                     assert(-0.5 < dx && dx <= 0.5);
                 }
             }
-            double scorecp = computeScore<scoreTypeE>(point.x, point.y - 1, refMean);
-            double scorecn = computeScore<scoreTypeE>(point.x, point.y + 1, refMean);
+            double scorecp = getScore<scoreTypeE>(point.x, point.y - 1, refMean);
+            double scorecn = getScore<scoreTypeE>(point.x, point.y + 1, refMean);
             if (bestScore < scorecp && bestScore <= scorecn) {
                 // don't simplify the denominator in the following expression,
                 // 2*bestScore - scorenc - scorepc may cause an underflow.
@@ -548,6 +1448,9 @@ TrackerPMPlugin::trackRange(const OFX::TrackArguments& args)
         progressStart(name);
     }
 
+    TrackerPMState state;
+    state.lastImageTime = t;
+
     while (args.forward ? (t <= args.last) : (t >= args.last)) {
         OfxTime other = args.forward ? (t + 1) : (t - 1);
         
@@ -556,12 +1459,12 @@ TrackerPMPlugin::trackRange(const OFX::TrackArguments& args)
                srcComponents == OFX::ePixelComponentAlpha);
         
         if (srcComponents == OFX::ePixelComponentRGBA) {
-            trackInternal<4>(t, other, args);
+            trackInternal<4>(t, other, args, state);
         } else if (srcComponents == OFX::ePixelComponentRGB) {
-            trackInternal<3>(t, other, args);
+            trackInternal<3>(t, other, args, state);
         } else {
             assert(srcComponents == OFX::ePixelComponentAlpha);
-            trackInternal<1>(t, other, args);
+            trackInternal<1>(t, other, args, state);
         }
         if (args.forward) {
             ++t;
@@ -650,8 +1553,8 @@ getOtherBounds(const OfxPointD &refCenter, const OfxRectD& searchRect, OfxRectD
     }
 }
 
-/* set up and run a processor */
-void
+/* set up and run a processor. Returns false if a predicted match was rejected. */
+bool
 TrackerPMPlugin::setupAndProcess(TrackerPMProcessorBase &processor,
                                  OfxTime refTime,
                                  const OfxRectD& refBounds,
@@ -661,7 +1564,9 @@ TrackerPMPlugin::setupAndProcess(TrackerPMProcessorBase &processor,
                                  const OFX::Image* maskImg,
                                  OfxTime otherTime,
                                  const OfxRectD& trackSearchBounds,
-                                 const OFX::Image* otherImg)
+                                 const OFX::Image* otherImg,
+                                 bool predicted,
+                                 TrackerPMState& state)
 {
     const double par = _srcClip->getPixelAspectRatio();
     const OfxPointD rsOne = {1., 1.};
@@ -692,29 +1597,59 @@ TrackerPMPlugin::setupAndProcess(TrackerPMProcessorBase &processor,
     bool canProcess = processor.setValues(refImg, otherImg, maskImg, refRectPixel, refCenterI);
     
     if (!canProcess) {
+        if (predicted) {
+            return false;
+        }
         // can't track: erase any existing track
         _center->deleteKeyAtTime(otherTime);
+        state.hasLastScore = false;
     } else {
-        // Call the base class process member, this will call the derived templated process code
-        processor.process();
+        int pyramidLevels;
+        _pyramidLevels->getValueAtTime(refTime, pyramidLevels);
+        if (pyramidLevels > 0) {
+            processor.processPyramid(pyramidLevels);
+        } else {
+            // Call the base class process member, this will call the derived templated process code
+            processor.process();
+        }
 
         //////////////////////////////////
         // TODO: subpixel interpolation //
         //////////////////////////////////
 
         ///ok the score is now computed, update the center
-        if (processor.getBestScore() == std::numeric_limits<double>::infinity()) {
+        const double bestScore = processor.getBestScore();
+        if (bestScore == std::numeric_limits<double>::infinity()) {
+            if (predicted) {
+                return false;
+            }
             // can't track: erase any existing track
             _center->deleteKeyAtTime(otherTime);
+            state.hasLastScore = false;
         } else {
-            
+            const OfxPointD& bestMatch = processor.getBestMatch();
+
+            if (predicted) {
+                // the pattern may lie outside of the predicted window if the match is on its border,
+                // and the prediction may have locked on another feature if the score got much worse:
+                // in both cases, the caller searches again in the full window.
+                if (bestMatch.x <= trackSearchBoundsPixel.x1 + 0.5 || bestMatch.x >= trackSearchBoundsPixel.x2 - 1.5 ||
+                    bestMatch.y <= trackSearchBoundsPixel.y1 + 0.5 || bestMatch.y >= trackSearchBoundsPixel.y2 - 1.5) {
+                    return false;
+                }
+                if (state.hasLastScore && bestScore > state.lastScore + kPredictionScoreTolerance * std::abs(state.lastScore)) {
+                    return false;
+                }
+            }
+            state.hasLastScore = true;
+            state.lastScore = bestScore;
+
             // Offset the newCenter by the offset a thaat time
             OfxPointD otherOffset;
             _offset->getValueAtTime(otherTime, otherOffset.x, otherOffset.y);
             
             OfxPointD newCenterPixelSub;
             OfxPointD newCenter;
-            const OfxPointD& bestMatch = processor.getBestMatch();
 
             newCenterPixelSub.x = refCenterPixelSub.x + bestMatch.x - refCenterI.x;
             newCenterPixelSub.y = refCenterPixelSub.y + bestMatch.y - refCenterI.y;
@@ -731,10 +1666,11 @@ TrackerPMPlugin::setupAndProcess(TrackerPMProcessorBase &processor,
            // endEditBlock();
         }
     }
+    return true;
 }
 
 template <class PIX, int nComponents, int maxValue>
-void
+bool
 TrackerPMPlugin::trackInternalForDepth(OfxTime refTime,
                                        const OfxRectD& refBounds,
                                        const OfxPointD& refCenter,
@@ -743,7 +1679,9 @@ TrackerPMPlugin::trackInternalForDepth(OfxTime refTime,
                                        const OFX::Image* maskImg,
                                        OfxTime otherTime,
                                        const OfxRectD& trackSearchBounds,
-                                       const OFX::Image* otherImg)
+                                       const OFX::Image* otherImg,
+                                       bool predicted,
+                                       TrackerPMState& state)
 {
     int scoreI;
     _score->getValueAtTime(refTime, scoreI);
@@ -752,28 +1690,70 @@ TrackerPMPlugin::trackInternalForDepth(OfxTime refTime,
     switch (typeE) {
         case eTrackerSSD: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerSSD> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg);
-        }   break;
+            return setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, predicted, state);
+        }
         case eTrackerSAD: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerSAD> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg);
-        }   break;
+            return setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, predicted, state);
+        }
         case eTrackerNCC: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerNCC> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset,  refImg, maskImg, otherTime, trackSearchBounds, otherImg);
-        }   break;
+            return setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, predicted, state);
+        }
         case eTrackerZNCC: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerZNCC> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg);
-        }   break;
+            return setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, predicted, state);
+        }
     }
+    return true;
 }
 
 
+bool
+TrackerPMPlugin::predictMotion(OfxTime refTime, OfxTime otherTime, const OfxPointD& refCenterWithOffset, OfxPointD* displacement)
+{
+    int motionModelI;
+    _motionModel->getValueAtTime(refTime, motionModelI);
+    MotionModelEnum motionModel = (MotionModelEnum)motionModelI;
+    if (motionModel == eMotionModelNone) {
+        return false;
+    }
+
+    // the previous positions are the keyframes of the center set by the previous steps
+    const OfxTime step = otherTime - refTime;
+    const OfxTime prevTime = refTime - step;
+    if (_center->getKeyIndex(refTime, eKeySearchNear) == -1 ||
+        _center->getKeyIndex(prevTime, eKeySearchNear) == -1) {
+        return false;
+    }
+    OfxPointD prevCenter;
+    _center->getValueAtTime(prevTime, prevCenter.x, prevCenter.y);
+    OfxPointD prevOffset;
+    _offset->getValueAtTime(prevTime, prevOffset.x, prevOffset.y);
+    OfxPointD velocity;
+    velocity.x = refCenterWithOffset.x - (prevCenter.x + prevOffset.x);
+    velocity.y = refCenterWithOffset.y - (prevCenter.y + prevOffset.y);
+    *displacement = velocity;
+
+    if (motionModel == eMotionModelAcceleration) {
+        const OfxTime prevPrevTime = prevTime - step;
+        if (_center->getKeyIndex(prevPrevTime, eKeySearchNear) != -1) {
+            OfxPointD prevPrevCenter;
+            _center->getValueAtTime(prevPrevTime, prevPrevCenter.x, prevPrevCenter.y);
+            OfxPointD prevPrevOffset;
+            _offset->getValueAtTime(prevPrevTime, prevPrevOffset.x, prevPrevOffset.y);
+            // add the change of velocity between the two previous steps
+            displacement->x += velocity.x - ((prevCenter.x + prevOffset.x) - (prevPrevCenter.x + prevPrevOffset.x));
+            displacement->y += velocity.y - ((prevCenter.y + prevOffset.y) - (prevPrevCenter.y + prevPrevOffset.y));
+        }
+    }
+    return true;
+}
+
 // the internal render function
 template <int nComponents>
 void
-TrackerPMPlugin::trackInternal(OfxTime refTime, OfxTime otherTime, const OFX::TrackArguments& args)
+TrackerPMPlugin::trackInternal(OfxTime refTime, OfxTime otherTime, const OFX::TrackArguments& args, TrackerPMState& state)
 {
     OfxRectD refRect;
     _innerBtmLeft->getValueAtTime(refTime, refRect.x1, refRect.y1);
@@ -794,36 +1774,29 @@ TrackerPMPlugin::trackInternal(OfxTime refTime, OfxTime otherTime, const OFX::Tr
     OfxRectD refBounds;
     getRefBounds(refRect, refCenterWithOffset, &refBounds);
 
-    OfxRectD otherBounds;
-    getOtherBounds(refCenterWithOffset, searchRect, &otherBounds);
-
-    std::auto_ptr<const OFX::Image> srcRef((_srcClip && _srcClip->isConnected()) ?
-                                           _srcClip->fetchImage(refTime, refBounds) : 0);
-    std::auto_ptr<const OFX::Image> srcOther((_srcClip && _srcClip->isConnected()) ?
-                                             _srcClip->fetchImage(otherTime, otherBounds) : 0);
-    if (!srcRef.get() || !srcOther.get()) {
-        return;
-    }
-    if (srcRef.get()) {
-        if (srcRef->getRenderScale().x != args.renderScale.x ||
-            srcRef->getRenderScale().y != args.renderScale.y) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
+    // the other image of the previous step usually contains the pattern, since the pattern was found in its search area
+    std::auto_ptr<const OFX::Image> srcRef;
+    if (state.lastImage.get() && state.lastImageTime == refTime) {
+        const OfxPointD rsOne = {1., 1.};
+        OfxRectI refBoundsPixel;
+        OFX::MergeImages2D::toPixelEnclosing(refBounds, rsOne, _srcClip->getPixelAspectRatio(), &refBoundsPixel);
+        const OfxRectI& lastBounds = state.lastImage->getBounds();
+        if (lastBounds.x1 <= refBoundsPixel.x1 && refBoundsPixel.x2 <= lastBounds.x2 &&
+            lastBounds.y1 <= refBoundsPixel.y1 && refBoundsPixel.y2 <= lastBounds.y2) {
+            srcRef = state.lastImage;
         }
     }
-    if (srcOther.get()) {
-        if (srcOther->getRenderScale().x != args.renderScale.x ||
-            srcOther->getRenderScale().y != args.renderScale.y) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
-        }
+    state.lastImage.reset();
+    if (!srcRef.get() && _srcClip && _srcClip->isConnected()) {
+        srcRef.reset(_srcClip->fetchImage(refTime, refBounds));
     }
-    // renderScale should never be something else than 1 when called from ActionInstanceChanged
-    if ((srcRef->getPixelDepth() != srcOther->getPixelDepth()) ||
-        (srcRef->getPixelComponents() != srcOther->getPixelComponents()) ||
-        srcRef->getRenderScale().x != 1. || srcRef->getRenderScale().y != 1 ||
-        srcOther->getRenderScale().x != 1. || srcOther->getRenderScale().y != 1) {
-        OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+    if (!srcRef.get()) {
+        return;
+    }
+    if (srcRef->getRenderScale().x != args.renderScale.x ||
+        srcRef->getRenderScale().y != args.renderScale.y) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
     }
 
     OFX::BitDepthEnum srcBitDepth = srcRef->getPixelDepth();
@@ -839,21 +1812,81 @@ TrackerPMPlugin::trackInternal(OfxTime refTime, OfxTime otherTime, const OFX::Tr
         }
     }
 
-    OfxRectD trackSearchBounds;
-    getTrackSearchBounds(refRect, refCenterWithOffset, searchRect, &trackSearchBounds);
+    // If the motion can be predicted, search first in a smaller window centered on the predicted position,
+    // which must still contain the pattern and a few pixels around it.
+    OfxPointD displacement = {0., 0.};
+    OfxRectD predictedSearchRect;
+    bool hasPrediction = predictMotion(refTime, otherTime, refCenterWithOffset, &displacement);
+    if (hasPrediction) {
+        predictedSearchRect.x1 = std::min(refRect.x1 - kPredictionMargin, searchRect.x1 * kPredictionSearchScale);
+        predictedSearchRect.y1 = std::min(refRect.y1 - kPredictionMargin, searchRect.y1 * kPredictionSearchScale);
+        predictedSearchRect.x2 = std::max(refRect.x2 + kPredictionMargin, searchRect.x2 * kPredictionSearchScale);
+        predictedSearchRect.y2 = std::max(refRect.y2 + kPredictionMargin, searchRect.y2 * kPredictionSearchScale);
+        // not worth it if the predicted window is not smaller than the search window
+        hasPrediction = ((predictedSearchRect.x2 - predictedSearchRect.x1) * (predictedSearchRect.y2 - predictedSearchRect.y1) <
+                         (searchRect.x2 - searchRect.x1) * (searchRect.y2 - searchRect.y1));
+    }
+
+    // the first pass searches the predicted window, the second pass searches the full window around
+    // the previous position, and is only done if there is no prediction or if the predicted match was rejected.
+    for (int pass = hasPrediction ? 0 : 1; pass < 2; ++pass) {
+        const bool predicted = (pass == 0);
+        const OfxRectD& passSearchRect = predicted ? predictedSearchRect : searchRect;
+        OfxPointD searchCenter = refCenterWithOffset;
+        if (predicted) {
+            searchCenter.x += displacement.x;
+            searchCenter.y += displacement.y;
+        }
+
+        OfxRectD otherBounds;
+        getOtherBounds(searchCenter, passSearchRect, &otherBounds);
 
-    switch (srcBitDepth) {
-        case OFX::eBitDepthUByte: {
-            trackInternalForDepth<unsigned char, nComponents, 255>(refTime, refBounds, refCenter, refCenterWithOffset, srcRef.get(), mask.get(), otherTime, trackSearchBounds, srcOther.get());
-        }   break;
-        case OFX::eBitDepthUShort: {
-            trackInternalForDepth<unsigned short, nComponents, 65535>(refTime, refBounds, refCenter, refCenterWithOffset, srcRef.get(), mask.get(), otherTime, trackSearchBounds, srcOther.get());
-        }   break;
-        case OFX::eBitDepthFloat: {
-            trackInternalForDepth<float, nComponents, 1>(refTime, refBounds, refCenter, refCenterWithOffset, srcRef.get(), mask.get(), otherTime, trackSearchBounds, srcOther.get());
-        }   break;
-        default:
-            OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+        std::auto_ptr<const OFX::Image> srcOther((_srcClip && _srcClip->isConnected()) ?
+                                                 _srcClip->fetchImage(otherTime, otherBounds) : 0);
+        if (!srcOther.get()) {
+            if (predicted) {
+                // the host could not give the predicted window: try the full search window
+                continue;
+            }
+            return;
+        }
+        if (srcOther->getRenderScale().x != args.renderScale.x ||
+            srcOther->getRenderScale().y != args.renderScale.y) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        // renderScale should never be something else than 1 when called from ActionInstanceChanged
+        if ((srcRef->getPixelDepth() != srcOther->getPixelDepth()) ||
+            (srcRef->getPixelComponents() != srcOther->getPixelComponents()) ||
+            srcRef->getRenderScale().x != 1. || srcRef->getRenderScale().y != 1 ||
+            srcOther->getRenderScale().x != 1. || srcOther->getRenderScale().y != 1) {
+            OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+        }
+
+        OfxRectD trackSearchBounds;
+        getTrackSearchBounds(refRect, searchCenter, passSearchRect, &trackSearchBounds);
+
+        bool accepted = false;
+        switch (srcBitDepth) {
+            case OFX::eBitDepthUByte: {
+                accepted = trackInternalForDepth<unsigned char, nComponents, 255>(refTime, refBounds, refCenter, refCenterWithOffset, srcRef.get(), mask.get(), otherTime, trackSearchBounds, srcOther.get(), predicted, state);
+            }   break;
+            case OFX::eBitDepthUShort: {
+                accepted = trackInternalForDepth<unsigned short, nComponents, 65535>(refTime, refBounds, refCenter, refCenterWithOffset, srcRef.get(), mask.get(), otherTime, trackSearchBounds, srcOther.get(), predicted, state);
+            }   break;
+            case OFX::eBitDepthFloat: {
+                accepted = trackInternalForDepth<float, nComponents, 1>(refTime, refBounds, refCenter, refCenterWithOffset, srcRef.get(), mask.get(), otherTime, trackSearchBounds, srcOther.get(), predicted, state);
+            }   break;
+            default:
+                OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+        }
+
+        if (accepted) {
+            // keep the other image for the next step
+            state.lastImage = srcOther;
+            state.lastImageTime = otherTime;
+            return;
+        }
     }
 }
 
@@ -926,6 +1959,36 @@ void TrackerPMPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+
+    // pyramidLevels
+    {
+        IntParamDescriptor* param = desc.defineIntParam(kParamPyramidLevels);
+        param->setLabel(kParamPyramidLevelsLabel);
+        param->setHint(kParamPyramidLevelsHint);
+        param->setRange(0, 8);
+        param->setDisplayRange(0, 4);
+        param->setDefault(0);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // motionModel
+    {
+        ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamMotionModel);
+        param->setLabel(kParamMotionModelLabel);
+        param->setHint(kParamMotionModelHint);
+        assert(param->getNOptions() == eMotionModelNone);
+        param->appendOption(kParamMotionModelOptionNone, kParamMotionModelOptionNoneHint);
+        assert(param->getNOptions() == eMotionModelVelocity);
+        param->appendOption(kParamMotionModelOptionVelocity, kParamMotionModelOptionVelocityHint);
+        assert(param->getNOptions() == eMotionModelAcceleration);
+        param->appendOption(kParamMotionModelOptionAcceleration, kParamMotionModelOptionAccelerationHint);
+        param->setDefault((int)eMotionModelNone);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 
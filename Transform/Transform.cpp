@@ -73,6 +73,8 @@
 #include "Transform.h"
 #include "ofxsTransform3x3.h"
 #include "ofxsTransformInteract.h"
+#include "SeparableTransform.h"
+#include "MipmapTransform.h"
 
 #include <cmath>
 #include <iostream>
@@ -103,6 +105,8 @@ public:
     /** @brief ctor */
     TransformPlugin(OfxImageEffectHandle handle, bool masked, bool isDirBlur)
     : Transform3x3Plugin(handle, masked, isDirBlur)
+    , _isDirBlur(isDirBlur)
+    , _mipmap(0)
     , _translate(0)
     , _rotate(0)
     , _scale(0)
@@ -124,6 +128,10 @@ public:
         _center = fetchDouble2DParam(kParamTransformCenter);
         _interactive = fetchBooleanParam(kParamTransformInteractive);
         assert(_translate && _rotate && _scale && _scaleUniform && _skewX && _skewY && _skewOrder && _center && _interactive);
+        if (!isDirBlur) {
+            _mipmap = fetchBooleanParam(kParamMipmap);
+            assert(_mipmap);
+        }
     }
 
 private:
@@ -138,6 +146,19 @@ private:
     /** @brief called when a clip has just been changed in some way (a rewire maybe) */
     virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
 
+    /* the mipmap engine needs a larger source region than the generic render */
+    virtual void getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args, OFX::RegionOfInterestSetter &rois) OVERRIDE FINAL;
+
+    /* render with the mipmap or separable engines when possible, else with the generic Transform3x3 render */
+    virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
+
+    /* render a minifying transform with the mipmap engine if it is enabled, else a transform that is only
+       a scale and a translation with the separable engine. Returns false if it cannot. */
+    bool renderFast(const OFX::RenderArguments &args);
+
+    bool _isDirBlur;
+    OFX::BooleanParam* _mipmap;
+
     // NON-GENERIC
     OFX::Double2DParam* _translate;
     OFX::DoubleParam* _rotate;
@@ -328,6 +349,52 @@ TransformPlugin::changedClip(const InstanceChangedArgs &args, const std::string
     }
 }
 
+void
+TransformPlugin::render(const OFX::RenderArguments &args)
+{
+    if ( !renderFast(args) ) {
+        Transform3x3Plugin::render(args);
+    }
+}
+
+void
+TransformPlugin::getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args, OFX::RegionOfInterestSetter &rois)
+{
+    Transform3x3Plugin::getRegionsOfInterest(args, rois);
+    if (_isDirBlur) {
+        return;
+    }
+    const double time = args.time;
+    Transform3x3FastRenderValues values;
+    if ( !transform3x3FastRenderGetValues(time, _motionblur, _invert, _filter, _clamp, _blackOutside, _mix, _maskInvert, _mipmap, &values) ) {
+        return;
+    }
+    OFX::Matrix3x3 invtransform;
+    if ( !getInverseTransformCanonical(time, 1., values.invert, &invtransform) ) {
+        return;
+    }
+    transform3x3GetRegionsOfInterestFast(args, _srcClip, invtransform, values, rois);
+}
+
+bool
+TransformPlugin::renderFast(const OFX::RenderArguments &args)
+{
+    if (_isDirBlur) {
+        return false;
+    }
+    const double time = args.time;
+    Transform3x3FastRenderValues values;
+    if ( !transform3x3FastRenderGetValues(time, _motionblur, _invert, _filter, _clamp, _blackOutside, _mix, _maskInvert, _mipmap, &values) ) {
+        return false;
+    }
+    OFX::Matrix3x3 invtransform;
+    if ( !getInverseTransformCanonical(time, 1., values.invert, &invtransform) ) {
+        return false;
+    }
+
+    return transform3x3RenderFast(*this, args, _dstClip, _srcClip, _maskClip, invtransform, values);
+}
+
 
 
 
@@ -492,6 +559,8 @@ void TransformPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc,
 
     TransformPluginDescribeInContext(desc, context, page);
 
+    mipmapTransformDescribeParams(desc, page);
+
     Transform3x3DescribeInContextEnd(desc, context, page, false);
 }
 
@@ -523,6 +592,8 @@ void TransformMaskedPluginFactory::describeInContext(OFX::ImageEffectDescriptor
 
     TransformPluginDescribeInContext(desc, context, page);
 
+    mipmapTransformDescribeParams(desc, page);
+
     Transform3x3DescribeInContextEnd(desc, context, page, true);
 }
 